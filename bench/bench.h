@@ -0,0 +1,44 @@
+#pragma once
+
+
+#include "util.h"
+#include <chrono>
+
+
+/**
+ * Returns the current time in seconds from a monotonic clock.
+ */
+inline f64 bench_now() {
+    using namespace std::chrono;
+    return duration<f64>(steady_clock::now().time_since_epoch()).count();
+}
+
+
+/**
+ * Prevents the compiler from optimizing away the computed result.
+ */
+inline void bench_do_not_optimize(const void* ptr) {
+    static const void* volatile sink;
+    sink = ptr;
+    (void) sink;
+}
+
+
+// Benchmarks, each one takes the remaining command line arguments.
+int bench_gemm(int argc, char** argv);
+int bench_forward(int argc, char** argv);
+int bench_batch(int argc, char** argv);
+int bench_elementwise(int argc, char** argv);
+int bench_quantize(int argc, char** argv);
+int bench_load(int argc, char** argv);
+int bench_train(int argc, char** argv);
+int bench_images(int argc, char** argv);
+int bench_conv(int argc, char** argv);
+int bench_profile(int argc, char** argv);
+int bench_suite(int argc, char** argv);
+int bench_static(int argc, char** argv);
+int bench_sparse(int argc, char** argv);
+int bench_half(int argc, char** argv);
+int bench_pipeline(int argc, char** argv);
+int bench_cache(int argc, char** argv);
+int bench_numa(int argc, char** argv);
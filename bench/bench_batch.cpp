@@ -0,0 +1,99 @@
+#include "bench.h"
+#include "coalescer.h"
+#include "network.h"
+#include "thread_pool.h"
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+
+static Network bench_batch_network(u32 width, u32 depth) {
+    Network network;
+    for (u32 i = 0; i < depth; i++) {
+        network.layers.push_back(dense_layer(width, width, tensor_init_random, tensor_init_zeros));
+        network.layers.push_back(relu(true));
+    }
+    return network;
+}
+
+
+/**
+ * Compares the throughput of single sample forward passes, batched
+ * forward passes and many client threads going through the coalescer.
+ */
+int bench_batch(int argc, char** argv) {
+    u32 width = 1024;
+    u32 depth = 4;
+    u32 clients = 16;
+    u32 requests_per_client = 200;
+    Coalescer_Config config;
+    for (int i = 0; i < argc; i++) {
+        if (i + 1 >= argc) break;
+        if (strcmp(argv[i], "--width") == 0) width = (u32) atoi(argv[++i]);
+        else if (strcmp(argv[i], "--depth") == 0) depth = (u32) atoi(argv[++i]);
+        else if (strcmp(argv[i], "--clients") == 0) clients = (u32) atoi(argv[++i]);
+        else if (strcmp(argv[i], "--requests") == 0) requests_per_client = (u32) atoi(argv[++i]);
+        else if (strcmp(argv[i], "--max-batch") == 0) config.max_batch_size = (u32) atoi(argv[++i]);
+        else if (strcmp(argv[i], "--max-latency") == 0) config.max_latency_ms = atof(argv[++i]);
+        else if (strcmp(argv[i], "--threads") == 0) thread_pool_set_num_threads((u32) atoi(argv[++i]));
+    }
+
+    Network network = bench_batch_network(width, depth);
+    std::cout << "mlp " << depth << "x" << width << ", threads " << thread_pool_num_threads() << std::endl;
+    std::cout << std::fixed << std::setprecision(1);
+
+    u32 batch_sizes[] = { 1, 8, 32, 128 };
+    for (u32 batch_size : batch_sizes) {
+        Tensor batch = tensor_create_2d(batch_size, width);
+        tensor_init_random(batch);
+        network.forward_batch(&batch);
+
+        int iterations = 0;
+        f64 start = bench_now();
+        while (bench_now() - start < 0.5 || iterations < 3) {
+            Tensor output = network.forward_batch(&batch);
+            bench_do_not_optimize(output.data);
+            iterations++;
+        }
+        f64 elapsed = bench_now() - start;
+        std::cout << "  forward_batch n=" << std::setw(4) << batch_size << ": "
+                  << std::setw(10) << iterations*batch_size/elapsed << " samples/s, "
+                  << std::setprecision(3) << elapsed/iterations*1e3 << " ms/batch"
+                  << std::setprecision(1) << std::endl;
+        tensor_free(batch);
+    }
+
+    Request_Coalescer* coalescer = coalescer_create(&network, width, config);
+    std::vector<std::thread> threads;
+    f64 start = bench_now();
+    for (u32 c = 0; c < clients; c++) {
+        threads.emplace_back([&, c] {
+            Tensor input = tensor_create_2d(1, width);
+            Tensor output = tensor_create_2d(1, width);
+            tensor_init_random(input);
+            for (u32 r = 0; r < requests_per_client; r++) {
+                coalescer_forward(coalescer, &input, &output);
+            }
+            tensor_free(input);
+            tensor_free(output);
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    f64 elapsed = bench_now() - start;
+
+    Coalescer_Stats stats = coalescer_stats(coalescer);
+    coalescer_destroy(coalescer);
+    std::cout << "  coalescer " << clients << " clients, max batch " << config.max_batch_size
+              << ", max latency " << config.max_latency_ms << " ms:" << std::endl;
+    std::cout << "    throughput:      " << stats.requests/elapsed << " samples/s" << std::endl;
+    std::cout << "    mean batch size: " << stats.mean_batch_size << std::endl;
+    std::cout << std::setprecision(3);
+    std::cout << "    latency p50:     " << stats.p50_latency_ms << " ms" << std::endl;
+    std::cout << "    latency p99:     " << stats.p99_latency_ms << " ms" << std::endl;
+    return 0;
+}
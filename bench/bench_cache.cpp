@@ -0,0 +1,216 @@
+#include "bench.h"
+#include "cache.h"
+#include "thread_pool.h"
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+
+/**
+ * Hash throughput of every kernel, the hashes of all lengths up to a few
+ * stripes and of the large buffer must match the scalar kernel.
+ */
+static void bench_cache_hash(u64 bytes, int iterations) {
+    std::vector<u8> data(bytes);
+    for (u64 i = 0; i < bytes; i++) data[i] = (u8) rand();
+
+    hash_set_kernel(Hash_Kernel_Scalar);
+    std::vector<u64> expected;
+    for (u64 length = 0; length < 4*HASH_STRIPE_BYTES; length++) expected.push_back(hash_bytes(data.data() + 1, length, 7));
+    expected.push_back(hash_bytes(data.data(), bytes));
+
+    std::cout << "  kernel    hash GB/s  quantize GB/s  mismatches" << std::endl;
+    std::vector<i32> quantized(bytes/sizeof(float));
+    std::vector<i32> quantized_scalar(bytes/sizeof(float));
+    hash_quantize(quantized_scalar.data(), (const float*) data.data(), quantized.size(), 1e-3f);
+    for (Hash_Kernel_Type type : { Hash_Kernel_Scalar, Hash_Kernel_AVX2 }) {
+        if (!hash_set_kernel(type)) continue;
+        u64 mismatches = 0;
+        for (u64 length = 0; length < 4*HASH_STRIPE_BYTES; length++) {
+            mismatches += hash_bytes(data.data() + 1, length, 7) != expected[length];
+        }
+
+        f64 hash_time = 1e30;
+        for (int i = 0; i < iterations; i++) {
+            f64 start = bench_now();
+            u64 hash = hash_bytes(data.data(), bytes);
+            hash_time = fmin(hash_time, bench_now() - start);
+            mismatches += hash != expected.back();
+        }
+
+        f64 quantize_time = 1e30;
+        for (int i = 0; i < iterations; i++) {
+            f64 start = bench_now();
+            hash_quantize(quantized.data(), (const float*) data.data(), quantized.size(), 1e-3f);
+            quantize_time = fmin(quantize_time, bench_now() - start);
+        }
+        mismatches += memcmp(quantized.data(), quantized_scalar.data(), sizeof(i32)*quantized.size()) != 0;
+
+        std::cout << "  " << std::left << std::setw(8) << hash_kernel_name() << std::right
+                  << std::fixed << std::setprecision(1) << std::setw(11) << bytes/hash_time*1e-9
+                  << std::setw(15) << 2.0*bytes/quantize_time*1e-9 << std::setw(12) << mismatches << std::endl;
+    }
+    hash_set_kernel(Hash_Kernel_Auto);
+}
+
+
+/**
+ * Index into `unique` inputs with a skewed distribution, a few inputs
+ * make up most of the traffic like in the request logs.
+ */
+static u32 bench_cache_pick(u32 unique) {
+    f32 u = (f32) rand()/RAND_MAX;
+    return (u32) (unique*u*u*u) % unique;
+}
+
+
+/**
+ * Runs `count` requests through the network with and without the cache,
+ * the requests perturbed by `noise` (relative) when it is not zero.
+ */
+static void bench_cache_forward(Network& network, std::vector<Tensor>& inputs, u32 count,
+                                Cache_Config config, f32 noise, const char* label) {
+    u32 unique = (u32) inputs.size();
+    Tensor request = tensor_create(inputs[0].shape, inputs[0].ndim);
+    Inference_Cache* cache = cache_create(config);
+
+    srand(2);
+    f64 uncached_time = 0.0, cached_time = 0.0;
+    f32 error = 0.0f, scale = 0.0f;
+    for (u32 i = 0; i < count; i++) {
+        Tensor& base = inputs[bench_cache_pick(unique)];
+        for (u32 j = 0; j < request.length; j++) {
+            request.data[j] = base.data[j]*(1.0f + noise*((f32) rand()/RAND_MAX - 0.5f));
+        }
+
+        // Both run on a copy, since in place layers may write over the input.
+        Tensor copy = tensor_copy(request);
+        f64 start = bench_now();
+        Tensor expected = network.forward(&copy);
+        uncached_time += bench_now() - start;
+        Tensor expected_copy = tensor_copy(expected);
+
+        tensor_copy_into(copy, request);
+        start = bench_now();
+        Tensor output = cache_forward(cache, &network, &copy);
+        cached_time += bench_now() - start;
+        for (u32 j = 0; j < output.length; j++) {
+            error = fmaxf(error, fabsf(output.data[j] - expected_copy.data[j]));
+            scale = fmaxf(scale, fabsf(expected_copy.data[j]));
+        }
+        tensor_free(output);
+        tensor_free(expected_copy);
+        tensor_free(copy);
+    }
+
+    Cache_Stats stats = cache_stats(cache);
+    std::cout << "  " << std::left << std::setw(26) << label << std::right << std::fixed << std::setprecision(1)
+              << std::setw(10) << count/uncached_time << std::setw(10) << count/cached_time
+              << std::setw(7) << std::setprecision(2) << uncached_time/cached_time << "x"
+              << std::setw(8) << std::setprecision(1) << stats.hit_rate*100.0
+              << std::setw(10) << stats.evictions << std::setw(9) << stats.entries
+              << std::scientific << std::setprecision(1) << std::setw(10) << (scale > 0.0f ? error/scale : error) << std::fixed << std::endl;
+
+    cache_destroy(cache);
+    tensor_free(request);
+}
+
+
+/**
+ * Several threads with their own copy of the network share one cache.
+ */
+static void bench_cache_threads(Network& network, std::vector<Tensor>& inputs, u32 count, u32 num_threads) {
+    Inference_Cache* cache = cache_create();
+    std::vector<Network> copies;
+    for (u32 t = 0; t < num_threads; t++) copies.push_back(network_share_weights(network));
+
+    f64 start = bench_now();
+    std::vector<std::thread> threads;
+    for (u32 t = 0; t < num_threads; t++) {
+        threads.emplace_back([&, t]() {
+            Tensor request = tensor_create(inputs[0].shape, inputs[0].ndim);
+            u32 state = t + 1;
+            for (u32 i = 0; i < count; i++) {
+                state = state*1664525u + 1013904223u;
+                f32 u = (state >> 8)*(1.0f/(1 << 24));
+                tensor_copy_into(request, inputs[(u32) (inputs.size()*u*u*u) % inputs.size()]);
+                Tensor output = cache_forward(cache, &copies[t], &request);
+                bench_do_not_optimize(output.data);
+                tensor_free(output);
+            }
+            tensor_free(request);
+        });
+    }
+    for (std::thread& thread : threads) thread.join();
+    f64 time = bench_now() - start;
+
+    Cache_Stats stats = cache_stats(cache);
+    std::cout << "  " << std::setw(3) << num_threads << " threads: " << std::fixed << std::setprecision(1)
+              << std::setw(10) << num_threads*count/time << " requests/s, hit rate " << stats.hit_rate*100.0
+              << "%" << std::endl;
+    for (Network& copy : copies) network_release_shared(copy);
+    cache_destroy(cache);
+}
+
+
+/**
+ * Hash kernels, then a stream of repeated requests through an mlp with and
+ * without the cache: exact inputs, a budget too small for all of them,
+ * slightly perturbed inputs in exact and approximate mode, and threads
+ * sharing a cache.
+ */
+int bench_cache(int argc, char** argv) {
+    u32 width = 1024;
+    u32 depth = 4;
+    u32 unique = 500;
+    u32 count = 5000;
+    u32 num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    for (int i = 0; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "--width") == 0) width = (u32) atoi(argv[++i]);
+        else if (strcmp(argv[i], "--depth") == 0) depth = (u32) atoi(argv[++i]);
+        else if (strcmp(argv[i], "--unique") == 0) unique = (u32) atoi(argv[++i]);
+        else if (strcmp(argv[i], "--count") == 0) count = (u32) atoi(argv[++i]);
+        else if (strcmp(argv[i], "--threads") == 0) num_threads = (u32) atoi(argv[++i]);
+    }
+
+    std::cout << "hash of 16 MB" << std::endl;
+    bench_cache_hash(16 << 20, 10);
+
+    Network network;
+    for (u32 i = 0; i < depth; i++) {
+        u32 outputs = i + 1 < depth ? width : 10;
+        network.layers.push_back(dense_layer(width, outputs, tensor_init_random, tensor_init_zeros));
+        if (i + 1 < depth) network.layers.push_back(relu(true));
+    }
+    std::vector<Tensor> inputs(unique);
+    for (Tensor& input : inputs) {
+        input = tensor_create_2d(1, width);
+        tensor_init_random(input);
+    }
+
+    u64 entry_bytes = sizeof(Cache_Entry) + sizeof(f32)*(width + 10);
+    std::cout << std::endl << "mlp " << depth << "x" << width << ", " << count << " requests over "
+              << unique << " inputs, hash " << hash_kernel_name() << std::endl;
+    std::cout << "  cache                     uncached/s  cached/s  speedup  hit %  evictions  entries  rel error" << std::endl;
+    Cache_Config config;
+    bench_cache_forward(network, inputs, count, config, 0.0f, "exact");
+    config.max_bytes = unique/4*entry_bytes;
+    bench_cache_forward(network, inputs, count, config, 0.0f, "exact, 1/4 of the inputs");
+    config = {};
+    bench_cache_forward(network, inputs, count, config, 1e-6f, "exact, noise 1e-6");
+    config.quantum = 1e-3f;
+    bench_cache_forward(network, inputs, count, config, 1e-6f, "approximate, noise 1e-6");
+
+    std::cout << std::endl << "shared cache, network copies per thread" << std::endl;
+    for (u32 threads = 1; threads <= num_threads; threads *= 2) {
+        bench_cache_threads(network, inputs, count, threads);
+    }
+
+    for (Tensor& input : inputs) tensor_free(input);
+    network_destroy(network);
+    return 0;
+}
@@ -0,0 +1,134 @@
+#include "bench.h"
+#include "conv.h"
+#include "thread_pool.h"
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+
+
+static void bench_init_weights(Tensor& weights) {
+    tensor_init_random(weights);
+    f32 limit = sqrtf(6.0f/weights.shape[0]);
+    for (u32 i = 0; i < weights.length; i++) {
+        weights.data[i] = (2.0f*weights.data[i] - 1.0f)*limit;
+    }
+}
+
+
+struct Bench_Conv_Shape {
+    const char* name;
+    u32 size;
+    u32 in_channels;
+    u32 out_channels;
+    u32 kernel;
+    u32 stride;
+    u32 padding;
+};
+
+
+/**
+ * Returns the best time of a forward pass in seconds.
+ */
+static f64 bench_conv_time(Conv2D_Layer* layer, Tensor& input, Tensor& output, int iterations) {
+    layer->forward_into(&input, &output);
+    f64 best = 1e30;
+    for (int i = 0; i < iterations; i++) {
+        f64 start = bench_now();
+        layer->forward_into(&input, &output);
+        best = fmin(best, bench_now() - start);
+    }
+    bench_do_not_optimize(output.data);
+    return best;
+}
+
+
+/**
+ * Runs typical convolutions of image classifiers with every algorithm
+ * that supports them, reporting GFLOP/s (of the plain convolution, so
+ * winograd can exceed the machine's peak) and the error against im2col.
+ * The algorithm picked automatically is marked with a star.
+ */
+int bench_conv(int argc, char** argv) {
+    u32 batch = 8;
+    int iterations = 5;
+    for (int i = 0; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "--batch") == 0) batch = (u32) atoi(argv[++i]);
+        else if (strcmp(argv[i], "--iterations") == 0) iterations = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--threads") == 0) thread_pool_set_num_threads((u32) atoi(argv[++i]));
+    }
+
+    Bench_Conv_Shape shapes[] = {
+        { "stem 7x7/2", 224, 3, 64, 7, 2, 3 },
+        { "3x3 56", 56, 64, 64, 3, 1, 1 },
+        { "1x1 56", 56, 64, 256, 1, 1, 0 },
+        { "3x3/2 56", 56, 64, 128, 3, 2, 1 },
+        { "3x3 28", 28, 128, 128, 3, 1, 1 },
+        { "3x3 14", 14, 256, 256, 3, 1, 1 },
+        { "3x3 7", 7, 512, 512, 3, 1, 1 },
+        { "1x1 7", 7, 512, 2048, 1, 1, 0 },
+    };
+    Conv_Algorithm algorithms[] = {
+        Conv_Algorithm_Im2col, Conv_Algorithm_Pointwise, Conv_Algorithm_Winograd, Conv_Algorithm_Direct
+    };
+
+    std::cout << "batch " << batch << ", threads " << thread_pool_num_threads() << std::endl;
+    std::cout << std::fixed;
+    for (Bench_Conv_Shape& shape : shapes) {
+        Conv2D_Layer* layer = conv2d(shape.in_channels, shape.out_channels, shape.kernel,
+                                     shape.stride, shape.padding, bench_init_weights,
+                                     tensor_init_random, Gemm_Activation_ReLU);
+        u32 input_shape[4] = { batch, shape.size, shape.size, shape.in_channels };
+        Tensor input = tensor_create(input_shape, 4);
+        tensor_init_random(input);
+        u32 output_shape[4];
+        layer->output_shape(input_shape, 4, output_shape);
+        Tensor output = tensor_create(output_shape, 4);
+        Tensor reference = tensor_create(output_shape, 4);
+
+        // The first pass measures the algorithms and keeps the fastest.
+        layer->forward_into(&input, &output);
+        Conv_Algorithm selected = conv_select_algorithm(layer, input_shape);
+        f64 flops = 2.0*output_shape[1]*output_shape[2]*shape.out_channels*
+                    shape.in_channels*shape.kernel*shape.kernel*batch;
+        std::cout << "  " << std::left << std::setw(12) << shape.name << std::right
+                  << std::setw(4) << shape.in_channels << " -> " << std::setw(4) << shape.out_channels
+                  << std::setprecision(2) << std::setw(8) << flops*1e-9 << " GFLOP" << std::endl;
+
+        for (Conv_Algorithm algorithm : algorithms) {
+            bool pointwise = shape.kernel == 1 && shape.stride == 1 && shape.padding == 0;
+            if (algorithm == Conv_Algorithm_Pointwise && !pointwise) continue;
+            if (algorithm == Conv_Algorithm_Winograd && !(shape.kernel == 3 && shape.stride == 1)) continue;
+
+            layer->algorithm = algorithm;
+            f64 time = bench_conv_time(layer, input, output, iterations);
+            if (algorithm == Conv_Algorithm_Im2col) tensor_copy_into(reference, output);
+
+            f32 max_error = 0.0f;
+            for (u32 n = 0; n < batch; n++) {
+                for (u32 c = 0; c < output_shape[3]; c++) {
+                    for (u32 y = 0; y < output_shape[2]; y++) {
+                        for (u32 x = 0; x < output_shape[1]; x++) {
+                            u64 a = n + (u64) x*output.stride[1] + (u64) y*output.stride[2] + (u64) c*output.stride[3];
+                            u64 b = n + (u64) x*reference.stride[1] + (u64) y*reference.stride[2] + (u64) c*reference.stride[3];
+                            max_error = fmaxf(max_error, fabsf(output.data[a] - reference.data[b]));
+                        }
+                    }
+                }
+            }
+
+            std::cout << "    " << (algorithm == selected ? "*" : " ") << std::left << std::setw(10)
+                      << conv_algorithm_name(algorithm) << std::right << std::setprecision(3)
+                      << std::setw(9) << time*1e3 << " ms " << std::setprecision(1) << std::setw(7)
+                      << flops/time*1e-9 << " GFLOP/s  max error " << std::scientific
+                      << std::setprecision(1) << max_error << std::fixed << std::endl;
+        }
+
+        tensor_free(input);
+        tensor_free(output);
+        tensor_free(reference);
+        layer_destroy(layer);
+    }
+    return 0;
+}
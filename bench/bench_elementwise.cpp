@@ -0,0 +1,175 @@
+#include "bench.h"
+#include "kernels.h"
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+
+/**
+ * The loops the tensor functions used before the vectorized kernels,
+ * kept here as the baseline.
+ */
+static void loop_add(float* out, const float* a, const float* b, u64 n) {
+    for (u64 i = 0; i < n; i++) out[i] = a[i] + b[i];
+}
+
+
+static void loop_relu(float* out, const float* in, u64 n) {
+    for (u64 i = 0; i < n; i++) out[i] = fmax(0.0f, in[i]);
+}
+
+
+enum Elementwise_Op {
+    Op_Add, Op_Mul, Op_Fma, Op_ReLU, Op_Exp, Op_Sigmoid, Op_Tanh, Op_Softmax, Op_Count
+};
+
+
+static const char* op_names[Op_Count] = {
+    "add", "mul", "fma", "relu", "exp", "sigmoid", "tanh", "softmax"
+};
+
+
+/// Number of arrays read and written by each op.
+static const int op_streams[Op_Count] = { 3, 3, 4, 2, 2, 2, 2, 2 };
+
+
+static void run_op(const Elementwise_Kernels& k, Elementwise_Op op,
+                   float* out, const float* a, const float* b, const float* c, u64 n) {
+    switch (op) {
+        case Op_Add: k.add(out, a, b, n); break;
+        case Op_Mul: k.mul(out, a, b, n); break;
+        case Op_Fma: k.fma(out, a, b, c, n); break;
+        case Op_ReLU: k.relu(out, a, n); break;
+        case Op_Exp: k.exp(out, a, n); break;
+        case Op_Sigmoid: k.sigmoid(out, a, n); break;
+        case Op_Tanh: k.tanh(out, a, n); break;
+        case Op_Softmax: k.softmax(out, a, n); break;
+        default: break;
+    }
+}
+
+
+/**
+ * Measures the maximum relative (and absolute) error of the approximated
+ * transcendentals against double precision over a dense sweep of [-88, 88].
+ */
+static void bench_elementwise_accuracy(const Elementwise_Kernels& k) {
+    const u64 n = 1 << 20;
+    std::vector<float> in(n), out(n);
+    for (u64 i = 0; i < n; i++) in[i] = -88.0f + 176.0f*(f32) i/(n - 1);
+
+    f64 exp_rel = 0.0, sigmoid_rel = 0.0, tanh_rel = 0.0, tanh_abs = 0.0;
+    k.exp(out.data(), in.data(), n);
+    for (u64 i = 0; i < n; i++) {
+        f64 ref = exp((f64) in[i]);
+        if (ref < 1e-37) continue;
+        exp_rel = fmax(exp_rel, fabs(out[i] - ref)/ref);
+    }
+    k.sigmoid(out.data(), in.data(), n);
+    for (u64 i = 0; i < n; i++) {
+        f64 ref = 1.0/(1.0 + exp(-(f64) in[i]));
+        if (ref < 1e-37) continue;
+        sigmoid_rel = fmax(sigmoid_rel, fabs(out[i] - ref)/ref);
+    }
+    k.tanh(out.data(), in.data(), n);
+    for (u64 i = 0; i < n; i++) {
+        f64 ref = tanh((f64) in[i]);
+        tanh_abs = fmax(tanh_abs, fabs(out[i] - ref));
+        if (ref != 0.0) tanh_rel = fmax(tanh_rel, fabs(out[i] - ref)/fabs(ref));
+    }
+
+    // Softmax over a vector of moderately sized logits.
+    f64 softmax_rel = 0.0;
+    const u64 m = 1000;
+    std::vector<f64> ref(m);
+    for (u64 i = 0; i < m; i++) in[i] = 10.0f*sinf((f32) i);
+    k.softmax(out.data(), in.data(), m);
+    f64 sum = 0.0;
+    for (u64 i = 0; i < m; i++) sum += ref[i] = exp((f64) in[i] - 10.0);
+    for (u64 i = 0; i < m; i++) {
+        softmax_rel = fmax(softmax_rel, fabs(out[i] - ref[i]/sum)/(ref[i]/sum));
+    }
+
+    std::cout << std::scientific << std::setprecision(2)
+              << "  " << std::left << std::setw(8) << k.name << std::right
+              << " exp rel " << exp_rel << ", sigmoid rel " << sigmoid_rel
+              << ", tanh abs " << tanh_abs << " rel " << tanh_rel
+              << ", softmax rel " << softmax_rel << std::endl;
+}
+
+
+/**
+ * Reports the throughput in GB/s of every kernel for every supported
+ * instruction set against the plain loops, over sizes fitting in L1, L2,
+ * L3 and main memory respectively.
+ */
+int bench_elementwise(int, char**) {
+    Kernel_Isa isas[] = { Kernel_Isa_Scalar, Kernel_Isa_SSE, Kernel_Isa_AVX2, Kernel_Isa_AVX512 };
+    u64 sizes[] = { 4*1024, 64*1024, 1024*1024, 16*1024*1024 };
+
+    std::cout << "accuracy of transcendentals (vs double precision):" << std::endl;
+    for (Kernel_Isa isa : isas) {
+        const Elementwise_Kernels* k = kernels_for_isa(isa);
+        if (k) bench_elementwise_accuracy(*k);
+    }
+
+    std::vector<float> a(sizes[3]), b(sizes[3]), c(sizes[3]), out(sizes[3]);
+    for (u64 i = 0; i < sizes[3]; i++) {
+        a[i] = (f32) rand()/RAND_MAX*4.0f - 2.0f;
+        b[i] = (f32) rand()/RAND_MAX*4.0f - 2.0f;
+        c[i] = (f32) rand()/RAND_MAX*4.0f - 2.0f;
+    }
+
+    for (u64 n : sizes) {
+        std::cout << std::endl << "throughput in GB/s, n = " << n
+                  << " (" << n*sizeof(float)/1024 << " KiB per array):" << std::endl;
+        std::cout << "  " << std::left << std::setw(10) << "kernel" << std::right << std::setw(10) << "loop";
+        for (Kernel_Isa isa : isas) {
+            const Elementwise_Kernels* k = kernels_for_isa(isa);
+            if (k) std::cout << std::setw(10) << k->name;
+        }
+        std::cout << std::endl;
+
+        for (int op = 0; op < Op_Count; op++) {
+            f64 bytes = (f64) op_streams[op]*n*sizeof(float);
+            std::cout << "  " << std::left << std::setw(10) << op_names[op] << std::right
+                      << std::fixed << std::setprecision(2);
+
+            auto measure = [&](auto&& run) {
+                f64 best = 1e30;
+                f64 start = bench_now();
+                int iterations = 0;
+                while (bench_now() - start < 0.1 || iterations < 3) {
+                    f64 t0 = bench_now();
+                    run();
+                    f64 elapsed = bench_now() - t0;
+                    bench_do_not_optimize(out.data());
+                    if (elapsed < best) best = elapsed;
+                    iterations++;
+                }
+                return bytes/best*1e-9;
+            };
+
+            if (op == Op_Add) {
+                std::cout << std::setw(10) << measure([&] { loop_add(out.data(), a.data(), b.data(), n); });
+            } else if (op == Op_ReLU) {
+                std::cout << std::setw(10) << measure([&] { loop_relu(out.data(), a.data(), n); });
+            } else {
+                std::cout << std::setw(10) << "-";
+            }
+
+            for (Kernel_Isa isa : isas) {
+                const Elementwise_Kernels* k = kernels_for_isa(isa);
+                if (!k) continue;
+                std::cout << std::setw(10) << measure([&] {
+                    run_op(*k, (Elementwise_Op) op, out.data(), a.data(), b.data(), c.data(), n);
+                });
+            }
+            std::cout << std::endl;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,93 @@
+#include "bench.h"
+#include "memory.h"
+#include "network.h"
+#include "plan.h"
+#include "thread_pool.h"
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+
+
+/**
+ * Runs forward passes of an MLP and reports the latency and the number of
+ * heap allocations made per forward pass once the network is warmed up.
+ * With `--plan` the network is compiled into an execution plan first.
+ */
+int bench_forward(int argc, char** argv) {
+    u32 width = 1024;
+    u32 depth = 4;
+    u32 batch = 1;
+    int iterations = 100;
+    bool fuse = false;
+    bool plan = false;
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "--fuse") == 0) fuse = true;
+        if (strcmp(argv[i], "--plan") == 0) plan = true;
+        if (i + 1 >= argc) break;
+        if (strcmp(argv[i], "--width") == 0) width = (u32) atoi(argv[++i]);
+        else if (strcmp(argv[i], "--depth") == 0) depth = (u32) atoi(argv[++i]);
+        else if (strcmp(argv[i], "--batch") == 0) batch = (u32) atoi(argv[++i]);
+        else if (strcmp(argv[i], "--iterations") == 0) iterations = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--threads") == 0) thread_pool_set_num_threads((u32) atoi(argv[++i]));
+    }
+
+    Network network;
+    for (u32 i = 0; i < depth; i++) {
+        network.layers.push_back(dense_layer(width, width, tensor_init_random, tensor_init_zeros));
+        network.layers.push_back(relu());
+    }
+    if (fuse) {
+        network_fuse_layers(network);
+    }
+
+    Tensor input = tensor_create_2d(batch, width);
+    tensor_init_random(input);
+
+    Execution_Plan* execution_plan = nullptr;
+    if (plan) {
+        execution_plan = plan_compile(&network, input.shape, input.ndim);
+        std::cout << *execution_plan;
+    }
+    auto forward = [&]() {
+        return execution_plan ? plan_forward(execution_plan, &input) : network.forward(&input);
+    };
+
+    // The first passes grow the arena, after that it should be stable.
+    for (int i = 0; i < 3; i++) {
+        forward();
+    }
+
+    Memory_Stats before = memory_stats();
+    f64 best = 1e30;
+    f64 total = 0.0;
+    for (int i = 0; i < iterations; i++) {
+        f64 start = bench_now();
+        Tensor output = forward();
+        f64 elapsed = bench_now() - start;
+        bench_do_not_optimize(output.data);
+        if (elapsed < best) best = elapsed;
+        total += elapsed;
+    }
+    Memory_Stats after = memory_stats();
+
+    u64 allocations = after.heap_allocations - before.heap_allocations;
+    u64 arena_allocations = after.arena_allocations - before.arena_allocations;
+    f64 flops = 2.0*width*width*batch*depth;
+    std::cout << "mlp " << depth << "x" << width << ", batch " << batch
+              << ", threads " << thread_pool_num_threads()
+              << (fuse ? ", fused" : "") << (plan ? ", planned" : "") << std::endl;
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "  mean forward:       " << total/iterations*1e3 << " ms" << std::endl;
+    std::cout << "  best forward:       " << best*1e3 << " ms ("
+              << flops/best*1e-9 << " GFLOP/s)" << std::endl;
+    std::cout << "  heap allocations:   " << allocations << " in " << iterations << " forward passes" << std::endl;
+    std::cout << "  arena allocations:  " << arena_allocations/iterations << " per forward pass" << std::endl;
+    if (execution_plan) {
+        std::cout << "  workspace:          " << execution_plan->workspace_bytes/1024 << " KiB" << std::endl;
+        plan_destroy(execution_plan);
+    } else {
+        std::cout << "  arena peak:         " << network.arena.peak/1024 << " KiB" << std::endl;
+    }
+    return allocations == 0 ? 0 : 1;
+}
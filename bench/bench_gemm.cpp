@@ -0,0 +1,127 @@
+#include "bench.h"
+#include "gemm.h"
+#include "thread_pool.h"
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+
+struct Gemm_Shape {
+    u32 m, n, k;
+    const char* label;
+};
+
+
+typedef void Gemm_Function(u32 m, u32 n, u32 k,
+                           const float* a, i32 rsa, i32 csa,
+                           const float* b, i32 rsb, i32 csb,
+                           float beta, float* c, u32 ldc);
+
+
+/**
+ * Runs the gemm repeatedly for at least `min_time` seconds
+ * and returns the best observed throughput in GFLOP/s.
+ */
+static f64 bench_gemm_gflops(Gemm_Function* gemm, Gemm_Shape shape,
+                             const float* a, const float* b, float* c,
+                             f64 min_time) {
+    f64 flops = 2.0*shape.m*shape.n*shape.k;
+    f64 best = 1e30;
+    f64 total = 0.0;
+    int iterations = 0;
+    while (total < min_time || iterations < 2) {
+        f64 start = bench_now();
+        gemm(shape.m, shape.n, shape.k, a, shape.k, 1, b, shape.n, 1, 0.0f, c, shape.n);
+        f64 elapsed = bench_now() - start;
+        bench_do_not_optimize(c);
+        if (elapsed < best) best = elapsed;
+        total += elapsed;
+        iterations++;
+    }
+    return flops/best*1e-9;
+}
+
+
+int bench_gemm(int argc, char** argv) {
+    bool full = false;
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "--full") == 0) full = true;
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            thread_pool_set_num_threads((u32) atoi(argv[++i]));
+        }
+    }
+
+    Gemm_Shape shapes[] = {
+        { 128, 128, 128, "square" },
+        { 256, 256, 256, "square" },
+        { 512, 512, 512, "square" },
+        { 1024, 1024, 1024, "square" },
+        { 2048, 2048, 2048, "square" },
+        { 1024, 1, 1024, "tall-skinny" },
+        { 4096, 1, 1024, "tall-skinny" },
+        { 4096, 8, 1024, "tall-skinny" },
+        { 4096, 32, 1024, "tall-skinny" },
+        { 1024, 64, 4096, "tall-skinny" },
+    };
+
+    std::cout << "gemm kernel: " << gemm_kernel_name()
+              << ", threads: " << thread_pool_num_threads() << std::endl;
+    std::cout << std::left << std::setw(12) << "shape"
+              << std::setw(20) << "m x n x k"
+              << std::right << std::setw(10) << "naive"
+              << std::setw(10) << "scalar"
+              << std::setw(10) << "blocked"
+              << std::setw(10) << "speedup"
+              << std::setw(12) << "max error" << std::endl;
+
+    for (Gemm_Shape shape : shapes) {
+        std::vector<float> a((size_t) shape.m*shape.k);
+        std::vector<float> b((size_t) shape.k*shape.n);
+        std::vector<float> c((size_t) shape.m*shape.n);
+        std::vector<float> expected((size_t) shape.m*shape.n);
+        for (float& x : a) x = (float) rand()/RAND_MAX - 0.5f;
+        for (float& x : b) x = (float) rand()/RAND_MAX - 0.5f;
+
+        // The naive loop is far too slow for the largest shapes.
+        f64 naive_flops = 2.0*shape.m*shape.n*shape.k;
+        bool run_naive = full || naive_flops <= 2.2e9;
+
+        gemm_f32_reference(shape.m, shape.n, shape.k, a.data(), shape.k, 1,
+                           b.data(), shape.n, 1, 0.0f, expected.data(), shape.n);
+        f64 naive = 0.0;
+        if (run_naive) {
+            naive = bench_gemm_gflops(gemm_f32_reference, shape, a.data(), b.data(), c.data(), 0.2);
+        }
+
+        gemm_set_kernel(Gemm_Kernel_Scalar);
+        f64 scalar = bench_gemm_gflops(gemm_f32, shape, a.data(), b.data(), c.data(), 0.2);
+        gemm_set_kernel(Gemm_Kernel_Auto);
+        f64 blocked = bench_gemm_gflops(gemm_f32, shape, a.data(), b.data(), c.data(), 0.2);
+
+        f32 max_error = 0.0f;
+        for (size_t i = 0; i < c.size(); i++) {
+            max_error = fmaxf(max_error, fabsf(c[i] - expected[i]));
+        }
+
+        char dims[32];
+        snprintf(dims, sizeof(dims), "%ux%ux%u", shape.m, shape.n, shape.k);
+        std::cout << std::left << std::setw(12) << shape.label
+                  << std::setw(20) << dims << std::right << std::fixed << std::setprecision(2);
+        if (run_naive) {
+            std::cout << std::setw(10) << naive;
+        } else {
+            std::cout << std::setw(10) << "-";
+        }
+        std::cout << std::setw(10) << scalar << std::setw(10) << blocked;
+        if (run_naive) {
+            std::cout << std::setw(9) << blocked/naive << "x";
+        } else {
+            std::cout << std::setw(10) << "-";
+        }
+        std::cout << std::setw(12) << std::scientific << std::setprecision(1) << max_error << std::endl;
+    }
+    return 0;
+}
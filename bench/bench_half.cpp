@@ -0,0 +1,196 @@
+#include "bench.h"
+#include "network.h"
+#include "thread_pool.h"
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+
+/**
+ * Returns the best time of a single call in seconds.
+ */
+template <typename Function>
+static f64 bench_half_time(int iterations, Function&& function) {
+    function();
+    f64 best = 1e30;
+    for (int i = 0; i < iterations; i++) {
+        f64 start = bench_now();
+        function();
+        best = fmin(best, bench_now() - start);
+    }
+    return best;
+}
+
+
+static void bench_half_init_weights(Tensor& weights) {
+    tensor_init_random(weights);
+    f32 limit = sqrtf(6.0f/weights.shape[0]);
+    for (u32 i = 0; i < weights.length; i++) {
+        weights.data[i] = (2.0f*weights.data[i] - 1.0f)*limit;
+    }
+}
+
+
+static f32 bench_half_max_error(Tensor& output, Tensor& expected) {
+    f32 error = 0.0f, scale = 0.0f;
+    for (u32 i = 0; i < output.length; i++) {
+        error = fmaxf(error, fabsf(output.data[i] - expected.data[i]));
+        scale = fmaxf(scale, fabsf(expected.data[i]));
+    }
+    return scale > 0.0f ? error/scale : error;
+}
+
+
+/**
+ * Conversion throughput of every supported kernel, every result is
+ * compared bit for bit with the scalar conversions: all 65536 16-bit
+ * values to fp32 and random fp32 values to 16 bits. NaN payloads and
+ * fp32 subnormals (flushed to zero by AVX-512 BF16) are not compared.
+ */
+static void bench_half_conversions(u64 count, int iterations) {
+    std::vector<float> floats(count);
+    std::vector<u16> halves(count);
+    std::vector<float> floats_out(count);
+    std::vector<u16> halves_out(count);
+    for (u64 i = 0; i < count; i++) {
+        u32 bits = (u32) rand() ^ ((u32) rand() << 16);
+        // Mostly values in the range of weights, some of any magnitude.
+        floats[i] = i % 8 ? ((f32) rand()/RAND_MAX - 0.5f)*(f32) (1 << (i % 20)) : 0.0f;
+        if (i % 8 == 0) memcpy(&floats[i], &bits, sizeof(bits));
+        halves[i] = (u16) i;
+    }
+
+    std::cout << "  kernel              type   to f32 GB/s  from f32 GB/s  mismatches" << std::endl;
+    for (Half_Kernel_Type type : { Half_Kernel_Scalar, Half_Kernel_F16C, Half_Kernel_AVX512_BF16 }) {
+        if (!half_set_kernel(type)) continue;
+        for (Dtype dtype : { Dtype_F16, Dtype_BF16 }) {
+            f64 to_time = bench_half_time(iterations, [&]() {
+                half_to_f32(dtype, floats_out.data(), halves.data(), count);
+            });
+            u64 mismatches = 0;
+            for (u64 i = 0; i < count; i++) {
+                f32 expected = dtype_load(dtype, halves.data(), i);
+                mismatches += memcmp(&expected, &floats_out[i], sizeof(f32)) != 0 && expected == expected;
+            }
+
+            f64 from_time = bench_half_time(iterations, [&]() {
+                half_from_f32(dtype, halves_out.data(), floats.data(), count);
+            });
+            for (u64 i = 0; i < count; i++) {
+                u16 expected = dtype == Dtype_F16 ? half_f32_to_f16(floats[i]) : half_f32_to_bf16(floats[i]);
+                mismatches += expected != halves_out[i] && std::isnormal(floats[i]);
+            }
+
+            std::cout << "  " << std::left << std::setw(20) << half_kernel_name() << std::setw(5) << dtype_name(dtype)
+                      << std::right << std::fixed << std::setprecision(1)
+                      << std::setw(14) << 6.0*count/to_time*1e-9
+                      << std::setw(15) << 6.0*count/from_time*1e-9
+                      << std::setw(12) << mismatches << std::endl;
+        }
+    }
+    half_set_kernel(Half_Kernel_Auto);
+}
+
+
+/**
+ * One dense layer with fp32, fp16 and bf16 weights, a single sample
+ * streams the weights once so it is bound by their bytes.
+ */
+static void bench_half_dense(u32 inputs, u32 outputs, u32 batch, int iterations) {
+    Dense_Layer* layer = dense_layer(inputs, outputs, bench_half_init_weights, tensor_init_random);
+    Tensor input = tensor_create_2d(batch, inputs);
+    Tensor expected = tensor_create_2d(batch, outputs);
+    Tensor output = tensor_create_2d(batch, outputs);
+    tensor_init_random(input);
+
+    f64 f32_time = 0.0;
+    for (Dtype dtype : { Dtype_F32, Dtype_F16, Dtype_BF16 }) {
+        Tensor weights = tensor_convert(layer->weights, dtype);
+        f64 time = bench_half_time(iterations, [&]() {
+            tensor_dense_into(output, weights, input, layer->bias, Gemm_Activation_ReLU);
+        });
+        if (dtype == Dtype_F32) {
+            f32_time = time;
+            tensor_copy_into(expected, output);
+        }
+        std::cout << "  " << std::setw(6) << batch << std::setw(6) << dtype_name(dtype)
+                  << std::fixed << std::setprecision(1) << std::setw(10) << time*1e6
+                  << std::setw(7) << std::setprecision(2) << f32_time/time << "x"
+                  << std::setw(9) << std::setprecision(1) << tensor_bytes(weights)/(f64) (1 << 20)
+                  << std::setw(10) << tensor_bytes(weights)/time*1e-9
+                  << std::scientific << std::setprecision(1) << std::setw(10) << bench_half_max_error(output, expected)
+                  << std::fixed << std::endl;
+        tensor_free(weights);
+    }
+
+    tensor_free(input);
+    tensor_free(expected);
+    tensor_free(output);
+    tensor_free(layer->weights);
+    tensor_free(layer->bias);
+    delete layer;
+}
+
+
+/**
+ * Conversion kernels, dense layers with 16-bit weights for single samples
+ * and batches against fp32 weights, and an MLP converted in place by
+ * `network_convert_weights`.
+ */
+int bench_half(int argc, char** argv) {
+    u32 width = 4096;
+    u32 batch = 32;
+    int iterations = 20;
+    for (int i = 0; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "--width") == 0) width = (u32) atoi(argv[++i]);
+        else if (strcmp(argv[i], "--batch") == 0) batch = (u32) atoi(argv[++i]);
+        else if (strcmp(argv[i], "--iterations") == 0) iterations = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--threads") == 0) thread_pool_set_num_threads((u32) atoi(argv[++i]));
+    }
+
+    std::cout << "conversions of 1M elements" << std::endl;
+    bench_half_conversions(1 << 20, iterations);
+
+    std::cout << std::endl << "dense " << width << "x" << width << " + relu, gemm " << gemm_kernel_name()
+              << ", conversions " << half_kernel_name() << ", threads " << thread_pool_num_threads() << std::endl;
+    std::cout << "   batch  type   time us  speedup  weights MB  weights GB/s  rel error" << std::endl;
+    for (u32 samples : { 1u, batch }) bench_half_dense(width, width, samples, iterations);
+
+    // The same MLP (same seed) is converted in place to every type.
+    const u32 depth = 4;
+    Tensor input = tensor_create_2d(1, width);
+    tensor_init_random(input);
+    Tensor expected = {};
+    f64 f32_time = 0.0;
+    std::cout << std::endl << "mlp " << width << " x " << depth << ", single sample" << std::endl;
+    for (Dtype dtype : { Dtype_F32, Dtype_F16, Dtype_BF16 }) {
+        srand(1);
+        Network network;
+        for (u32 i = 0; i < depth; i++) {
+            u32 outputs = i + 1 < depth ? width : 10;
+            network.layers.push_back(dense_layer(width, outputs, bench_half_init_weights, tensor_init_random));
+            if (i + 1 < depth) network.layers.push_back(relu());
+        }
+        network_fuse_layers(network);
+        i64 saved = network_convert_weights(network, dtype);
+
+        Tensor output = network.forward(&input);
+        if (dtype == Dtype_F32) expected = tensor_copy(output);
+        f32 error = bench_half_max_error(output, expected);
+        f64 time = bench_half_time(iterations, [&]() { bench_do_not_optimize(network.forward(&input).data); });
+        if (dtype == Dtype_F32) f32_time = time;
+        std::cout << "  " << std::setw(4) << dtype_name(dtype) << std::fixed << std::setprecision(1)
+                  << " saved " << std::setw(5) << saved/(f64) (1 << 20) << " MB, forward " << std::setw(7) << time*1e6
+                  << " us (" << std::setprecision(2) << f32_time/time << "x), rel error "
+                  << std::scientific << std::setprecision(1) << error << std::fixed << std::endl;
+
+        network_destroy(network);
+    }
+
+    tensor_free(input);
+    tensor_free(expected);
+    return 0;
+}
@@ -0,0 +1,185 @@
+#include "bench.h"
+#include "image_loader.h"
+#include "network.h"
+#include "thread_pool.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+
+
+static u32 bench_crc32(const u8* data, u64 size, u32 crc = 0) {
+    crc = ~crc;
+    for (u64 i = 0; i < size; i++) {
+        crc ^= data[i];
+        for (int b = 0; b < 8; b++) crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+    }
+    return ~crc;
+}
+
+
+static void bench_put_u32(std::vector<u8>& out, u32 value) {
+    for (int shift = 24; shift >= 0; shift -= 8) out.push_back((u8) (value >> shift));
+}
+
+
+static void bench_png_chunk(std::vector<u8>& out, const char* type, const std::vector<u8>& data) {
+    bench_put_u32(out, (u32) data.size());
+    u64 start = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data.begin(), data.end());
+    bench_put_u32(out, bench_crc32(out.data() + start, out.size() - start));
+}
+
+
+/**
+ * Writes an RGB image as a PNG with uncompressed (stored) deflate blocks,
+ * which is all stb_image needs and avoids vendoring an encoder.
+ */
+static bool bench_write_png(const char* path, const u8* pixels, u32 width, u32 height) {
+    std::vector<u8> raw;
+    for (u32 y = 0; y < height; y++) {
+        raw.push_back(0);
+        raw.insert(raw.end(), pixels + (u64) y*width*3, pixels + (u64) (y + 1)*width*3);
+    }
+
+    std::vector<u8> zlib = { 0x78, 0x01 };
+    u32 a = 1, b = 0;
+    for (u8 byte : raw) {
+        a = (a + byte) % 65521;
+        b = (b + a) % 65521;
+    }
+    for (u64 offset = 0; offset < raw.size(); offset += 65535) {
+        u32 length = (u32) std::min<u64>(65535, raw.size() - offset);
+        zlib.push_back(offset + length == raw.size() ? 1 : 0);
+        zlib.push_back((u8) length);
+        zlib.push_back((u8) (length >> 8));
+        zlib.push_back((u8) ~length);
+        zlib.push_back((u8) (~length >> 8));
+        zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + length);
+    }
+    bench_put_u32(zlib, (b << 16) | a);
+
+    std::vector<u8> header;
+    bench_put_u32(header, width);
+    bench_put_u32(header, height);
+    header.insert(header.end(), { 8, 2, 0, 0, 0 });
+
+    std::vector<u8> png = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    bench_png_chunk(png, "IHDR", header);
+    bench_png_chunk(png, "IDAT", zlib);
+    bench_png_chunk(png, "IEND", {});
+
+    FILE* file = fopen(path, "wb");
+    if (!file) return false;
+    bool ok = fwrite(png.data(), 1, png.size(), file) == png.size();
+    return fclose(file) == 0 && ok;
+}
+
+
+/**
+ * Decodes images and feeds them through a small MLP, once decoding
+ * inline on the compute thread and once with the loader's workers
+ * decoding ahead into the ring of batch buffers. Uses the images in
+ * `--dir` or generates `--count` synthetic PNGs of `--source` pixels.
+ */
+int bench_images(int argc, char** argv) {
+    const char* dir = nullptr;
+    u32 count = 512;
+    u32 source_size = 320;
+    Image_Loader_Config config;
+    config.width = 64;
+    config.height = 64;
+    for (int i = 0; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "--dir") == 0) dir = argv[++i];
+        else if (strcmp(argv[i], "--count") == 0) count = (u32) atoi(argv[++i]);
+        else if (strcmp(argv[i], "--source") == 0) source_size = (u32) atoi(argv[++i]);
+        else if (strcmp(argv[i], "--size") == 0) config.width = config.height = (u32) atoi(argv[++i]);
+        else if (strcmp(argv[i], "--batch") == 0) config.batch_size = (u32) atoi(argv[++i]);
+        else if (strcmp(argv[i], "--workers") == 0) config.num_workers = (u32) atoi(argv[++i]);
+        else if (strcmp(argv[i], "--buffers") == 0) config.num_buffers = (u32) atoi(argv[++i]);
+        else if (strcmp(argv[i], "--threads") == 0) thread_pool_set_num_threads((u32) atoi(argv[++i]));
+    }
+
+    namespace fs = std::filesystem;
+    std::vector<std::string> paths;
+    if (dir) {
+        for (const fs::directory_entry& entry : fs::directory_iterator(dir)) {
+            if (entry.is_regular_file()) paths.push_back(entry.path().string());
+        }
+    } else {
+        dir = "bench_images";
+        fs::create_directories(dir);
+        std::vector<u8> pixels((u64) source_size*source_size*3);
+        for (u32 i = 0; i < count; i++) {
+            for (u64 p = 0; p < pixels.size(); p++) pixels[p] = (u8) (p*7 + i*13 + rand() % 32);
+            std::string path = std::string(dir) + "/image_" + std::to_string(i) + ".png";
+            if (!bench_write_png(path.c_str(), pixels.data(), source_size, source_size)) {
+                std::cerr << "error: failed to write `" << path << "`" << std::endl;
+                return 1;
+            }
+            paths.push_back(path);
+        }
+    }
+    if (paths.empty()) {
+        std::cerr << "error: no images in `" << dir << "`" << std::endl;
+        return 1;
+    }
+
+    u32 features = config.channels*config.height*config.width;
+    Network network;
+    network.layers.push_back(dense_layer(features, 128, tensor_init_random, tensor_init_random));
+    network.layers.push_back(relu());
+    network.layers.push_back(dense_layer(128, 10, tensor_init_random, tensor_init_random));
+
+    std::cout << paths.size() << " images from `" << dir << "` to " << config.width << "x"
+              << config.height << "x" << config.channels << ", batch " << config.batch_size
+              << ", compute threads " << thread_pool_num_threads() << std::endl;
+    std::cout << std::fixed << std::setprecision(1);
+
+    // Baseline, every image is decoded on the compute thread right before use.
+    Tensor batch = tensor_create_2d(config.batch_size, features);
+    f64 compute_time = 0.0;
+    f64 start = bench_now();
+    for (u64 first = 0; first < paths.size(); first += config.batch_size) {
+        u32 size = (u32) std::min<u64>(config.batch_size, paths.size() - first);
+        batch.shape[0] = size;
+        tensor_set_contiguous(batch);
+        for (u32 s = 0; s < size; s++) image_load_into(paths[first + s].c_str(), config, batch, s);
+        f64 compute_start = bench_now();
+        Tensor output = network.forward(&batch);
+        compute_time += bench_now() - compute_start;
+        bench_do_not_optimize(output.data);
+    }
+    f64 inline_time = bench_now() - start;
+    std::cout << "  inline decode  " << std::setw(9) << paths.size()/inline_time << " images/s, "
+              << "compute " << 100.0*compute_time/inline_time << "% of the time" << std::endl;
+
+    // Pipelined, the workers decode ahead while the network runs.
+    Image_Loader* loader = image_loader_create(paths, config);
+    Image_Batch images;
+    compute_time = 0.0;
+    start = bench_now();
+    while (image_loader_next(loader, &images)) {
+        f64 compute_start = bench_now();
+        Tensor output = network.forward(&images.images);
+        compute_time += bench_now() - compute_start;
+        bench_do_not_optimize(output.data);
+        image_loader_release(loader, &images);
+    }
+    f64 loader_time = bench_now() - start;
+    Image_Loader_Stats stats = image_loader_stats(loader);
+    image_loader_destroy(loader);
+
+    std::cout << "  " << config.num_workers << " workers, " << config.num_buffers << " buffers "
+              << std::setw(9) << stats.images/loader_time << " images/s, compute "
+              << 100.0*compute_time/loader_time << "% of the time, speedup "
+              << std::setprecision(2) << inline_time/loader_time << "x" << std::endl;
+    std::cout << std::setprecision(1);
+    std::cout << "  consumer stalls " << stats.consumer_stalls << " (" << stats.consumer_wait_ms
+              << " ms waiting), worker stalls " << stats.worker_stalls << ", decode errors "
+              << stats.decode_errors << std::endl;
+    return 0;
+}
@@ -0,0 +1,92 @@
+#include "bench.h"
+#include "model_file.h"
+#include "network.h"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+
+
+/**
+ * Saves an MLP to a model file and compares mapping it against reading
+ * the whole file into memory, the time to load, the first forward pass
+ * (which faults the mapped weights in) and the steady state forward pass.
+ */
+int bench_load(int argc, char** argv) {
+    u32 width = 2048;
+    u32 depth = 8;
+    const char* path = "bench_model.bin";
+    for (int i = 0; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "--width") == 0) width = (u32) atoi(argv[++i]);
+        else if (strcmp(argv[i], "--depth") == 0) depth = (u32) atoi(argv[++i]);
+        else if (strcmp(argv[i], "--path") == 0) path = argv[++i];
+    }
+
+    Network network;
+    for (u32 i = 0; i < depth; i++) {
+        network.layers.push_back(dense_layer(width, width, tensor_init_random, tensor_init_random));
+        network.layers.push_back(relu());
+    }
+    network_fuse_layers(network);
+
+    Tensor input = tensor_create_2d(1, width);
+    tensor_init_random(input);
+    Tensor reference = network.forward(&input);
+    Tensor expected = tensor_copy(reference);
+
+    f64 start = bench_now();
+    if (!model_save(network, path)) return 1;
+    f64 save_time = bench_now() - start;
+
+    // Baseline, read the whole file into memory.
+    start = bench_now();
+    FILE* file = fopen(path, "rb");
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    u8* contents = (u8*) memory_alloc((size_t) size);
+    size_t read = fread(contents, 1, (size_t) size, file);
+    fclose(file);
+    f64 read_time = bench_now() - start;
+    bench_do_not_optimize(contents);
+    memory_free(contents);
+    if (read != (size_t) size) return 1;
+
+    Network loaded;
+    start = bench_now();
+    Model_File* model = model_load(path, &loaded);
+    f64 load_time = bench_now() - start;
+    if (!model) return 1;
+
+    start = bench_now();
+    Tensor output = loaded.forward(&input);
+    f64 first_time = bench_now() - start;
+
+    f64 steady_time = 1e30;
+    for (int i = 0; i < 10; i++) {
+        start = bench_now();
+        output = loaded.forward(&input);
+        steady_time = fmin(steady_time, bench_now() - start);
+    }
+
+    f32 max_error = 0.0f;
+    for (u32 i = 0; i < output.length; i++) {
+        max_error = fmaxf(max_error, fabsf(output.data[i] - expected.data[i]));
+    }
+
+    std::cout << "mlp " << depth << "x" << width << ", "
+              << std::fixed << std::setprecision(1) << size/(1024.0*1024.0) << " MiB model file" << std::endl;
+    std::cout << std::setprecision(3);
+    std::cout << "  save:               " << save_time*1e3 << " ms" << std::endl;
+    std::cout << "  read whole file:    " << read_time*1e3 << " ms" << std::endl;
+    std::cout << "  map (model_load):   " << load_time*1e3 << " ms" << std::endl;
+    std::cout << "  first forward:      " << first_time*1e3 << " ms" << std::endl;
+    std::cout << "  steady forward:     " << steady_time*1e3 << " ms" << std::endl;
+    std::cout << "  max difference:     " << max_error << std::endl;
+
+    model_close(model);
+    remove(path);
+    return max_error == 0.0f ? 0 : 1;
+}
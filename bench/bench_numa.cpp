@@ -0,0 +1,142 @@
+#include "bench.h"
+#include "numa.h"
+#include "thread_pool.h"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+
+/**
+ * Share of the pages of the placed weights of a replica that are on `node`,
+ * or -1 if the kernel doesn't tell (not faulted in, other platforms).
+ */
+static f64 bench_numa_local_share(Network& replica, u32 node_id) {
+    u64 local = 0, known = 0;
+    for (Layer* layer : replica.layers) {
+        if (layer->type() != Layer_Type_Dense) continue;
+        Tensor& weights = ((Dense_Layer*) layer)->weights;
+        for (u64 offset = 0; offset < tensor_bytes(weights); offset += 4096) {
+            i32 node = numa_node_of((const u8*) weights.data + offset);
+            if (node < 0) continue;
+            known++;
+            local += (u32) node == node_id;
+        }
+    }
+    return known > 0 ? (f64) local/known : -1.0;
+}
+
+
+/**
+ * One thread per node, bound to it and running its kernels inline, does
+ * batch 1 forward passes for `seconds` on a copy of the layers of the
+ * replica of node `(node + shift) % num_nodes`, shift 0 is local.
+ */
+static void bench_numa_run(Numa_Network* numa, u32 width, f64 seconds, u32 shift, const char* label) {
+    const Numa_Topology& topology = numa->topology;
+    std::atomic<bool> stop(false);
+    std::vector<u64> counts(topology.num_nodes, 0);
+    std::vector<f64> local(topology.num_nodes, -1.0);
+
+    std::vector<std::thread> threads;
+    for (u32 node = 0; node < topology.num_nodes; node++) {
+        threads.emplace_back([&, node]() {
+            numa_bind_thread(topology, node);
+            thread_pool_set_inline(true);
+            Network* replica = numa_network_replica(numa, (node + shift) % topology.num_nodes);
+            Network copy = network_share_weights(*replica);
+            if (!topology.simulated) local[node] = bench_numa_local_share(copy, topology.ids[node]);
+
+            Tensor input = tensor_create_2d(1, width);
+            tensor_init_random(input);
+            u64 count = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                Tensor output = copy.forward(&input);
+                bench_do_not_optimize(output.data);
+                count++;
+            }
+            counts[node] = count;
+            tensor_free(input);
+            network_release_shared(copy);
+        });
+    }
+    f64 start = bench_now();
+    std::this_thread::sleep_for(std::chrono::duration<f64>(seconds));
+    stop = true;
+    for (std::thread& thread : threads) thread.join();
+    f64 time = bench_now() - start;
+
+    u64 total = 0;
+    f64 local_sum = 0.0;
+    for (u32 node = 0; node < topology.num_nodes; node++) {
+        total += counts[node];
+        local_sum += local[node];
+    }
+    std::cout << "  " << std::left << std::setw(22) << label << std::right << std::fixed << std::setprecision(1)
+              << std::setw(12) << total/time << std::setw(14) << numa->bytes/(f64) (1 << 20);
+    if (local[0] >= 0.0) std::cout << std::setw(12) << local_sum/topology.num_nodes*100.0;
+    else std::cout << std::setw(12) << "-";
+    std::cout << "   ";
+    for (u32 node = 0; node < topology.num_nodes; node++) std::cout << " " << counts[node]/time;
+    std::cout << std::endl;
+}
+
+
+/**
+ * Throughput of an mlp whose weights are larger than the caches with one
+ * bound thread per node: the weights as loaded, interleaved over the nodes,
+ * replicated per node with every thread reading its local replica, and
+ * replicated but read from the replica of the next node (all remote).
+ * `--simulate n` splits the CPUs of the machine into n nodes, memory isn't
+ * bound to those so the policies only differ on a real topology.
+ */
+int bench_numa(int argc, char** argv) {
+    u32 width = 2048;
+    u32 depth = 6;
+    u32 simulate = 0;
+    f64 seconds = 2.0;
+    for (int i = 0; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "--width") == 0) width = (u32) atoi(argv[++i]);
+        else if (strcmp(argv[i], "--depth") == 0) depth = (u32) atoi(argv[++i]);
+        else if (strcmp(argv[i], "--simulate") == 0) simulate = (u32) atoi(argv[++i]);
+        else if (strcmp(argv[i], "--seconds") == 0) seconds = atof(argv[++i]);
+    }
+
+    Numa_Topology topology = simulate > 0 ? numa_topology_simulated(simulate) : numa_topology();
+    std::cout << topology.num_nodes << (topology.simulated ? " simulated" : "") << " nodes" << std::endl;
+    for (u32 node = 0; node < topology.num_nodes; node++) {
+        std::cout << "  node " << topology.ids[node] << ": cpus";
+        for (u32 cpu : topology.cpus[node]) std::cout << " " << cpu;
+        std::cout << std::endl;
+    }
+
+    Network network;
+    for (u32 i = 0; i < depth; i++) {
+        network.layers.push_back(dense_layer(width, width, tensor_init_random, tensor_init_zeros));
+        if (i + 1 < depth) network.layers.push_back(relu(true));
+    }
+    std::cout << std::endl << "mlp " << depth << "x" << width << ", "
+              << std::fixed << std::setprecision(1) << depth*(f64) width*width*sizeof(f32)/(1 << 20)
+              << " MB of weights, batch 1, one thread per node" << std::endl;
+    std::cout << "  policy               inferences/s  placed (MB)  local pages %    per node/s" << std::endl;
+
+    Numa_Network* numa = numa_network_create(&network, topology, Numa_Policy_None);
+    bench_numa_run(numa, width, seconds, 0, "none");
+    numa_network_destroy(numa);
+
+    numa = numa_network_create(&network, topology, Numa_Policy_Interleave);
+    bench_numa_run(numa, width, seconds, 0, "interleave");
+    numa_network_destroy(numa);
+
+    numa = numa_network_create(&network, topology, Numa_Policy_Replicate);
+    bench_numa_run(numa, width, seconds, 0, "replicate, local");
+    if (topology.num_nodes > 1) bench_numa_run(numa, width, seconds, 1, "replicate, remote");
+    numa_network_destroy(numa);
+
+    network_destroy(network);
+    return 0;
+}
@@ -0,0 +1,118 @@
+#include "bench.h"
+#include "pipeline.h"
+#include "thread_pool.h"
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+
+static void bench_pipeline_init_weights(Tensor& weights) {
+    tensor_init_random(weights);
+    f32 limit = sqrtf(6.0f/weights.shape[0]);
+    for (u32 i = 0; i < weights.length; i++) {
+        weights.data[i] = (2.0f*weights.data[i] - 1.0f)*limit;
+    }
+}
+
+
+/**
+ * Streams inputs through a deep mlp one after the other on the calling
+ * thread (with and without the thread pool) and through pipelines with an
+ * increasing number of stages, every output is checked against the
+ * sequential one.
+ */
+int bench_pipeline(int argc, char** argv) {
+    u32 width = 1024;
+    u32 depth = 8;
+    u32 batch = 1;
+    u32 count = 2000;
+    u32 max_stages = std::max(std::thread::hardware_concurrency(), 1u);
+    Pipeline_Config config;
+    for (int i = 0; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "--width") == 0) width = (u32) atoi(argv[++i]);
+        else if (strcmp(argv[i], "--depth") == 0) depth = (u32) atoi(argv[++i]);
+        else if (strcmp(argv[i], "--batch") == 0) batch = (u32) atoi(argv[++i]);
+        else if (strcmp(argv[i], "--count") == 0) count = (u32) atoi(argv[++i]);
+        else if (strcmp(argv[i], "--stages") == 0) max_stages = (u32) atoi(argv[++i]);
+        else if (strcmp(argv[i], "--ring") == 0) config.ring_capacity = (u32) atoi(argv[++i]);
+    }
+
+    // Layers of different widths, so balancing is more than splitting evenly.
+    Network network;
+    for (u32 i = 0; i < depth; i++) {
+        u32 inputs = i % 3 == 1 ? 2*width : width;
+        u32 outputs = (i + 1) % 3 == 1 ? 2*width : width;
+        if (i + 1 == depth) outputs = 10;
+        network.layers.push_back(dense_layer(inputs, outputs, bench_pipeline_init_weights, tensor_init_random));
+        if (i + 1 < depth) network.layers.push_back(relu());
+    }
+    network_fuse_layers(network);
+
+    std::vector<Tensor> inputs(count);
+    std::vector<Tensor> expected(count);
+    for (u32 i = 0; i < count; i++) {
+        inputs[i] = tensor_create_2d(batch, width);
+        tensor_init_random(inputs[i]);
+    }
+
+    std::cout << "mlp " << depth << " layers of " << width << " and " << 2*width << ", batch " << batch
+              << ", " << count << " inputs, hardware threads " << std::thread::hardware_concurrency() << std::endl;
+    std::cout << std::fixed << std::setprecision(1);
+
+    u32 input_shape[] = { batch, width };
+    Execution_Plan* plan = plan_compile(&network, input_shape, 2);
+    for (u32 threads : { 1u, 0u }) {
+        thread_pool_set_num_threads(threads);
+        plan_forward(plan, &inputs[0]);
+        f64 start = bench_now();
+        for (u32 i = 0; i < count; i++) {
+            Tensor output = plan_forward(plan, &inputs[i]);
+            if (threads == 1) expected[i] = tensor_copy(output);
+        }
+        f64 time = bench_now() - start;
+        std::cout << "  sequential, threads " << std::setw(3) << thread_pool_num_threads() << ":  "
+                  << std::setw(9) << count/time << " inputs/s" << std::endl;
+    }
+    plan_destroy(plan);
+
+    Tensor output = tensor_create(expected[0].shape, expected[0].ndim);
+    max_stages = std::max(max_stages, 2u);
+    for (u32 stages = 2; ; stages *= 2) {
+        config.num_stages = std::min(stages, max_stages);
+        Pipeline* pipeline = pipeline_create(&network, input_shape, 2, config);
+
+        // One thread feeds the pipeline while this one takes the outputs.
+        f64 start = bench_now();
+        std::thread producer([&]() {
+            for (u32 i = 0; i < count; i++) pipeline_submit(pipeline, &inputs[i]);
+        });
+        f32 error = 0.0f;
+        for (u32 i = 0; i < count; i++) {
+            pipeline_receive(pipeline, &output);
+            for (u32 j = 0; j < output.length; j++) {
+                error = fmaxf(error, fabsf(output.data[j] - expected[i].data[j]));
+            }
+        }
+        f64 time = bench_now() - start;
+        producer.join();
+
+        std::cout << std::endl << "  pipeline, stages " << std::setw(3) << pipeline->stages.size() << ":  "
+                  << std::setw(9) << count/time << " inputs/s, max error " << std::scientific
+                  << std::setprecision(1) << error << std::fixed << std::endl;
+        std::cout << pipeline_stats(pipeline);
+        pipeline_destroy(pipeline);
+        if (config.num_stages == max_stages) break;
+    }
+
+    tensor_free(output);
+    for (u32 i = 0; i < count; i++) {
+        tensor_free(inputs[i]);
+        tensor_free(expected[i]);
+    }
+    network_destroy(network);
+    return 0;
+}
@@ -0,0 +1,92 @@
+#include "bench.h"
+#include "conv.h"
+#include "network.h"
+#include "profiler.h"
+#include "thread_pool.h"
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+
+
+/**
+ * Returns the average time of a forward pass in seconds.
+ */
+static f64 bench_profile_time(Network& network, Tensor& input, int iterations) {
+    f64 start = bench_now();
+    for (int i = 0; i < iterations; i++) {
+        Tensor output = network.forward(&input);
+        bench_do_not_optimize(output.data);
+    }
+    return (bench_now() - start)/iterations;
+}
+
+
+/**
+ * Profiles forward passes of a small image classifier, printing the
+ * per-layer and per-kernel summary and writing a Chrome trace to
+ * `--trace`. The time per pass is measured with the profiler switched
+ * off and on, the instrumentation needs the debug or profile build.
+ */
+int bench_profile(int argc, char** argv) {
+    u32 batch = 8;
+    u32 size = 32;
+    int iterations = 20;
+    const char* trace = "profile_trace.json";
+    for (int i = 0; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "--batch") == 0) batch = (u32) atoi(argv[++i]);
+        else if (strcmp(argv[i], "--size") == 0) size = (u32) atoi(argv[++i]);
+        else if (strcmp(argv[i], "--iterations") == 0) iterations = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--trace") == 0) trace = argv[++i];
+        else if (strcmp(argv[i], "--threads") == 0) thread_pool_set_num_threads((u32) atoi(argv[++i]));
+    }
+
+    u32 pooled = size/4;
+    Network network = sequential({
+        conv2d(3, 32, 3, 1, 1, tensor_init_random, tensor_init_zeros),
+        relu(),
+        max_pool(2, 2),
+        conv2d(32, 64, 3, 1, 1, tensor_init_random, tensor_init_zeros),
+        relu(),
+        avg_pool(2, 2),
+        flatten(),
+        dense_layer(64*pooled*pooled, 256, tensor_init_random, tensor_init_zeros),
+        relu(),
+        dense_layer(256, 10, tensor_init_random, tensor_init_zeros),
+        softmax(),
+    });
+
+    u32 input_shape[4] = { batch, size, size, 3 };
+    Tensor input = tensor_create(input_shape, 4);
+    tensor_init_random(input);
+
+    // Warm up the arena and let the convolutions pick their algorithms.
+    bench_profile_time(network, input, 3);
+    f64 disabled = bench_profile_time(network, input, iterations);
+
+    std::cout << "cnn " << size << "x" << size << "x3, batch " << batch << ", threads "
+              << thread_pool_num_threads() << std::endl;
+    std::cout << std::fixed << std::setprecision(3);
+    if (!profiler_set_enabled(true)) {
+        std::cout << "  profiler off     " << std::setw(9) << disabled*1e3 << " ms" << std::endl;
+        std::cout << "  profiling is not compiled into this build, use the debug or profile configuration" << std::endl;
+        tensor_free(input);
+        return 0;
+    }
+
+    profiler_reset();
+    f64 enabled = bench_profile_time(network, input, iterations);
+    profiler_set_enabled(false);
+
+    std::cout << "  profiler off     " << std::setw(9) << disabled*1e3 << " ms" << std::endl;
+    std::cout << "  profiler on      " << std::setw(9) << enabled*1e3 << " ms, overhead "
+              << std::setprecision(1) << 100.0*(enabled/disabled - 1.0) << "%" << std::endl;
+    std::cout << std::endl;
+    profiler_print_summary(std::cout);
+
+    if (profiler_write_trace(trace)) {
+        std::cout << std::endl << "trace written to `" << trace << "`" << std::endl;
+    }
+    tensor_free(input);
+    return 0;
+}
@@ -0,0 +1,140 @@
+#include "bench.h"
+#include "network.h"
+#include "quantize.h"
+#include "thread_pool.h"
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+
+/**
+ * Uniform weights in [-limit, limit] scaled by the number of inputs,
+ * so the activations keep roughly the same range through the layers.
+ */
+static void bench_init_weights(Tensor& weights) {
+    tensor_init_random(weights);
+    f32 limit = sqrtf(6.0f/weights.shape[0]);
+    for (u32 i = 0; i < weights.length; i++) {
+        weights.data[i] = (2.0f*weights.data[i] - 1.0f)*limit;
+    }
+}
+
+
+static void bench_init_bias(Tensor& bias) {
+    tensor_init_random(bias);
+    for (u32 i = 0; i < bias.length; i++) bias.data[i] = 0.1f*(bias.data[i] - 0.5f);
+}
+
+
+/**
+ * Returns the best time of a single forward pass in seconds.
+ */
+static f64 bench_quantize_time(Network& network, Tensor& input, int iterations) {
+    for (int i = 0; i < 3; i++) network.forward(&input);
+    f64 best = 1e30;
+    for (int i = 0; i < iterations; i++) {
+        f64 start = bench_now();
+        Tensor output = network.forward(&input);
+        f64 elapsed = bench_now() - start;
+        bench_do_not_optimize(output.data);
+        if (elapsed < best) best = elapsed;
+    }
+    return best;
+}
+
+
+/**
+ * Quantizes an MLP to int8 after calibrating it on random samples and
+ * reports the accuracy against the fp32 network on another set of samples
+ * (relative error and agreement of the highest output per sample)
+ * together with the forward latency of every int8 kernel and of fp32.
+ */
+int bench_quantize(int argc, char** argv) {
+    u32 width = 1024;
+    u32 depth = 4;
+    u32 batch = 32;
+    u32 calibration_size = 256;
+    int iterations = 50;
+    for (int i = 0; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "--width") == 0) width = (u32) atoi(argv[++i]);
+        else if (strcmp(argv[i], "--depth") == 0) depth = (u32) atoi(argv[++i]);
+        else if (strcmp(argv[i], "--batch") == 0) batch = (u32) atoi(argv[++i]);
+        else if (strcmp(argv[i], "--calibration") == 0) calibration_size = (u32) atoi(argv[++i]);
+        else if (strcmp(argv[i], "--iterations") == 0) iterations = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--threads") == 0) thread_pool_set_num_threads((u32) atoi(argv[++i]));
+    }
+
+    Network network;
+    for (u32 i = 0; i < depth; i++) {
+        network.layers.push_back(dense_layer(width, width, bench_init_weights, bench_init_bias));
+        if (i + 1 < depth) network.layers.push_back(relu());
+    }
+    network_fuse_layers(network);
+
+    Tensor calibration = tensor_create_2d(calibration_size, width);
+    Tensor input = tensor_create_2d(batch, width);
+    tensor_init_random(calibration);
+    tensor_init_random(input);
+
+    // Reference output and latency in fp32.
+    f64 fp32_time = bench_quantize_time(network, input, iterations);
+    Tensor output = network.forward(&input);
+    std::vector<f32> expected(output.data, output.data + output.length);
+
+    network_quantize(network, calibration);
+
+    u32 outputs = (u32) expected.size()/batch;
+    f64 flops = 2.0*width*width*depth*batch;
+    std::cout << "mlp " << depth << "x" << width << ", batch " << batch
+              << ", calibrated on " << calibration_size << " samples, threads "
+              << thread_pool_num_threads() << std::endl;
+    std::cout << "  weights: " << (u64) depth*width*width*sizeof(f32)/1024 << " KiB fp32, "
+              << (u64) depth*width*((width + QUANTIZE_K_ALIGNMENT - 1)/QUANTIZE_K_ALIGNMENT*QUANTIZE_K_ALIGNMENT)/1024
+              << " KiB int8" << std::endl;
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "  " << std::left << std::setw(8) << "fp32" << std::right
+              << std::setw(10) << fp32_time*1e3 << " ms " << std::setw(8) << flops/fp32_time*1e-9
+              << " GFLOP/s" << std::endl;
+
+    Gemm_S8_Kernel_Type types[] = { Gemm_S8_Kernel_Scalar, Gemm_S8_Kernel_AVX2, Gemm_S8_Kernel_VNNI };
+    for (Gemm_S8_Kernel_Type type : types) {
+        if (!gemm_s8_set_kernel(type)) continue;
+        f64 time = bench_quantize_time(network, input, iterations);
+        Tensor quantized = network.forward(&input);
+
+        f64 error = 0.0, norm = 0.0, max_error = 0.0;
+        for (u32 i = 0; i < quantized.length; i++) {
+            f64 difference = quantized.data[i] - expected[i];
+            error += difference*difference;
+            norm += (f64) expected[i]*expected[i];
+            max_error = fmax(max_error, fabs(difference));
+        }
+
+        // Outputs of a sample are a column, element (s, o) is at o*batch + s.
+        u32 agree = 0;
+        for (u32 s = 0; s < batch; s++) {
+            u32 best_expected = 0, best_quantized = 0;
+            for (u32 o = 1; o < outputs; o++) {
+                if (expected[o*batch + s] > expected[best_expected*batch + s]) best_expected = o;
+                if (quantized.data[o*batch + s] > quantized.data[best_quantized*batch + s]) best_quantized = o;
+            }
+            if (best_expected == best_quantized) agree++;
+        }
+
+        std::cout << "  " << std::left << std::setw(8) << gemm_s8_kernel_name() << std::right
+                  << std::setw(10) << time*1e3 << " ms " << std::setw(8) << flops/time*1e-9
+                  << " GOP/s  speedup " << std::setprecision(2) << fp32_time/time
+                  << "x  relative error " << std::scientific << sqrt(error/norm)
+                  << "  max error " << max_error << std::fixed << std::setprecision(3)
+                  << "  top-1 agreement " << 100.0*agree/batch << "%" << std::endl;
+    }
+    gemm_s8_set_kernel(Gemm_S8_Kernel_Auto);
+
+    tensor_free(calibration);
+    tensor_free(input);
+    network_destroy(network);
+    return 0;
+}
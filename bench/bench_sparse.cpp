@@ -0,0 +1,176 @@
+#include "bench.h"
+#include "network.h"
+#include "sparse.h"
+#include "thread_pool.h"
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+
+/**
+ * Returns the best time of a single call in seconds.
+ */
+template <typename Function>
+static f64 bench_sparse_time(int iterations, Function&& function) {
+    function();
+    f64 best = 1e30;
+    for (int i = 0; i < iterations; i++) {
+        f64 start = bench_now();
+        function();
+        best = fmin(best, bench_now() - start);
+    }
+    return best;
+}
+
+
+/**
+ * Uniform weights in [-limit, limit] scaled by the number of inputs.
+ */
+static void bench_sparse_init_weights(Tensor& weights) {
+    tensor_init_random(weights);
+    f32 limit = sqrtf(6.0f/weights.shape[0]);
+    for (u32 i = 0; i < weights.length; i++) {
+        weights.data[i] = (2.0f*weights.data[i] - 1.0f)*limit;
+    }
+}
+
+
+static f32 bench_sparse_max_error(Tensor& output, Tensor& expected) {
+    f32 error = 0.0f, scale = 0.0f;
+    for (u32 i = 0; i < output.length; i++) {
+        error = fmaxf(error, fabsf(output.data[i] - expected.data[i]));
+        scale = fmaxf(scale, fabsf(expected.data[i]));
+    }
+    return scale > 0.0f ? error/scale : error;
+}
+
+
+/**
+ * Times one pruned layer dense, as CSR (pruned per weight) and block-sparse
+ * (pruned per 4 x 8 block) at the same sparsity.
+ */
+static void bench_sparse_layer(u32 inputs, u32 outputs, u32 batch, f32 sparsity, int iterations) {
+    Dense_Layer* csr_dense = dense_layer(inputs, outputs, bench_sparse_init_weights, tensor_init_random);
+    Dense_Layer* block_dense = dense_layer(inputs, outputs, bench_sparse_init_weights, tensor_init_random);
+    tensor_copy_into(block_dense->weights, csr_dense->weights);
+    tensor_copy_into(block_dense->bias, csr_dense->bias);
+    sparse_prune(csr_dense->weights, sparsity);
+    sparse_prune(block_dense->weights, sparsity, SPARSE_BLOCK_ROWS, SPARSE_BLOCK_COLS);
+    Sparse_Dense_Layer* csr = sparse_dense_layer(csr_dense, Sparse_Format_CSR, Gemm_Activation_ReLU);
+    Sparse_Dense_Layer* block = sparse_dense_layer(block_dense, Sparse_Format_Block, Gemm_Activation_ReLU);
+
+    Tensor input = tensor_create_2d(batch, inputs);
+    Tensor expected = tensor_create_2d(batch, outputs);
+    Tensor output = tensor_create_2d(batch, outputs);
+    tensor_init_random(input);
+
+    f64 dense_time = bench_sparse_time(iterations, [&]() {
+        tensor_dense_into(output, csr_dense->weights, input, csr_dense->bias, Gemm_Activation_ReLU);
+    });
+    tensor_copy_into(expected, output);
+    f64 csr_time = bench_sparse_time(iterations, [&]() { csr->forward_into(&input, &output); });
+    f32 csr_error = bench_sparse_max_error(output, expected);
+
+    tensor_dense_into(expected, block_dense->weights, input, block_dense->bias, Gemm_Activation_ReLU);
+    f64 block_time = bench_sparse_time(iterations, [&]() { block->forward_into(&input, &output); });
+    f32 block_error = bench_sparse_max_error(output, expected);
+
+    f64 dense_mb = sizeof(f32)*(f64) inputs*outputs/(1 << 20);
+    std::cout << "  " << std::setw(5) << (int) (100*sparsity + 0.5f) << "%" << std::setw(6) << batch
+              << std::setprecision(1) << std::setw(10) << dense_time*1e6
+              << std::setw(10) << csr_time*1e6 << std::setw(6) << std::setprecision(2) << dense_time/csr_time << "x"
+              << std::setprecision(1) << std::setw(10) << block_time*1e6 << std::setw(6) << std::setprecision(2)
+              << dense_time/block_time << "x" << std::setw(9) << dense_mb
+              << std::setw(9) << sparse_bytes(csr->weights)/(f64) (1 << 20)
+              << std::setw(9) << sparse_bytes(block->weights)/(f64) (1 << 20)
+              << std::scientific << std::setprecision(1) << std::setw(10) << std::max(csr_error, block_error)
+              << std::fixed << std::endl;
+
+    tensor_free(input);
+    tensor_free(expected);
+    tensor_free(output);
+    delete csr;
+    delete block;
+    layer_destroy(csr_dense);
+    layer_destroy(block_dense);
+}
+
+
+/**
+ * Pruned dense layers as sparse CSR and block-sparse matrices at increasing
+ * sparsity, single samples (SpMV) and batches (SpMM), then an MLP pruned to
+ * 90% converted by `network_sparsify` with the format picked per layer.
+ */
+int bench_sparse(int argc, char** argv) {
+    u32 width = 1024;
+    u32 batch = 32;
+    int iterations = 20;
+    for (int i = 0; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "--width") == 0) width = (u32) atoi(argv[++i]);
+        else if (strcmp(argv[i], "--batch") == 0) batch = (u32) atoi(argv[++i]);
+        else if (strcmp(argv[i], "--iterations") == 0) iterations = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--kernel") == 0) {
+            if (!sparse_set_kernel(strcmp(argv[++i], "scalar") == 0 ? Sparse_Kernel_Scalar : Sparse_Kernel_AVX2)) {
+                std::cerr << "error: sparse kernel " << argv[i] << " is not supported on this cpu" << std::endl;
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--threads") == 0) thread_pool_set_num_threads((u32) atoi(argv[++i]));
+    }
+
+    std::cout << "dense " << width << "x" << width << " + relu, sparse kernels " << sparse_kernel_name()
+              << ", threads " << thread_pool_num_threads() << std::endl;
+    std::cout << "  sparsity batch  dense us    csr us           block us         dense MB   csr MB block MB  rel error"
+              << std::endl;
+    std::cout << std::fixed;
+    for (u32 samples : { 1u, batch }) {
+        for (f32 sparsity : { 0.5f, 0.8f, 0.9f, 0.95f, 0.99f }) {
+            bench_sparse_layer(width, width, samples, sparsity, iterations);
+        }
+    }
+
+    // Magnitude pruning of every layer of an MLP, network_sparsify measures each one.
+    Network network;
+    const u32 depth = 4;
+    for (u32 i = 0; i < depth; i++) {
+        Dense_Layer* dense = dense_layer(width, i + 1 < depth ? width : 10, bench_sparse_init_weights, tensor_init_random);
+        sparse_prune(dense->weights, i == 0 ? 0.3f : 0.9f, i % 2 ? SPARSE_BLOCK_ROWS : 1, i % 2 ? SPARSE_BLOCK_COLS : 1);
+        network.layers.push_back(dense);
+        if (i + 1 < depth) network.layers.push_back(relu());
+    }
+    network_fuse_layers(network);
+    Tensor input = tensor_create_2d(batch, width);
+    tensor_init_random(input);
+    Tensor reference = network.forward(&input);
+    Tensor expected = tensor_copy(reference);
+    f64 dense_time = bench_sparse_time(iterations, [&]() { bench_do_not_optimize(network.forward(&input).data); });
+
+    u32 replaced = network_sparsify(network, batch);
+    Tensor output = network.forward(&input);
+    f32 error = bench_sparse_max_error(output, expected);
+    f64 sparse_time = bench_sparse_time(iterations, [&]() { bench_do_not_optimize(network.forward(&input).data); });
+
+    std::cout << std::endl << "mlp " << width << " x " << depth << " pruned 30/90/90/90%, batch " << batch << std::endl;
+    for (u32 i = 0; i < network.layers.size(); i++) {
+        Layer* layer = network.layers[i];
+        std::cout << "  [" << i << "] " << layer_type_name(layer->type());
+        if (layer->type() == Layer_Type_Sparse_Dense) {
+            Sparse_Matrix& weights = ((Sparse_Dense_Layer*) layer)->weights;
+            std::cout << (weights.format == Sparse_Format_CSR ? " csr" : " block") << ", "
+                      << std::setprecision(1) << 100.0*sparse_stored_values(weights)/((f64) weights.rows*weights.cols)
+                      << "% stored";
+        }
+        std::cout << std::endl;
+    }
+    std::cout << "  " << replaced << " layers sparse, forward " << std::setprecision(1) << dense_time*1e6 << " us -> "
+              << sparse_time*1e6 << " us (" << std::setprecision(2) << dense_time/sparse_time << "x), rel error "
+              << std::scientific << std::setprecision(1) << error << std::fixed << std::endl;
+
+    tensor_free(input);
+    tensor_free(expected);
+    network_destroy(network);
+    return 0;
+}
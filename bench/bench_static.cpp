@@ -0,0 +1,145 @@
+#include "bench.h"
+#include "memory.h"
+#include "network.h"
+#include "plan.h"
+#include "static_network.h"
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+
+
+/**
+ * Returns the best time of `iterations` calls in nanoseconds per call.
+ */
+template <typename Function>
+static f64 bench_static_time(int iterations, Function&& function) {
+    f64 best = 1e30;
+    for (int round = 0; round < 5; round++) {
+        f64 start = bench_now();
+        for (int i = 0; i < iterations; i++) function();
+        best = fmin(best, (bench_now() - start)/iterations*1e9);
+    }
+    return best;
+}
+
+
+/**
+ * Forward pass of a static model through a function pointer, so the
+ * compiler can't hoist the computation out of the timing loop.
+ */
+template <u32 N, typename Model>
+static void bench_static_forward(const Model* model, const Static_Tensor<N, Model::inputs>* input,
+                                 Static_Tensor<N, Model::outputs>* output) {
+    model->forward(*input, *output);
+}
+
+
+/**
+ * Runs the same MLP (dense layers with ReLU in between) as a dynamic network
+ * with fused layers, as an execution plan and as a static network of dense
+ * layers with fused ReLU, checking that the outputs agree and reporting the
+ * time and the allocations per pass.
+ */
+template <u32 N, typename Model>
+static void bench_static_model(const char* name, const u32* sizes, u32 num_layers, int iterations) {
+    Network network;
+    for (u32 i = 0; i < num_layers; i++) {
+        network.layers.push_back(dense_layer(sizes[i], sizes[i + 1], tensor_init_random, tensor_init_random));
+        if (i + 1 < num_layers) network.layers.push_back(relu());
+    }
+    network_fuse_layers(network);
+
+    // Fusing left one dense layer per static layer.
+    Model* model = new Model;
+    u32 index = 0;
+    std::apply([&](auto&... layers) {
+        auto load = [&](auto& layer) {
+            Layer* dynamic = network.layers[index++];
+            Dense_Layer* dense = dynamic->type() == Layer_Type_Fused_Dense
+                ? ((Fused_Dense_Layer*) dynamic)->dense : (Dense_Layer*) dynamic;
+            static_dense_load(layer, dense->weights, dense->bias);
+        };
+        (load(layers), ...);
+    }, model->layers);
+
+    Static_Tensor<N, Model::inputs> input;
+    Static_Tensor<N, Model::outputs> output;
+    Tensor dynamic_input = tensor_create_2d(N, Model::inputs);
+    tensor_init_random(dynamic_input);
+    static_copy_from(input, dynamic_input);
+    Execution_Plan* plan = plan_compile(&network, dynamic_input.shape, dynamic_input.ndim);
+
+    Tensor expected = network.forward(&dynamic_input);
+    model->forward(input, output);
+    f32 max_error = 0.0f, max_value = 0.0f;
+    for (u32 i = 0; i < output.length; i++) {
+        max_error = fmaxf(max_error, fabsf(output.data[i] - expected.data[i]));
+        max_value = fmaxf(max_value, fabsf(expected.data[i]));
+    }
+
+    Memory_Stats before = memory_stats();
+    f64 dynamic_time = bench_static_time(iterations, [&]() {
+        Tensor result = network.forward(&dynamic_input);
+        bench_do_not_optimize(result.data);
+    });
+    f64 plan_time = bench_static_time(iterations, [&]() {
+        Tensor result = plan_forward(plan, &dynamic_input);
+        bench_do_not_optimize(result.data);
+    });
+    Memory_Stats middle = memory_stats();
+    auto (*volatile forward)(const Model*, const Static_Tensor<N, Model::inputs>*,
+                             Static_Tensor<N, Model::outputs>*) = bench_static_forward<N, Model>;
+    f64 static_time = bench_static_time(iterations, [&]() {
+        forward(model, &input, &output);
+        bench_do_not_optimize(output.data);
+    });
+    Memory_Stats after = memory_stats();
+
+    u64 dynamic_allocations = middle.arena_allocations - before.arena_allocations;
+    u64 static_allocations = after.arena_allocations - middle.arena_allocations +
+                             after.heap_allocations - middle.heap_allocations;
+    std::cout << "  " << std::left << std::setw(18) << name << std::right << " batch " << std::setw(2) << N
+              << std::setw(10) << dynamic_time << " ns" << std::setw(10) << plan_time << " ns"
+              << std::setw(10) << static_time << " ns  speedup " << std::setprecision(2)
+              << std::setw(5) << dynamic_time/static_time << "x (plan " << plan_time/static_time
+              << "x)  allocations " << dynamic_allocations/(5*iterations) << " / " << static_allocations
+              << "  relative error " << std::scientific << std::setprecision(1) << max_error/max_value
+              << std::fixed << std::setprecision(1) << std::endl;
+
+    plan_destroy(plan);
+    tensor_free(dynamic_input);
+    delete model;
+}
+
+
+/**
+ * Small fixed-architecture MLPs run dynamically and with the shapes
+ * compiled in, in nanoseconds per forward pass.
+ */
+int bench_static(int argc, char** argv) {
+    int iterations = 100000;
+    for (int i = 0; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "--iterations") == 0) iterations = atoi(argv[++i]);
+    }
+
+    std::cout << "forward pass        dynamic (fused)       plan      static" << std::endl;
+    std::cout << std::fixed << std::setprecision(1);
+
+    const u32 tiny[] = { 3, 2 };
+    bench_static_model<1, Static_Sequential<Static_Dense<3, 2, Gemm_Activation_None>>>("3 -> 2", tiny, 1, iterations);
+    bench_static_model<8, Static_Sequential<Static_Dense<3, 2, Gemm_Activation_None>>>("3 -> 2", tiny, 1, iterations);
+
+    const u32 small[] = { 16, 32, 4 };
+    typedef Static_Sequential<Static_Dense<16, 32, Gemm_Activation_ReLU>, Static_Dense<32, 4>> Small;
+    bench_static_model<1, Small>("16 -> 32 -> 4", small, 2, iterations);
+    bench_static_model<8, Small>("16 -> 32 -> 4", small, 2, iterations);
+
+    const u32 medium[] = { 64, 64, 64, 10 };
+    typedef Static_Sequential<Static_Dense<64, 64, Gemm_Activation_ReLU>,
+                              Static_Dense<64, 64, Gemm_Activation_ReLU>, Static_Dense<64, 10>> Medium;
+    bench_static_model<1, Medium>("64 -> 64 -> 64 -> 10", medium, 3, iterations/10);
+    bench_static_model<8, Medium>("64 -> 64 -> 64 -> 10", medium, 3, iterations/10);
+    return 0;
+}
@@ -0,0 +1,416 @@
+#include "bench.h"
+#include "gemm.h"
+#include "network.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+/**
+ * Single measured operation, `work` is the number of floating point
+ * operations or bytes moved per call, depending on the unit.
+ */
+struct Suite_Case {
+    std::string name;
+    f64 work;
+    const char* unit;
+    std::function<void()> run;
+};
+
+
+/**
+ * Statistics of the time of a single call over the repetitions, in seconds.
+ */
+struct Suite_Result {
+    std::string name;
+    u32 threads;
+    u64 iterations;
+    u32 repetitions;
+    f64 min;
+    f64 median;
+    f64 mean;
+    f64 stddev;
+    f64 throughput;
+    const char* unit;
+};
+
+
+struct Suite_Options {
+    f64 warmup_time = 0.05;
+    f64 min_time = 0.02;
+    u32 repetitions = 10;
+    const char* filter = nullptr;
+    bool pin_threads = true;
+};
+
+
+/**
+ * Warms the case up for `warmup_time` and uses the observed speed to pick
+ * the number of calls per repetition, so every repetition takes at least
+ * `min_time`. The repetitions give the spread of the timings.
+ */
+static Suite_Result suite_measure(const Suite_Options& options, Suite_Case& test) {
+    u64 warmup_calls = 0;
+    f64 start = bench_now();
+    f64 elapsed;
+    do {
+        test.run();
+        warmup_calls++;
+        elapsed = bench_now() - start;
+    } while (elapsed < options.warmup_time || warmup_calls < 2);
+    u64 iterations = (u64) ceil(options.min_time/(elapsed/warmup_calls));
+    iterations = std::max<u64>(iterations, 1);
+
+    std::vector<f64> samples(options.repetitions);
+    for (u32 r = 0; r < options.repetitions; r++) {
+        f64 begin = bench_now();
+        for (u64 i = 0; i < iterations; i++) test.run();
+        samples[r] = (bench_now() - begin)/iterations;
+    }
+    std::sort(samples.begin(), samples.end());
+
+    Suite_Result result;
+    result.name = test.name;
+    result.threads = thread_pool_num_threads();
+    result.iterations = iterations;
+    result.repetitions = options.repetitions;
+    result.min = samples.front();
+    u32 n = options.repetitions;
+    result.median = n % 2 ? samples[n/2] : 0.5*(samples[n/2 - 1] + samples[n/2]);
+    result.mean = 0.0;
+    for (f64 sample : samples) result.mean += sample;
+    result.mean /= n;
+    result.stddev = 0.0;
+    for (f64 sample : samples) result.stddev += (sample - result.mean)*(sample - result.mean);
+    result.stddev = n > 1 ? sqrt(result.stddev/(n - 1)) : 0.0;
+    result.throughput = test.work/result.median*1e-9;
+    result.unit = test.unit;
+    return result;
+}
+
+
+static const char* suite_size_name(u32 length) {
+    static char buffer[16];
+    if (length % (1 << 20) == 0) snprintf(buffer, sizeof(buffer), "%uM", length >> 20);
+    else if (length % (1 << 10) == 0) snprintf(buffer, sizeof(buffer), "%uK", length >> 10);
+    else snprintf(buffer, sizeof(buffer), "%u", length);
+    return buffer;
+}
+
+
+static const char* suite_build_name() {
+#if defined(DEBUG)
+    return "debug";
+#elif defined(PROFILE)
+    return "profile";
+#else
+    return "release";
+#endif
+}
+
+
+/**
+ * Writes the results with one result per line,
+ * which is also what the compare mode expects.
+ */
+static bool suite_write_json(const char* path, const std::vector<Suite_Result>& results) {
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        std::cerr << "error: failed to open `" << path << "` for writing" << std::endl;
+        return false;
+    }
+    fprintf(file, "{\n\"build\": \"%s\", \"gemm_kernel\": \"%s\", \"hardware_threads\": %u,\n\"results\": [\n",
+            suite_build_name(), gemm_kernel_name(), std::thread::hardware_concurrency());
+    for (u64 i = 0; i < results.size(); i++) {
+        const Suite_Result& result = results[i];
+        fprintf(file, "{\"name\": \"%s\", \"threads\": %u, \"iterations\": %llu, \"repetitions\": %u, "
+                      "\"min_ns\": %.1f, \"median_ns\": %.1f, \"mean_ns\": %.1f, \"stddev_ns\": %.1f, "
+                      "\"throughput\": %.3f, \"unit\": \"%s\"}%s\n",
+                result.name.c_str(), result.threads, (unsigned long long) result.iterations,
+                result.repetitions, result.min*1e9, result.median*1e9, result.mean*1e9,
+                result.stddev*1e9, result.throughput, result.unit, i + 1 < results.size() ? "," : "");
+    }
+    fprintf(file, "]\n}\n");
+    bool ok = !ferror(file);
+    if (fclose(file) != 0 || !ok) {
+        std::cerr << "error: failed to write `" << path << "`" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+
+static bool suite_json_string(const std::string& line, const char* key, std::string* value) {
+    std::string pattern = std::string("\"") + key + "\": \"";
+    size_t begin = line.find(pattern);
+    if (begin == std::string::npos) return false;
+    begin += pattern.size();
+    size_t end = line.find('"', begin);
+    if (end == std::string::npos) return false;
+    *value = line.substr(begin, end - begin);
+    return true;
+}
+
+
+static bool suite_json_number(const std::string& line, const char* key, f64* value) {
+    std::string pattern = std::string("\"") + key + "\": ";
+    size_t begin = line.find(pattern);
+    if (begin == std::string::npos) return false;
+    *value = strtod(line.c_str() + begin + pattern.size(), nullptr);
+    return true;
+}
+
+
+/**
+ * Reads the results of a file written by `suite_write_json`.
+ */
+static bool suite_read_json(const char* path, std::vector<Suite_Result>& results, std::string* build) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        std::cerr << "error: failed to open baseline `" << path << "`" << std::endl;
+        return false;
+    }
+    std::string line;
+    char buffer[1024];
+    while (fgets(buffer, sizeof(buffer), file)) {
+        line += buffer;
+        if (line.back() != '\n' && !feof(file)) continue;
+
+        suite_json_string(line, "build", build);
+        Suite_Result result = {};
+        f64 threads, median, mean, stddev;
+        if (suite_json_string(line, "name", &result.name) && suite_json_number(line, "threads", &threads) &&
+            suite_json_number(line, "median_ns", &median) && suite_json_number(line, "mean_ns", &mean) &&
+            suite_json_number(line, "stddev_ns", &stddev)) {
+            result.threads = (u32) threads;
+            result.median = median*1e-9;
+            result.mean = mean*1e-9;
+            result.stddev = stddev*1e-9;
+            results.push_back(result);
+        }
+        line.clear();
+    }
+    fclose(file);
+    if (results.empty()) {
+        std::cerr << "error: no results in baseline `" << path << "`" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+
+/**
+ * Compares the medians against the baseline, a case regressed if it got
+ * slower by more than the tolerance and more than twice the combined
+ * relative spread of both runs, so noisy cases need a larger change.
+ * Returns the number of regressions.
+ */
+static u32 suite_compare(const std::vector<Suite_Result>& results, const char* path, f64 tolerance) {
+    std::vector<Suite_Result> baseline;
+    std::string build;
+    if (!suite_read_json(path, baseline, &build)) return 1;
+    if (build != suite_build_name()) {
+        std::cout << "warning: the baseline is a " << build << " build, this is a "
+                  << suite_build_name() << " build" << std::endl;
+    }
+
+    u32 regressions = 0, improvements = 0, missing = 0;
+    std::cout << std::endl << "compared to `" << path << "` (tolerance " << std::setprecision(1)
+              << tolerance*100.0 << "%)" << std::endl;
+    for (const Suite_Result& result : results) {
+        const Suite_Result* base = nullptr;
+        for (const Suite_Result& candidate : baseline) {
+            if (candidate.name == result.name && candidate.threads == result.threads) base = &candidate;
+        }
+        if (!base) {
+            missing++;
+            continue;
+        }
+
+        f64 change = result.median/base->median - 1.0;
+        f64 noise = result.stddev/result.mean + base->stddev/base->mean;
+        f64 threshold = std::max(tolerance, 2.0*noise);
+        const char* verdict = nullptr;
+        if (change > threshold) {
+            verdict = "REGRESSION";
+            regressions++;
+        } else if (change < -threshold) {
+            verdict = "improvement";
+            improvements++;
+        }
+        if (verdict) {
+            std::cout << "  " << std::left << std::setw(24) << result.name << std::right << std::setw(3)
+                      << result.threads << "t " << std::setprecision(3) << std::setw(11) << base->median*1e6
+                      << " -> " << std::setw(11) << result.median*1e6 << " us " << std::showpos
+                      << std::setprecision(1) << std::setw(7) << change*100.0 << "%" << std::noshowpos
+                      << " (threshold " << threshold*100.0 << "%)  " << verdict << std::endl;
+        }
+    }
+    std::cout << "  " << regressions << " regressions, " << improvements << " improvements, "
+              << results.size() - regressions - improvements - missing << " unchanged";
+    if (missing > 0) std::cout << ", " << missing << " not in the baseline";
+    std::cout << std::endl;
+    return regressions;
+}
+
+
+/**
+ * Reproducible measurements of the tensor kernels (element-wise ops over
+ * L1, L2 and memory sized tensors, bias broadcast, softmax, matmul) and
+ * of MLP forward passes, for each thread count in `--threads` (a comma
+ * separated list, by default 1 and all hardware threads). Threads are
+ * pinned to CPUs unless `--no-pin` is given. `--json` writes the results,
+ * `--baseline` compares them against an earlier JSON file and fails if
+ * any case got slower than `--tolerance` (a fraction, 0.05 by default).
+ */
+int bench_suite(int argc, char** argv) {
+    Suite_Options options;
+    const char* json = nullptr;
+    const char* baseline = nullptr;
+    f64 tolerance = 0.05;
+    std::vector<u32> thread_counts;
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "--no-pin") == 0) options.pin_threads = false;
+        if (strcmp(argv[i], "--quick") == 0) {
+            options.warmup_time = 0.01;
+            options.min_time = 0.005;
+            options.repetitions = 5;
+        }
+        if (i + 1 >= argc) break;
+        if (strcmp(argv[i], "--json") == 0) json = argv[++i];
+        else if (strcmp(argv[i], "--baseline") == 0) baseline = argv[++i];
+        else if (strcmp(argv[i], "--tolerance") == 0) tolerance = atof(argv[++i]);
+        else if (strcmp(argv[i], "--filter") == 0) options.filter = argv[++i];
+        else if (strcmp(argv[i], "--repetitions") == 0) options.repetitions = (u32) std::max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--min-time") == 0) options.min_time = atof(argv[++i]);
+        else if (strcmp(argv[i], "--threads") == 0) {
+            for (char* token = strtok(argv[++i], ","); token; token = strtok(nullptr, ",")) {
+                thread_counts.push_back((u32) atoi(token));
+            }
+        }
+    }
+    if (thread_counts.empty()) {
+        thread_counts.push_back(1);
+        u32 hardware = std::thread::hardware_concurrency();
+        if (hardware > 1) thread_counts.push_back(hardware);
+    }
+
+    // Inputs of the element-wise ops, a few sizes fitting in L1, L2 and only in memory.
+    // Adding zeros and multiplying by ones keeps the values, so repeated calls never
+    // reach denormals. The exponent gets its own input, which settles at the clamp.
+    const u32 sizes[] = { 4 << 10, 256 << 10, 4 << 20 };
+    const u32 max_size = 4 << 20;
+    Tensor source = tensor_create_1d(max_size);
+    Tensor target = tensor_create_1d(max_size);
+    Tensor exponent = tensor_create_1d(max_size);
+    Tensor zeros = tensor_create_1d(max_size);
+    Tensor ones = tensor_create_1d(max_size);
+    tensor_init_random(source);
+    tensor_init_random(exponent);
+    tensor_init_zeros(zeros);
+    tensor_init_ones(ones);
+    std::vector<Tensor> tensors = { source, target, exponent, zeros, ones };
+
+    std::vector<Suite_Case> cases;
+    const u32 batch = 64;
+    for (u32 size : sizes) {
+        std::string suffix = std::string("/") + suite_size_name(size);
+        Tensor x = tensor_wrap(source.data, &size, 1);
+        Tensor y = tensor_wrap(target.data, &size, 1);
+        Tensor e = tensor_wrap(exponent.data, &size, 1);
+        Tensor z = tensor_wrap(zeros.data, &size, 1);
+        Tensor o = tensor_wrap(ones.data, &size, 1);
+        u32 batch_shape[2] = { batch, size/batch };
+        Tensor xb = tensor_wrap(source.data, batch_shape, 2);
+        Tensor bias = tensor_wrap(zeros.data, &batch_shape[1], 1);
+        f64 bytes = sizeof(float)*(f64) size;
+
+        cases.push_back({ "copy" + suffix, 2*bytes, "GB/s", [=]() mutable { tensor_copy_into(y, x); } });
+        cases.push_back({ "add" + suffix, 3*bytes, "GB/s", [=]() mutable { tensor_add(x, z); } });
+        cases.push_back({ "mul" + suffix, 3*bytes, "GB/s", [=]() mutable { tensor_mul(x, o); } });
+        cases.push_back({ "add_bias" + suffix, 2*bytes, "GB/s", [=]() mutable { tensor_add_bias(xb, bias); } });
+        cases.push_back({ "relu" + suffix, 2*bytes, "GB/s", [=]() mutable { f_relu(x); } });
+        cases.push_back({ "sigmoid" + suffix, 2*bytes, "GB/s", [=]() mutable { f_sigmoid(x); } });
+        cases.push_back({ "tanh" + suffix, 2*bytes, "GB/s", [=]() mutable { f_tanh(x); } });
+        cases.push_back({ "exp" + suffix, 2*bytes, "GB/s", [=]() mutable { f_exp(e); } });
+        cases.push_back({ "softmax" + suffix, 2*bytes, "GB/s", [=]() mutable { f_softmax(xb); } });
+    }
+
+    // Products are allocated from an arena that is reset on every call.
+    Memory_Arena arena;
+    for (u32 n : { 128u, 512u, 1024u }) {
+        Tensor lhs = tensor_create_2d(n, n);
+        Tensor rhs = tensor_create_2d(n, n);
+        tensor_init_random(lhs);
+        tensor_init_random(rhs);
+        tensors.push_back(lhs);
+        tensors.push_back(rhs);
+        Memory_Arena* products = &arena;
+        cases.push_back({ "matmul/" + std::to_string(n), 2.0*n*n*n, "GFLOP/s", [=]() mutable {
+            arena_reset(products);
+            Arena_Scope scope(products);
+            Tensor product = tensor_matmul(lhs, rhs);
+            bench_do_not_optimize(product.data);
+        } });
+    }
+
+    // End to end forward passes, 4 dense layers with ReLU.
+    for (u32 width : { 256u, 1024u }) {
+        Network* network = new Network;
+        for (u32 i = 0; i < 4; i++) {
+            network->layers.push_back(dense_layer(width, width, tensor_init_random, tensor_init_zeros));
+            network->layers.push_back(relu());
+        }
+        for (u32 samples : { 1u, 64u }) {
+            Tensor input = tensor_create_2d(samples, width);
+            tensor_init_random(input);
+            tensors.push_back(input);
+            std::string name = "mlp/" + std::to_string(width) + "x4/b" + std::to_string(samples);
+            cases.push_back({ name, 2.0*width*width*4*samples, "GFLOP/s", [=]() mutable {
+                Tensor output = network->forward(&input);
+                bench_do_not_optimize(output.data);
+            } });
+        }
+    }
+
+    std::cout << "suite, " << suite_build_name() << " build, gemm kernel " << gemm_kernel_name()
+              << ", " << options.repetitions << " repetitions of at least " << options.min_time*1e3
+              << " ms" << (options.pin_threads ? ", pinned threads" : "") << std::endl;
+    std::vector<Suite_Result> results;
+    for (u32 threads : thread_counts) {
+        thread_pool_set_num_threads(threads, options.pin_threads);
+        std::cout << std::endl << "threads " << thread_pool_num_threads() << std::endl;
+        std::cout << "  " << std::left << std::setw(24) << "name" << std::right << std::setw(13) << "median us"
+                  << std::setw(9) << "+- %" << std::setw(13) << "min us" << std::setw(12) << "throughput" << std::endl;
+        for (Suite_Case& test : cases) {
+            if (options.filter && test.name.find(options.filter) == std::string::npos) continue;
+            Suite_Result result = suite_measure(options, test);
+            results.push_back(result);
+            std::cout << "  " << std::left << std::setw(24) << result.name << std::right << std::fixed
+                      << std::setprecision(3) << std::setw(13) << result.median*1e6
+                      << std::setprecision(1) << std::setw(9) << 100.0*result.stddev/result.mean
+                      << std::setprecision(3) << std::setw(13) << result.min*1e6
+                      << std::setprecision(2) << std::setw(12) << result.throughput << " " << result.unit << std::endl;
+        }
+    }
+
+    for (Tensor& tensor : tensors) tensor_free(tensor);
+    arena_destroy(&arena);
+
+    if (json && suite_write_json(json, results)) {
+        std::cout << std::endl << "results written to `" << json << "`" << std::endl;
+    }
+    if (baseline && suite_compare(results, baseline, tolerance) > 0) {
+        return 1;
+    }
+    return 0;
+}
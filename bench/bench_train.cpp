@@ -0,0 +1,133 @@
+#include "bench.h"
+#include "memory.h"
+#include "network.h"
+#include "thread_pool.h"
+#include "train.h"
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+
+
+static void bench_init_weights(Tensor& weights) {
+    tensor_init_random(weights);
+    f32 limit = sqrtf(6.0f/weights.shape[0]);
+    for (u32 i = 0; i < weights.length; i++) {
+        weights.data[i] = (2.0f*weights.data[i] - 1.0f)*limit;
+    }
+}
+
+
+static void bench_init_bias(Tensor& bias) {
+    tensor_init_zeros(bias);
+}
+
+
+static Network bench_train_mlp(u32 inputs, u32 width, u32 outputs, u32 depth) {
+    Network network;
+    for (u32 i = 0; i < depth; i++) {
+        u32 in = i == 0 ? inputs : width;
+        u32 out = i + 1 == depth ? outputs : width;
+        network.layers.push_back(dense_layer(in, out, bench_init_weights, bench_init_bias));
+        if (i + 1 < depth) network.layers.push_back(relu());
+    }
+    return network;
+}
+
+
+/**
+ * Trains an MLP to fit a randomly initialized teacher network of the same
+ * shape (regression with MSE) and reports the training throughput in
+ * samples/s, the heap allocations of the steady state training step and
+ * the loss at the start and end. With `--frozen n` the first n dense layers
+ * are not trained, which skips the gradient GEMM of their weights.
+ */
+int bench_train(int argc, char** argv) {
+    u32 width = 512;
+    u32 depth = 4;
+    u32 batch = 64;
+    u32 frozen = 0;
+    int steps = 200;
+    f32 learning_rate = 0.0f;
+    Optimizer_Config config;
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "--adam") == 0) config.type = Optimizer_Adam;
+        else if (i + 1 >= argc) break;
+        else if (strcmp(argv[i], "--width") == 0) width = (u32) atoi(argv[++i]);
+        else if (strcmp(argv[i], "--depth") == 0) depth = (u32) atoi(argv[++i]);
+        else if (strcmp(argv[i], "--batch") == 0) batch = (u32) atoi(argv[++i]);
+        else if (strcmp(argv[i], "--frozen") == 0) frozen = (u32) atoi(argv[++i]);
+        else if (strcmp(argv[i], "--steps") == 0) steps = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--lr") == 0) learning_rate = (f32) atof(argv[++i]);
+        else if (strcmp(argv[i], "--threads") == 0) thread_pool_set_num_threads((u32) atoi(argv[++i]));
+    }
+    // The teacher outputs are not normalized, so plain SGD needs a smaller step.
+    if (learning_rate == 0.0f) learning_rate = config.type == Optimizer_Adam ? 1e-3f : 3e-3f;
+    config.learning_rate = learning_rate;
+
+    u32 inputs = width, outputs = 16;
+    Network teacher = bench_train_mlp(inputs, width, outputs, depth);
+    Network student = bench_train_mlp(inputs, width, outputs, depth);
+
+    u32 dense_layers = 0;
+    for (Layer* layer : student.layers) {
+        if (layer->type() != Layer_Type_Dense) continue;
+        if (dense_layers++ < frozen) layer->require_grad = false;
+    }
+
+    // A fixed set of batches so the loss is comparable between steps.
+    const u32 num_batches = 8;
+    Tensor input[num_batches], target[num_batches];
+    for (u32 b = 0; b < num_batches; b++) {
+        input[b] = tensor_create_2d(batch, inputs);
+        tensor_init_random(input[b]);
+        target[b] = tensor_create_2d(batch, outputs);
+        Tensor output = teacher.forward(&input[b]);
+        tensor_copy_into(target[b], output);
+    }
+
+    Optimizer* optimizer = optimizer_create(student, config);
+
+    // The first steps warm up the arena, after that nothing is allocated.
+    f32 first_loss = network_train_step(student, optimizer, input[0], target[0], Loss_MSE);
+    for (u32 b = 1; b < num_batches; b++) {
+        network_train_step(student, optimizer, input[b], target[b], Loss_MSE);
+    }
+
+    Memory_Stats before = memory_stats();
+    f64 start = bench_now();
+    f32 loss = 0.0f;
+    for (int i = 0; i < steps; i++) {
+        u32 b = i % num_batches;
+        loss = network_train_step(student, optimizer, input[b], target[b], Loss_MSE);
+    }
+    f64 elapsed = bench_now() - start;
+    Memory_Stats after = memory_stats();
+
+    f64 flops = 0.0;
+    dense_layers = 0;
+    for (Layer* layer : student.layers) {
+        if (layer->type() != Layer_Type_Dense) continue;
+        Dense_Layer* dense = (Dense_Layer*) layer;
+        f64 gemm = 2.0*dense->weights.length*batch;
+        // Forward, gradient of the input (except the first layer) and of the weights.
+        flops += gemm + (dense_layers > 0 ? gemm : 0.0) + (dense->require_grad ? gemm : 0.0);
+        dense_layers++;
+    }
+
+    std::cout << "mlp " << depth << "x" << width << ", batch " << batch << ", "
+              << (config.type == Optimizer_Adam ? "adam" : "sgd") << " lr " << config.learning_rate
+              << ", frozen " << frozen << ", threads " << thread_pool_num_threads() << std::endl;
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "  " << steps << " steps in " << elapsed*1e3 << " ms, "
+              << steps*batch/elapsed << " samples/s, " << elapsed/steps*1e6 << " us/step, "
+              << flops*steps/elapsed*1e-9 << " GFLOP/s" << std::endl;
+    std::cout << "  heap allocations per step: "
+              << (f64) (after.heap_allocations - before.heap_allocations)/steps << std::endl;
+    std::cout << std::scientific << std::setprecision(3);
+    std::cout << "  loss " << first_loss << " -> " << loss << std::endl;
+
+    optimizer_destroy(optimizer);
+    return 0;
+}
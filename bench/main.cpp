@@ -0,0 +1,58 @@
+#include "bench.h"
+#include <cstring>
+#include <iostream>
+
+
+struct Benchmark {
+    const char* name;
+    const char* description;
+    int (*run)(int argc, char** argv);
+};
+
+
+static Benchmark benchmarks[] = {
+    { "gemm", "blocked sgemm vs naive triple loop in GFLOP/s [--full] [--threads n]", bench_gemm },
+    { "forward", "mlp forward latency and steady state heap allocations [--fuse]", bench_forward },
+    { "batch", "batched forward and request coalescer throughput/latency", bench_batch },
+    { "elementwise", "vectorized element-wise kernels in GB/s and their accuracy", bench_elementwise },
+    { "quantize", "int8 quantized mlp accuracy and latency vs fp32 [--width n] [--batch n]", bench_quantize },
+    { "load", "model file save, mmap load and cold vs warm forward [--width n] [--depth n]", bench_load },
+    { "train", "mlp training throughput in samples/s [--adam] [--frozen n] [--batch n]", bench_train },
+    { "images", "image decode pipeline images/s and starvation [--dir path] [--workers n]", bench_images },
+    { "conv", "convolution algorithms per layer shape in GFLOP/s [--batch n]", bench_conv },
+    { "profile", "per-layer and per-kernel profile of a cnn with a chrome trace [--trace path]", bench_profile },
+    { "suite", "all kernels and mlp passes with statistics [--json path] [--baseline path]", bench_suite },
+    { "static", "small mlps with compile-time shapes vs dynamic and planned [--iterations n]", bench_static },
+    { "sparse", "pruned dense layers in csr and block format vs dense [--width n] [--batch n] [--kernel scalar]", bench_sparse },
+    { "half", "fp16 and bf16 weight conversion and dense layers vs fp32 [--width n] [--batch n]", bench_half },
+    { "pipeline", "layer-pipelined streaming across pinned cores with stage utilization [--stages n]", bench_pipeline },
+    { "cache", "content-addressed inference cache hit rate and speedup, exact and approximate [--unique n]", bench_cache },
+    { "numa", "local versus remote weight throughput per numa policy, one thread per node [--simulate n]", bench_numa },
+};
+
+
+static void print_usage(const char* program) {
+    std::cout << "usage: " << program << " <benchmark> [options]" << std::endl;
+    std::cout << "benchmarks:" << std::endl;
+    for (Benchmark& bench : benchmarks) {
+        std::cout << "  " << bench.name << "\t" << bench.description << std::endl;
+    }
+}
+
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    for (Benchmark& bench : benchmarks) {
+        if (strcmp(bench.name, argv[1]) == 0) {
+            return bench.run(argc - 2, argv + 2);
+        }
+    }
+
+    std::cerr << "error: unknown benchmark `" << argv[1] << "`" << std::endl;
+    print_usage(argv[0]);
+    return 1;
+}
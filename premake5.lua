@@ -3,7 +3,8 @@ workspace "ai-playground"
     configurations
     {
         "debug",
-        "release"
+        "release",
+        "profile"
     }
 
     outputdir = "%{cfg.buildcfg}"
@@ -60,12 +61,221 @@ project "playground"
         {
             "OS_LINUX"
         }
+
+        links
+        {
+            "pthread"
+        }
         
     filter "configurations:debug"
-        defines { "DEBUG" }
+        defines { "DEBUG", "PROFILE" }
         symbols "On"
     
 
     filter "configurations:release"
         defines { "NDEBUG" }
         optimize "On"
+
+    -- Release with the profiler instrumentation compiled in.
+    filter "configurations:profile"
+        defines { "NDEBUG", "PROFILE" }
+        optimize "On"
+
+    -- Kernels for specific instruction sets are compiled with those enabled,
+    -- the CPU features are checked at runtime before they get called.
+    filter { "files:src/*_avx2.cpp", "action:vs*" }
+        buildoptions { "/arch:AVX2" }
+
+    filter { "files:src/*_avx2.cpp", "action:not vs*" }
+        buildoptions { "-mavx2", "-mfma" }
+
+    filter { "files:src/*_avx512.cpp", "action:vs*" }
+        buildoptions { "/arch:AVX512" }
+
+    filter { "files:src/*_avx512.cpp", "action:not vs*" }
+        buildoptions { "-mavx512f", "-mfma" }
+
+    filter { "files:src/*_sse.cpp", "action:not vs*" }
+        buildoptions { "-msse4.1" }
+
+    filter { "files:src/*_vnni.cpp", "action:vs*" }
+        buildoptions { "/arch:AVX512" }
+
+    filter { "files:src/*_vnni.cpp", "action:not vs*" }
+        buildoptions { "-mavx512f", "-mavx512bw", "-mavx512vl", "-mavx512vnni" }
+
+    filter { "files:src/*_f16c.cpp", "action:vs*" }
+        buildoptions { "/arch:AVX2" }
+
+    filter { "files:src/*_f16c.cpp", "action:not vs*" }
+        buildoptions { "-mavx2", "-mfma", "-mf16c" }
+
+    filter { "files:src/*_bf16.cpp", "action:vs*" }
+        buildoptions { "/arch:AVX512" }
+
+    filter { "files:src/*_bf16.cpp", "action:not vs*" }
+        buildoptions { "-mavx512f", "-mavx512bw", "-mavx512vl", "-mavx512bf16" }
+
+    filter {}
+
+
+project "benchmark"
+    kind "ConsoleApp"
+    language "C++"
+
+    targetdir ("bin/" .. outputdir .. "/")
+    objdir ("bin-int/" .. outputdir .. "/benchmark/")
+
+    files
+    {
+        "src/**.h",
+        "src/**.cpp",
+        "bench/**.h",
+        "bench/**.cpp"
+    }
+
+    removefiles
+    {
+        "src/main.cpp"
+    }
+
+    includedirs
+    {
+         "src/",
+         "bench/",
+         "vendor/include/"
+    }
+
+    filter "system:windows"
+        cppdialect "C++17"
+        staticruntime "On"
+        systemversion "latest"
+        defines { "OS_WINDOWS" }
+
+    filter "system:macosx"
+        cppdialect "C++17"
+        staticruntime "On"
+        systemversion "latest"
+        defines { "OS_MACOS" }
+
+    filter "system:linux"
+        cppdialect "C++17"
+        staticruntime "On"
+        systemversion "latest"
+        defines { "OS_LINUX" }
+        links { "pthread" }
+
+    -- Benchmarks are always built with optimizations.
+    filter "configurations:debug"
+        defines { "DEBUG", "PROFILE" }
+        symbols "On"
+        optimize "Speed"
+
+    filter "configurations:release"
+        defines { "NDEBUG" }
+        optimize "Speed"
+
+    filter "configurations:profile"
+        defines { "NDEBUG", "PROFILE" }
+        optimize "Speed"
+
+    filter { "files:src/*_avx2.cpp", "action:vs*" }
+        buildoptions { "/arch:AVX2" }
+
+    filter { "files:src/*_avx2.cpp", "action:not vs*" }
+        buildoptions { "-mavx2", "-mfma" }
+
+    filter { "files:src/*_avx512.cpp", "action:vs*" }
+        buildoptions { "/arch:AVX512" }
+
+    filter { "files:src/*_avx512.cpp", "action:not vs*" }
+        buildoptions { "-mavx512f", "-mfma" }
+
+    filter { "files:src/*_sse.cpp", "action:not vs*" }
+        buildoptions { "-msse4.1" }
+
+    filter { "files:src/*_vnni.cpp", "action:vs*" }
+        buildoptions { "/arch:AVX512" }
+
+    filter { "files:src/*_vnni.cpp", "action:not vs*" }
+        buildoptions { "-mavx512f", "-mavx512bw", "-mavx512vl", "-mavx512vnni" }
+
+    filter { "files:src/*_f16c.cpp", "action:vs*" }
+        buildoptions { "/arch:AVX2" }
+
+    filter { "files:src/*_f16c.cpp", "action:not vs*" }
+        buildoptions { "-mavx2", "-mfma", "-mf16c" }
+
+    filter { "files:src/*_bf16.cpp", "action:vs*" }
+        buildoptions { "/arch:AVX512" }
+
+    filter { "files:src/*_bf16.cpp", "action:not vs*" }
+        buildoptions { "-mavx512f", "-mavx512bw", "-mavx512vl", "-mavx512bf16" }
+
+    filter {}
+
+
+project "server"
+    kind "ConsoleApp"
+    language "C++"
+
+    targetdir ("bin/" .. outputdir .. "/")
+    objdir ("bin-int/" .. outputdir .. "/server/")
+
+    files
+    {
+        "src/**.h",
+        "src/**.cpp",
+        "server/**.cpp"
+    }
+
+    removefiles
+    {
+        "src/main.cpp"
+    }
+
+    includedirs
+    {
+         "src/",
+         "vendor/include/"
+    }
+
+    -- The server needs epoll and unix domain sockets.
+    filter "system:linux"
+        cppdialect "C++17"
+        staticruntime "On"
+        systemversion "latest"
+        defines { "OS_LINUX" }
+        links { "pthread" }
+
+    filter "configurations:debug"
+        defines { "DEBUG", "PROFILE" }
+        symbols "On"
+
+    filter "configurations:release"
+        defines { "NDEBUG" }
+        optimize "Speed"
+
+    filter "configurations:profile"
+        defines { "NDEBUG", "PROFILE" }
+        optimize "Speed"
+
+    filter { "files:src/*_avx2.cpp", "action:not vs*" }
+        buildoptions { "-mavx2", "-mfma" }
+
+    filter { "files:src/*_avx512.cpp", "action:not vs*" }
+        buildoptions { "-mavx512f", "-mfma" }
+
+    filter { "files:src/*_sse.cpp", "action:not vs*" }
+        buildoptions { "-msse4.1" }
+
+    filter { "files:src/*_vnni.cpp", "action:not vs*" }
+        buildoptions { "-mavx512f", "-mavx512bw", "-mavx512vl", "-mavx512vnni" }
+
+    filter { "files:src/*_f16c.cpp", "action:not vs*" }
+        buildoptions { "-mavx2", "-mfma", "-mf16c" }
+
+    filter { "files:src/*_bf16.cpp", "action:not vs*" }
+        buildoptions { "-mavx512f", "-mavx512bw", "-mavx512vl", "-mavx512bf16" }
+
+    filter {}
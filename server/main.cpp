@@ -0,0 +1,399 @@
+#include "server.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+
+struct Command {
+    const char* name;
+    const char* description;
+    int (*run)(int argc, char** argv);
+};
+
+
+/**
+ * Layer sizes of the demo models, from the inputs to the outputs.
+ */
+struct Demo_Model {
+    const char* name;
+    u32 sizes[4];
+    u32 num_layers;
+};
+
+
+static const Demo_Model demo_models[] = {
+    { "small", { 64, 128, 10 }, 2 },
+    { "medium", { 256, 512, 512, 10 }, 3 },
+};
+
+
+static f64 server_main_now() {
+    using namespace std::chrono;
+    return duration<f64>(steady_clock::now().time_since_epoch()).count();
+}
+
+
+/**
+ * MLP with random weights, ReLU after every dense layer but the last.
+ */
+static Network* demo_network(const Demo_Model& demo) {
+    Network* network = new Network;
+    for (u32 i = 0; i < demo.num_layers; i++) {
+        network->layers.push_back(dense_layer(demo.sizes[i], demo.sizes[i + 1], tensor_init_random, tensor_init_random));
+        if (i + 1 < demo.num_layers) network->layers.push_back(relu());
+    }
+    network_fuse_layers(*network);
+    return network;
+}
+
+
+static Server* running_server = nullptr;
+
+
+static void on_signal(int) {
+    if (running_server) server_stop(running_server);
+}
+
+
+static void print_model_stats(const char* name, const Server_Model_Stats& stats) {
+    std::cout << "  " << std::left << std::setw(12) << name << std::right
+              << std::setw(10) << stats.requests << std::setw(10) << stats.rejected
+              << std::setw(12) << stats.throughput << std::setw(10) << stats.mean_batch_samples
+              << std::setw(10) << stats.p50_latency_ms << std::setw(10) << stats.p99_latency_ms << std::endl;
+}
+
+
+static void print_stats_header() {
+    std::cout << "  model         requests  rejected   request/s     batch   p50 ms    p99 ms" << std::endl;
+    std::cout << std::fixed << std::setprecision(3);
+}
+
+
+/**
+ * Runs the server until it gets SIGINT or SIGTERM, then prints the statistics of every model.
+ */
+static int command_serve(int argc, char** argv) {
+    Server_Config config;
+    u32 intra_threads = 1;
+    bool demo = false;
+    std::vector<std::pair<std::string, std::string>> files;
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "--demo") == 0) demo = true;
+        else if (i + 1 >= argc) break;
+        else if (strcmp(argv[i], "--socket") == 0) config.socket_path = argv[++i];
+        else if (strcmp(argv[i], "--workers") == 0) config.num_workers = (u32) atoi(argv[++i]);
+        else if (strcmp(argv[i], "--max-batch") == 0) config.max_batch_samples = (u32) atoi(argv[++i]);
+        else if (strcmp(argv[i], "--max-pending") == 0) config.max_pending = (u32) atoi(argv[++i]);
+        else if (strcmp(argv[i], "--threads") == 0) intra_threads = (u32) atoi(argv[++i]);
+        else if (strcmp(argv[i], "--numa") == 0) {
+            const char* policy = argv[++i];
+            if (strcmp(policy, "replicate") == 0) config.numa_policy = Numa_Policy_Replicate;
+            else if (strcmp(policy, "interleave") == 0) config.numa_policy = Numa_Policy_Interleave;
+            else if (strcmp(policy, "none") != 0) {
+                std::cerr << "error: expected --numa replicate|interleave|none, got `" << policy << "`" << std::endl;
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--model") == 0) {
+            // name=path
+            std::string spec = argv[++i];
+            size_t equals = spec.find('=');
+            if (equals == std::string::npos) {
+                std::cerr << "error: expected --model name=path, got `" << spec << "`" << std::endl;
+                return 1;
+            }
+            files.push_back({ spec.substr(0, equals), spec.substr(equals + 1) });
+        }
+    }
+
+    // Requests run in parallel on the workers, so by default every kernel stays on its worker.
+    thread_pool_set_num_threads(intra_threads);
+    Server* server = server_create(config);
+    for (auto& file : files) {
+        if (server_load_model(server, file.first.c_str(), file.second.c_str()) < 0) return 1;
+    }
+    std::vector<Network*> networks;
+    if (demo) {
+        for (const Demo_Model& model : demo_models) {
+            networks.push_back(demo_network(model));
+            server_add_model(server, model.name, networks.back());
+        }
+    }
+    if (server->models.empty()) {
+        std::cerr << "error: no models, pass --model name=path or --demo" << std::endl;
+        return 1;
+    }
+
+    std::cout << "serving on `" << config.socket_path << "` with " << server->config.num_workers << " workers";
+    if (config.numa_policy != Numa_Policy_None) std::cout << ", numa " << numa_policy_name(config.numa_policy);
+    std::cout << std::endl;
+    for (u32 i = 0; i < server->models.size(); i++) {
+        Server_Model* model = server->models[i];
+        std::cout << "  [" << i << "] " << model->name << " " << model->num_inputs << " -> " << model->num_outputs << std::endl;
+    }
+
+    running_server = server;
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    bool ok = server_run(server);
+    running_server = nullptr;
+
+    if (ok) {
+        std::cout << std::endl;
+        print_stats_header();
+        for (u32 i = 0; i < server->models.size(); i++) {
+            print_model_stats(server->models[i]->name.c_str(), server_stats(server, i));
+        }
+    }
+    server_destroy(server);
+    return ok ? 0 : 1;
+}
+
+
+/**
+ * Writes the demo models as model files, to be served with --model.
+ */
+static int command_demo_models(int argc, char** argv) {
+    std::string directory = argc > 0 ? argv[0] : ".";
+    for (const Demo_Model& model : demo_models) {
+        Network* network = demo_network(model);
+        std::string path = directory + "/" + model.name + ".model";
+        if (!model_save(*network, path.c_str())) return 1;
+        std::cout << "wrote `" << path << "`" << std::endl;
+    }
+    return 0;
+}
+
+
+/**
+ * Results of one load generator connection, per model.
+ */
+struct Load_Results {
+    std::vector<u64> completed;
+    std::vector<u64> rejected;
+    std::vector<u64> samples;
+    std::vector<std::vector<f32>> latencies;
+    bool failed = false;
+};
+
+
+struct Load_Config {
+    const char* socket_path;
+    std::vector<u32> models;
+    u32 depth;
+    u32 samples;
+    f64 duration;
+};
+
+
+/**
+ * Keeps `depth` requests in flight on one connection for the duration,
+ * cycling through the models, and records the latency of each request.
+ */
+static void load_connection_main(const Load_Config* config, const std::vector<Server_Model_Info>* infos,
+                                 u32 seed, Load_Results* results) {
+    u32 num_models = (u32) infos->size();
+    results->completed.assign(num_models, 0);
+    results->rejected.assign(num_models, 0);
+    results->samples.assign(num_models, 0);
+    results->latencies.assign(num_models, {});
+
+    int fd = server_connect(config->socket_path);
+    if (fd < 0) {
+        results->failed = true;
+        return;
+    }
+
+    std::mt19937 random(seed);
+    std::uniform_real_distribution<f32> uniform(-1.0f, 1.0f);
+    std::vector<std::vector<f32>> inputs(num_models);
+    for (u32 m : config->models) {
+        inputs[m].resize(config->samples*(*infos)[m].num_inputs);
+        for (f32& value : inputs[m]) value = uniform(random);
+    }
+
+    // The id of a request is the slot holding its send time.
+    std::vector<f64> send_times(config->depth);
+    u32 next_model = seed;
+    auto send_request = [&](u32 slot) {
+        u32 model = config->models[next_model++ % config->models.size()];
+        Server_Request request = {};
+        request.magic = SERVER_PROTOCOL_MAGIC;
+        request.op = Server_Op_Forward;
+        request.id = slot;
+        request.model = model;
+        request.num_samples = config->samples;
+        request.num_features = (*infos)[model].num_inputs;
+        send_times[slot] = server_main_now();
+        return server_send(fd, request, inputs[model].data());
+    };
+
+    f64 end = server_main_now() + config->duration;
+    u32 in_flight = 0;
+    for (u32 slot = 0; slot < config->depth; slot++, in_flight++) {
+        if (!send_request(slot)) results->failed = true;
+    }
+
+    Server_Response response;
+    std::vector<u8> payload;
+    while (in_flight > 0 && !results->failed) {
+        if (!server_receive(fd, &response, payload) || response.id >= config->depth) {
+            results->failed = true;
+            break;
+        }
+        in_flight--;
+        f64 now = server_main_now();
+        if (response.status == Server_Status_Ok) {
+            results->completed[response.model]++;
+            results->samples[response.model] += response.num_samples;
+            results->latencies[response.model].push_back((f32) ((now - send_times[response.id])*1e3));
+        } else if (response.status == Server_Status_Overloaded) {
+            results->rejected[response.model]++;
+        } else {
+            std::cerr << "error: request failed with status " << response.status << std::endl;
+            results->failed = true;
+            break;
+        }
+
+        if (now < end) {
+            if (!send_request(response.id)) results->failed = true;
+            in_flight++;
+        }
+    }
+    close(fd);
+}
+
+
+/**
+ * Load generator, closed loop: every connection keeps `--depth` requests
+ * of `--samples` samples each in flight for `--duration` seconds. Prints
+ * the throughput and latency seen by the clients and then by the server.
+ */
+static int command_load(int argc, char** argv) {
+    Load_Config config;
+    config.socket_path = Server_Config().socket_path;
+    config.depth = 4;
+    config.samples = 1;
+    config.duration = 5.0;
+    u32 connections = 8;
+    std::vector<std::string> names;
+    for (int i = 0; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "--socket") == 0) config.socket_path = argv[++i];
+        else if (strcmp(argv[i], "--connections") == 0) connections = (u32) atoi(argv[++i]);
+        else if (strcmp(argv[i], "--depth") == 0) config.depth = (u32) atoi(argv[++i]);
+        else if (strcmp(argv[i], "--samples") == 0) config.samples = (u32) atoi(argv[++i]);
+        else if (strcmp(argv[i], "--duration") == 0) config.duration = atof(argv[++i]);
+        else if (strcmp(argv[i], "--model") == 0) names.push_back(argv[++i]);
+    }
+    config.depth = std::max(config.depth, 1u);
+    config.samples = std::max(config.samples, 1u);
+
+    int fd = server_connect(config.socket_path);
+    std::vector<Server_Model_Info> infos;
+    if (fd < 0 || !server_list_models(fd, infos)) {
+        std::cerr << "error: cannot list the models of the server" << std::endl;
+        return 1;
+    }
+    for (u32 m = 0; m < infos.size(); m++) {
+        if (names.empty() || std::find(names.begin(), names.end(), infos[m].name) != names.end()) {
+            config.models.push_back(m);
+        }
+    }
+    if (config.models.empty()) {
+        std::cerr << "error: the server has none of the requested models" << std::endl;
+        return 1;
+    }
+
+    std::cout << connections << " connections, " << config.depth << " requests in flight each, "
+              << config.samples << " samples per request, " << config.duration << " s" << std::endl;
+    std::vector<Load_Results> results(connections);
+    std::vector<std::thread> threads;
+    f64 start = server_main_now();
+    for (u32 c = 0; c < connections; c++) {
+        threads.emplace_back(load_connection_main, &config, &infos, c, &results[c]);
+    }
+    for (std::thread& thread : threads) thread.join();
+    f64 elapsed = server_main_now() - start;
+
+    std::cout << std::endl << "client" << std::endl;
+    std::cout << "  model         requests  rejected   request/s  sample/s   p50 ms    p99 ms" << std::endl;
+    std::cout << std::fixed << std::setprecision(3);
+    bool failed = false;
+    for (u32 m : config.models) {
+        u64 completed = 0, rejected = 0, samples = 0;
+        std::vector<f32> latencies;
+        for (Load_Results& result : results) {
+            failed |= result.failed;
+            completed += result.completed[m];
+            rejected += result.rejected[m];
+            samples += result.samples[m];
+            latencies.insert(latencies.end(), result.latencies[m].begin(), result.latencies[m].end());
+        }
+        std::sort(latencies.begin(), latencies.end());
+        f64 p50 = latencies.empty() ? 0.0 : latencies[(latencies.size() - 1)*50/100];
+        f64 p99 = latencies.empty() ? 0.0 : latencies[(latencies.size() - 1)*99/100];
+        std::cout << "  " << std::left << std::setw(12) << infos[m].name << std::right
+                  << std::setw(10) << completed << std::setw(10) << rejected
+                  << std::setw(12) << completed/elapsed << std::setw(10) << std::setprecision(0) << samples/elapsed
+                  << std::setprecision(3) << std::setw(10) << p50 << std::setw(10) << p99 << std::endl;
+    }
+
+    Server_Request request = {};
+    request.magic = SERVER_PROTOCOL_MAGIC;
+    request.op = Server_Op_Stats;
+    Server_Response response;
+    std::vector<u8> payload;
+    if (server_send(fd, request, nullptr) && server_receive(fd, &response, payload)) {
+        std::cout << std::endl << "server (since it started)" << std::endl;
+        print_stats_header();
+        const Server_Model_Stats* stats = (const Server_Model_Stats*) payload.data();
+        for (u32 m = 0; m < response.num_samples; m++) print_model_stats(infos[m].name, stats[m]);
+    }
+    close(fd);
+
+    if (failed) std::cerr << "error: some connections failed" << std::endl;
+    return failed ? 1 : 0;
+}
+
+
+static Command commands[] = {
+    { "serve", "serve models over a unix socket [--model name=path] [--demo] [--workers n] [--max-pending n] [--numa replicate|interleave]", command_serve },
+    { "load", "closed loop load generator [--connections n] [--depth n] [--samples n] [--duration s]", command_load },
+    { "demo-models", "write the demo models as model files [directory]", command_demo_models },
+};
+
+
+static void print_usage(const char* program) {
+    std::cout << "usage: " << program << " <command> [options]" << std::endl;
+    std::cout << "commands:" << std::endl;
+    for (Command& command : commands) {
+        std::cout << "  " << command.name << "\t" << command.description << std::endl;
+    }
+}
+
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    for (Command& command : commands) {
+        if (strcmp(command.name, argv[1]) == 0) {
+            return command.run(argc - 2, argv + 2);
+        }
+    }
+
+    std::cerr << "error: unknown command `" << argv[1] << "`" << std::endl;
+    print_usage(argv[0]);
+    return 1;
+}
@@ -0,0 +1,252 @@
+#include "cache.h"
+#include <cstring>
+#include <vector>
+
+
+/**
+ * Key of an input while it is looked up, the words either point into
+ * the input itself or into a thread local buffer.
+ */
+struct Cache_Key {
+    u64 hash;
+    u8 ndim;
+    u32 shape[TENSOR_MAX_DIMS];
+    const u32* words;
+    u64 num_words;
+};
+
+
+static thread_local std::vector<u32> cache_key_buffer;
+
+
+/**
+ * Builds the key of the input. The data of a contiguous input is hashed
+ * in place unless it has to be quantized first, the shape is the seed.
+ */
+static Cache_Key cache_make_key(Inference_Cache* cache, Tensor* input) {
+    assert(input->dtype == Dtype_F32);
+    Cache_Key key = {};
+    key.ndim = input->ndim;
+    for (u8 d = 0; d < input->ndim; d++) key.shape[d] = input->shape[d];
+    key.num_words = input->length;
+
+    const float* data = input->data;
+    Tensor contiguous = {};
+    if (!tensor_is_contiguous(*input)) {
+        Arena_Scope heap(nullptr);
+        contiguous = tensor_copy(*input);
+        data = contiguous.data;
+    }
+
+    if (cache->config.quantum > 0.0f) {
+        cache_key_buffer.resize(key.num_words);
+        hash_quantize((i32*) cache_key_buffer.data(), data, key.num_words, cache->config.quantum);
+        key.words = cache_key_buffer.data();
+    } else if (contiguous.data) {
+        cache_key_buffer.assign((const u32*) data, (const u32*) data + key.num_words);
+        key.words = cache_key_buffer.data();
+    } else {
+        key.words = (const u32*) data;
+    }
+    tensor_free(contiguous);
+
+    u64 seed = hash_bytes(key.shape, sizeof(u32)*key.ndim, key.ndim);
+    key.hash = hash_bytes(key.words, sizeof(u32)*key.num_words, seed);
+    return key;
+}
+
+
+static bool cache_key_equal(const Cache_Entry* entry, const Cache_Key& key) {
+    if (entry->ndim != key.ndim || entry->key_words != key.num_words) return false;
+    if (memcmp(entry->shape, key.shape, sizeof(u32)*key.ndim) != 0) return false;
+    return memcmp(entry->key, key.words, sizeof(u32)*key.num_words) == 0;
+}
+
+
+/**
+ * The upper bits pick the shard, the map of the shard hashes all of them.
+ */
+static Cache_Shard& cache_shard(Inference_Cache* cache, u64 hash) {
+    return cache->shards[(hash >> 40) % cache->config.num_shards];
+}
+
+
+static void cache_unlink(Cache_Entry* entry) {
+    entry->prev->next = entry->next;
+    entry->next->prev = entry->prev;
+}
+
+
+static void cache_push_front(Cache_Shard& shard, Cache_Entry* entry) {
+    entry->prev = &shard.lru;
+    entry->next = shard.lru.next;
+    shard.lru.next->prev = entry;
+    shard.lru.next = entry;
+}
+
+
+static void cache_free_entry(Cache_Entry* entry) {
+    tensor_free(entry->output);
+    memory_free(entry->key);
+    delete entry;
+}
+
+
+/**
+ * Removes the entry from the shard, the shard must be locked.
+ */
+static void cache_remove(Cache_Shard& shard, Cache_Entry* entry) {
+    cache_unlink(entry);
+    shard.entries.erase(entry->hash);
+    shard.bytes -= entry->bytes;
+    shard.evictions++;
+    cache_free_entry(entry);
+}
+
+
+static bool cache_find(Inference_Cache* cache, const Cache_Key& key, Tensor* output) {
+    Cache_Shard& shard = cache_shard(cache, key.hash);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.entries.find(key.hash);
+    if (it == shard.entries.end() || !cache_key_equal(it->second, key)) {
+        shard.misses++;
+        return false;
+    }
+
+    Cache_Entry* entry = it->second;
+    cache_unlink(entry);
+    cache_push_front(shard, entry);
+    *output = tensor_view(entry->output);
+    shard.hits++;
+    return true;
+}
+
+
+/**
+ * Inserts the entry unless the key is already cached (another thread
+ * computed it at the same time), returns a reference to the cached output.
+ */
+static Tensor cache_put(Inference_Cache* cache, const Cache_Key& key, Tensor& output) {
+    u64 key_bytes = sizeof(u32)*key.num_words;
+    u64 bytes = sizeof(Cache_Entry) + key_bytes + tensor_bytes(output);
+
+    Cache_Entry* entry = new Cache_Entry;
+    entry->hash = key.hash;
+    entry->ndim = key.ndim;
+    memcpy(entry->shape, key.shape, sizeof(entry->shape));
+    entry->key_words = key.num_words;
+    entry->key = (u32*) memory_alloc(key_bytes > 0 ? key_bytes : 1);
+    memcpy(entry->key, key.words, key_bytes);
+    {
+        Arena_Scope heap(nullptr);
+        entry->output = tensor_copy(output);
+    }
+    entry->bytes = bytes;
+
+    Cache_Shard& shard = cache_shard(cache, key.hash);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.entries.find(key.hash);
+    if (it != shard.entries.end()) {
+        if (cache_key_equal(it->second, key)) {
+            cache_free_entry(entry);
+            return tensor_view(it->second->output);
+        }
+        cache_remove(shard, it->second);
+    }
+    if (bytes > cache->shard_max_bytes) {
+        Tensor result = tensor_view(entry->output);
+        cache_free_entry(entry);
+        return result;
+    }
+
+    while (shard.bytes + bytes > cache->shard_max_bytes) {
+        cache_remove(shard, shard.lru.prev);
+    }
+    shard.entries[key.hash] = entry;
+    cache_push_front(shard, entry);
+    shard.bytes += bytes;
+    shard.insertions++;
+    return tensor_view(entry->output);
+}
+
+
+Inference_Cache* cache_create(Cache_Config config) {
+    assert(config.num_shards > 0);
+    Inference_Cache* cache = new Inference_Cache;
+    cache->config = config;
+    cache->shard_max_bytes = config.max_bytes/config.num_shards;
+    cache->shards = new Cache_Shard[config.num_shards];
+    for (u32 i = 0; i < config.num_shards; i++) {
+        Cache_Shard& shard = cache->shards[i];
+        shard.lru.prev = &shard.lru;
+        shard.lru.next = &shard.lru;
+        shard.bytes = 0;
+        shard.hits = 0;
+        shard.misses = 0;
+        shard.insertions = 0;
+        shard.evictions = 0;
+    }
+    return cache;
+}
+
+
+void cache_destroy(Inference_Cache* cache) {
+    for (u32 i = 0; i < cache->config.num_shards; i++) {
+        Cache_Shard& shard = cache->shards[i];
+        for (auto& it : shard.entries) {
+            cache_free_entry(it.second);
+        }
+    }
+    delete[] cache->shards;
+    delete cache;
+}
+
+
+bool cache_lookup(Inference_Cache* cache, Tensor* input, Tensor* output) {
+    Cache_Key key = cache_make_key(cache, input);
+    return cache_find(cache, key, output);
+}
+
+
+void cache_insert(Inference_Cache* cache, Tensor* input, Tensor& output) {
+    Cache_Key key = cache_make_key(cache, input);
+    Tensor result = cache_put(cache, key, output);
+    tensor_free(result);
+}
+
+
+Tensor cache_forward(Inference_Cache* cache, Network* network, Tensor* input) {
+    Cache_Key key = cache_make_key(cache, input);
+    Tensor output;
+    if (cache_find(cache, key, &output)) {
+        return output;
+    }
+
+    // Layers running in place may write over the input, so a key pointing
+    // into it is moved to the key buffer of this thread first.
+    if (key.words == (const u32*) input->data) {
+        cache_key_buffer.assign(key.words, key.words + key.num_words);
+        key.words = cache_key_buffer.data();
+    }
+    output = network->forward(input);
+    return cache_put(cache, key, output);
+}
+
+
+Cache_Stats cache_stats(Inference_Cache* cache) {
+    Cache_Stats stats = {};
+    for (u32 i = 0; i < cache->config.num_shards; i++) {
+        Cache_Shard& shard = cache->shards[i];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        stats.hits += shard.hits;
+        stats.misses += shard.misses;
+        stats.insertions += shard.insertions;
+        stats.evictions += shard.evictions;
+        stats.entries += shard.entries.size();
+        stats.bytes += shard.bytes;
+    }
+    if (stats.hits + stats.misses > 0) {
+        stats.hit_rate = (f64) stats.hits/(stats.hits + stats.misses);
+    }
+    return stats;
+}
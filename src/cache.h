@@ -0,0 +1,133 @@
+#pragma once
+
+
+#include "network.h"
+#include "hash.h"
+#include <mutex>
+#include <unordered_map>
+
+
+/***************************************************************************
+ * Inference cache
+ *
+ * Content addressed cache of network outputs, placed in front of the
+ * forward pass for traffic where the same inputs arrive again and again.
+ * The key of an input is its shape and its data, hashed with `hash_bytes`.
+ * Every entry keeps a copy of the key, so a hit is only reported when the
+ * input really is the same and a hash collision is just a miss.
+ *
+ * The entries are spread over shards by their hash, each shard has its own
+ * lock, map and least recently used list and its share of the memory
+ * budget. A lookup holds the lock of one shard for a map lookup and a list
+ * splice, hashing the input and running the network happen outside of it.
+ *
+ * In approximate mode the input is rounded to multiples of a step before it
+ * is hashed and compared, so inputs that differ by less than the rounding
+ * (e.g. noise from upstream float formatting) share a cached result. The
+ * result is the output of whichever of these inputs was computed first.
+ ***************************************************************************/
+
+
+struct Cache_Config {
+    u32 num_shards = 16;
+    /// Upper bound of the memory of the keys and outputs of all entries.
+    u64 max_bytes = 64ull << 20;
+    /// Zero caches by exact input, otherwise inputs are rounded to
+    /// multiples of `quantum` and inputs that round the same share a result.
+    f32 quantum = 0.0f;
+};
+
+
+struct Cache_Stats {
+    u64 hits;
+    u64 misses;
+    u64 insertions;
+    /// Entries dropped to stay within the memory budget (or replaced by
+    /// an input with the same hash).
+    u64 evictions;
+    u64 entries;
+    u64 bytes;
+    f64 hit_rate;
+};
+
+
+struct Cache_Entry {
+    u64 hash;
+    // Neighbours in the shard's recency list.
+    Cache_Entry* prev;
+    Cache_Entry* next;
+
+    // Key, the shape and the words of the input data (float bits or quantized).
+    u8 ndim;
+    u32 shape[TENSOR_MAX_DIMS];
+    u32* key;
+    u64 key_words;
+
+    Tensor output;
+    u64 bytes;
+};
+
+
+struct alignas(64) Cache_Shard {
+    std::mutex mutex;
+    std::unordered_map<u64, Cache_Entry*> entries;
+    /// Sentinel of the recency list, `lru.next` is the most recently used.
+    Cache_Entry lru;
+    u64 bytes;
+
+    u64 hits;
+    u64 misses;
+    u64 insertions;
+    u64 evictions;
+};
+
+
+struct Inference_Cache {
+    Cache_Config config;
+    u64 shard_max_bytes;
+    Cache_Shard* shards;
+};
+
+
+/**
+ * Creates an empty cache, safe to use from any number of threads.
+ */
+Inference_Cache* cache_create(Cache_Config config = {});
+
+
+/**
+ * Frees all the entries, outputs returned by the cache stay valid
+ * until they are freed.
+ */
+void cache_destroy(Inference_Cache* cache);
+
+
+/**
+ * Looks the input up, on a hit `output` is set to a new reference to
+ * the cached output (the caller frees it) and true is returned.
+ */
+bool cache_lookup(Inference_Cache* cache, Tensor* input, Tensor* output);
+
+
+/**
+ * Adds a copy of the output for the input, evicting the least recently
+ * used entries of its shard as needed. Outputs larger than a shard's
+ * share of the budget are not cached.
+ */
+void cache_insert(Inference_Cache* cache, Tensor* input, Tensor& output);
+
+
+/**
+ * Returns the cached output for the input or runs the network and caches
+ * its output. Either way the result is a new reference the caller has to
+ * free, it is never overwritten by later forward passes. The network must
+ * only be used by one thread at a time (see `network_share_weights`),
+ * the cache can be shared by all of them.
+ */
+Tensor cache_forward(Inference_Cache* cache, Network* network, Tensor* input);
+
+
+/**
+ * Returns the counters summed over all shards.
+ */
+Cache_Stats cache_stats(Inference_Cache* cache);
@@ -0,0 +1,162 @@
+#include "coalescer.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+
+/**
+ * Number of recent request latencies kept for the percentiles.
+ */
+const u32 COALESCER_LATENCY_WINDOW = 4096;
+
+
+static f64 coalescer_now() {
+    using namespace std::chrono;
+    return duration<f64>(steady_clock::now().time_since_epoch()).count();
+}
+
+
+/**
+ * Packs the requests into the batch input, runs the network and scatters
+ * the output columns back to the requests.
+ */
+static void coalescer_run_batch(Request_Coalescer* coalescer,
+                                Coalescer_Request** requests, u32 count) {
+    Tensor& batch = coalescer->batch_input;
+    batch.shape[0] = count;
+    batch.shape[1] = coalescer->num_inputs;
+    tensor_set_contiguous(batch);
+
+    // Samples are columns of the batch, i.e. feature `f` of sample `s`
+    // is stored at `f*count + s`.
+    for (u32 s = 0; s < count; s++) {
+        const float* sample = requests[s]->input->data;
+        for (u32 f = 0; f < coalescer->num_inputs; f++) {
+            batch.data[f*count + s] = sample[f];
+        }
+    }
+
+    Tensor output = plan_forward(coalescer->plan, &batch);
+    u32 num_outputs = output.length/count;
+    for (u32 s = 0; s < count; s++) {
+        Tensor* result = requests[s]->output;
+        assert(result->length == num_outputs);
+        for (u32 o = 0; o < num_outputs; o++) {
+            result->data[o] = output.data[o*count + s];
+        }
+    }
+}
+
+
+static void coalescer_dispatcher_main(Request_Coalescer* coalescer) {
+    std::vector<Coalescer_Request*> batch;
+    batch.reserve(coalescer->config.max_batch_size);
+    f64 max_latency = coalescer->config.max_latency_ms*1e-3;
+
+    std::unique_lock<std::mutex> lock(coalescer->mutex);
+    while (true) {
+        coalescer->request_ready.wait(lock, [&] {
+            return coalescer->shutdown || !coalescer->pending.empty();
+        });
+        if (coalescer->pending.empty()) {
+            return;
+        }
+
+        // Wait for the batch to fill up, at most until the oldest request's deadline.
+        f64 deadline = coalescer->pending.front()->submit_time + max_latency;
+        while (coalescer->pending.size() < coalescer->config.max_batch_size && !coalescer->shutdown) {
+            f64 remaining = deadline - coalescer_now();
+            if (remaining <= 0.0) break;
+            coalescer->request_ready.wait_for(lock, std::chrono::duration<f64>(remaining));
+        }
+
+        u32 count = (u32) std::min<size_t>(coalescer->pending.size(), coalescer->config.max_batch_size);
+        batch.assign(coalescer->pending.begin(), coalescer->pending.begin() + count);
+        coalescer->pending.erase(coalescer->pending.begin(), coalescer->pending.begin() + count);
+
+        lock.unlock();
+        coalescer_run_batch(coalescer, batch.data(), count);
+        f64 finish_time = coalescer_now();
+        lock.lock();
+
+        for (Coalescer_Request* request : batch) {
+            f64 latency_ms = (finish_time - request->submit_time)*1e3;
+            coalescer->latencies[coalescer->latency_cursor % COALESCER_LATENCY_WINDOW] = (f32) latency_ms;
+            coalescer->latency_cursor++;
+            request->done = true;
+        }
+        coalescer->num_requests += count;
+        coalescer->num_batches++;
+        coalescer->request_done.notify_all();
+    }
+}
+
+
+Request_Coalescer* coalescer_create(Network* network, u32 num_inputs, Coalescer_Config config) {
+    assert(config.max_batch_size > 0);
+    Request_Coalescer* coalescer = new Request_Coalescer;
+    coalescer->network = network;
+    coalescer->config = config;
+    coalescer->num_inputs = num_inputs;
+    coalescer->shutdown = false;
+    coalescer->pending.reserve(4*config.max_batch_size);
+    coalescer->batch_input = tensor_create_2d(config.max_batch_size, num_inputs);
+    coalescer->plan = plan_compile(network, coalescer->batch_input.shape, 2);
+    coalescer->num_requests = 0;
+    coalescer->num_batches = 0;
+    coalescer->latencies.assign(COALESCER_LATENCY_WINDOW, 0.0f);
+    coalescer->latency_cursor = 0;
+    coalescer->dispatcher = std::thread(coalescer_dispatcher_main, coalescer);
+    return coalescer;
+}
+
+
+void coalescer_destroy(Request_Coalescer* coalescer) {
+    {
+        std::lock_guard<std::mutex> lock(coalescer->mutex);
+        coalescer->shutdown = true;
+    }
+    coalescer->request_ready.notify_all();
+    coalescer->dispatcher.join();
+    tensor_free(coalescer->batch_input);
+    plan_destroy(coalescer->plan);
+    delete coalescer;
+}
+
+
+void coalescer_forward(Request_Coalescer* coalescer, Tensor* input, Tensor* output) {
+    assert(input->length == coalescer->num_inputs);
+    Coalescer_Request request;
+    request.input = input;
+    request.output = output;
+    request.done = false;
+
+    std::unique_lock<std::mutex> lock(coalescer->mutex);
+    request.submit_time = coalescer_now();
+    coalescer->pending.push_back(&request);
+    if (coalescer->pending.size() == 1 ||
+        coalescer->pending.size() >= coalescer->config.max_batch_size) {
+        coalescer->request_ready.notify_one();
+    }
+    coalescer->request_done.wait(lock, [&] { return request.done; });
+}
+
+
+Coalescer_Stats coalescer_stats(Request_Coalescer* coalescer) {
+    std::lock_guard<std::mutex> lock(coalescer->mutex);
+    Coalescer_Stats stats = {};
+    stats.requests = coalescer->num_requests;
+    stats.batches = coalescer->num_batches;
+    if (stats.batches > 0) {
+        stats.mean_batch_size = (f64) stats.requests/stats.batches;
+    }
+
+    u32 count = std::min(coalescer->latency_cursor, COALESCER_LATENCY_WINDOW);
+    if (count > 0) {
+        std::vector<f32> sorted(coalescer->latencies.begin(), coalescer->latencies.begin() + count);
+        std::sort(sorted.begin(), sorted.end());
+        stats.p50_latency_ms = sorted[(count - 1)*50/100];
+        stats.p99_latency_ms = sorted[(count - 1)*99/100];
+    }
+    return stats;
+}
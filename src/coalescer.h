@@ -0,0 +1,99 @@
+#pragma once
+
+
+#include "network.h"
+#include "plan.h"
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+/***************************************************************************
+ * Request coalescing
+ *
+ * Collects single sample forward requests coming from many threads and
+ * runs them through the network as one batch. A batch is dispatched as
+ * soon as it is full or once the oldest request has waited for the
+ * maximum latency, whichever comes first.
+ ***************************************************************************/
+
+
+struct Coalescer_Config {
+    /// Maximum number of samples in a single batch.
+    u32 max_batch_size = 32;
+    /// Maximum time in milliseconds a request waits for the batch to fill up.
+    f64 max_latency_ms = 1.0;
+};
+
+
+struct Coalescer_Stats {
+    u64 requests;
+    u64 batches;
+    f64 mean_batch_size;
+    /// Latency from submit to result in milliseconds, over the recent requests.
+    f64 p50_latency_ms;
+    f64 p99_latency_ms;
+};
+
+
+/**
+ * Single forward request, lives on the stack of the submitting thread.
+ */
+struct Coalescer_Request {
+    Tensor* input;
+    Tensor* output;
+    f64 submit_time;
+    bool done;
+};
+
+
+struct Request_Coalescer {
+    Network* network;
+    Coalescer_Config config;
+    u32 num_inputs;
+
+    std::mutex mutex;
+    std::condition_variable request_ready;
+    std::condition_variable request_done;
+    std::vector<Coalescer_Request*> pending;
+    bool shutdown;
+
+    // Batch input and the plan for the largest batch, owned by the dispatcher thread.
+    Tensor batch_input;
+    Execution_Plan* plan;
+    std::thread dispatcher;
+
+    // Statistics, latencies are kept in a ring of the most recent requests.
+    u64 num_requests;
+    u64 num_batches;
+    std::vector<f32> latencies;
+    u32 latency_cursor;
+};
+
+
+/**
+ * Creates a coalescer and starts its dispatcher thread. The network
+ * must not be used by anyone else while the coalescer is running.
+ */
+Request_Coalescer* coalescer_create(Network* network, u32 num_inputs, Coalescer_Config config);
+
+
+/**
+ * Stops the dispatcher thread, pending requests are finished first.
+ */
+void coalescer_destroy(Request_Coalescer* coalescer);
+
+
+/**
+ * Forwards a single sample of shape (1, inputs), blocks until the batch
+ * it ended up in has been computed and its output copied into `output`
+ * which must have the shape (1, outputs). Safe to call from any thread.
+ */
+void coalescer_forward(Request_Coalescer* coalescer, Tensor* input, Tensor* output);
+
+
+/**
+ * Returns the batching and latency statistics.
+ */
+Coalescer_Stats coalescer_stats(Request_Coalescer* coalescer);
@@ -0,0 +1,641 @@
+#include "conv.h"
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cstring>
+
+
+/**
+ * Scratch buffers of the convolutions, one set per thread that only ever grows.
+ */
+struct Conv_Workspace {
+    float* input = nullptr;
+    u64 input_size = 0;
+    float* columns = nullptr;
+    u64 columns_size = 0;
+    float* products = nullptr;
+    u64 products_size = 0;
+    float* zeros = nullptr;
+    u64 zeros_size = 0;
+
+    ~Conv_Workspace() {
+        memory_free(input);
+        memory_free(columns);
+        memory_free(products);
+        memory_free(zeros);
+    }
+};
+
+
+static Conv_Workspace& conv_workspace() {
+    static thread_local Conv_Workspace workspace;
+    return workspace;
+}
+
+
+static float* conv_reserve(float*& buffer, u64& size, u64 count) {
+    if (size < count) {
+        memory_free(buffer);
+        buffer = (float*) memory_alloc(sizeof(float)*count);
+        size = count;
+    }
+    return buffer;
+}
+
+
+void tensor_set_image_layout(Tensor& tensor, Image_Layout layout) {
+    assert(tensor.ndim == 4);
+    if (layout != Image_Layout_NHWC) {
+        tensor_set_contiguous(tensor);
+        return;
+    }
+
+    u32 batch = tensor.shape[0];
+    u32 width = tensor.shape[1];
+    u32 channels = tensor.shape[3];
+    tensor.stride[0] = 1;
+    tensor.stride[3] = batch;
+    tensor.stride[1] = batch*channels;
+    tensor.stride[2] = batch*channels*width;
+    tensor.length = batch*width*tensor.shape[2]*channels;
+}
+
+
+bool tensor_has_image_layout(const Tensor& tensor, Image_Layout layout) {
+    if (tensor.ndim != 4) return false;
+    Tensor expected = tensor;
+    tensor_set_image_layout(expected, layout);
+    return tensor_same_layout(tensor, expected);
+}
+
+
+const char* conv_algorithm_name(Conv_Algorithm algorithm) {
+    switch (algorithm) {
+        case Conv_Algorithm_Auto: return "auto";
+        case Conv_Algorithm_Im2col: return "im2col";
+        case Conv_Algorithm_Pointwise: return "pointwise";
+        case Conv_Algorithm_Winograd: return "winograd";
+        case Conv_Algorithm_Direct: return "direct";
+    }
+    return "unknown";
+}
+
+
+/**
+ * Collects the algorithms the auto algorithm chooses from for the layer,
+ * direct is left out since it never beats im2col.
+ */
+static u32 conv_candidates(const Conv2D_Layer* layer, Conv_Algorithm* candidates) {
+    u32 count = 0;
+    u32 k = layer->kernel_size;
+    if (k == 1 && layer->stride == 1 && layer->padding == 0) {
+        candidates[count++] = Conv_Algorithm_Pointwise;
+    } else {
+        candidates[count++] = Conv_Algorithm_Im2col;
+    }
+    if (k == 3 && layer->stride == 1) candidates[count++] = Conv_Algorithm_Winograd;
+    return count;
+}
+
+
+Conv_Algorithm conv_select_algorithm(const Conv2D_Layer* layer, const u32* input_shape) {
+    if (layer->algorithm != Conv_Algorithm_Auto) return layer->algorithm;
+
+    Conv_Algorithm candidates[4];
+    if (conv_candidates(layer, candidates) == 1) return candidates[0];
+
+    bool tuned = layer->tuned_algorithm != Conv_Algorithm_Auto;
+    for (u32 d = 0; d < 3; d++) tuned = tuned && layer->tuned_shape[d] == input_shape[d + 1];
+    return tuned ? layer->tuned_algorithm : Conv_Algorithm_Auto;
+}
+
+
+void conv_reset(Conv2D_Layer* layer) {
+    if (layer->winograd_weights.data) tensor_free(layer->winograd_weights);
+    layer->winograd_weights = {};
+    layer->tuned_algorithm = Conv_Algorithm_Auto;
+}
+
+
+/**
+ * Unrolls the patches of output rows [row_begin, row_end) into a matrix with
+ * one row per weight (channel, kernel row, kernel column) and one column per
+ * output element (row, column, sample), then multiplies it with the weights.
+ */
+static void conv_im2col(Conv2D_Layer* layer, Tensor& x, Tensor& y) {
+    u32 batch = x.shape[0], width = x.shape[1], height = x.shape[2];
+    u32 out_width = y.shape[1], out_height = y.shape[2];
+    u32 k = layer->kernel_size, stride = layer->stride;
+    i32 padding = (i32) layer->padding;
+    u32 num_weights = layer->in_channels*k*k;
+    u64 row_floats = (u64) out_width*batch;
+
+    u32 chunk_rows = (u32) std::max<u64>(1, CONV_CHUNK_FLOATS/(num_weights*row_floats));
+    chunk_rows = std::min(chunk_rows, out_height);
+    Conv_Workspace& workspace = conv_workspace();
+    float* columns = conv_reserve(workspace.columns, workspace.columns_size, num_weights*chunk_rows*row_floats);
+
+    Gemm_Epilogue epilogue;
+    epilogue.bias = layer->bias.data;
+    epilogue.activation = layer->activation;
+
+    for (u32 row_begin = 0; row_begin < out_height; row_begin += chunk_rows) {
+        u32 rows = std::min(chunk_rows, out_height - row_begin);
+        u64 num_columns = rows*row_floats;
+
+        parallel_for(0, num_weights, 16, [&](u64 begin, u64 end) {
+            for (u64 w = begin; w < end; w++) {
+                u32 c = (u32) (w/(k*k));
+                i32 ky = (i32) (w/k % k);
+                i32 kx = (i32) (w % k);
+                const float* plane = x.data + (u64) c*x.stride[3];
+
+                for (u32 r = 0; r < rows; r++) {
+                    float* out = columns + w*num_columns + r*row_floats;
+                    i32 yi = (i32) ((row_begin + r)*stride) + ky - padding;
+                    if (yi < 0 || yi >= (i32) height) {
+                        memset(out, 0, sizeof(float)*row_floats);
+                        continue;
+                    }
+
+                    const float* in = plane + (u64) yi*x.stride[2];
+                    for (u32 xo = 0; xo < out_width; xo++) {
+                        i32 xi = (i32) (xo*stride) + kx - padding;
+                        float* pixel = out + (u64) xo*batch;
+                        if (xi < 0 || xi >= (i32) width) {
+                            memset(pixel, 0, sizeof(float)*batch);
+                        } else {
+                            memcpy(pixel, in + (u64) xi*batch, sizeof(float)*batch);
+                        }
+                    }
+                }
+            }
+        });
+
+        gemm_f32_fused(layer->out_channels, (u32) num_columns, num_weights,
+                       layer->weights.data, layer->weights.stride[1], layer->weights.stride[0],
+                       columns, (i32) num_columns, 1,
+                       0.0f, y.data + row_begin*row_floats, (u32) (out_height*row_floats), epilogue);
+    }
+}
+
+
+/**
+ * 1x1 convolution, the NCHW input is the (C, H*W*N) matrix as is.
+ */
+static void conv_pointwise(Conv2D_Layer* layer, Tensor& x, Tensor& y) {
+    u32 pixels = x.shape[0]*x.shape[1]*x.shape[2];
+    Gemm_Epilogue epilogue;
+    epilogue.bias = layer->bias.data;
+    epilogue.activation = layer->activation;
+    gemm_f32_fused(layer->out_channels, pixels, layer->in_channels,
+                   layer->weights.data, layer->weights.stride[1], layer->weights.stride[0],
+                   x.data, x.stride[3], 1,
+                   0.0f, y.data, pixels, epilogue);
+}
+
+
+/**
+ * Samples transformed at once by the winograd tile transforms,
+ * the inner loops over them are plain enough to be vectorized.
+ */
+const u32 WINOGRAD_LANES = 16;
+
+
+/**
+ * Convolution with F(2x2, 3x3). The weights g of every pair of channels are
+ * transformed to U = G*g*G^T and every 4x4 input tile d (overlapping by two)
+ * to V = B^T*d*B, then each of the 16 positions e of the tiles is a GEMM
+ * M[e] = U[e]*V[e] over the channels, and the 2x2 output is A^T*M*A.
+ */
+static void conv_winograd(Conv2D_Layer* layer, Tensor& x, Tensor& y) {
+    u32 batch = x.shape[0], width = x.shape[1], height = x.shape[2];
+    u32 out_width = y.shape[1], out_height = y.shape[2];
+    u32 in_channels = layer->in_channels, out_channels = layer->out_channels;
+    i32 padding = (i32) layer->padding;
+    u32 tiles_x = (out_width + 1)/2;
+    u32 tiles_y = (out_height + 1)/2;
+    u64 tile_row_floats = (u64) tiles_x*batch;
+
+    u32 chunk_rows = (u32) std::max<u64>(1, CONV_CHUNK_FLOATS/(16*(in_channels + out_channels)*tile_row_floats));
+    chunk_rows = std::min(chunk_rows, tiles_y);
+    Conv_Workspace& workspace = conv_workspace();
+    float* v = conv_reserve(workspace.columns, workspace.columns_size, 16*in_channels*chunk_rows*tile_row_floats);
+    float* m = conv_reserve(workspace.products, workspace.products_size, 16*out_channels*chunk_rows*tile_row_floats);
+    float* zeros = conv_reserve(workspace.zeros, workspace.zeros_size, batch);
+    memset(zeros, 0, sizeof(float)*batch);
+
+    // Weights, U[e] is a (Co, C) matrix.
+    if (!layer->winograd_weights.data) {
+        Arena_Scope heap(nullptr);
+        layer->winograd_weights = tensor_create_1d(16*out_channels*in_channels);
+        float* u = layer->winograd_weights.data;
+        Tensor& weights = layer->weights;
+        parallel_for(0, out_channels, 8, [&](u64 begin, u64 end) {
+            for (u64 o = begin; o < end; o++) {
+                for (u32 c = 0; c < in_channels; c++) {
+                    f32 g[3][3], gg[4][3];
+                    for (u32 i = 0; i < 9; i++) {
+                        g[i/3][i % 3] = weights.data[o*weights.stride[1] + (c*9 + i)*weights.stride[0]];
+                    }
+                    for (u32 j = 0; j < 3; j++) {
+                        gg[0][j] = g[0][j];
+                        gg[1][j] = 0.5f*(g[0][j] + g[1][j] + g[2][j]);
+                        gg[2][j] = 0.5f*(g[0][j] - g[1][j] + g[2][j]);
+                        gg[3][j] = g[2][j];
+                    }
+                    for (u32 i = 0; i < 4; i++) {
+                        f32 row[4] = {
+                            gg[i][0],
+                            0.5f*(gg[i][0] + gg[i][1] + gg[i][2]),
+                            0.5f*(gg[i][0] - gg[i][1] + gg[i][2]),
+                            gg[i][2],
+                        };
+                        for (u32 j = 0; j < 4; j++) u[((u64) (i*4 + j)*out_channels + o)*in_channels + c] = row[j];
+                    }
+                }
+            }
+        });
+    }
+    const float* u = layer->winograd_weights.data;
+
+    for (u32 tile_begin = 0; tile_begin < tiles_y; tile_begin += chunk_rows) {
+        u32 rows = std::min(chunk_rows, tiles_y - tile_begin);
+        u64 num_columns = rows*tile_row_floats;
+
+        // Input tiles, V[e] is a (C, tiles*N) matrix.
+        parallel_for(0, in_channels, 1, [&](u64 begin, u64 end) {
+            for (u64 c = begin; c < end; c++) {
+                const float* plane = x.data + c*x.stride[3];
+                for (u32 t = 0; t < rows*tiles_x; t++) {
+                    i32 y0 = (i32) (2*(tile_begin + t/tiles_x)) - padding;
+                    i32 x0 = (i32) (2*(t % tiles_x)) - padding;
+                    const float* d[16];
+                    for (i32 i = 0; i < 4; i++) {
+                        for (i32 j = 0; j < 4; j++) {
+                            bool inside = y0 + i >= 0 && y0 + i < (i32) height && x0 + j >= 0 && x0 + j < (i32) width;
+                            d[i*4 + j] = inside ? plane + (u64) (y0 + i)*x.stride[2] + (u64) (x0 + j)*batch : zeros;
+                        }
+                    }
+
+                    float* out = v + c*num_columns + (u64) t*batch;
+                    for (u32 n0 = 0; n0 < batch; n0 += WINOGRAD_LANES) {
+                        u32 count = std::min(WINOGRAD_LANES, batch - n0);
+                        f32 tile[16][WINOGRAD_LANES], rows_t[16][WINOGRAD_LANES];
+                        for (u32 e = 0; e < 16; e++) memcpy(tile[e], d[e] + n0, sizeof(float)*count);
+                        for (u32 j = 0; j < 4; j++) {
+                            for (u32 n = 0; n < count; n++) {
+                                rows_t[0*4 + j][n] = tile[0*4 + j][n] - tile[2*4 + j][n];
+                                rows_t[1*4 + j][n] = tile[1*4 + j][n] + tile[2*4 + j][n];
+                                rows_t[2*4 + j][n] = tile[2*4 + j][n] - tile[1*4 + j][n];
+                                rows_t[3*4 + j][n] = tile[1*4 + j][n] - tile[3*4 + j][n];
+                            }
+                        }
+                        for (u32 i = 0; i < 4; i++) {
+                            f32* r = rows_t[i*4];
+                            f32* e0 = out + ((u64) (i*4 + 0)*in_channels)*num_columns + n0;
+                            f32* e1 = out + ((u64) (i*4 + 1)*in_channels)*num_columns + n0;
+                            f32* e2 = out + ((u64) (i*4 + 2)*in_channels)*num_columns + n0;
+                            f32* e3 = out + ((u64) (i*4 + 3)*in_channels)*num_columns + n0;
+                            for (u32 n = 0; n < count; n++) {
+                                f32 a0 = r[n], a1 = r[WINOGRAD_LANES + n];
+                                f32 a2 = r[2*WINOGRAD_LANES + n], a3 = r[3*WINOGRAD_LANES + n];
+                                e0[n] = a0 - a2;
+                                e1[n] = a1 + a2;
+                                e2[n] = a2 - a1;
+                                e3[n] = a1 - a3;
+                            }
+                        }
+                    }
+                }
+            }
+        });
+
+        for (u32 e = 0; e < 16; e++) {
+            gemm_f32(out_channels, (u32) num_columns, in_channels,
+                     u + (u64) e*out_channels*in_channels, in_channels, 1,
+                     v + (u64) e*in_channels*num_columns, (i32) num_columns, 1,
+                     0.0f, m + (u64) e*out_channels*num_columns, (u32) num_columns);
+        }
+
+        // Output tiles, each one covers 2x2 pixels unless at the border.
+        parallel_for(0, out_channels, 1, [&](u64 begin, u64 end) {
+            for (u64 o = begin; o < end; o++) {
+                f32 b = layer->bias.data[o*layer->bias.stride[0]];
+                float* plane = y.data + o*y.stride[3];
+                for (u32 t = 0; t < rows*tiles_x; t++) {
+                    u32 yo = 2*(tile_begin + t/tiles_x);
+                    u32 xo = 2*(t % tiles_x);
+                    const float* in = m + o*num_columns + (u64) t*batch;
+                    u64 e_stride = (u64) out_channels*num_columns;
+
+                    for (u32 n0 = 0; n0 < batch; n0 += WINOGRAD_LANES) {
+                        u32 count = std::min(WINOGRAD_LANES, batch - n0);
+                        f32 cols[8][WINOGRAD_LANES];
+                        for (u32 j = 0; j < 4; j++) {
+                            const float* m0 = in + (0*4 + j)*e_stride + n0;
+                            const float* m1 = in + (1*4 + j)*e_stride + n0;
+                            const float* m2 = in + (2*4 + j)*e_stride + n0;
+                            const float* m3 = in + (3*4 + j)*e_stride + n0;
+                            for (u32 n = 0; n < count; n++) {
+                                cols[j][n] = m0[n] + m1[n] + m2[n];
+                                cols[4 + j][n] = m1[n] - m2[n] - m3[n];
+                            }
+                        }
+                        for (u32 i = 0; i < 2 && yo + i < out_height; i++) {
+                            f32* r = cols[i*4];
+                            float* out = plane + (u64) (yo + i)*y.stride[2] + (u64) xo*batch + n0;
+                            for (u32 n = 0; n < count; n++) {
+                                out[n] = r[n] + r[WINOGRAD_LANES + n] + r[2*WINOGRAD_LANES + n] + b;
+                            }
+                            if (xo + 1 == out_width) continue;
+                            out += batch;
+                            for (u32 n = 0; n < count; n++) {
+                                out[n] = r[WINOGRAD_LANES + n] - r[2*WINOGRAD_LANES + n] - r[3*WINOGRAD_LANES + n] + b;
+                            }
+                        }
+                    }
+                }
+            }
+        });
+    }
+}
+
+
+/**
+ * Convolution of NHWC images as a GEMM per output pixel and kernel tap,
+ * the (Co, C) weights of the tap times the (C, N) block of the input pixel
+ * accumulated into the (Co, N) block of the output pixel.
+ */
+static void conv_direct(Conv2D_Layer* layer, Tensor& x, Tensor& y) {
+    u32 batch = x.shape[0], width = x.shape[1], height = x.shape[2];
+    u32 out_width = y.shape[1], out_height = y.shape[2];
+    u32 k = layer->kernel_size, stride = layer->stride;
+    i32 padding = (i32) layer->padding;
+    Tensor& weights = layer->weights;
+
+    parallel_for(0, (u64) out_width*out_height, 1, [&](u64 begin, u64 end) {
+        for (u64 p = begin; p < end; p++) {
+            u32 xo = (u32) (p % out_width);
+            u32 yo = (u32) (p/out_width);
+            float* out = y.data + (u64) xo*y.stride[1] + (u64) yo*y.stride[2];
+
+            // Taps outside the input only read padding, the last one inside
+            // applies the bias and activation once the sum is complete.
+            u32 first = k*k, last = 0;
+            for (u32 t = 0; t < k*k; t++) {
+                i32 yi = (i32) (yo*stride + t/k) - padding;
+                i32 xi = (i32) (xo*stride + t % k) - padding;
+                if (yi < 0 || yi >= (i32) height || xi < 0 || xi >= (i32) width) continue;
+                first = std::min(first, t);
+                last = t;
+            }
+
+            if (first == k*k) {
+                for (u32 o = 0; o < layer->out_channels; o++) {
+                    f32 value = gemm_apply_epilogue(0.0f, layer->bias.data, o, layer->activation);
+                    for (u32 n = 0; n < batch; n++) out[(u64) o*batch + n] = value;
+                }
+                continue;
+            }
+
+            for (u32 t = first; t <= last; t++) {
+                i32 yi = (i32) (yo*stride + t/k) - padding;
+                i32 xi = (i32) (xo*stride + t % k) - padding;
+                if (yi < 0 || yi >= (i32) height || xi < 0 || xi >= (i32) width) continue;
+                const float* in = x.data + (u64) xi*x.stride[1] + (u64) yi*x.stride[2];
+
+                Gemm_Epilogue epilogue;
+                if (t == last) {
+                    epilogue.bias = layer->bias.data;
+                    epilogue.activation = layer->activation;
+                }
+                gemm_f32_fused(layer->out_channels, batch, layer->in_channels,
+                               weights.data + (u64) t*weights.stride[0],
+                               weights.stride[1], k*k*weights.stride[0],
+                               in, x.stride[3], 1,
+                               t == first ? 0.0f : 1.0f, out, y.stride[3], epilogue);
+            }
+        }
+    });
+}
+
+
+static void conv_run(Conv2D_Layer* layer, Conv_Algorithm algorithm, Tensor* input, Tensor* output) {
+    assert(algorithm != Conv_Algorithm_Pointwise || (layer->kernel_size == 1 && layer->stride == 1 && layer->padding == 0));
+    assert(algorithm != Conv_Algorithm_Winograd || (layer->kernel_size == 3 && layer->stride == 1));
+    Image_Layout layout = algorithm == Conv_Algorithm_Direct ? Image_Layout_NHWC : Image_Layout_NCHW;
+
+    // Inputs in the other layout (or any other strides) are copied first.
+    Tensor x = *input;
+    if (!tensor_has_image_layout(x, layout)) {
+        Conv_Workspace& workspace = conv_workspace();
+        float* data = conv_reserve(workspace.input, workspace.input_size, input->length);
+        x = tensor_wrap(data, input->shape, 4);
+        tensor_set_image_layout(x, layout);
+        tensor_copy_into(x, *input);
+    }
+    tensor_set_image_layout(*output, layout);
+
+    PROFILE_SCOPE(conv_algorithm_name(algorithm), PROFILE_KERNEL, 2ull*output->length*layer->weights.shape[0],
+                  sizeof(float)*((u64) x.length + layer->weights.length + output->length));
+    switch (algorithm) {
+        case Conv_Algorithm_Auto: assert(false); break;
+        case Conv_Algorithm_Im2col: conv_im2col(layer, x, *output); break;
+        case Conv_Algorithm_Pointwise: conv_pointwise(layer, x, *output); break;
+        case Conv_Algorithm_Direct: conv_direct(layer, x, *output); break;
+
+        case Conv_Algorithm_Winograd: {
+            conv_winograd(layer, x, *output);
+            switch (layer->activation) {
+                case Gemm_Activation_None: break;
+                case Gemm_Activation_ReLU: f_relu(*output); break;
+                case Gemm_Activation_Sigmoid: f_sigmoid(*output); break;
+                case Gemm_Activation_Tanh: f_tanh(*output); break;
+            }
+            break;
+        }
+    }
+}
+
+
+/**
+ * Runs every candidate algorithm twice (the first run grows the
+ * scratch buffers) and keeps the fastest for this input shape.
+ */
+static Conv_Algorithm conv_tune(Conv2D_Layer* layer, Tensor* input, Tensor* output) {
+    using namespace std::chrono;
+    Conv_Algorithm candidates[4];
+    u32 count = conv_candidates(layer, candidates);
+
+    Conv_Algorithm best = candidates[0];
+    f64 best_time = 1e30;
+    for (u32 i = 0; i < count; i++) {
+        for (u32 run = 0; run < 2; run++) {
+            auto start = steady_clock::now();
+            conv_run(layer, candidates[i], input, output);
+            f64 time = duration<f64>(steady_clock::now() - start).count();
+            if (run == 1 && time < best_time) {
+                best = candidates[i];
+                best_time = time;
+            }
+        }
+    }
+
+    layer->tuned_algorithm = best;
+    for (u32 d = 0; d < 3; d++) layer->tuned_shape[d] = input->shape[d + 1];
+    return best;
+}
+
+
+void Conv2D_Layer::forward_into(Tensor* input, Tensor* output) {
+    // The strides of the output are set for the algorithm, only its shape matters.
+    u32 shape[4];
+    output_shape(input->shape, input->ndim, shape);
+    assert(output->ndim == 4 && memcmp(output->shape, shape, sizeof(shape)) == 0);
+    assert(tensor_is_contiguous(bias));
+
+    Conv_Algorithm selected = conv_select_algorithm(this, input->shape);
+    if (selected == Conv_Algorithm_Auto) {
+        selected = conv_tune(this, input, output);
+    }
+    conv_run(this, selected, input, output);
+}
+
+
+void Pool_Layer::forward_into(Tensor* input, Tensor* output) {
+    assert(input->ndim == 4 && output->ndim == 4);
+
+    // The samples of a pixel have to be contiguous, everything else may be strided.
+    Tensor x = *input;
+    if (x.stride[0] != 1 && x.shape[0] != 1) {
+        Conv_Workspace& workspace = conv_workspace();
+        float* data = conv_reserve(workspace.input, workspace.input_size, input->length);
+        x = tensor_wrap(data, input->shape, 4);
+        tensor_copy_into(x, *input);
+    }
+    tensor_set_image_layout(*output, tensor_has_image_layout(x, Image_Layout_NHWC) ?
+                                     Image_Layout_NHWC : Image_Layout_NCHW);
+
+    u32 batch = x.shape[0], width = x.shape[1], height = x.shape[2];
+    u32 out_width = output->shape[1], out_height = output->shape[2];
+    i32 pad = (i32) padding;
+    Tensor& y = *output;
+
+    parallel_for(0, (u64) x.shape[3]*out_height, 4, [&](u64 begin, u64 end) {
+        for (u64 row = begin; row < end; row++) {
+            u32 c = (u32) (row/out_height);
+            u32 yo = (u32) (row % out_height);
+            i32 y0 = (i32) (yo*stride) - pad;
+            i32 y1 = std::min(y0 + (i32) kernel_size, (i32) height);
+            y0 = std::max(y0, 0);
+
+            for (u32 xo = 0; xo < out_width; xo++) {
+                i32 x0 = (i32) (xo*stride) - pad;
+                i32 x1 = std::min(x0 + (i32) kernel_size, (i32) width);
+                x0 = std::max(x0, 0);
+
+                float* out = y.data + (u64) c*y.stride[3] + (u64) yo*y.stride[2] + (u64) xo*y.stride[1];
+                f32 initial = pool == Pool_Max ? -FLT_MAX : 0.0f;
+                for (u32 n = 0; n < batch; n++) out[n] = initial;
+
+                for (i32 yi = y0; yi < y1; yi++) {
+                    for (i32 xi = x0; xi < x1; xi++) {
+                        const float* in = x.data + (u64) c*x.stride[3] + (u64) yi*x.stride[2] + (u64) xi*x.stride[1];
+                        if (pool == Pool_Max) {
+                            for (u32 n = 0; n < batch; n++) out[n] = std::max(out[n], in[n]);
+                        } else {
+                            for (u32 n = 0; n < batch; n++) out[n] += in[n];
+                        }
+                    }
+                }
+
+                if (pool == Pool_Average) {
+                    i32 count = (y1 - y0)*(x1 - x0);
+                    f32 scale = count > 0 ? 1.0f/count : 0.0f;
+                    for (u32 n = 0; n < batch; n++) out[n] *= scale;
+                }
+            }
+        }
+    });
+}
+
+
+void Flatten_Layer::forward_into(Tensor* input, Tensor* output) {
+    // Copy through a contiguous view of the output with the input's shape,
+    // which puts the elements of any input layout into NCHW order.
+    Tensor images = tensor_wrap(output->data, input->shape, input->ndim);
+    assert(images.length == output->length);
+    tensor_copy_into(images, *input);
+}
+
+
+Tensor Flatten_Layer::forward(Tensor* input) {
+    if (!tensor_is_contiguous(*input)) return Layer::forward(input);
+
+    // Contiguous images already are the batch, only the shape changes.
+    Tensor output = *input;
+    output_shape(input->shape, input->ndim, output.shape);
+    output.ndim = 2;
+    tensor_set_contiguous(output);
+    return output;
+}
+
+
+Conv2D_Layer* conv2d(
+    u32 in_channels,
+    u32 out_channels,
+    u32 kernel_size,
+    u32 stride,
+    u32 padding,
+    void init_weights(Tensor&),
+    void init_biases(Tensor&),
+    Gemm_Activation activation
+) {
+    assert(kernel_size > 0 && stride > 0);
+    Conv2D_Layer* layer = new Conv2D_Layer;
+    layer->in_channels = in_channels;
+    layer->out_channels = out_channels;
+    layer->kernel_size = kernel_size;
+    layer->stride = stride;
+    layer->padding = padding;
+    layer->activation = activation;
+    layer->weights = tensor_create_2d(in_channels*kernel_size*kernel_size, out_channels);
+    layer->bias = tensor_create_1d(out_channels);
+    init_weights(layer->weights);
+    init_biases(layer->bias);
+    return layer;
+}
+
+
+void conv2d_reference(Conv2D_Layer* layer, Tensor& input, Tensor& output) {
+    u32 batch = input.shape[0], width = input.shape[1], height = input.shape[2];
+    u32 k = layer->kernel_size;
+    i32 padding = (i32) layer->padding;
+    Tensor& w = layer->weights;
+    Tensor& x = input;
+    Tensor& y = output;
+
+    for (u32 o = 0; o < layer->out_channels; o++) {
+        for (u32 yo = 0; yo < output.shape[2]; yo++) {
+            for (u32 xo = 0; xo < output.shape[1]; xo++) {
+                for (u32 n = 0; n < batch; n++) {
+                    f64 sum = layer->bias.data[o*layer->bias.stride[0]];
+                    for (u32 c = 0; c < layer->in_channels; c++) {
+                        for (u32 ky = 0; ky < k; ky++) {
+                            for (u32 kx = 0; kx < k; kx++) {
+                                i32 yi = (i32) (yo*layer->stride + ky) - padding;
+                                i32 xi = (i32) (xo*layer->stride + kx) - padding;
+                                if (yi < 0 || yi >= (i32) height || xi < 0 || xi >= (i32) width) continue;
+                                f32 weight = w.data[o*w.stride[1] + ((c*k + ky)*k + kx)*w.stride[0]];
+                                sum += weight*x.data[n*x.stride[0] + xi*x.stride[1] + yi*x.stride[2] + c*x.stride[3]];
+                            }
+                        }
+                    }
+                    y.data[n*y.stride[0] + xo*y.stride[1] + yo*y.stride[2] + o*y.stride[3]] =
+                        gemm_apply_epilogue((f32) sum, nullptr, 0, layer->activation);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,254 @@
+#pragma once
+
+
+#include "network.h"
+
+
+/***************************************************************************
+ * Convolution and pooling
+ *
+ * Images are 4-D tensors of shape (N, W, H, C). Like every other batch
+ * the samples are the fastest changing dimension, so each pixel of each
+ * channel is a contiguous vector of N values and all the kernels below
+ * vectorize over the batch. The layout of the remaining dimensions is
+ * given by the strides, using the usual names (ignoring the batch):
+ *
+ *   NCHW   planar, the contiguous layout, x is next to fastest then y
+ *          then the channel. Flattening gives the (N, C*H*W) batches of
+ *          the image loader and the dense layers.
+ *   NHWC   interleaved, the channels of a pixel are next to each other,
+ *          a permuted view with strides (1, N*C, N*C*W, N).
+ *
+ * Layers accept either layout and pick the one of their output. A 2-D
+ * convolution lowers to a matrix product in one of these ways:
+ *
+ *   im2col     NCHW, the general case. Patches of the input are unrolled
+ *              into a (C*k*k, Ho*Wo*N) matrix in chunks of output rows,
+ *              multiplied by the (Co, C*k*k) weights.
+ *   pointwise  NCHW, 1x1 stride 1 without padding, the input already is
+ *              the (C, H*W*N) matrix so this is a single GEMM.
+ *   winograd   NCHW, 3x3 stride 1 using F(2x2, 3x3): 16 GEMMs over
+ *              transformed 4x4 input tiles do the work of 36 per 2x2
+ *              outputs, 2.25 times fewer multiplications.
+ *   direct     NHWC, one GEMM per output pixel and kernel tap reading the
+ *              (C, N) block of the input pixel in place, nothing is
+ *              unrolled. The GEMMs are far too small to compete, so it
+ *              only runs when forced and serves as a reference for NHWC.
+ *
+ * With the auto algorithm the layer measures the NCHW algorithms that fit
+ * its shapes on the first forward pass for a new image size and keeps the
+ * fastest one, which depends on the shapes as much as on the machine.
+ *
+ * Bias and activation are applied in the GEMM epilogue where possible.
+ * The scratch memory is per thread and only grows, so a warm forward pass
+ * does not allocate. Convolution and pooling layers have no backward pass.
+ ***************************************************************************/
+
+
+enum Image_Layout {
+    Image_Layout_NCHW,
+    Image_Layout_NHWC,
+};
+
+
+enum Conv_Algorithm {
+    Conv_Algorithm_Auto,
+    Conv_Algorithm_Im2col,
+    Conv_Algorithm_Pointwise,
+    Conv_Algorithm_Winograd,
+    Conv_Algorithm_Direct,
+};
+
+
+/**
+ * Floats of scratch memory the im2col and winograd buffers are limited to,
+ * larger convolutions are processed in chunks of output rows.
+ */
+const u64 CONV_CHUNK_FLOATS = 1 << 20;
+
+
+/**
+ * Sets the strides of a 4-D image tensor for the layout, the length
+ * and the set of elements it covers stay the same.
+ */
+void tensor_set_image_layout(Tensor& tensor, Image_Layout layout);
+
+
+/**
+ * Checks if a 4-D image tensor has exactly the strides of the layout.
+ */
+bool tensor_has_image_layout(const Tensor& tensor, Image_Layout layout);
+
+
+/**
+ * Size of the output along one spatial dimension.
+ */
+inline u32 conv_output_size(u32 input, u32 kernel, u32 stride, u32 padding) {
+    assert(input + 2*padding >= kernel);
+    return (input + 2*padding - kernel)/stride + 1;
+}
+
+
+const char* conv_algorithm_name(Conv_Algorithm algorithm);
+
+
+/**
+ * 2-D convolution with square kernels and the same stride and padding
+ * (zeros) in both directions. The weights have the shape (C*k*k, Co) like
+ * the weights of a dense layer with C*k*k inputs, the inputs of output
+ * channel `o` are ordered by input channel, then kernel row and column.
+ */
+struct Conv2D_Layer : Layer {
+    u32 in_channels;
+    u32 out_channels;
+    u32 kernel_size;
+    u32 stride;
+    u32 padding;
+    Tensor weights;
+    Tensor bias;
+    Gemm_Activation activation = Gemm_Activation_None;
+    /// Forces a specific algorithm, mostly useful for benchmarking.
+    Conv_Algorithm algorithm = Conv_Algorithm_Auto;
+
+    // Fastest algorithm measured for inputs of this width, height and channels,
+    // tuning is not thread safe so run a forward pass before sharing the layer.
+    Conv_Algorithm tuned_algorithm = Conv_Algorithm_Auto;
+    u32 tuned_shape[3] = {};
+    // Weights transformed for winograd, computed by the first pass using them.
+    Tensor winograd_weights = {};
+
+    virtual Layer_Type type() const override {
+        return Layer_Type_Conv2D;
+    }
+
+    virtual u8 output_shape(const u32* input_shape, u8 ndim, u32* shape) const override {
+        assert(ndim == 4 && input_shape[3] == in_channels);
+        (void) ndim;
+        shape[0] = input_shape[0];
+        shape[1] = conv_output_size(input_shape[1], kernel_size, stride, padding);
+        shape[2] = conv_output_size(input_shape[2], kernel_size, stride, padding);
+        shape[3] = out_channels;
+        return 4;
+    }
+
+    virtual void forward_into(Tensor* input, Tensor* output) override;
+};
+
+
+/**
+ * Returns the algorithm the layer uses for inputs of the given shape,
+ * or Conv_Algorithm_Auto if the next forward pass is going to measure them.
+ */
+Conv_Algorithm conv_select_algorithm(const Conv2D_Layer* layer, const u32* input_shape);
+
+
+/**
+ * Drops the transformed weights and the tuned algorithm,
+ * has to be called after changing the weights.
+ */
+void conv_reset(Conv2D_Layer* layer);
+
+
+enum Pool_Type {
+    Pool_Max,
+    /// Average of the elements inside the image, padding is not counted.
+    Pool_Average,
+};
+
+
+/**
+ * Max or average pooling over square windows of each channel,
+ * the output has the same layout as the input.
+ */
+struct Pool_Layer : Layer {
+    Pool_Type pool;
+    u32 kernel_size;
+    u32 stride;
+    u32 padding;
+
+    virtual Layer_Type type() const override {
+        return pool == Pool_Max ? Layer_Type_Max_Pool : Layer_Type_Avg_Pool;
+    }
+
+    virtual u8 output_shape(const u32* input_shape, u8 ndim, u32* shape) const override {
+        assert(ndim == 4);
+        (void) ndim;
+        shape[0] = input_shape[0];
+        shape[1] = conv_output_size(input_shape[1], kernel_size, stride, padding);
+        shape[2] = conv_output_size(input_shape[2], kernel_size, stride, padding);
+        shape[3] = input_shape[3];
+        return 4;
+    }
+
+    virtual void forward_into(Tensor* input, Tensor* output) override;
+};
+
+
+/**
+ * Flattens images of shape (N, W, H, C) into a batch of shape (N, C*H*W)
+ * in NCHW order for the dense layers, NCHW inputs are not copied.
+ */
+struct Flatten_Layer : Layer {
+    virtual Layer_Type type() const override {
+        return Layer_Type_Flatten;
+    }
+
+    virtual u8 output_shape(const u32* input_shape, u8 ndim, u32* shape) const override {
+        shape[0] = input_shape[0];
+        shape[1] = 1;
+        for (u8 d = 1; d < ndim; d++) shape[1] *= input_shape[d];
+        return 2;
+    }
+
+    virtual void forward_into(Tensor* input, Tensor* output) override;
+
+    virtual Tensor forward(Tensor* input) override;
+};
+
+
+/**
+ * Creates a convolution from `in_channels` to `out_channels` with kernels
+ * of `kernel_size` x `kernel_size`.
+ */
+Conv2D_Layer* conv2d(
+    u32 in_channels,
+    u32 out_channels,
+    u32 kernel_size,
+    u32 stride,
+    u32 padding,
+    void init_weights(Tensor&),
+    void init_biases(Tensor&),
+    Gemm_Activation activation = Gemm_Activation_None
+);
+
+
+inline Pool_Layer* max_pool(u32 kernel_size, u32 stride, u32 padding = 0) {
+    Pool_Layer* layer = new Pool_Layer;
+    layer->pool = Pool_Max;
+    layer->kernel_size = kernel_size;
+    layer->stride = stride;
+    layer->padding = padding;
+    return layer;
+}
+
+
+inline Pool_Layer* avg_pool(u32 kernel_size, u32 stride, u32 padding = 0) {
+    Pool_Layer* layer = new Pool_Layer;
+    layer->pool = Pool_Average;
+    layer->kernel_size = kernel_size;
+    layer->stride = stride;
+    layer->padding = padding;
+    return layer;
+}
+
+
+inline Flatten_Layer* flatten() {
+    return new Flatten_Layer;
+}
+
+
+/**
+ * Reference convolution with plain loops over NCHW tensors, used for
+ * verifying and benchmarking the other algorithms.
+ */
+void conv2d_reference(Conv2D_Layer* layer, Tensor& input, Tensor& output);
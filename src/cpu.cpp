@@ -0,0 +1,98 @@
+#include "cpu.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+
+#if defined(_MSC_VER)
+static void cpu_cpuid(u32 leaf, u32 subleaf, u32 regs[4]) {
+    int info[4];
+    __cpuidex(info, (int) leaf, (int) subleaf);
+    for (int i = 0; i < 4; i++) regs[i] = (u32) info[i];
+}
+
+
+static u64 cpu_xgetbv(u32 index) {
+    return _xgetbv(index);
+}
+#elif defined(__x86_64__) || defined(__i386__)
+static void cpu_cpuid(u32 leaf, u32 subleaf, u32 regs[4]) {
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+}
+
+
+static u64 cpu_xgetbv(u32 index) {
+    u32 eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(index));
+    return ((u64) edx << 32) | eax;
+}
+#else
+static void cpu_cpuid(u32 leaf, u32 subleaf, u32 regs[4]) {
+    regs[0] = regs[1] = regs[2] = regs[3] = 0;
+}
+
+
+static u64 cpu_xgetbv(u32 index) {
+    return 0;
+}
+#endif
+
+
+static Cpu_Features cpu_detect_features() {
+    Cpu_Features features = {};
+
+    u32 regs[4];
+    cpu_cpuid(0, 0, regs);
+    u32 max_leaf = regs[0];
+    if (max_leaf < 1) {
+        return features;
+    }
+
+    cpu_cpuid(1, 0, regs);
+    features.sse41 = (regs[2] >> 19) & 1;
+    bool has_fma = (regs[2] >> 12) & 1;
+    bool has_osxsave = (regs[2] >> 27) & 1;
+    bool has_avx = (regs[2] >> 28) & 1;
+
+    // The AVX registers are only usable if the OS saves the upper
+    // halves of the ymm registers on context switch (XCR0 bit 1 and 2),
+    // AVX-512 additionally needs the opmask and zmm state (bit 5, 6 and 7).
+    bool os_avx = false;
+    bool os_avx512 = false;
+    if (has_osxsave) {
+        u64 xcr0 = cpu_xgetbv(0);
+        os_avx = (xcr0 & 0x6) == 0x6;
+        os_avx512 = (xcr0 & 0xE6) == 0xE6;
+    }
+
+    features.avx = has_avx && os_avx;
+    features.fma = has_fma && features.avx;
+    features.f16c = ((regs[2] >> 29) & 1) && features.avx;
+
+    if (max_leaf >= 7) {
+        cpu_cpuid(7, 0, regs);
+        features.avx2 = ((regs[1] >> 5) & 1) && features.avx;
+        features.avx512f = ((regs[1] >> 16) & 1) && os_avx512 && features.fma;
+        bool has_avx512bw = (regs[1] >> 30) & 1;
+        bool has_avx512vl = (regs[1] >> 31) & 1;
+        bool has_avx512vnni = (regs[2] >> 11) & 1;
+        features.avx512vnni = features.avx512f && has_avx512bw && has_avx512vl && has_avx512vnni;
+
+        u32 max_subleaf = regs[0];
+        if (max_subleaf >= 1) {
+            cpu_cpuid(7, 1, regs);
+            bool has_avx512bf16 = (regs[0] >> 5) & 1;
+            features.avx512bf16 = features.avx512f && has_avx512bw && has_avx512vl && has_avx512bf16;
+        }
+    }
+    return features;
+}
+
+
+const Cpu_Features& cpu_features() {
+    static Cpu_Features features = cpu_detect_features();
+    return features;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+
+#include "util.h"
+
+
+/**
+ * Instruction set extensions supported by the host CPU (and enabled by the OS).
+ * Kernels with several implementations use this to pick the fastest one
+ * at runtime, the scalar code path is always available as a fallback.
+ */
+struct Cpu_Features {
+    bool sse41;
+    bool avx;
+    bool avx2;
+    bool fma;
+    // Conversion between fp16 and fp32 (vcvtph2ps and vcvtps2ph).
+    bool f16c;
+    bool avx512f;
+    // AVX-512 VNNI together with BW and VL, needed by the int8 kernels.
+    bool avx512vnni;
+    // AVX-512 BF16 together with BW and VL, rounds fp32 to bf16 (vcvtneps2bf16).
+    bool avx512bf16;
+};
+
+
+/**
+ * Queries the CPU features using cpuid, the result is computed once
+ * and then cached for the remainder of the program.
+ */
+const Cpu_Features& cpu_features();
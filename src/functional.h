@@ -2,6 +2,7 @@
 
 
 #include "tensor.h"
+#include "profiler.h"
 #include <cmath>
 
 
@@ -11,7 +12,84 @@
 
 
 inline void f_relu(Tensor& tensor) {
-    for (int i = 0; i < tensor.length; i++) {
-        tensor.data[i] = fmax(0.0f, tensor.data[i]);
+    tensor_apply(tensor, kernels().relu);
+}
+
+
+/**
+ * Logistic sigmoid `1 / (1 + exp(-x))`.
+ */
+inline void f_sigmoid(Tensor& tensor) {
+    tensor_apply(tensor, kernels().sigmoid);
+}
+
+
+/**
+ * Hyperbolic tangent.
+ */
+inline void f_tanh(Tensor& tensor) {
+    tensor_apply(tensor, kernels().tanh);
+}
+
+
+/**
+ * Natural exponential function.
+ */
+inline void f_exp(Tensor& tensor) {
+    tensor_apply(tensor, kernels().exp);
+}
+
+
+/**
+ * Column buffer of the strided softmax, one per thread that only ever grows,
+ * so the forward pass stays free of heap allocations once warm.
+ */
+struct Softmax_Workspace {
+    float* column = nullptr;
+    u64 size = 0;
+
+    ~Softmax_Workspace() {
+        memory_free(column);
+    }
+};
+
+
+inline float* softmax_reserve(u64 count) {
+    static thread_local Softmax_Workspace workspace;
+    if (workspace.size < count) {
+        memory_free(workspace.column);
+        workspace.column = (float*) memory_alloc(sizeof(float)*count);
+        workspace.size = count;
+    }
+    return workspace.column;
+}
+
+
+/**
+ * Softmax over the features of each sample, i.e. over each column
+ * of a 2-dimensional tensor or over the whole 1-dimensional tensor.
+ */
+inline void f_softmax(Tensor& tensor) {
+    PROFILE_SCOPE("softmax", PROFILE_KERNEL, 4ull*tensor.length, 2*sizeof(float)*tensor.length);
+    u32 batch = tensor.ndim == 2 ? tensor.shape[0] : 1;
+    u32 features = tensor.length / batch;
+    u32 sample_stride = tensor.stride[0];
+    u32 feature_stride = tensor.ndim == 2 ? tensor.stride[1] : tensor.stride[0];
+    if (feature_stride == 1) {
+        for (u32 s = 0; s < batch; s++) {
+            float* sample = tensor.data + (u64) s*sample_stride;
+            kernels().softmax(sample, sample, features);
+        }
+        return;
+    }
+
+    // Samples are strided columns, so each one is gathered first.
+    float stack_column[256];
+    float* column = features <= 256 ? stack_column : softmax_reserve(features);
+    for (u32 s = 0; s < batch; s++) {
+        float* sample = tensor.data + (u64) s*sample_stride;
+        for (u32 f = 0; f < features; f++) column[f] = sample[(u64) f*feature_stride];
+        kernels().softmax(column, column, features);
+        for (u32 f = 0; f < features; f++) sample[(u64) f*feature_stride] = column[f];
     }
 }
@@ -0,0 +1,410 @@
+#include "gemm.h"
+#include "cpu.h"
+#include "memory.h"
+#include "profiler.h"
+#include "thread_pool.h"
+#include <cstring>
+
+
+static Gemm_Micro_Kernel* gemm_kernel = nullptr;
+static Gemv_Kernel* gemv_kernel = nullptr;
+static Gemv_Half_Kernel* gemv_f16_kernel = nullptr;
+static Gemv_Half_Kernel* gemv_bf16_kernel = nullptr;
+static const char* gemm_kernel_label = "none";
+
+
+bool gemm_set_kernel(Gemm_Kernel_Type type) {
+    const Cpu_Features& cpu = cpu_features();
+    switch (type) {
+        case Gemm_Kernel_Auto: {
+            if (cpu.avx2 && cpu.fma) {
+                return gemm_set_kernel(Gemm_Kernel_AVX2);
+            }
+            return gemm_set_kernel(Gemm_Kernel_Scalar);
+        }
+
+        case Gemm_Kernel_Scalar: {
+            gemm_kernel = gemm_micro_kernel_scalar;
+            gemv_kernel = gemv_kernel_scalar;
+            gemv_f16_kernel = gemv_kernel_f16_scalar;
+            gemv_bf16_kernel = gemv_kernel_bf16_scalar;
+            gemm_kernel_label = "scalar";
+            return true;
+        }
+
+        case Gemm_Kernel_AVX2: {
+            if (!(cpu.avx2 && cpu.fma)) return false;
+            gemm_kernel = gemm_micro_kernel_avx2;
+            gemv_kernel = gemv_kernel_avx2;
+            gemv_f16_kernel = cpu.f16c ? gemv_kernel_f16_f16c : gemv_kernel_f16_scalar;
+            gemv_bf16_kernel = cpu.f16c ? gemv_kernel_bf16_f16c : gemv_kernel_bf16_scalar;
+            gemm_kernel_label = "avx2";
+            return true;
+        }
+    }
+    return false;
+}
+
+
+const char* gemm_kernel_name() {
+    if (!gemm_kernel) gemm_set_kernel(Gemm_Kernel_Auto);
+    return gemm_kernel_label;
+}
+
+
+void gemm_micro_kernel_scalar(u32 kc, const float* a, const float* b,
+                              float* c, u32 ldc, float beta,
+                              const float* bias, Gemm_Activation activation) {
+    float acc[GEMM_MR][GEMM_NR] = {};
+    for (u32 p = 0; p < kc; p++) {
+        for (u32 i = 0; i < GEMM_MR; i++) {
+            float a_ip = a[i];
+            for (u32 j = 0; j < GEMM_NR; j++) {
+                acc[i][j] += a_ip*b[j];
+            }
+        }
+        a += GEMM_MR;
+        b += GEMM_NR;
+    }
+
+    for (u32 i = 0; i < GEMM_MR; i++) {
+        float* c_row = c + i*ldc;
+        if (beta != 0.0f) {
+            for (u32 j = 0; j < GEMM_NR; j++) acc[i][j] += beta*c_row[j];
+        }
+        for (u32 j = 0; j < GEMM_NR; j++) {
+            c_row[j] = gemm_apply_epilogue(acc[i][j], bias, i, activation);
+        }
+    }
+}
+
+
+void gemv_kernel_scalar(u32 m, u32 k, const float* a, u32 lda,
+                        const float* x, float beta, float* y, u32 incy,
+                        const float* bias, Gemm_Activation activation) {
+    for (u32 i = 0; i < m; i++) {
+        const float* a_row = a + (i64) i*lda;
+        float sum = 0.0f;
+        for (u32 p = 0; p < k; p++) {
+            sum += a_row[p]*x[p];
+        }
+        float* y_i = y + (i64) i*incy;
+        if (beta != 0.0f) sum += beta*(*y_i);
+        *y_i = gemm_apply_epilogue(sum, bias, i, activation);
+    }
+}
+
+
+void gemv_kernel_f16_scalar(u32 m, u32 k, const u16* a, u32 lda,
+                            const float* x, float beta, float* y, u32 incy,
+                            const float* bias, Gemm_Activation activation) {
+    for (u32 i = 0; i < m; i++) {
+        const u16* a_row = a + (i64) i*lda;
+        float sum = 0.0f;
+        for (u32 p = 0; p < k; p++) {
+            sum += half_f16_to_f32(a_row[p])*x[p];
+        }
+        float* y_i = y + (i64) i*incy;
+        if (beta != 0.0f) sum += beta*(*y_i);
+        *y_i = gemm_apply_epilogue(sum, bias, i, activation);
+    }
+}
+
+
+void gemv_kernel_bf16_scalar(u32 m, u32 k, const u16* a, u32 lda,
+                             const float* x, float beta, float* y, u32 incy,
+                             const float* bias, Gemm_Activation activation) {
+    for (u32 i = 0; i < m; i++) {
+        const u16* a_row = a + (i64) i*lda;
+        float sum = 0.0f;
+        for (u32 p = 0; p < k; p++) {
+            sum += half_bf16_to_f32(a_row[p])*x[p];
+        }
+        float* y_i = y + (i64) i*incy;
+        if (beta != 0.0f) sum += beta*(*y_i);
+        *y_i = gemm_apply_epilogue(sum, bias, i, activation);
+    }
+}
+
+
+/**
+ * Returns A advanced by `elements` elements of its type.
+ */
+static inline const void* gemm_offset_a(const void* a, Dtype dtype, i64 elements) {
+    return (const u8*) a + elements*dtype_size(dtype);
+}
+
+
+/**
+ * Packs a mc x kc block of A into micro-panels of MR rows,
+ * rows past the end of the matrix are padded with zeros.
+ * A stored in 16 bits is converted to fp32 one row at a time.
+ */
+static void gemm_pack_a(Dtype dtype, u32 mc, u32 kc, const void* a_data, i32 rsa, i32 csa, float* packed) {
+    if (dtype != Dtype_F32) {
+        alignas(64) float rows[GEMM_MR][GEMM_KC];
+        for (u32 i0 = 0; i0 < mc; i0 += GEMM_MR) {
+            u32 count = mc - i0 < GEMM_MR ? mc - i0 : GEMM_MR;
+            for (u32 i = 0; i < GEMM_MR; i++) {
+                const u16* a_row = (const u16*) a_data + (i64) (i0 + i)*rsa;
+                if (i >= count) {
+                    memset(rows[i], 0, sizeof(float)*kc);
+                } else if (csa == 1) {
+                    half_to_f32(dtype, rows[i], a_row, kc);
+                } else {
+                    for (u32 p = 0; p < kc; p++) rows[i][p] = dtype_load(dtype, a_row, (i64) p*csa);
+                }
+            }
+            for (u32 p = 0; p < kc; p++) {
+                for (u32 i = 0; i < GEMM_MR; i++) packed[i] = rows[i][p];
+                packed += GEMM_MR;
+            }
+        }
+        return;
+    }
+
+    const float* a = (const float*) a_data;
+    for (u32 i0 = 0; i0 < mc; i0 += GEMM_MR) {
+        u32 rows = mc - i0 < GEMM_MR ? mc - i0 : GEMM_MR;
+        const float* a_panel = a + (i64) i0*rsa;
+        for (u32 p = 0; p < kc; p++) {
+            for (u32 i = 0; i < rows; i++) {
+                packed[i] = a_panel[(i64) i*rsa + (i64) p*csa];
+            }
+            for (u32 i = rows; i < GEMM_MR; i++) {
+                packed[i] = 0.0f;
+            }
+            packed += GEMM_MR;
+        }
+    }
+}
+
+
+/**
+ * Packs a kc x nc block of B into micro-panels of NR columns,
+ * columns past the end of the matrix are padded with zeros.
+ */
+static void gemm_pack_b(u32 kc, u32 nc, const float* b, i32 rsb, i32 csb, float* packed) {
+    for (u32 j0 = 0; j0 < nc; j0 += GEMM_NR) {
+        u32 cols = nc - j0 < GEMM_NR ? nc - j0 : GEMM_NR;
+        const float* b_panel = b + (i64) j0*csb;
+        for (u32 p = 0; p < kc; p++) {
+            const float* b_row = b_panel + (i64) p*rsb;
+            if (csb == 1) {
+                memcpy(packed, b_row, sizeof(float)*cols);
+            } else {
+                for (u32 j = 0; j < cols; j++) packed[j] = b_row[(i64) j*csb];
+            }
+            for (u32 j = cols; j < GEMM_NR; j++) {
+                packed[j] = 0.0f;
+            }
+            packed += GEMM_NR;
+        }
+    }
+}
+
+
+/**
+ * Packing buffers are allocated once per thread and reused by every call.
+ */
+struct Gemm_Workspace {
+    float* packed_a;
+    float* packed_b;
+
+    Gemm_Workspace() {
+        packed_a = (float*) memory_alloc(sizeof(float)*GEMM_MC*GEMM_KC);
+        packed_b = (float*) memory_alloc(sizeof(float)*GEMM_KC*GEMM_NC);
+    }
+
+    ~Gemm_Workspace() {
+        memory_free(packed_a);
+        memory_free(packed_b);
+    }
+};
+
+
+static Gemm_Workspace& gemm_workspace() {
+    static thread_local Gemm_Workspace workspace;
+    return workspace;
+}
+
+
+/**
+ * Computes rows [ic_begin, ic_end) of one packed kc x nc block of B,
+ * this is the unit of work that is distributed over the thread pool.
+ * The epilogue is only given for the last block along k.
+ */
+static void gemm_macro_kernel(Gemm_Micro_Kernel* kernel, u32 ic_begin, u32 ic_end,
+                              u32 nc, u32 kc, Dtype a_dtype, const void* a, i32 rsa, i32 csa,
+                              const float* packed_b, float beta, float* c, u32 ldc,
+                              const Gemm_Epilogue* epilogue) {
+    float* packed_a = gemm_workspace().packed_a;
+    const float* bias = epilogue ? epilogue->bias : nullptr;
+    Gemm_Activation activation = epilogue ? epilogue->activation : Gemm_Activation_None;
+
+    // Edge tiles are computed into a temporary tile and then copied out,
+    // this way the micro-kernels only ever have to deal with full tiles.
+    alignas(64) float edge[GEMM_MR*GEMM_NR];
+
+    for (u32 ic = ic_begin; ic < ic_end; ic += GEMM_MC) {
+        u32 mc = ic_end - ic < GEMM_MC ? ic_end - ic : GEMM_MC;
+        gemm_pack_a(a_dtype, mc, kc, gemm_offset_a(a, a_dtype, (i64) ic*rsa), rsa, csa, packed_a);
+
+        for (u32 jr = 0; jr < nc; jr += GEMM_NR) {
+            u32 nr = nc - jr < GEMM_NR ? nc - jr : GEMM_NR;
+            const float* b_panel = packed_b + jr*kc;
+
+            for (u32 ir = 0; ir < mc; ir += GEMM_MR) {
+                u32 mr = mc - ir < GEMM_MR ? mc - ir : GEMM_MR;
+                const float* a_panel = packed_a + ir*kc;
+                float* c_tile = c + (ic + ir)*ldc + jr;
+                const float* tile_bias = bias ? bias + ic + ir : nullptr;
+
+                if (mr == GEMM_MR && nr == GEMM_NR) {
+                    kernel(kc, a_panel, b_panel, c_tile, ldc, beta, tile_bias, activation);
+                } else {
+                    kernel(kc, a_panel, b_panel, edge, GEMM_NR, 0.0f, nullptr, Gemm_Activation_None);
+                    for (u32 i = 0; i < mr; i++) {
+                        float* c_row = c_tile + i*ldc;
+                        for (u32 j = 0; j < nr; j++) {
+                            float value = edge[i*GEMM_NR + j];
+                            if (beta != 0.0f) value += beta*c_row[j];
+                            c_row[j] = gemm_apply_epilogue(value, tile_bias, i, activation);
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+/**
+ * Below this many flops the whole product runs on the calling thread,
+ * waking up the thread pool costs more than it saves.
+ */
+const u64 GEMM_PARALLEL_MIN_FLOPS = 1 << 20;
+
+
+void gemm_mixed_fused(Dtype a_dtype, u32 m, u32 n, u32 k,
+                      const void* a, i32 rsa, i32 csa,
+                      const float* b, i32 rsb, i32 csb,
+                      float beta, float* c, u32 ldc,
+                      const Gemm_Epilogue& epilogue) {
+    if (m == 0 || n == 0) return;
+    PROFILE_SCOPE(a_dtype == Dtype_F32 ? "gemm" : a_dtype == Dtype_F16 ? "gemm_f16" : "gemm_bf16", PROFILE_KERNEL, 2ull*m*n*k,
+                  dtype_size(a_dtype)*(u64) m*k + sizeof(float)*((u64) k*n + (u64) m*n));
+    if (k == 0) {
+        for (u32 i = 0; i < m; i++) {
+            for (u32 j = 0; j < n; j++) {
+                float value = beta == 0.0f ? 0.0f : beta*c[i*ldc + j];
+                c[i*ldc + j] = gemm_apply_epilogue(value, epilogue.bias, i, epilogue.activation);
+            }
+        }
+        return;
+    }
+
+    if (!gemm_kernel) gemm_set_kernel(Gemm_Kernel_Auto);
+    Gemm_Micro_Kernel* kernel = gemm_kernel;
+    Gemv_Kernel* gemv = gemv_kernel;
+    Gemv_Half_Kernel* gemv_half = a_dtype == Dtype_F16 ? gemv_f16_kernel : gemv_bf16_kernel;
+
+    float* packed_b = gemm_workspace().packed_b;
+    bool parallel = 2ull*m*n*k >= GEMM_PARALLEL_MIN_FLOPS;
+    u32 num_threads = parallel ? thread_pool_num_threads() : 1;
+
+    // A strided column of B is gathered into the packing buffer first,
+    // columns too long for it go through the packed path instead.
+    if (n == 1 && csa == 1 && (rsb == 1 || k <= GEMM_KC*GEMM_NC)) {
+        const float* x = b;
+        if (rsb != 1) {
+            for (u32 p = 0; p < k; p++) packed_b[p] = b[(i64) p*rsb];
+            x = packed_b;
+        }
+
+        u64 grain = parallel ? (32*1024 + k - 1)/k : m;
+        parallel_for(0, m, grain, [&](u64 begin, u64 end) {
+            const float* bias = epilogue.bias ? epilogue.bias + begin : nullptr;
+            if (a_dtype == Dtype_F32) {
+                gemv((u32) (end - begin), k, (const float*) a + (i64) begin*rsa, rsa, x, beta, c + begin*ldc, ldc,
+                     bias, epilogue.activation);
+            } else {
+                gemv_half((u32) (end - begin), k, (const u16*) a + (i64) begin*rsa, rsa, x, beta, c + begin*ldc, ldc,
+                          bias, epilogue.activation);
+            }
+        });
+        return;
+    }
+
+    // Rows of C are split into blocks over the threads, use smaller blocks
+    // than MC when needed to give every thread at least a couple of blocks.
+    u64 row_block = GEMM_MC;
+    if (num_threads > 1) {
+        u64 rows_per_thread = (m + 2*num_threads - 1)/(2*num_threads);
+        rows_per_thread = (rows_per_thread + GEMM_MR - 1)/GEMM_MR*GEMM_MR;
+        if (rows_per_thread < row_block) row_block = rows_per_thread;
+    }
+
+    for (u32 jc = 0; jc < n; jc += GEMM_NC) {
+        u32 nc = n - jc < GEMM_NC ? n - jc : GEMM_NC;
+
+        for (u32 pc = 0; pc < k; pc += GEMM_KC) {
+            u32 kc = k - pc < GEMM_KC ? k - pc : GEMM_KC;
+            float beta_block = pc == 0 ? beta : 1.0f;
+            const Gemm_Epilogue* epilogue_block = pc + kc == k ? &epilogue : nullptr;
+
+            const float* b_block = b + (i64) pc*rsb + (i64) jc*csb;
+            u64 num_panels = (nc + GEMM_NR - 1)/GEMM_NR;
+            parallel_for(0, num_panels, parallel ? 8 : num_panels, [&](u64 begin, u64 end) {
+                u32 j0 = (u32) begin*GEMM_NR;
+                u32 j1 = (u32) end*GEMM_NR < nc ? (u32) end*GEMM_NR : nc;
+                gemm_pack_b(kc, j1 - j0, b_block + (i64) j0*csb, rsb, csb, packed_b + j0*kc);
+            });
+
+            const void* a_block = gemm_offset_a(a, a_dtype, (i64) pc*csa);
+            float* c_block = c + jc;
+            u64 num_blocks = (m + row_block - 1)/row_block;
+            parallel_for(0, num_blocks, 1, [&](u64 begin, u64 end) {
+                u32 ic_begin = (u32) (begin*row_block);
+                u32 ic_end = end*row_block < m ? (u32) (end*row_block) : m;
+                gemm_macro_kernel(kernel, ic_begin, ic_end, nc, kc, a_dtype, a_block, rsa, csa,
+                                  packed_b, beta_block, c_block, ldc, epilogue_block);
+            });
+        }
+    }
+}
+
+
+void gemm_f32_fused(u32 m, u32 n, u32 k,
+                    const float* a, i32 rsa, i32 csa,
+                    const float* b, i32 rsb, i32 csb,
+                    float beta, float* c, u32 ldc,
+                    const Gemm_Epilogue& epilogue) {
+    gemm_mixed_fused(Dtype_F32, m, n, k, a, rsa, csa, b, rsb, csb, beta, c, ldc, epilogue);
+}
+
+
+void gemm_f32(u32 m, u32 n, u32 k,
+              const float* a, i32 rsa, i32 csa,
+              const float* b, i32 rsb, i32 csb,
+              float beta, float* c, u32 ldc) {
+    Gemm_Epilogue epilogue;
+    gemm_f32_fused(m, n, k, a, rsa, csa, b, rsb, csb, beta, c, ldc, epilogue);
+}
+
+
+void gemm_f32_reference(u32 m, u32 n, u32 k,
+                        const float* a, i32 rsa, i32 csa,
+                        const float* b, i32 rsb, i32 csb,
+                        float beta, float* c, u32 ldc) {
+    for (u32 i = 0; i < m; i++) {
+        for (u32 j = 0; j < n; j++) {
+            float sum = 0.0f;
+            for (u32 p = 0; p < k; p++) {
+                sum += a[(i64) i*rsa + (i64) p*csa]*b[(i64) p*rsb + (i64) j*csb];
+            }
+            float* c_ij = c + i*ldc + j;
+            *c_ij = beta == 0.0f ? sum : sum + beta*(*c_ij);
+        }
+    }
+}
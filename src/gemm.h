@@ -0,0 +1,182 @@
+#pragma once
+
+
+#include "util.h"
+#include "half.h"
+#include <cmath>
+
+
+/***************************************************************************
+ * General matrix multiplication
+ *
+ * All matrices are described by a base pointer and a row- and column stride
+ * (in number of elements), this makes it possible to multiply transposed
+ * or strided matrices without first copying them.
+ ***************************************************************************/
+
+
+/**
+ * Element-wise activation that can be applied by the gemm epilogue.
+ */
+enum Gemm_Activation {
+    Gemm_Activation_None,
+    Gemm_Activation_ReLU,
+    Gemm_Activation_Sigmoid,
+    Gemm_Activation_Tanh,
+};
+
+
+/**
+ * Epilogue applied to C once the product is complete while the tile is
+ * still in registers, i.e. C = activation(A*B + beta*C + bias) where
+ * `bias[i]` is added to every element of row `i` (nullptr for no bias).
+ */
+struct Gemm_Epilogue {
+    const float* bias = nullptr;
+    Gemm_Activation activation = Gemm_Activation_None;
+};
+
+
+/**
+ * Micro-kernel computes a MR x NR tile of C from packed panels of A and B.
+ * The panel of A is stored as `kc` columns of MR elements and the panel of B
+ * is stored as `kc` rows of NR elements. If `beta` is zero then C is
+ * never read, so it may contain uninitialized memory. The optional `bias`
+ * points at the MR bias values of the tile's rows and is applied together
+ * with the activation before the tile is stored.
+ */
+typedef void Gemm_Micro_Kernel(u32 kc, const float* a, const float* b,
+                               float* c, u32 ldc, float beta,
+                               const float* bias, Gemm_Activation activation);
+
+
+/**
+ * Register tile size shared by all the micro-kernels,
+ * i.e. the packed panels have the same layout regardless of kernel.
+ */
+const u32 GEMM_MR = 6;
+const u32 GEMM_NR = 16;
+
+
+/**
+ * Cache blocking parameters, the packed block of A (MC x KC) is sized
+ * to stay in L2 and the packed panel of B (KC x NC) is sized for L3.
+ * A single KC x NR micro-panel of B is then streamed from L1.
+ */
+const u32 GEMM_MC = 120;
+const u32 GEMM_KC = 256;
+const u32 GEMM_NC = 3072;
+
+
+enum Gemm_Kernel_Type {
+    Gemm_Kernel_Auto,
+    Gemm_Kernel_Scalar,
+    Gemm_Kernel_AVX2,
+};
+
+
+/**
+ * Forces a specific micro-kernel, mostly useful for benchmarking.
+ * The default is to pick the fastest kernel supported by the CPU.
+ * Returns false if the requested kernel is not supported.
+ */
+bool gemm_set_kernel(Gemm_Kernel_Type type);
+
+
+/**
+ * Returns the name of the micro-kernel that is currently in use.
+ */
+const char* gemm_kernel_name();
+
+
+/**
+ * Computes C = A*B + beta*C where A is m x k, B is k x n and C is m x n.
+ * C is stored row major with leading dimension `ldc`.
+ */
+void gemm_f32(u32 m, u32 n, u32 k,
+              const float* a, i32 rsa, i32 csa,
+              const float* b, i32 rsb, i32 csb,
+              float beta, float* c, u32 ldc);
+
+
+/**
+ * Same as `gemm_f32` but applies the bias and activation of the epilogue
+ * as part of the last pass over C, instead of as separate passes.
+ */
+void gemm_f32_fused(u32 m, u32 n, u32 k,
+                    const float* a, i32 rsa, i32 csa,
+                    const float* b, i32 rsb, i32 csb,
+                    float beta, float* c, u32 ldc,
+                    const Gemm_Epilogue& epilogue);
+
+
+/**
+ * Same as `gemm_f32_fused` but the elements of A are stored as `a_dtype`,
+ * i.e. fp16 or bf16 weights. They are converted to fp32 while A is packed
+ * (or by the matrix-vector kernel when C has a single column) and the
+ * products are accumulated in fp32. The strides of A are in elements.
+ */
+void gemm_mixed_fused(Dtype a_dtype, u32 m, u32 n, u32 k,
+                      const void* a, i32 rsa, i32 csa,
+                      const float* b, i32 rsb, i32 csb,
+                      float beta, float* c, u32 ldc,
+                      const Gemm_Epilogue& epilogue);
+
+
+/**
+ * Reference implementation using a plain triple loop,
+ * used for verifying and benchmarking the blocked implementation.
+ */
+void gemm_f32_reference(u32 m, u32 n, u32 k,
+                        const float* a, i32 rsa, i32 csa,
+                        const float* b, i32 rsb, i32 csb,
+                        float beta, float* c, u32 ldc);
+
+
+/**
+ * Matrix-vector kernel computes y = A*x + beta*y where A is m x k with
+ * contiguous rows (leading dimension `lda`) and x is contiguous.
+ * Used instead of the packed path when C only has a single column, since
+ * then every element of A is only used once and packing doesn't pay off.
+ */
+typedef void Gemv_Kernel(u32 m, u32 k, const float* a, u32 lda,
+                         const float* x, float beta, float* y, u32 incy,
+                         const float* bias, Gemm_Activation activation);
+
+
+/**
+ * Matrix-vector kernel with A stored in 16 bits, converted while it is streamed.
+ */
+typedef void Gemv_Half_Kernel(u32 m, u32 k, const u16* a, u32 lda,
+                              const float* x, float beta, float* y, u32 incy,
+                              const float* bias, Gemm_Activation activation);
+
+
+/**
+ * Applies bias and activation to a single value, used by the scalar
+ * kernels and for edge tiles. Static so that the copy in the AVX2
+ * translation unit is never picked by the linker for the other ones.
+ */
+static inline float gemm_apply_epilogue(float value, const float* bias, u32 row, Gemm_Activation activation) {
+    if (bias) value += bias[row];
+    switch (activation) {
+        case Gemm_Activation_None: break;
+        case Gemm_Activation_ReLU: value = value > 0.0f ? value : 0.0f; break;
+        case Gemm_Activation_Sigmoid: value = 1.0f/(1.0f + expf(-value)); break;
+        case Gemm_Activation_Tanh: value = tanhf(value); break;
+    }
+    return value;
+}
+
+
+// Micro-kernels, the AVX2 kernel lives in its own translation unit
+// since it is compiled with AVX2 and FMA code generation enabled,
+// the same for the half precision kernels with F16C.
+Gemm_Micro_Kernel gemm_micro_kernel_scalar;
+Gemm_Micro_Kernel gemm_micro_kernel_avx2;
+Gemv_Kernel gemv_kernel_scalar;
+Gemv_Kernel gemv_kernel_avx2;
+Gemv_Half_Kernel gemv_kernel_f16_scalar;
+Gemv_Half_Kernel gemv_kernel_f16_f16c;
+Gemv_Half_Kernel gemv_kernel_bf16_scalar;
+Gemv_Half_Kernel gemv_kernel_bf16_f16c;
@@ -0,0 +1,175 @@
+// NOTE: this file is compiled with AVX2 and FMA enabled (see premake5.lua),
+// so only include headers without inline functions to avoid the compiler
+// emitting AVX2 instructions into code shared with the other translation units.
+#include "gemm.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include "kernels_impl.h"
+
+
+/**
+ * 6x16 micro-kernel, keeps the C tile in 12 ymm registers and
+ * broadcasts one element of A at a time against two vectors of B.
+ */
+void gemm_micro_kernel_avx2(u32 kc, const float* a, const float* b,
+                            float* c, u32 ldc, float beta,
+                            const float* bias, Gemm_Activation activation) {
+    __m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps();
+    __m256 c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps();
+    __m256 c20 = _mm256_setzero_ps(), c21 = _mm256_setzero_ps();
+    __m256 c30 = _mm256_setzero_ps(), c31 = _mm256_setzero_ps();
+    __m256 c40 = _mm256_setzero_ps(), c41 = _mm256_setzero_ps();
+    __m256 c50 = _mm256_setzero_ps(), c51 = _mm256_setzero_ps();
+
+    for (u32 p = 0; p < kc; p++) {
+        __m256 b0 = _mm256_load_ps(b);
+        __m256 b1 = _mm256_load_ps(b + 8);
+        __m256 ai;
+
+        ai = _mm256_broadcast_ss(a + 0);
+        c00 = _mm256_fmadd_ps(ai, b0, c00); c01 = _mm256_fmadd_ps(ai, b1, c01);
+        ai = _mm256_broadcast_ss(a + 1);
+        c10 = _mm256_fmadd_ps(ai, b0, c10); c11 = _mm256_fmadd_ps(ai, b1, c11);
+        ai = _mm256_broadcast_ss(a + 2);
+        c20 = _mm256_fmadd_ps(ai, b0, c20); c21 = _mm256_fmadd_ps(ai, b1, c21);
+        ai = _mm256_broadcast_ss(a + 3);
+        c30 = _mm256_fmadd_ps(ai, b0, c30); c31 = _mm256_fmadd_ps(ai, b1, c31);
+        ai = _mm256_broadcast_ss(a + 4);
+        c40 = _mm256_fmadd_ps(ai, b0, c40); c41 = _mm256_fmadd_ps(ai, b1, c41);
+        ai = _mm256_broadcast_ss(a + 5);
+        c50 = _mm256_fmadd_ps(ai, b0, c50); c51 = _mm256_fmadd_ps(ai, b1, c51);
+
+        a += GEMM_MR;
+        b += GEMM_NR;
+    }
+
+    __m256 rows[GEMM_MR][2] = {
+        { c00, c01 }, { c10, c11 }, { c20, c21 },
+        { c30, c31 }, { c40, c41 }, { c50, c51 },
+    };
+
+    if (beta != 0.0f) {
+        __m256 vbeta = _mm256_set1_ps(beta);
+        for (u32 i = 0; i < GEMM_MR; i++) {
+            float* c_row = c + i*ldc;
+            rows[i][0] = _mm256_fmadd_ps(vbeta, _mm256_loadu_ps(c_row), rows[i][0]);
+            rows[i][1] = _mm256_fmadd_ps(vbeta, _mm256_loadu_ps(c_row + 8), rows[i][1]);
+        }
+    }
+
+    if (bias) {
+        for (u32 i = 0; i < GEMM_MR; i++) {
+            __m256 vbias = _mm256_broadcast_ss(bias + i);
+            rows[i][0] = _mm256_add_ps(rows[i][0], vbias);
+            rows[i][1] = _mm256_add_ps(rows[i][1], vbias);
+        }
+    }
+
+    switch (activation) {
+        case Gemm_Activation_None: {
+            break;
+        }
+
+        case Gemm_Activation_ReLU: {
+            __m256 zero = _mm256_setzero_ps();
+            for (u32 i = 0; i < GEMM_MR; i++) {
+                rows[i][0] = _mm256_max_ps(rows[i][0], zero);
+                rows[i][1] = _mm256_max_ps(rows[i][1], zero);
+            }
+            break;
+        }
+
+        case Gemm_Activation_Sigmoid: {
+            for (u32 i = 0; i < GEMM_MR; i++) {
+                rows[i][0] = vec_sigmoid<Vec_AVX2>(rows[i][0]);
+                rows[i][1] = vec_sigmoid<Vec_AVX2>(rows[i][1]);
+            }
+            break;
+        }
+
+        case Gemm_Activation_Tanh: {
+            for (u32 i = 0; i < GEMM_MR; i++) {
+                rows[i][0] = vec_tanh<Vec_AVX2>(rows[i][0]);
+                rows[i][1] = vec_tanh<Vec_AVX2>(rows[i][1]);
+            }
+            break;
+        }
+    }
+
+    for (u32 i = 0; i < GEMM_MR; i++) {
+        _mm256_storeu_ps(c + i*ldc, rows[i][0]);
+        _mm256_storeu_ps(c + i*ldc + 8, rows[i][1]);
+    }
+}
+
+
+static inline float gemv_hsum_avx2(__m256 v) {
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+    return _mm_cvtss_f32(sum);
+}
+
+
+/**
+ * Computes four dot products at a time so every load of x is reused
+ * four times, A is streamed through exactly once.
+ */
+void gemv_kernel_avx2(u32 m, u32 k, const float* a, u32 lda,
+                      const float* x, float beta, float* y, u32 incy,
+                      const float* bias, Gemm_Activation activation) {
+    u32 i = 0;
+    for (; i + 4 <= m; i += 4) {
+        const float* a0 = a + (i64) i*lda;
+        const float* a1 = a0 + lda;
+        const float* a2 = a1 + lda;
+        const float* a3 = a2 + lda;
+        __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+        __m256 s2 = _mm256_setzero_ps(), s3 = _mm256_setzero_ps();
+
+        u32 p = 0;
+        for (; p + 8 <= k; p += 8) {
+            __m256 xv = _mm256_loadu_ps(x + p);
+            s0 = _mm256_fmadd_ps(_mm256_loadu_ps(a0 + p), xv, s0);
+            s1 = _mm256_fmadd_ps(_mm256_loadu_ps(a1 + p), xv, s1);
+            s2 = _mm256_fmadd_ps(_mm256_loadu_ps(a2 + p), xv, s2);
+            s3 = _mm256_fmadd_ps(_mm256_loadu_ps(a3 + p), xv, s3);
+        }
+
+        float sums[4] = { gemv_hsum_avx2(s0), gemv_hsum_avx2(s1), gemv_hsum_avx2(s2), gemv_hsum_avx2(s3) };
+        for (; p < k; p++) {
+            sums[0] += a0[p]*x[p];
+            sums[1] += a1[p]*x[p];
+            sums[2] += a2[p]*x[p];
+            sums[3] += a3[p]*x[p];
+        }
+
+        for (u32 r = 0; r < 4; r++) {
+            float* y_i = y + (i64) (i + r)*incy;
+            float value = beta == 0.0f ? sums[r] : sums[r] + beta*(*y_i);
+            *y_i = gemm_apply_epilogue(value, bias, i + r, activation);
+        }
+    }
+
+    if (i < m) {
+        gemv_kernel_scalar(m - i, k, a + (i64) i*lda, lda, x, beta, y + (i64) i*incy, incy,
+                           bias ? bias + i : nullptr, activation);
+    }
+}
+
+#else
+
+void gemm_micro_kernel_avx2(u32 kc, const float* a, const float* b,
+                            float* c, u32 ldc, float beta,
+                            const float* bias, Gemm_Activation activation) {
+    gemm_micro_kernel_scalar(kc, a, b, c, ldc, beta, bias, activation);
+}
+
+
+void gemv_kernel_avx2(u32 m, u32 k, const float* a, u32 lda,
+                      const float* x, float beta, float* y, u32 incy,
+                      const float* bias, Gemm_Activation activation) {
+    gemv_kernel_scalar(m, k, a, lda, x, beta, y, incy, bias, activation);
+}
+
+#endif
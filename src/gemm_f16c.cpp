@@ -0,0 +1,109 @@
+// NOTE: this file is compiled with AVX2, FMA and F16C enabled (see premake5.lua),
+// so only include headers without inline functions to avoid the compiler
+// emitting AVX2 instructions into code shared with the other translation units.
+#include "gemm.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+
+
+namespace {
+
+/**
+ * Loads 8 elements of A and converts them to fp32.
+ */
+template <Dtype T>
+inline __m256 load_half(const u16* a) {
+    __m128i half = _mm_loadu_si128((const __m128i*) a);
+    if (T == Dtype_F16) return _mm256_cvtph_ps(half);
+    return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(half), 16));
+}
+
+
+inline float hsum(__m256 v) {
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+    return _mm_cvtss_f32(sum);
+}
+
+
+/**
+ * Same as gemv_kernel_avx2, four dot products at a time so every load of x
+ * is reused four times, while A is streamed at half the bytes.
+ */
+template <Dtype T>
+void gemv_half(u32 m, u32 k, const u16* a, u32 lda,
+               const float* x, float beta, float* y, u32 incy,
+               const float* bias, Gemm_Activation activation) {
+    u32 i = 0;
+    for (; i + 4 <= m; i += 4) {
+        const u16* a0 = a + (i64) i*lda;
+        const u16* a1 = a0 + lda;
+        const u16* a2 = a1 + lda;
+        const u16* a3 = a2 + lda;
+        __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+        __m256 s2 = _mm256_setzero_ps(), s3 = _mm256_setzero_ps();
+
+        u32 p = 0;
+        for (; p + 8 <= k; p += 8) {
+            __m256 xv = _mm256_loadu_ps(x + p);
+            s0 = _mm256_fmadd_ps(load_half<T>(a0 + p), xv, s0);
+            s1 = _mm256_fmadd_ps(load_half<T>(a1 + p), xv, s1);
+            s2 = _mm256_fmadd_ps(load_half<T>(a2 + p), xv, s2);
+            s3 = _mm256_fmadd_ps(load_half<T>(a3 + p), xv, s3);
+        }
+
+        float sums[4] = { hsum(s0), hsum(s1), hsum(s2), hsum(s3) };
+        for (; p < k; p++) {
+            sums[0] += dtype_load(T, a0, p)*x[p];
+            sums[1] += dtype_load(T, a1, p)*x[p];
+            sums[2] += dtype_load(T, a2, p)*x[p];
+            sums[3] += dtype_load(T, a3, p)*x[p];
+        }
+
+        for (u32 r = 0; r < 4; r++) {
+            float* y_i = y + (i64) (i + r)*incy;
+            float value = beta == 0.0f ? sums[r] : sums[r] + beta*(*y_i);
+            *y_i = gemm_apply_epilogue(value, bias, i + r, activation);
+        }
+    }
+
+    if (i < m) {
+        Gemv_Half_Kernel* rest = T == Dtype_F16 ? gemv_kernel_f16_scalar : gemv_kernel_bf16_scalar;
+        rest(m - i, k, a + (i64) i*lda, lda, x, beta, y + (i64) i*incy, incy, bias ? bias + i : nullptr, activation);
+    }
+}
+
+}
+
+
+void gemv_kernel_f16_f16c(u32 m, u32 k, const u16* a, u32 lda,
+                          const float* x, float beta, float* y, u32 incy,
+                          const float* bias, Gemm_Activation activation) {
+    gemv_half<Dtype_F16>(m, k, a, lda, x, beta, y, incy, bias, activation);
+}
+
+
+void gemv_kernel_bf16_f16c(u32 m, u32 k, const u16* a, u32 lda,
+                           const float* x, float beta, float* y, u32 incy,
+                           const float* bias, Gemm_Activation activation) {
+    gemv_half<Dtype_BF16>(m, k, a, lda, x, beta, y, incy, bias, activation);
+}
+
+#else
+
+void gemv_kernel_f16_f16c(u32 m, u32 k, const u16* a, u32 lda,
+                          const float* x, float beta, float* y, u32 incy,
+                          const float* bias, Gemm_Activation activation) {
+    gemv_kernel_f16_scalar(m, k, a, lda, x, beta, y, incy, bias, activation);
+}
+
+
+void gemv_kernel_bf16_f16c(u32 m, u32 k, const u16* a, u32 lda,
+                           const float* x, float beta, float* y, u32 incy,
+                           const float* bias, Gemm_Activation activation) {
+    gemv_kernel_bf16_scalar(m, k, a, lda, x, beta, y, incy, bias, activation);
+}
+
+#endif
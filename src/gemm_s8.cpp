@@ -0,0 +1,103 @@
+#include "gemm_s8.h"
+#include "cpu.h"
+#include "profiler.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cassert>
+
+
+static Gemm_S8_Kernel* gemm_s8_kernel = nullptr;
+static const char* gemm_s8_kernel_label = "none";
+
+
+bool gemm_s8_set_kernel(Gemm_S8_Kernel_Type type) {
+    const Cpu_Features& cpu = cpu_features();
+    switch (type) {
+        case Gemm_S8_Kernel_Auto: {
+            if (cpu.avx512vnni) {
+                return gemm_s8_set_kernel(Gemm_S8_Kernel_VNNI);
+            }
+            if (cpu.avx2) {
+                return gemm_s8_set_kernel(Gemm_S8_Kernel_AVX2);
+            }
+            return gemm_s8_set_kernel(Gemm_S8_Kernel_Scalar);
+        }
+
+        case Gemm_S8_Kernel_Scalar: {
+            gemm_s8_kernel = gemm_s8_kernel_scalar;
+            gemm_s8_kernel_label = "scalar";
+            return true;
+        }
+
+        case Gemm_S8_Kernel_AVX2: {
+            if (!cpu.avx2) return false;
+            gemm_s8_kernel = gemm_s8_kernel_avx2;
+            gemm_s8_kernel_label = "avx2";
+            return true;
+        }
+
+        case Gemm_S8_Kernel_VNNI: {
+            if (!cpu.avx512vnni) return false;
+            gemm_s8_kernel = gemm_s8_kernel_vnni;
+            gemm_s8_kernel_label = "vnni";
+            return true;
+        }
+    }
+    return false;
+}
+
+
+const char* gemm_s8_kernel_name() {
+    if (!gemm_s8_kernel) gemm_s8_set_kernel(Gemm_S8_Kernel_Auto);
+    return gemm_s8_kernel_label;
+}
+
+
+void gemm_s8_kernel_scalar(u32 m, u32 n, u32 k, const i8* a, u32 lda,
+                           const u8* b, u32 ldb, i32* c, u32 ldc) {
+    for (u32 i = 0; i < m; i++) {
+        const i8* a_row = a + (u64) i*lda;
+        for (u32 j = 0; j < n; j++) {
+            const u8* b_row = b + (u64) j*ldb;
+            i32 sum = 0;
+            for (u32 p = 0; p < k; p++) {
+                sum += (i32) a_row[p]*(i32) b_row[p];
+            }
+            c[(u64) i*ldc + j] = sum;
+        }
+    }
+}
+
+
+/**
+ * Below this many operations the product runs on the calling thread.
+ */
+const u64 GEMM_S8_PARALLEL_MIN_OPS = 1 << 20;
+
+
+/**
+ * Number of rows of A per task when split over the thread pool.
+ */
+const u32 GEMM_S8_ROWS_PER_TASK = 16;
+
+
+void gemm_s8(u32 m, u32 n, u32 k, const i8* a, u32 lda,
+             const u8* b, u32 ldb, i32* c, u32 ldc) {
+    assert(k % GEMM_S8_K_ALIGNMENT == 0);
+    PROFILE_SCOPE("gemm_s8", PROFILE_KERNEL, 2ull*m*n*k, (u64) m*k + (u64) k*n + sizeof(i32)*m*n);
+    if (!gemm_s8_kernel) gemm_s8_set_kernel(Gemm_S8_Kernel_Auto);
+    Gemm_S8_Kernel* kernel = gemm_s8_kernel;
+
+    if (2ull*m*n*k < GEMM_S8_PARALLEL_MIN_OPS) {
+        kernel(m, n, k, a, lda, b, ldb, c, ldc);
+        return;
+    }
+
+    u32 num_tasks = (m + GEMM_S8_ROWS_PER_TASK - 1)/GEMM_S8_ROWS_PER_TASK;
+    parallel_for(0, num_tasks, 1, [=](u64 begin, u64 end) {
+        u32 row_begin = (u32) begin*GEMM_S8_ROWS_PER_TASK;
+        u32 row_end = std::min((u32) end*GEMM_S8_ROWS_PER_TASK, m);
+        kernel(row_end - row_begin, n, k, a + (u64) row_begin*lda, lda,
+               b, ldb, c + (u64) row_begin*ldc, ldc);
+    });
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+
+#include "util.h"
+
+
+/***************************************************************************
+ * Int8 matrix multiplication
+ *
+ * Products of signed 8-bit weights and unsigned 7-bit activations with
+ * 32-bit accumulation, used by the quantized layers (see quantize.h).
+ * The activations use 7 bits so that the sum of two products in pmaddubsw
+ * can never saturate 16 bits (2*127*127 < 32767), the VNNI and scalar
+ * kernels use the same range so every kernel gives exactly the same result.
+ ***************************************************************************/
+
+
+/**
+ * The shared dimension is a multiple of this many elements, i.e. one
+ * AVX-512 register, rows are padded with zeros up to it.
+ */
+const u32 GEMM_S8_K_ALIGNMENT = 64;
+
+
+/**
+ * Largest value of the unsigned activations.
+ */
+const i32 GEMM_S8_B_MAX = 127;
+
+
+/**
+ * Int8 kernel computes C = A*B^T, where A is m x k signed 8-bit (the
+ * weights, rows `lda` apart), B is n x k unsigned 7-bit (the samples, rows
+ * `ldb` apart) and C is m x n 32-bit row major with leading dimension `ldc`.
+ */
+typedef void Gemm_S8_Kernel(u32 m, u32 n, u32 k, const i8* a, u32 lda,
+                            const u8* b, u32 ldb, i32* c, u32 ldc);
+
+
+enum Gemm_S8_Kernel_Type {
+    Gemm_S8_Kernel_Auto,
+    Gemm_S8_Kernel_Scalar,
+    Gemm_S8_Kernel_AVX2,
+    Gemm_S8_Kernel_VNNI,
+};
+
+
+/**
+ * Forces a specific int8 kernel, mostly useful for benchmarking.
+ * Returns false if the requested kernel is not supported.
+ */
+bool gemm_s8_set_kernel(Gemm_S8_Kernel_Type type);
+
+
+/**
+ * Returns the name of the int8 kernel that is currently in use.
+ */
+const char* gemm_s8_kernel_name();
+
+
+/**
+ * Computes C = A*B^T using the current int8 kernel,
+ * split over the thread pool when the product is large enough.
+ */
+void gemm_s8(u32 m, u32 n, u32 k, const i8* a, u32 lda,
+             const u8* b, u32 ldb, i32* c, u32 ldc);
+
+
+// The AVX2 kernel uses pmaddubsw and pmaddwd, the VNNI kernel vpdpbusd,
+// both live in their own translation unit compiled for that instruction set.
+Gemm_S8_Kernel gemm_s8_kernel_scalar;
+Gemm_S8_Kernel gemm_s8_kernel_avx2;
+Gemm_S8_Kernel gemm_s8_kernel_vnni;
@@ -0,0 +1,92 @@
+// NOTE: this file is compiled with AVX2 enabled (see premake5.lua), so only
+// include headers without inline functions to avoid the compiler emitting
+// AVX2 instructions into code shared with the other translation units.
+#include "gemm_s8.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+
+
+namespace {
+
+/**
+ * Adds the products of 32 unsigned and signed bytes to 8 int32 lanes,
+ * pmaddubsw sums pairs into 16 bits which can't saturate for 7-bit
+ * activations, pmaddwd with ones then widens and sums the pairs again.
+ */
+inline __m256i dot_u8s8(__m256i acc, __m256i b, __m256i a, __m256i ones) {
+    __m256i pairs = _mm256_maddubs_epi16(b, a);
+    return _mm256_add_epi32(acc, _mm256_madd_epi16(pairs, ones));
+}
+
+
+inline i32 reduce_add(__m256i v) {
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4E));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1));
+    return _mm_cvtsi128_si32(sum);
+}
+
+
+/**
+ * Computes a R x S tile of C, every row of A loaded is used against S
+ * rows of B and vice versa, the R*S accumulators stay in registers.
+ */
+template <u32 R, u32 S>
+inline void gemm_s8_tile(u32 k, const i8* a, u32 lda, const u8* b, u32 ldb, i32* c, u32 ldc) {
+    const __m256i ones = _mm256_set1_epi16(1);
+    __m256i acc[R][S];
+    for (u32 i = 0; i < R; i++) {
+        for (u32 j = 0; j < S; j++) acc[i][j] = _mm256_setzero_si256();
+    }
+
+    for (u32 p = 0; p < k; p += 32) {
+        __m256i bv[S];
+        for (u32 j = 0; j < S; j++) {
+            bv[j] = _mm256_loadu_si256((const __m256i*) (b + (u64) j*ldb + p));
+        }
+        for (u32 i = 0; i < R; i++) {
+            __m256i av = _mm256_loadu_si256((const __m256i*) (a + (u64) i*lda + p));
+            for (u32 j = 0; j < S; j++) acc[i][j] = dot_u8s8(acc[i][j], bv[j], av, ones);
+        }
+    }
+
+    for (u32 i = 0; i < R; i++) {
+        for (u32 j = 0; j < S; j++) c[(u64) i*ldc + j] = reduce_add(acc[i][j]);
+    }
+}
+
+}
+
+
+void gemm_s8_kernel_avx2(u32 m, u32 n, u32 k, const i8* a, u32 lda,
+                         const u8* b, u32 ldb, i32* c, u32 ldc) {
+    u32 i = 0;
+    for (; i + 4 <= m; i += 4) {
+        u32 j = 0;
+        for (; j + 2 <= n; j += 2) {
+            gemm_s8_tile<4, 2>(k, a + (u64) i*lda, lda, b + (u64) j*ldb, ldb, c + (u64) i*ldc + j, ldc);
+        }
+        for (; j < n; j++) {
+            gemm_s8_tile<4, 1>(k, a + (u64) i*lda, lda, b + (u64) j*ldb, ldb, c + (u64) i*ldc + j, ldc);
+        }
+    }
+    for (; i < m; i++) {
+        u32 j = 0;
+        for (; j + 4 <= n; j += 4) {
+            gemm_s8_tile<1, 4>(k, a + (u64) i*lda, lda, b + (u64) j*ldb, ldb, c + (u64) i*ldc + j, ldc);
+        }
+        for (; j < n; j++) {
+            gemm_s8_tile<1, 1>(k, a + (u64) i*lda, lda, b + (u64) j*ldb, ldb, c + (u64) i*ldc + j, ldc);
+        }
+    }
+}
+
+#else
+
+void gemm_s8_kernel_avx2(u32 m, u32 n, u32 k, const i8* a, u32 lda,
+                         const u8* b, u32 ldb, i32* c, u32 ldc) {
+    gemm_s8_kernel_scalar(m, n, k, a, lda, b, ldb, c, ldc);
+}
+
+#endif
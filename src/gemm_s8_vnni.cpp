@@ -0,0 +1,81 @@
+// NOTE: this file is compiled with AVX-512 VNNI enabled (see premake5.lua), so only
+// include headers without inline functions to avoid the compiler emitting
+// AVX-512 instructions into code shared with the other translation units.
+#include "gemm_s8.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+
+
+namespace {
+
+inline i32 reduce_add(__m512i v) {
+    __m256i half = _mm256_add_epi32(_mm512_castsi512_si256(v), _mm512_extracti64x4_epi64(v, 1));
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(half), _mm256_extracti128_si256(half, 1));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4E));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1));
+    return _mm_cvtsi128_si32(sum);
+}
+
+
+/**
+ * Computes a R x S tile of C, vpdpbusd multiplies 64 unsigned and signed
+ * bytes and adds groups of four products straight into 16 int32 lanes.
+ */
+template <u32 R, u32 S>
+inline void gemm_s8_tile(u32 k, const i8* a, u32 lda, const u8* b, u32 ldb, i32* c, u32 ldc) {
+    __m512i acc[R][S];
+    for (u32 i = 0; i < R; i++) {
+        for (u32 j = 0; j < S; j++) acc[i][j] = _mm512_setzero_si512();
+    }
+
+    for (u32 p = 0; p < k; p += 64) {
+        __m512i bv[S];
+        for (u32 j = 0; j < S; j++) {
+            bv[j] = _mm512_loadu_si512((const void*) (b + (u64) j*ldb + p));
+        }
+        for (u32 i = 0; i < R; i++) {
+            __m512i av = _mm512_loadu_si512((const void*) (a + (u64) i*lda + p));
+            for (u32 j = 0; j < S; j++) acc[i][j] = _mm512_dpbusd_epi32(acc[i][j], bv[j], av);
+        }
+    }
+
+    for (u32 i = 0; i < R; i++) {
+        for (u32 j = 0; j < S; j++) c[(u64) i*ldc + j] = reduce_add(acc[i][j]);
+    }
+}
+
+}
+
+
+void gemm_s8_kernel_vnni(u32 m, u32 n, u32 k, const i8* a, u32 lda,
+                         const u8* b, u32 ldb, i32* c, u32 ldc) {
+    u32 i = 0;
+    for (; i + 4 <= m; i += 4) {
+        u32 j = 0;
+        for (; j + 4 <= n; j += 4) {
+            gemm_s8_tile<4, 4>(k, a + (u64) i*lda, lda, b + (u64) j*ldb, ldb, c + (u64) i*ldc + j, ldc);
+        }
+        for (; j < n; j++) {
+            gemm_s8_tile<4, 1>(k, a + (u64) i*lda, lda, b + (u64) j*ldb, ldb, c + (u64) i*ldc + j, ldc);
+        }
+    }
+    for (; i < m; i++) {
+        u32 j = 0;
+        for (; j + 4 <= n; j += 4) {
+            gemm_s8_tile<1, 4>(k, a + (u64) i*lda, lda, b + (u64) j*ldb, ldb, c + (u64) i*ldc + j, ldc);
+        }
+        for (; j < n; j++) {
+            gemm_s8_tile<1, 1>(k, a + (u64) i*lda, lda, b + (u64) j*ldb, ldb, c + (u64) i*ldc + j, ldc);
+        }
+    }
+}
+
+#else
+
+void gemm_s8_kernel_vnni(u32 m, u32 n, u32 k, const i8* a, u32 lda,
+                         const u8* b, u32 ldb, i32* c, u32 ldc) {
+    gemm_s8_kernel_scalar(m, n, k, a, lda, b, ldb, c, ldc);
+}
+
+#endif
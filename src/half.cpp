@@ -0,0 +1,106 @@
+#include "half.h"
+#include "cpu.h"
+#include <cassert>
+
+
+static Half_To_F32_Kernel* half_f16_load_kernel = nullptr;
+static Half_To_F32_Kernel* half_bf16_load_kernel = nullptr;
+static Half_From_F32_Kernel* half_f16_store_kernel = nullptr;
+static Half_From_F32_Kernel* half_bf16_store_kernel = nullptr;
+static const char* half_kernel_label = "none";
+
+
+const char* dtype_name(Dtype dtype) {
+    switch (dtype) {
+        case Dtype_F32: return "f32";
+        case Dtype_F16: return "f16";
+        case Dtype_BF16: return "bf16";
+    }
+    return "unknown";
+}
+
+
+bool half_set_kernel(Half_Kernel_Type type) {
+    const Cpu_Features& cpu = cpu_features();
+    switch (type) {
+        case Half_Kernel_Auto: {
+            if (cpu.avx2 && cpu.f16c && cpu.avx512bf16) {
+                return half_set_kernel(Half_Kernel_AVX512_BF16);
+            }
+            if (cpu.avx2 && cpu.f16c) {
+                return half_set_kernel(Half_Kernel_F16C);
+            }
+            return half_set_kernel(Half_Kernel_Scalar);
+        }
+
+        case Half_Kernel_Scalar: {
+            half_f16_load_kernel = half_f16_to_f32_scalar;
+            half_bf16_load_kernel = half_bf16_to_f32_scalar;
+            half_f16_store_kernel = half_f32_to_f16_scalar;
+            half_bf16_store_kernel = half_f32_to_bf16_scalar;
+            half_kernel_label = "scalar";
+            return true;
+        }
+
+        case Half_Kernel_F16C: {
+            if (!(cpu.avx2 && cpu.f16c)) return false;
+            half_f16_load_kernel = half_f16_to_f32_f16c;
+            half_bf16_load_kernel = half_bf16_to_f32_f16c;
+            half_f16_store_kernel = half_f32_to_f16_f16c;
+            half_bf16_store_kernel = half_f32_to_bf16_f16c;
+            half_kernel_label = "f16c";
+            return true;
+        }
+
+        case Half_Kernel_AVX512_BF16: {
+            if (!(cpu.avx2 && cpu.f16c && cpu.avx512bf16)) return false;
+            half_f16_load_kernel = half_f16_to_f32_f16c;
+            half_bf16_load_kernel = half_bf16_to_f32_f16c;
+            half_f16_store_kernel = half_f32_to_f16_f16c;
+            half_bf16_store_kernel = half_f32_to_bf16_avx512;
+            half_kernel_label = "f16c+avx512bf16";
+            return true;
+        }
+    }
+    return false;
+}
+
+
+const char* half_kernel_name() {
+    if (!half_f16_load_kernel) half_set_kernel(Half_Kernel_Auto);
+    return half_kernel_label;
+}
+
+
+void half_to_f32(Dtype dtype, float* out, const u16* in, u64 n) {
+    if (!half_f16_load_kernel) half_set_kernel(Half_Kernel_Auto);
+    assert(dtype != Dtype_F32);
+    (dtype == Dtype_F16 ? half_f16_load_kernel : half_bf16_load_kernel)(out, in, n);
+}
+
+
+void half_from_f32(Dtype dtype, u16* out, const float* in, u64 n) {
+    if (!half_f16_load_kernel) half_set_kernel(Half_Kernel_Auto);
+    assert(dtype != Dtype_F32);
+    (dtype == Dtype_F16 ? half_f16_store_kernel : half_bf16_store_kernel)(out, in, n);
+}
+
+
+void half_f16_to_f32_scalar(float* out, const u16* in, u64 n) {
+    for (u64 i = 0; i < n; i++) out[i] = half_f16_to_f32(in[i]);
+}
+
+
+void half_bf16_to_f32_scalar(float* out, const u16* in, u64 n) {
+    for (u64 i = 0; i < n; i++) out[i] = half_bf16_to_f32(in[i]);
+}
+
+
+void half_f32_to_f16_scalar(u16* out, const float* in, u64 n) {
+    for (u64 i = 0; i < n; i++) out[i] = half_f32_to_f16(in[i]);
+}
+
+
+void half_f32_to_bf16_scalar(u16* out, const float* in, u64 n) {
+    for (u64 i = 0; i < n; i++) out[i] = half_f32_to_bf16(in[i]);
+}
@@ -0,0 +1,191 @@
+#pragma once
+
+
+#include "util.h"
+#include <cmath>
+#include <cstring>
+
+
+/***************************************************************************
+ * Half precision
+ *
+ * Weights can be stored in 16 bits and are converted to fp32 as they are
+ * read by the kernels, all the arithmetic and accumulation stays in fp32.
+ * This halves the memory of the weights and the bytes streamed by memory
+ * bound passes (e.g. a single sample through a dense layer).
+ *
+ *   F16     IEEE half, 5 exponent bits and 10 mantissa bits, values up to
+ *           65504 with ~3 significant digits
+ *   BF16    the upper 16 bits of an fp32, same range as fp32 with ~2
+ *           significant digits, so it can't overflow when converting
+ *
+ * Converting arrays uses F16C (and AVX-512 BF16 for rounding to bf16)
+ * when the CPU supports it and bit manipulation otherwise.
+ ***************************************************************************/
+
+
+/**
+ * Element type of a tensor, the values are stored in model files
+ * so new ones must be added at the end.
+ */
+enum Dtype : u8 {
+    Dtype_F32,
+    Dtype_F16,
+    Dtype_BF16,
+};
+
+
+/**
+ * Returns the size in bytes of one element.
+ */
+static inline u32 dtype_size(Dtype dtype) {
+    return dtype == Dtype_F32 ? 4 : 2;
+}
+
+
+const char* dtype_name(Dtype dtype);
+
+
+/**
+ * Scalar conversions, the ones to 16 bits round to nearest even. Static
+ * like gemm_apply_epilogue so the ISA translation units can use them.
+ */
+static inline f32 half_f16_to_f32(u16 value) {
+    u32 sign = (u32) (value & 0x8000) << 16;
+    u32 exponent = (value >> 10) & 0x1F;
+    u32 mantissa = value & 0x3FF;
+    u32 bits;
+    if (exponent == 0x1F) {
+        // Infinity or NaN.
+        bits = sign | 0x7F800000 | (mantissa << 13);
+    } else if (exponent != 0) {
+        bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+    } else {
+        // Zero or subnormal, i.e. mantissa*2^-24.
+        f32 magnitude = (f32) mantissa*(1.0f/16777216.0f);
+        memcpy(&bits, &magnitude, sizeof(bits));
+        bits |= sign;
+    }
+    f32 result;
+    memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+
+static inline u16 half_f32_to_f16(f32 value) {
+    u32 bits;
+    memcpy(&bits, &value, sizeof(bits));
+    u16 sign = (u16) ((bits >> 16) & 0x8000);
+    u32 magnitude = bits & 0x7FFFFFFF;
+    if (magnitude >= 0x7F800000) {
+        // Infinity stays infinity, NaN stays a quiet NaN.
+        return sign | (magnitude > 0x7F800000 ? 0x7E00 : 0x7C00);
+    }
+    if (magnitude >= 0x477FF000) {
+        // Rounds to a value above 65504.
+        return sign | 0x7C00;
+    }
+    if (magnitude < 0x38800000) {
+        // Below the smallest normal half, rounding on the 2^-24 grid.
+        f32 absolute;
+        memcpy(&absolute, &magnitude, sizeof(absolute));
+        return sign | (u16) nearbyintf(absolute*16777216.0f);
+    }
+    // Rebias the exponent and round the 13 dropped mantissa bits.
+    u32 rounded = magnitude + 0xFFF + ((magnitude >> 13) & 1) - ((127 - 15) << 23);
+    return sign | (u16) (rounded >> 13);
+}
+
+
+static inline f32 half_bf16_to_f32(u16 value) {
+    u32 bits = (u32) value << 16;
+    f32 result;
+    memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+
+static inline u16 half_f32_to_bf16(f32 value) {
+    u32 bits;
+    memcpy(&bits, &value, sizeof(bits));
+    if ((bits & 0x7FFFFFFF) > 0x7F800000) {
+        return (u16) ((bits >> 16) | 0x40);
+    }
+    return (u16) ((bits + 0x7FFF + ((bits >> 16) & 1)) >> 16);
+}
+
+
+/**
+ * Reads or writes element `index` of an array of the given type.
+ */
+static inline f32 dtype_load(Dtype dtype, const void* data, u64 index) {
+    switch (dtype) {
+        case Dtype_F32: return ((const f32*) data)[index];
+        case Dtype_F16: return half_f16_to_f32(((const u16*) data)[index]);
+        case Dtype_BF16: return half_bf16_to_f32(((const u16*) data)[index]);
+    }
+    return 0.0f;
+}
+
+
+static inline void dtype_store(Dtype dtype, void* data, u64 index, f32 value) {
+    switch (dtype) {
+        case Dtype_F32: ((f32*) data)[index] = value; break;
+        case Dtype_F16: ((u16*) data)[index] = half_f32_to_f16(value); break;
+        case Dtype_BF16: ((u16*) data)[index] = half_f32_to_bf16(value); break;
+    }
+}
+
+
+/**
+ * Array conversion kernels, one for each direction and 16-bit type.
+ */
+typedef void Half_To_F32_Kernel(float* out, const u16* in, u64 n);
+typedef void Half_From_F32_Kernel(u16* out, const float* in, u64 n);
+
+
+enum Half_Kernel_Type {
+    Half_Kernel_Auto,
+    Half_Kernel_Scalar,
+    Half_Kernel_F16C,
+    // F16C with rounding to bf16 by AVX-512 BF16.
+    Half_Kernel_AVX512_BF16,
+};
+
+
+/**
+ * Forces specific conversion kernels, mostly useful for benchmarking.
+ * Returns false if the requested kernels are not supported.
+ */
+bool half_set_kernel(Half_Kernel_Type type);
+
+
+/**
+ * Returns the name of the conversion kernels that are currently in use.
+ */
+const char* half_kernel_name();
+
+
+/**
+ * Converts `n` elements of a 16-bit type to fp32.
+ */
+void half_to_f32(Dtype dtype, float* out, const u16* in, u64 n);
+
+
+/**
+ * Converts `n` fp32 elements to a 16-bit type, rounding to nearest even.
+ */
+void half_from_f32(Dtype dtype, u16* out, const float* in, u64 n);
+
+
+// Conversion kernels, the vectorized ones live in their own translation
+// units since they are compiled with F16C (or AVX-512 BF16) enabled.
+Half_To_F32_Kernel half_f16_to_f32_scalar;
+Half_To_F32_Kernel half_f16_to_f32_f16c;
+Half_To_F32_Kernel half_bf16_to_f32_scalar;
+Half_To_F32_Kernel half_bf16_to_f32_f16c;
+Half_From_F32_Kernel half_f32_to_f16_scalar;
+Half_From_F32_Kernel half_f32_to_f16_f16c;
+Half_From_F32_Kernel half_f32_to_bf16_scalar;
+Half_From_F32_Kernel half_f32_to_bf16_f16c;
+Half_From_F32_Kernel half_f32_to_bf16_avx512;
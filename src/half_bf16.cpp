@@ -0,0 +1,39 @@
+// NOTE: this file is compiled with AVX-512 BF16, BW and VL enabled (see premake5.lua), so only
+// include headers without inline functions to avoid the compiler emitting
+// AVX-512 instructions into code shared with the other translation units.
+#include "half.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+
+
+/**
+ * Rounds 32 floats at a time with vcvtne2ps2bf16, which rounds to nearest
+ * even and keeps NaNs quiet just like the scalar conversion.
+ */
+void half_f32_to_bf16_avx512(u16* out, const float* in, u64 n) {
+    u64 i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m512bh packed = _mm512_cvtne2ps_pbh(_mm512_loadu_ps(in + i + 16), _mm512_loadu_ps(in + i));
+        _mm512_storeu_si512(out + i, (__m512i) packed);
+    }
+    if (i < n) {
+        u32 count = (u32) (n - i);
+        __mmask16 lo = count >= 16 ? 0xFFFF : (__mmask16) ((1u << count) - 1);
+        __mmask16 hi = count > 16 ? (__mmask16) ((1u << (count - 16)) - 1) : 0;
+        __m256bh first = _mm512_cvtneps_pbh(_mm512_maskz_loadu_ps(lo, in + i));
+        _mm256_mask_storeu_epi16(out + i, lo, (__m256i) first);
+        if (hi) {
+            __m256bh second = _mm512_cvtneps_pbh(_mm512_maskz_loadu_ps(hi, in + i + 16));
+            _mm256_mask_storeu_epi16(out + i + 16, hi, (__m256i) second);
+        }
+    }
+}
+
+#else
+
+void half_f32_to_bf16_avx512(u16* out, const float* in, u64 n) {
+    half_f32_to_bf16_scalar(out, in, n);
+}
+
+#endif
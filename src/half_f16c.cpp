@@ -0,0 +1,91 @@
+// NOTE: this file is compiled with AVX2, FMA and F16C enabled (see premake5.lua),
+// so only include headers without inline functions to avoid the compiler
+// emitting AVX2 instructions into code shared with the other translation units.
+#include "half.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+
+
+void half_f16_to_f32_f16c(float* out, const u16* in, u64 n) {
+    u64 i = 0;
+    for (; i + 16 <= n; i += 16) {
+        _mm256_storeu_ps(out + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*) (in + i))));
+        _mm256_storeu_ps(out + i + 8, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*) (in + i + 8))));
+    }
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(out + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*) (in + i))));
+    }
+    for (; i < n; i++) out[i] = half_f16_to_f32(in[i]);
+}
+
+
+void half_bf16_to_f32_f16c(float* out, const u16* in, u64 n) {
+    u64 i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i wide = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*) (in + i)));
+        _mm256_storeu_ps(out + i, _mm256_castsi256_ps(_mm256_slli_epi32(wide, 16)));
+    }
+    for (; i < n; i++) out[i] = half_bf16_to_f32(in[i]);
+}
+
+
+void half_f32_to_f16_f16c(u16* out, const float* in, u64 n) {
+    u64 i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i half = _mm256_cvtps_ph(_mm256_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128((__m128i*) (out + i), half);
+    }
+    for (; i < n; i++) out[i] = half_f32_to_f16(in[i]);
+}
+
+
+/**
+ * Rounds 8 floats to bf16 in the low halves of the 32-bit lanes,
+ * NaNs are kept quiet instead of rounding them to infinity.
+ */
+static inline __m256i half_round_bf16(__m256 v) {
+    __m256i bits = _mm256_castps_si256(v);
+    __m256i lsb = _mm256_and_si256(_mm256_srli_epi32(bits, 16), _mm256_set1_epi32(1));
+    __m256i rounded = _mm256_srli_epi32(_mm256_add_epi32(_mm256_add_epi32(bits, _mm256_set1_epi32(0x7FFF)), lsb), 16);
+    __m256i magnitude = _mm256_and_si256(bits, _mm256_set1_epi32(0x7FFFFFFF));
+    __m256i nan = _mm256_cmpgt_epi32(magnitude, _mm256_set1_epi32(0x7F800000));
+    __m256i quiet = _mm256_or_si256(_mm256_srli_epi32(bits, 16), _mm256_set1_epi32(0x40));
+    return _mm256_blendv_epi8(rounded, quiet, nan);
+}
+
+
+void half_f32_to_bf16_f16c(u16* out, const float* in, u64 n) {
+    u64 i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i lo = half_round_bf16(_mm256_loadu_ps(in + i));
+        __m256i hi = half_round_bf16(_mm256_loadu_ps(in + i + 8));
+        // The pack interleaves the 128-bit lanes, so put them back in order.
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(lo, hi), 0xD8);
+        _mm256_storeu_si256((__m256i*) (out + i), packed);
+    }
+    for (; i < n; i++) out[i] = half_f32_to_bf16(in[i]);
+}
+
+#else
+
+void half_f16_to_f32_f16c(float* out, const u16* in, u64 n) {
+    half_f16_to_f32_scalar(out, in, n);
+}
+
+
+void half_bf16_to_f32_f16c(float* out, const u16* in, u64 n) {
+    half_bf16_to_f32_scalar(out, in, n);
+}
+
+
+void half_f32_to_f16_f16c(u16* out, const float* in, u64 n) {
+    half_f32_to_f16_scalar(out, in, n);
+}
+
+
+void half_f32_to_bf16_f16c(u16* out, const float* in, u64 n) {
+    half_f32_to_bf16_scalar(out, in, n);
+}
+
+#endif
@@ -0,0 +1,115 @@
+#include "hash.h"
+#include "cpu.h"
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+
+static Hash_Stripes_Kernel* hash_stripes_kernel = nullptr;
+static Hash_Quantize_Kernel* hash_quantize_kernel = nullptr;
+static const char* hash_kernel_label = "none";
+
+
+bool hash_set_kernel(Hash_Kernel_Type type) {
+    const Cpu_Features& cpu = cpu_features();
+    switch (type) {
+        case Hash_Kernel_Auto: {
+            return hash_set_kernel(cpu.avx2 ? Hash_Kernel_AVX2 : Hash_Kernel_Scalar);
+        }
+
+        case Hash_Kernel_Scalar: {
+            hash_stripes_kernel = hash_stripes_scalar;
+            hash_quantize_kernel = hash_quantize_scalar;
+            hash_kernel_label = "scalar";
+            return true;
+        }
+
+        case Hash_Kernel_AVX2: {
+            if (!cpu.avx2) return false;
+            hash_stripes_kernel = hash_stripes_avx2;
+            hash_quantize_kernel = hash_quantize_avx2;
+            hash_kernel_label = "avx2";
+            return true;
+        }
+    }
+    return false;
+}
+
+
+const char* hash_kernel_name() {
+    if (!hash_stripes_kernel) hash_set_kernel(Hash_Kernel_Auto);
+    return hash_kernel_label;
+}
+
+
+/**
+ * Finalizer of MurmurHash3, every input bit affects every output bit.
+ */
+static u64 hash_mix(u64 x) {
+    x ^= x >> 33;
+    x *= 0xFF51AFD7ED558CCDull;
+    x ^= x >> 33;
+    x *= 0xC4CEB9FE1A85EC53ull;
+    x ^= x >> 33;
+    return x;
+}
+
+
+u64 hash_finish(u64* acc, const u8* tail, u64 tail_bytes, u64 stripes, u64 bytes, u64 seed) {
+    // The tail is a last, zero padded stripe that only touches the lanes it covers.
+    u64 words[HASH_LANES] = {};
+    memcpy(words, tail, tail_bytes);
+    for (u32 lane = 0; lane*8 < tail_bytes; lane++) {
+        u64 mixed = words[lane] ^ (HASH_KEYS[lane] + stripes*HASH_KEY_STEP);
+        acc[lane] += (mixed & 0xFFFFFFFF)*(mixed >> 32) + words[lane];
+    }
+
+    u64 hash = hash_mix(seed ^ (bytes*HASH_KEY_STEP));
+    for (u32 lane = 0; lane < HASH_LANES; lane++) {
+        hash = hash_mix(hash ^ hash_mix(acc[lane] + lane));
+    }
+    return hash;
+}
+
+
+u64 hash_bytes(const void* data, u64 bytes, u64 seed) {
+    if (!hash_stripes_kernel) hash_set_kernel(Hash_Kernel_Auto);
+    u64 acc[HASH_LANES] = {};
+    u64 stripes = bytes/HASH_STRIPE_BYTES;
+    const u8* base = (const u8*) data;
+    hash_stripes_kernel(acc, base, stripes);
+    u64 done = stripes*HASH_STRIPE_BYTES;
+    return hash_finish(acc, base + done, bytes - done, stripes, bytes, seed);
+}
+
+
+void hash_quantize(i32* out, const float* in, u64 n, float step) {
+    if (!hash_quantize_kernel) hash_set_kernel(Hash_Kernel_Auto);
+    assert(step > 0.0f);
+    hash_quantize_kernel(out, in, n, 1.0f/step);
+}
+
+
+void hash_stripes_scalar(u64* acc, const u8* data, u64 stripes) {
+    for (u64 s = 0; s < stripes; s++) {
+        const u8* stripe = data + s*HASH_STRIPE_BYTES;
+        for (u32 lane = 0; lane < HASH_LANES; lane++) {
+            u64 word;
+            memcpy(&word, stripe + 8*lane, sizeof(word));
+            u64 mixed = word ^ (HASH_KEYS[lane] + s*HASH_KEY_STEP);
+            acc[lane] += (mixed & 0xFFFFFFFF)*(mixed >> 32) + word;
+        }
+    }
+}
+
+
+void hash_quantize_scalar(i32* out, const float* in, u64 n, float inv_step) {
+    // Same order of operations as max/min in SIMD, so NaNs end up at the low end.
+    const float limit = (float) (1 << 30);
+    for (u64 i = 0; i < n; i++) {
+        float value = in[i]*inv_step;
+        value = value > -limit ? value : -limit;
+        value = value < limit ? value : limit;
+        out[i] = (i32) nearbyintf(value);
+    }
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+
+#include "util.h"
+
+
+/***************************************************************************
+ * Content hashing
+ *
+ * Fast non-cryptographic 64-bit hash of a range of bytes, e.g. the data of
+ * a tensor. The bytes are consumed in stripes of 64 bytes by 8 independent
+ * 64-bit lanes, so a stripe is two AVX2 registers. Every lane mixes its word
+ * with a key that depends on the lane and the position of the stripe, then
+ * accumulates the product of the two 32-bit halves of the mixed word and
+ * the word itself:
+ *
+ *   mixed = word ^ (HASH_KEYS[lane] + stripe*HASH_KEY_STEP)
+ *   acc[lane] += lo32(mixed)*hi32(mixed) + word
+ *
+ * The remaining bytes, the length and the seed are folded into the lanes by
+ * `hash_finish` and the lanes are combined with a 64-bit finalizer. Every
+ * kernel computes the exact same hash, so hashes can be compared across
+ * kernels and machines.
+ ***************************************************************************/
+
+
+const u32 HASH_LANES = 8;
+const u32 HASH_STRIPE_BYTES = 64;
+
+
+/**
+ * Keys of the lanes (arbitrary odd constants) and the amount they advance
+ * by every stripe, so that reordering stripes changes the hash.
+ */
+const u64 HASH_KEYS[HASH_LANES] = {
+    0x9E3779B185EBCA87ull, 0xC2B2AE3D27D4EB4Full, 0x165667B19E3779F9ull, 0xD6E8FEB86659FD93ull,
+    0xFF51AFD7ED558CCDull, 0xC4CEB9FE1A85EC53ull, 0x27D4EB2F165667C5ull, 0x85EBCA77C2B2AE63ull,
+};
+const u64 HASH_KEY_STEP = 0x61C8864680B583EBull;
+
+
+/**
+ * Accumulates `stripes` stripes of 64 bytes into the lanes.
+ */
+typedef void Hash_Stripes_Kernel(u64* acc, const u8* data, u64 stripes);
+
+
+/**
+ * Rounds every value to the nearest multiple of a step and stores the
+ * multiple, i.e. `out[i] = round(in[i]*inv_step)` with ties to even.
+ * Results are clamped to [-2^30, 2^30] and NaNs become -2^30.
+ */
+typedef void Hash_Quantize_Kernel(i32* out, const float* in, u64 n, float inv_step);
+
+
+enum Hash_Kernel_Type {
+    Hash_Kernel_Auto,
+    Hash_Kernel_Scalar,
+    Hash_Kernel_AVX2,
+};
+
+
+/**
+ * Forces a specific kernel, mostly useful for benchmarking.
+ * Returns false if the requested kernel is not supported.
+ */
+bool hash_set_kernel(Hash_Kernel_Type type);
+
+
+/**
+ * Returns the name of the kernel that is currently in use.
+ */
+const char* hash_kernel_name();
+
+
+/**
+ * Hashes a range of bytes, different seeds give unrelated hashes.
+ */
+u64 hash_bytes(const void* data, u64 bytes, u64 seed = 0);
+
+
+/**
+ * Quantizes `n` floats to multiples of `step`, see Hash_Quantize_Kernel.
+ */
+void hash_quantize(i32* out, const float* in, u64 n, float step);
+
+
+/**
+ * Folds the bytes after the last whole stripe, the length and the seed
+ * into the lanes and combines them. Shared by all the kernels.
+ */
+u64 hash_finish(u64* acc, const u8* tail, u64 tail_bytes, u64 stripes, u64 bytes, u64 seed);
+
+
+// Kernels, the AVX2 kernels live in their own translation unit
+// since it is compiled with AVX2 code generation enabled.
+Hash_Stripes_Kernel hash_stripes_scalar;
+Hash_Stripes_Kernel hash_stripes_avx2;
+Hash_Quantize_Kernel hash_quantize_scalar;
+Hash_Quantize_Kernel hash_quantize_avx2;
@@ -0,0 +1,62 @@
+// NOTE: this file is compiled with AVX2 and FMA enabled (see premake5.lua),
+// so only include headers without inline functions to avoid the compiler
+// emitting AVX2 instructions into code shared with the other translation units.
+#include "hash.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+
+
+/**
+ * Lanes 0-3 and 4-7 of a stripe are one register each, the 32x32 bit
+ * products of the halves are exactly what vpmuludq computes.
+ */
+void hash_stripes_avx2(u64* acc, const u8* data, u64 stripes) {
+    __m256i acc0 = _mm256_loadu_si256((const __m256i*) acc);
+    __m256i acc1 = _mm256_loadu_si256((const __m256i*) (acc + 4));
+    __m256i key0 = _mm256_loadu_si256((const __m256i*) HASH_KEYS);
+    __m256i key1 = _mm256_loadu_si256((const __m256i*) (HASH_KEYS + 4));
+    const __m256i step = _mm256_set1_epi64x((long long) HASH_KEY_STEP);
+    for (u64 s = 0; s < stripes; s++) {
+        const u8* stripe = data + s*HASH_STRIPE_BYTES;
+        __m256i word0 = _mm256_loadu_si256((const __m256i*) stripe);
+        __m256i word1 = _mm256_loadu_si256((const __m256i*) (stripe + 32));
+        __m256i mixed0 = _mm256_xor_si256(word0, key0);
+        __m256i mixed1 = _mm256_xor_si256(word1, key1);
+        __m256i product0 = _mm256_mul_epu32(mixed0, _mm256_srli_epi64(mixed0, 32));
+        __m256i product1 = _mm256_mul_epu32(mixed1, _mm256_srli_epi64(mixed1, 32));
+        acc0 = _mm256_add_epi64(acc0, _mm256_add_epi64(product0, word0));
+        acc1 = _mm256_add_epi64(acc1, _mm256_add_epi64(product1, word1));
+        key0 = _mm256_add_epi64(key0, step);
+        key1 = _mm256_add_epi64(key1, step);
+    }
+    _mm256_storeu_si256((__m256i*) acc, acc0);
+    _mm256_storeu_si256((__m256i*) (acc + 4), acc1);
+}
+
+
+void hash_quantize_avx2(i32* out, const float* in, u64 n, float inv_step) {
+    const __m256 scale = _mm256_set1_ps(inv_step);
+    const __m256 low = _mm256_set1_ps(-(float) (1 << 30));
+    const __m256 high = _mm256_set1_ps((float) (1 << 30));
+    u64 i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 value = _mm256_mul_ps(_mm256_loadu_ps(in + i), scale);
+        value = _mm256_min_ps(_mm256_max_ps(value, low), high);
+        _mm256_storeu_si256((__m256i*) (out + i), _mm256_cvtps_epi32(value));
+    }
+    if (i < n) hash_quantize_scalar(out + i, in + i, n - i, inv_step);
+}
+
+#else
+
+void hash_stripes_avx2(u64* acc, const u8* data, u64 stripes) {
+    hash_stripes_scalar(acc, data, stripes);
+}
+
+
+void hash_quantize_avx2(i32* out, const float* in, u64 n, float inv_step) {
+    hash_quantize_scalar(out, in, n, inv_step);
+}
+
+#endif
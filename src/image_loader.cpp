@@ -0,0 +1,249 @@
+#include "image_loader.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+// The vendored header is kept as is, so silence its warnings here.
+#if defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-but-set-variable"
+#endif
+#define STB_IMAGE_IMPLEMENTATION
+#define STBI_FAILURE_USERMSG
+#include "stb_image.h"
+#if defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+
+
+static f64 image_loader_now() {
+    using namespace std::chrono;
+    return duration<f64>(steady_clock::now().time_since_epoch()).count();
+}
+
+
+/**
+ * Source position of every output row or column for the bilinear
+ * resize, the sample points are at the pixel centers.
+ */
+struct Image_Resize_Table {
+    std::vector<u32> index0;
+    std::vector<u32> index1;
+    std::vector<f32> weight;
+};
+
+
+static void image_resize_table(Image_Resize_Table& table, u32 source, u32 target) {
+    table.index0.resize(target);
+    table.index1.resize(target);
+    table.weight.resize(target);
+    f32 scale = (f32) source/target;
+    for (u32 i = 0; i < target; i++) {
+        f32 position = std::min(std::max((i + 0.5f)*scale - 0.5f, 0.0f), (f32) (source - 1));
+        u32 index = (u32) position;
+        table.index0[i] = index;
+        table.index1[i] = std::min(index + 1, source - 1);
+        table.weight[i] = position - index;
+    }
+}
+
+
+bool image_load_into(const char* path, const Image_Loader_Config& config, Tensor& batch, u32 sample) {
+    u32 width = config.width;
+    u32 height = config.height;
+    u32 channels = config.channels;
+    assert(batch.ndim == 2 && sample < batch.shape[0]);
+    assert(batch.shape[1] == channels*height*width);
+
+    int source_width, source_height, source_channels;
+    u8* pixels = stbi_load(path, &source_width, &source_height, &source_channels, (int) channels);
+    if (!pixels) {
+        std::cerr << "error: failed to decode image `" << path << "`: " << stbi_failure_reason() << std::endl;
+        return false;
+    }
+
+    // The tables are reused by every image decoded on this thread.
+    thread_local Image_Resize_Table rows;
+    thread_local Image_Resize_Table columns;
+    image_resize_table(rows, (u32) source_height, height);
+    image_resize_table(columns, (u32) source_width, width);
+
+    float* column = batch.data + (u64) sample*batch.stride[0];
+    u64 feature_stride = batch.stride[1];
+    u64 source_stride = (u64) source_width*channels;
+    for (u32 c = 0; c < channels; c++) {
+        // value/255 normalized with (value - mean)/std as a single multiply add.
+        f32 scale = 1.0f/(255.0f*config.std[c]);
+        f32 shift = -config.mean[c]/config.std[c];
+        float* plane = column + (u64) c*height*width*feature_stride;
+
+        for (u32 y = 0; y < height; y++) {
+            const u8* row0 = pixels + rows.index0[y]*source_stride + c;
+            const u8* row1 = pixels + rows.index1[y]*source_stride + c;
+            f32 wy = rows.weight[y];
+            float* out = plane + (u64) y*width*feature_stride;
+
+            for (u32 x = 0; x < width; x++) {
+                u32 x0 = columns.index0[x]*channels;
+                u32 x1 = columns.index1[x]*channels;
+                f32 wx = columns.weight[x];
+                f32 top = row0[x0] + wx*(row0[x1] - row0[x0]);
+                f32 bottom = row1[x0] + wx*(row1[x1] - row1[x0]);
+                f32 value = top + wy*(bottom - top);
+                out[(u64) x*feature_stride] = value*scale + shift;
+            }
+        }
+    }
+
+    stbi_image_free(pixels);
+    return true;
+}
+
+
+/**
+ * Decodes all the images of a batch into its slot.
+ */
+static void image_loader_decode_batch(Image_Loader* loader, Image_Loader_Slot& slot, u64 batch) {
+    u64 first = batch*loader->config.batch_size;
+    u32 count = (u32) std::min<u64>(loader->config.batch_size, loader->num_images - first);
+
+    // The last batch may be smaller, it is still stored contiguously.
+    Tensor& images = slot.images;
+    images.shape[0] = count;
+    images.shape[1] = loader->num_features;
+    tensor_set_contiguous(images);
+
+    u32 errors = 0;
+    for (u32 s = 0; s < count; s++) {
+        const std::string& path = loader->paths[(first + s) % loader->paths.size()];
+        if (!image_load_into(path.c_str(), loader->config, images, s)) {
+            for (u32 f = 0; f < loader->num_features; f++) images.data[(u64) f*count + s] = 0.0f;
+            errors++;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(loader->mutex);
+    slot.count = count;
+    slot.ready = true;
+    loader->images_decoded += count;
+    loader->decode_errors += errors;
+    loader->batch_ready.notify_all();
+}
+
+
+static void image_loader_worker_main(Image_Loader* loader) {
+    std::unique_lock<std::mutex> lock(loader->mutex);
+    while (!loader->shutdown && loader->next_decode < loader->num_batches) {
+        u64 batch = loader->next_decode++;
+        Image_Loader_Slot& slot = loader->slots[batch % loader->slots.size()];
+
+        // The slot still holds an earlier batch the consumer hasn't released.
+        if (slot.batch != batch) {
+            loader->worker_stalls++;
+            loader->slot_free.wait(lock, [&] { return loader->shutdown || slot.batch == batch; });
+            if (loader->shutdown) break;
+        }
+
+        lock.unlock();
+        image_loader_decode_batch(loader, slot, batch);
+        lock.lock();
+    }
+}
+
+
+Image_Loader* image_loader_create(const std::vector<std::string>& paths, Image_Loader_Config config) {
+    assert(config.batch_size > 0 && config.num_workers > 0 && config.num_buffers > 0);
+    assert(config.channels >= 1 && config.channels <= 4);
+
+    Image_Loader* loader = new Image_Loader;
+    loader->config = config;
+    loader->paths = paths;
+    loader->num_features = config.channels*config.height*config.width;
+    loader->num_images = (u64) paths.size()*config.epochs;
+    loader->num_batches = (loader->num_images + config.batch_size - 1)/config.batch_size;
+
+    loader->slots.resize(config.num_buffers);
+    for (u32 i = 0; i < config.num_buffers; i++) {
+        Image_Loader_Slot& slot = loader->slots[i];
+        slot.images = tensor_create_2d(config.batch_size, loader->num_features);
+        slot.batch = i;
+        slot.count = 0;
+        slot.ready = false;
+    }
+
+    loader->next_decode = 0;
+    loader->next_consume = 0;
+    loader->shutdown = false;
+    loader->start_time = image_loader_now();
+    loader->images_decoded = 0;
+    loader->decode_errors = 0;
+    loader->consumer_stalls = 0;
+    loader->consumer_wait_time = 0.0;
+    loader->worker_stalls = 0;
+
+    for (u32 i = 0; i < config.num_workers; i++) {
+        loader->workers.push_back(std::thread(image_loader_worker_main, loader));
+    }
+    return loader;
+}
+
+
+void image_loader_destroy(Image_Loader* loader) {
+    {
+        std::lock_guard<std::mutex> lock(loader->mutex);
+        loader->shutdown = true;
+    }
+    loader->slot_free.notify_all();
+    for (std::thread& worker : loader->workers) worker.join();
+    for (Image_Loader_Slot& slot : loader->slots) tensor_free(slot.images);
+    delete loader;
+}
+
+
+bool image_loader_next(Image_Loader* loader, Image_Batch* batch) {
+    std::unique_lock<std::mutex> lock(loader->mutex);
+    if (loader->next_consume >= loader->num_batches) return false;
+
+    u64 index = loader->next_consume++;
+    Image_Loader_Slot& slot = loader->slots[index % loader->slots.size()];
+    if (!(slot.ready && slot.batch == index)) {
+        loader->consumer_stalls++;
+        f64 start = image_loader_now();
+        loader->batch_ready.wait(lock, [&] { return slot.ready && slot.batch == index; });
+        loader->consumer_wait_time += image_loader_now() - start;
+    }
+
+    batch->images = slot.images;
+    batch->count = slot.count;
+    batch->index = index;
+    return true;
+}
+
+
+void image_loader_release(Image_Loader* loader, Image_Batch* batch) {
+    {
+        std::lock_guard<std::mutex> lock(loader->mutex);
+        Image_Loader_Slot& slot = loader->slots[batch->index % loader->slots.size()];
+        assert(slot.batch == batch->index && slot.ready);
+        slot.ready = false;
+        slot.batch += loader->slots.size();
+    }
+    loader->slot_free.notify_all();
+    batch->images = {};
+}
+
+
+Image_Loader_Stats image_loader_stats(Image_Loader* loader) {
+    std::lock_guard<std::mutex> lock(loader->mutex);
+    Image_Loader_Stats stats = {};
+    stats.images = loader->images_decoded;
+    stats.batches = loader->next_consume;
+    stats.decode_errors = loader->decode_errors;
+    f64 elapsed = image_loader_now() - loader->start_time;
+    if (elapsed > 0.0) stats.images_per_second = stats.images/elapsed;
+    stats.consumer_stalls = loader->consumer_stalls;
+    stats.consumer_wait_ms = loader->consumer_wait_time*1e3;
+    stats.worker_stalls = loader->worker_stalls;
+    return stats;
+}
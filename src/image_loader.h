@@ -0,0 +1,153 @@
+#pragma once
+
+
+#include "tensor.h"
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+/***************************************************************************
+ * Image loader
+ *
+ * Decodes JPEG/PNG/BMP/... files with stb_image on a set of worker threads
+ * and converts them into normalized float batches, so the thread running
+ * the network never waits on decoding. Every image is resized (bilinear)
+ * to the configured size, its values are scaled to [0, 1] and normalized
+ * per channel with `(value - mean)/std`.
+ *
+ * A batch has the usual shape (N, features) with samples as columns, the
+ * features of a sample are in planar (channel, row, column) order.
+ *
+ * Batches are decoded into a bounded ring of reusable buffers. Each worker
+ * decodes a whole batch at a time (so no two threads write to the same
+ * cache lines) into the slot of the ring that batch maps to, waiting if
+ * the consumer still holds that slot. The consumer takes the batches in
+ * order and hands every buffer back once done with it.
+ ***************************************************************************/
+
+
+struct Image_Loader_Config {
+    u32 batch_size = 32;
+    u32 width = 224;
+    u32 height = 224;
+    /// 1 (grey), 3 (RGB) or 4 (RGBA), images are converted as needed.
+    u32 channels = 3;
+    u32 num_workers = 4;
+    /// Number of batch buffers, at least num_workers + 1 to keep every
+    /// worker busy while the consumer holds a batch.
+    u32 num_buffers = 8;
+    /// Number of passes over the files.
+    u32 epochs = 1;
+    f32 mean[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    f32 std[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+};
+
+
+struct Image_Loader_Stats {
+    u64 images;
+    u64 batches;
+    /// Files that failed to decode, their samples are all zeros.
+    u64 decode_errors;
+    /// Decoded images per second since the loader was created.
+    f64 images_per_second;
+    /// Number of times the consumer found its next batch not ready yet
+    /// (the pipeline is starving the compute) and the total time waited.
+    u64 consumer_stalls;
+    f64 consumer_wait_ms;
+    /// Number of times a worker found its slot still held by the consumer
+    /// (the ring is full, decoding is ahead of the compute).
+    u64 worker_stalls;
+};
+
+
+/**
+ * Batch handed to the consumer, valid until it is released.
+ */
+struct Image_Batch {
+    /// Shape (count, channels*height*width), contiguous.
+    Tensor images;
+    /// Number of images, smaller than the batch size only for the last batch.
+    u32 count;
+    /// Position of the batch in the stream.
+    u64 index;
+};
+
+
+struct Image_Loader_Slot {
+    Tensor images;
+    /// Batch the slot holds or is reserved for next.
+    u64 batch;
+    u32 count;
+    bool ready;
+};
+
+
+struct Image_Loader {
+    Image_Loader_Config config;
+    std::vector<std::string> paths;
+    u32 num_features;
+    u64 num_images;
+    u64 num_batches;
+
+    std::mutex mutex;
+    std::condition_variable batch_ready;
+    std::condition_variable slot_free;
+    std::vector<Image_Loader_Slot> slots;
+    // Next batch to be claimed by a worker and to be taken by the consumer.
+    u64 next_decode;
+    u64 next_consume;
+    bool shutdown;
+    std::vector<std::thread> workers;
+
+    // Statistics, protected by the mutex.
+    f64 start_time;
+    u64 images_decoded;
+    u64 decode_errors;
+    u64 consumer_stalls;
+    f64 consumer_wait_time;
+    u64 worker_stalls;
+};
+
+
+/**
+ * Creates the loader and starts decoding the first batches right away.
+ */
+Image_Loader* image_loader_create(const std::vector<std::string>& paths, Image_Loader_Config config);
+
+
+/**
+ * Stops the workers and frees the buffers, batches
+ * that have not been released become invalid.
+ */
+void image_loader_destroy(Image_Loader* loader);
+
+
+/**
+ * Waits for the next batch, returns false once all of them have been taken.
+ * The batch must be released with `image_loader_release` when done with it,
+ * the consumer may hold up to `num_buffers` batches at a time.
+ */
+bool image_loader_next(Image_Loader* loader, Image_Batch* batch);
+
+
+/**
+ * Hands the buffer of the batch back to the workers.
+ */
+void image_loader_release(Image_Loader* loader, Image_Batch* batch);
+
+
+/**
+ * Returns the throughput and starvation counters.
+ */
+Image_Loader_Stats image_loader_stats(Image_Loader* loader);
+
+
+/**
+ * Decodes a single image into column `sample` of a batch of shape
+ * (N, channels*height*width) the same way the loader does, returns false
+ * (leaving the column untouched) if the file can't be decoded.
+ */
+bool image_load_into(const char* path, const Image_Loader_Config& config, Tensor& batch, u32 sample);
@@ -0,0 +1,130 @@
+#include "kernels.h"
+#include "cpu.h"
+#include <cmath>
+
+
+static void scalar_add(float* out, const float* a, const float* b, u64 n) {
+    for (u64 i = 0; i < n; i++) out[i] = a[i] + b[i];
+}
+
+
+static void scalar_mul(float* out, const float* a, const float* b, u64 n) {
+    for (u64 i = 0; i < n; i++) out[i] = a[i]*b[i];
+}
+
+
+static void scalar_fma(float* out, const float* a, const float* b, const float* c, u64 n) {
+    for (u64 i = 0; i < n; i++) out[i] = a[i]*b[i] + c[i];
+}
+
+
+static void scalar_relu(float* out, const float* in, u64 n) {
+    for (u64 i = 0; i < n; i++) out[i] = in[i] > 0.0f ? in[i] : 0.0f;
+}
+
+
+static void scalar_exp(float* out, const float* in, u64 n) {
+    for (u64 i = 0; i < n; i++) out[i] = expf(in[i]);
+}
+
+
+static void scalar_sigmoid(float* out, const float* in, u64 n) {
+    for (u64 i = 0; i < n; i++) out[i] = 1.0f/(1.0f + expf(-in[i]));
+}
+
+
+static void scalar_tanh(float* out, const float* in, u64 n) {
+    for (u64 i = 0; i < n; i++) out[i] = tanhf(in[i]);
+}
+
+
+static void scalar_softmax(float* out, const float* in, u64 n) {
+    if (n == 0) return;
+    float max = in[0];
+    for (u64 i = 1; i < n; i++) max = in[i] > max ? in[i] : max;
+
+    float sum = 0.0f;
+    for (u64 i = 0; i < n; i++) {
+        out[i] = expf(in[i] - max);
+        sum += out[i];
+    }
+
+    float scale = 1.0f/sum;
+    for (u64 i = 0; i < n; i++) out[i] *= scale;
+}
+
+
+static void scalar_relu_grad(float* out, const float* grad, const float* output, u64 n) {
+    for (u64 i = 0; i < n; i++) out[i] = output[i] > 0.0f ? grad[i] : 0.0f;
+}
+
+
+static void scalar_sgd(float* weights, const float* grad, float* velocity, u64 n,
+                       float learning_rate, float momentum) {
+    for (u64 i = 0; i < n; i++) {
+        velocity[i] = momentum*velocity[i] + grad[i];
+        weights[i] -= learning_rate*velocity[i];
+    }
+}
+
+
+static void scalar_adam(float* weights, const float* grad, float* m, float* v, u64 n,
+                        float learning_rate, float beta1, float beta2, float epsilon) {
+    for (u64 i = 0; i < n; i++) {
+        m[i] = beta1*m[i] + (1.0f - beta1)*grad[i];
+        v[i] = beta2*v[i] + (1.0f - beta2)*grad[i]*grad[i];
+        weights[i] -= learning_rate*m[i]/(sqrtf(v[i]) + epsilon);
+    }
+}
+
+
+const Elementwise_Kernels kernels_scalar = {
+    "scalar",
+    scalar_add,
+    scalar_mul,
+    scalar_fma,
+    scalar_relu,
+    scalar_exp,
+    scalar_sigmoid,
+    scalar_tanh,
+    scalar_softmax,
+    scalar_relu_grad,
+    scalar_sgd,
+    scalar_adam,
+};
+
+
+static const Elementwise_Kernels* kernels_current = nullptr;
+
+
+const Elementwise_Kernels* kernels_for_isa(Kernel_Isa isa) {
+    const Cpu_Features& cpu = cpu_features();
+    switch (isa) {
+        case Kernel_Isa_Auto: {
+            if (cpu.avx512f) return &kernels_avx512;
+            if (cpu.avx2 && cpu.fma) return &kernels_avx2;
+            if (cpu.sse41) return &kernels_sse;
+            return &kernels_scalar;
+        }
+
+        case Kernel_Isa_Scalar: return &kernels_scalar;
+        case Kernel_Isa_SSE: return cpu.sse41 ? &kernels_sse : nullptr;
+        case Kernel_Isa_AVX2: return cpu.avx2 && cpu.fma ? &kernels_avx2 : nullptr;
+        case Kernel_Isa_AVX512: return cpu.avx512f ? &kernels_avx512 : nullptr;
+    }
+    return nullptr;
+}
+
+
+bool kernels_set_isa(Kernel_Isa isa) {
+    const Elementwise_Kernels* selected = kernels_for_isa(isa);
+    if (!selected) return false;
+    kernels_current = selected;
+    return true;
+}
+
+
+const Elementwise_Kernels& kernels() {
+    if (!kernels_current) kernels_set_isa(Kernel_Isa_Auto);
+    return *kernels_current;
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+
+#include "util.h"
+
+
+/***************************************************************************
+ * Element-wise kernels
+ *
+ * Vectorized kernels over contiguous float arrays with one implementation
+ * per instruction set, the best one supported by the CPU is picked at
+ * startup. The output may alias any of the inputs.
+ *
+ * The scalar kernels use the C math library and serve as the reference.
+ * The vectorized transcendentals are polynomial approximations with the
+ * following maximum errors (measured over [-88, 88] by `benchmark elementwise`):
+ *
+ *   exp       relative error < 1.5e-7 (about 1 ulp), inputs below -87.3
+ *             return 0 and inputs above 88.7 return exp(88.7)
+ *   sigmoid   relative error < 2.5e-7
+ *   tanh      absolute error < 1e-7, relative error < 1.5e-7
+ *   softmax   relative error < 2e-6 per element for 1000 elements, this
+ *             is dominated by rounding in the sum and also holds for
+ *             the scalar kernel
+ ***************************************************************************/
+
+
+struct Elementwise_Kernels {
+    const char* name;
+
+    /// out = a + b
+    void (*add)(float* out, const float* a, const float* b, u64 n);
+    /// out = a * b
+    void (*mul)(float* out, const float* a, const float* b, u64 n);
+    /// out = a * b + c
+    void (*fma)(float* out, const float* a, const float* b, const float* c, u64 n);
+    /// out = max(in, 0)
+    void (*relu)(float* out, const float* in, u64 n);
+    /// out = exp(in)
+    void (*exp)(float* out, const float* in, u64 n);
+    /// out = 1 / (1 + exp(-in))
+    void (*sigmoid)(float* out, const float* in, u64 n);
+    /// out = tanh(in)
+    void (*tanh)(float* out, const float* in, u64 n);
+    /// out = exp(in - max(in)) / sum(exp(in - max(in)))
+    void (*softmax)(float* out, const float* in, u64 n);
+    /// out = output > 0 ? grad : 0, the gradient of relu given its output
+    void (*relu_grad)(float* out, const float* grad, const float* output, u64 n);
+
+    /// velocity = momentum*velocity + grad, weights -= learning_rate*velocity
+    void (*sgd)(float* weights, const float* grad, float* velocity, u64 n,
+                float learning_rate, float momentum);
+    /// m = beta1*m + (1 - beta1)*grad, v = beta2*v + (1 - beta2)*grad^2,
+    /// weights -= learning_rate*m/(sqrt(v) + epsilon), where the caller
+    /// folds the bias correction into the learning rate and epsilon
+    void (*adam)(float* weights, const float* grad, float* m, float* v, u64 n,
+                 float learning_rate, float beta1, float beta2, float epsilon);
+};
+
+
+enum Kernel_Isa {
+    Kernel_Isa_Auto,
+    Kernel_Isa_Scalar,
+    Kernel_Isa_SSE,
+    Kernel_Isa_AVX2,
+    Kernel_Isa_AVX512,
+};
+
+
+/**
+ * Returns the kernels currently in use.
+ */
+const Elementwise_Kernels& kernels();
+
+
+/**
+ * Returns the kernels for a specific instruction set,
+ * or nullptr if it is not supported by this CPU.
+ */
+const Elementwise_Kernels* kernels_for_isa(Kernel_Isa isa);
+
+
+/**
+ * Selects which kernels to use, mostly useful for benchmarking.
+ * Returns false if the instruction set is not supported.
+ */
+bool kernels_set_isa(Kernel_Isa isa);
+
+
+// Kernel tables of each instruction set, every one is defined in its
+// own translation unit compiled with that instruction set enabled.
+extern const Elementwise_Kernels kernels_scalar;
+extern const Elementwise_Kernels kernels_sse;
+extern const Elementwise_Kernels kernels_avx2;
+extern const Elementwise_Kernels kernels_avx512;
@@ -0,0 +1,27 @@
+// NOTE: this file is compiled with AVX2 and FMA enabled (see premake5.lua).
+#include "kernels_impl.h"
+
+
+#if defined(__AVX2__) && defined(__FMA__)
+
+const Elementwise_Kernels kernels_avx2 = {
+    "avx2",
+    vec_add<Vec_AVX2>,
+    vec_mul<Vec_AVX2>,
+    vec_fma<Vec_AVX2>,
+    vec_relu<Vec_AVX2>,
+    vec_exp_kernel<Vec_AVX2>,
+    vec_sigmoid_kernel<Vec_AVX2>,
+    vec_tanh_kernel<Vec_AVX2>,
+    vec_softmax<Vec_AVX2>,
+    vec_relu_grad<Vec_AVX2>,
+    vec_sgd<Vec_AVX2>,
+    vec_adam<Vec_AVX2>,
+};
+
+#else
+
+// Never selected since the CPU check fails, but the table has to exist.
+const Elementwise_Kernels kernels_avx2 = kernels_scalar;
+
+#endif
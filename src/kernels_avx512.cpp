@@ -0,0 +1,27 @@
+// NOTE: this file is compiled with AVX-512F enabled (see premake5.lua).
+#include "kernels_impl.h"
+
+
+#if defined(__AVX512F__)
+
+const Elementwise_Kernels kernels_avx512 = {
+    "avx512",
+    vec_add<Vec_AVX512>,
+    vec_mul<Vec_AVX512>,
+    vec_fma<Vec_AVX512>,
+    vec_relu<Vec_AVX512>,
+    vec_exp_kernel<Vec_AVX512>,
+    vec_sigmoid_kernel<Vec_AVX512>,
+    vec_tanh_kernel<Vec_AVX512>,
+    vec_softmax<Vec_AVX512>,
+    vec_relu_grad<Vec_AVX512>,
+    vec_sgd<Vec_AVX512>,
+    vec_adam<Vec_AVX512>,
+};
+
+#else
+
+// Never selected since the CPU check fails, but the table has to exist.
+const Elementwise_Kernels kernels_avx512 = kernels_scalar;
+
+#endif
@@ -0,0 +1,423 @@
+#pragma once
+
+// NOTE: only include this from the instruction set specific translation units
+// (kernels_sse.cpp, kernels_avx2.cpp, ...). Everything in here is in an anonymous
+// namespace so code generated for one instruction set never leaks into another.
+// The kernel tables must be constant initialized for the same reason, i.e. no
+// code compiled for the instruction set may run before the CPU has been checked.
+
+#include "kernels.h"
+#include <cmath>
+#include <immintrin.h>
+
+
+namespace {
+
+
+/***************************************************************************
+ * Vector traits, one per instruction set.
+ ***************************************************************************/
+
+
+#if defined(__SSE4_1__) || (defined(_MSC_VER) && defined(_M_X64))
+struct Vec_SSE {
+    typedef __m128 V;
+    static const u32 width = 4;
+
+    static V load(const float* p) { return _mm_loadu_ps(p); }
+    static void store(float* p, V v) { _mm_storeu_ps(p, v); }
+    static V set1(float x) { return _mm_set1_ps(x); }
+    static V zero() { return _mm_setzero_ps(); }
+    static V add(V a, V b) { return _mm_add_ps(a, b); }
+    static V sub(V a, V b) { return _mm_sub_ps(a, b); }
+    static V mul(V a, V b) { return _mm_mul_ps(a, b); }
+    static V div(V a, V b) { return _mm_div_ps(a, b); }
+    static V max(V a, V b) { return _mm_max_ps(a, b); }
+    static V min(V a, V b) { return _mm_min_ps(a, b); }
+    static V sqrt(V a) { return _mm_sqrt_ps(a); }
+    static V fmadd(V a, V b, V c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+    static V round(V a) { return _mm_round_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+    static V abs(V a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+    static V sign(V a) { return _mm_and_ps(_mm_set1_ps(-0.0f), a); }
+    static V bit_or(V a, V b) { return _mm_or_ps(a, b); }
+
+    /// Returns 2^n for integral valued n in [-126, 127].
+    static V pow2(V n) {
+        __m128i e = _mm_add_epi32(_mm_cvtps_epi32(n), _mm_set1_epi32(127));
+        return _mm_castsi128_ps(_mm_slli_epi32(e, 23));
+    }
+
+    /// Returns `a < b ? if_less : otherwise` per lane.
+    static V select_less(V a, V b, V if_less, V otherwise) {
+        return _mm_blendv_ps(otherwise, if_less, _mm_cmplt_ps(a, b));
+    }
+
+    static float reduce_add(V a) {
+        a = _mm_add_ps(a, _mm_movehl_ps(a, a));
+        a = _mm_add_ss(a, _mm_movehdup_ps(a));
+        return _mm_cvtss_f32(a);
+    }
+
+    static float reduce_max(V a) {
+        a = _mm_max_ps(a, _mm_movehl_ps(a, a));
+        a = _mm_max_ss(a, _mm_movehdup_ps(a));
+        return _mm_cvtss_f32(a);
+    }
+};
+#endif
+
+
+#ifdef __AVX2__
+struct Vec_AVX2 {
+    typedef __m256 V;
+    static const u32 width = 8;
+
+    static V load(const float* p) { return _mm256_loadu_ps(p); }
+    static void store(float* p, V v) { _mm256_storeu_ps(p, v); }
+    static V set1(float x) { return _mm256_set1_ps(x); }
+    static V zero() { return _mm256_setzero_ps(); }
+    static V add(V a, V b) { return _mm256_add_ps(a, b); }
+    static V sub(V a, V b) { return _mm256_sub_ps(a, b); }
+    static V mul(V a, V b) { return _mm256_mul_ps(a, b); }
+    static V div(V a, V b) { return _mm256_div_ps(a, b); }
+    static V max(V a, V b) { return _mm256_max_ps(a, b); }
+    static V min(V a, V b) { return _mm256_min_ps(a, b); }
+    static V sqrt(V a) { return _mm256_sqrt_ps(a); }
+    static V fmadd(V a, V b, V c) { return _mm256_fmadd_ps(a, b, c); }
+    static V round(V a) { return _mm256_round_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+    static V abs(V a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+    static V sign(V a) { return _mm256_and_ps(_mm256_set1_ps(-0.0f), a); }
+    static V bit_or(V a, V b) { return _mm256_or_ps(a, b); }
+
+    static V pow2(V n) {
+        __m256i e = _mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127));
+        return _mm256_castsi256_ps(_mm256_slli_epi32(e, 23));
+    }
+
+    static V select_less(V a, V b, V if_less, V otherwise) {
+        return _mm256_blendv_ps(otherwise, if_less, _mm256_cmp_ps(a, b, _CMP_LT_OQ));
+    }
+
+    static float reduce_add(V a) {
+        __m128 r = _mm_add_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+        r = _mm_add_ps(r, _mm_movehl_ps(r, r));
+        r = _mm_add_ss(r, _mm_movehdup_ps(r));
+        return _mm_cvtss_f32(r);
+    }
+
+    static float reduce_max(V a) {
+        __m128 r = _mm_max_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+        r = _mm_max_ps(r, _mm_movehl_ps(r, r));
+        r = _mm_max_ss(r, _mm_movehdup_ps(r));
+        return _mm_cvtss_f32(r);
+    }
+};
+#endif
+
+
+#ifdef __AVX512F__
+struct Vec_AVX512 {
+    typedef __m512 V;
+    static const u32 width = 16;
+
+    static V load(const float* p) { return _mm512_loadu_ps(p); }
+    static void store(float* p, V v) { _mm512_storeu_ps(p, v); }
+    static V set1(float x) { return _mm512_set1_ps(x); }
+    static V zero() { return _mm512_setzero_ps(); }
+    static V add(V a, V b) { return _mm512_add_ps(a, b); }
+    static V sub(V a, V b) { return _mm512_sub_ps(a, b); }
+    static V mul(V a, V b) { return _mm512_mul_ps(a, b); }
+    static V div(V a, V b) { return _mm512_div_ps(a, b); }
+    static V max(V a, V b) { return _mm512_max_ps(a, b); }
+    static V min(V a, V b) { return _mm512_min_ps(a, b); }
+    static V sqrt(V a) { return _mm512_sqrt_ps(a); }
+    static V fmadd(V a, V b, V c) { return _mm512_fmadd_ps(a, b, c); }
+    static V round(V a) { return _mm512_roundscale_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+    static V abs(V a) { return _mm512_abs_ps(a); }
+
+    static V sign(V a) {
+        return _mm512_castsi512_ps(_mm512_and_epi32(_mm512_castps_si512(a), _mm512_set1_epi32(0x80000000)));
+    }
+
+    static V bit_or(V a, V b) {
+        return _mm512_castsi512_ps(_mm512_or_epi32(_mm512_castps_si512(a), _mm512_castps_si512(b)));
+    }
+
+    static V pow2(V n) {
+        __m512i e = _mm512_add_epi32(_mm512_cvtps_epi32(n), _mm512_set1_epi32(127));
+        return _mm512_castsi512_ps(_mm512_slli_epi32(e, 23));
+    }
+
+    static V select_less(V a, V b, V if_less, V otherwise) {
+        return _mm512_mask_blend_ps(_mm512_cmp_ps_mask(a, b, _CMP_LT_OQ), otherwise, if_less);
+    }
+
+    static float reduce_add(V a) { return _mm512_reduce_add_ps(a); }
+    static float reduce_max(V a) { return _mm512_reduce_max_ps(a); }
+};
+#endif
+
+
+/***************************************************************************
+ * Approximations of the transcendental functions, see kernels.h for the
+ * error bounds. The polynomials are the single precision ones from Cephes.
+ ***************************************************************************/
+
+
+/**
+ * exp(x) = 2^n * exp(r) where n = round(x/ln(2)) and |r| <= ln(2)/2,
+ * exp(r) is then approximated by a degree 6 polynomial.
+ */
+template <typename Vec>
+inline typename Vec::V vec_exp(typename Vec::V x) {
+    typedef typename Vec::V V;
+    const V lower = Vec::set1(-87.3365447f);
+    V clamped = Vec::min(Vec::max(x, lower), Vec::set1(88.7228391f));
+
+    V n = Vec::round(Vec::mul(clamped, Vec::set1(1.44269504088896341f)));
+    V r = Vec::fmadd(n, Vec::set1(-0.693359375f), clamped);
+    r = Vec::fmadd(n, Vec::set1(2.12194440e-4f), r);
+
+    V p = Vec::set1(1.9875691500e-4f);
+    p = Vec::fmadd(p, r, Vec::set1(1.3981999507e-3f));
+    p = Vec::fmadd(p, r, Vec::set1(8.3334519073e-3f));
+    p = Vec::fmadd(p, r, Vec::set1(4.1665795894e-2f));
+    p = Vec::fmadd(p, r, Vec::set1(1.6666665459e-1f));
+    p = Vec::fmadd(p, r, Vec::set1(5.0000001201e-1f));
+    p = Vec::fmadd(p, Vec::mul(r, r), Vec::add(r, Vec::set1(1.0f)));
+
+    // Scale in two steps since 2^n alone overflows the exponent for n = 128.
+    V half_n = Vec::round(Vec::mul(n, Vec::set1(0.5f)));
+    V result = Vec::mul(Vec::mul(p, Vec::pow2(half_n)), Vec::pow2(Vec::sub(n, half_n)));
+    return Vec::select_less(x, lower, Vec::zero(), result);
+}
+
+
+template <typename Vec>
+inline typename Vec::V vec_sigmoid(typename Vec::V x) {
+    typedef typename Vec::V V;
+    V one = Vec::set1(1.0f);
+    V e = vec_exp<Vec>(Vec::sub(Vec::zero(), x));
+    return Vec::div(one, Vec::add(one, e));
+}
+
+
+/**
+ * Small inputs use an odd polynomial to keep the relative error low
+ * around zero, larger inputs use tanh(x) = 1 - 2/(exp(2x) + 1).
+ */
+template <typename Vec>
+inline typename Vec::V vec_tanh(typename Vec::V x) {
+    typedef typename Vec::V V;
+    V ax = Vec::abs(x);
+
+    V z = Vec::mul(x, x);
+    V p = Vec::set1(-5.70498872745e-3f);
+    p = Vec::fmadd(p, z, Vec::set1(2.06390887954e-2f));
+    p = Vec::fmadd(p, z, Vec::set1(-5.37397155531e-2f));
+    p = Vec::fmadd(p, z, Vec::set1(1.33314422036e-1f));
+    p = Vec::fmadd(p, z, Vec::set1(-3.33332819422e-1f));
+    V small = Vec::fmadd(Vec::mul(p, z), x, x);
+
+    V e = vec_exp<Vec>(Vec::add(ax, ax));
+    V large = Vec::sub(Vec::set1(1.0f), Vec::div(Vec::set1(2.0f), Vec::add(e, Vec::set1(1.0f))));
+    large = Vec::bit_or(large, Vec::sign(x));
+
+    return Vec::select_less(ax, Vec::set1(0.625f), small, large);
+}
+
+
+/***************************************************************************
+ * Kernels, the tail of each array is processed by copying it into a padded
+ * buffer so that it gets exactly the same treatment as the rest.
+ ***************************************************************************/
+
+
+template <typename Vec, typename Op>
+inline void vec_map(float* out, const float* in, u64 n, Op op) {
+    u64 i = 0;
+    for (; i + Vec::width <= n; i += Vec::width) {
+        Vec::store(out + i, op(Vec::load(in + i)));
+    }
+    if (i < n) {
+        alignas(64) float tail[Vec::width] = {};
+        for (u64 j = i; j < n; j++) tail[j - i] = in[j];
+        Vec::store(tail, op(Vec::load(tail)));
+        for (u64 j = i; j < n; j++) out[j] = tail[j - i];
+    }
+}
+
+
+template <typename Vec, typename Op>
+inline void vec_zip(float* out, const float* a, const float* b, u64 n, Op op) {
+    u64 i = 0;
+    for (; i + 4*Vec::width <= n; i += 4*Vec::width) {
+        typename Vec::V r0 = op(Vec::load(a + i), Vec::load(b + i));
+        typename Vec::V r1 = op(Vec::load(a + i + Vec::width), Vec::load(b + i + Vec::width));
+        typename Vec::V r2 = op(Vec::load(a + i + 2*Vec::width), Vec::load(b + i + 2*Vec::width));
+        typename Vec::V r3 = op(Vec::load(a + i + 3*Vec::width), Vec::load(b + i + 3*Vec::width));
+        Vec::store(out + i, r0);
+        Vec::store(out + i + Vec::width, r1);
+        Vec::store(out + i + 2*Vec::width, r2);
+        Vec::store(out + i + 3*Vec::width, r3);
+    }
+    for (; i + Vec::width <= n; i += Vec::width) {
+        Vec::store(out + i, op(Vec::load(a + i), Vec::load(b + i)));
+    }
+    if (i < n) {
+        alignas(64) float ta[Vec::width] = {};
+        alignas(64) float tb[Vec::width] = {};
+        for (u64 j = i; j < n; j++) {
+            ta[j - i] = a[j];
+            tb[j - i] = b[j];
+        }
+        Vec::store(ta, op(Vec::load(ta), Vec::load(tb)));
+        for (u64 j = i; j < n; j++) out[j] = ta[j - i];
+    }
+}
+
+
+template <typename Vec>
+void vec_add(float* out, const float* a, const float* b, u64 n) {
+    vec_zip<Vec>(out, a, b, n, [](typename Vec::V x, typename Vec::V y) { return Vec::add(x, y); });
+}
+
+
+template <typename Vec>
+void vec_mul(float* out, const float* a, const float* b, u64 n) {
+    vec_zip<Vec>(out, a, b, n, [](typename Vec::V x, typename Vec::V y) { return Vec::mul(x, y); });
+}
+
+
+template <typename Vec>
+void vec_fma(float* out, const float* a, const float* b, const float* c, u64 n) {
+    u64 i = 0;
+    for (; i + Vec::width <= n; i += Vec::width) {
+        Vec::store(out + i, Vec::fmadd(Vec::load(a + i), Vec::load(b + i), Vec::load(c + i)));
+    }
+    for (; i < n; i++) {
+        out[i] = a[i]*b[i] + c[i];
+    }
+}
+
+
+template <typename Vec>
+void vec_relu(float* out, const float* in, u64 n) {
+    vec_map<Vec>(out, in, n, [](typename Vec::V x) { return Vec::max(x, Vec::zero()); });
+}
+
+
+template <typename Vec>
+void vec_relu_grad(float* out, const float* grad, const float* output, u64 n) {
+    vec_zip<Vec>(out, grad, output, n, [](typename Vec::V g, typename Vec::V y) {
+        return Vec::select_less(Vec::zero(), y, g, Vec::zero());
+    });
+}
+
+
+template <typename Vec>
+void vec_exp_kernel(float* out, const float* in, u64 n) {
+    vec_map<Vec>(out, in, n, [](typename Vec::V x) { return vec_exp<Vec>(x); });
+}
+
+
+template <typename Vec>
+void vec_sigmoid_kernel(float* out, const float* in, u64 n) {
+    vec_map<Vec>(out, in, n, [](typename Vec::V x) { return vec_sigmoid<Vec>(x); });
+}
+
+
+template <typename Vec>
+void vec_tanh_kernel(float* out, const float* in, u64 n) {
+    vec_map<Vec>(out, in, n, [](typename Vec::V x) { return vec_tanh<Vec>(x); });
+}
+
+
+template <typename Vec>
+void vec_softmax(float* out, const float* in, u64 n) {
+    typedef typename Vec::V V;
+    if (n == 0) return;
+
+    float max = in[0];
+    u64 i = 0;
+    if (n >= Vec::width) {
+        V vmax = Vec::load(in);
+        for (i = Vec::width; i + Vec::width <= n; i += Vec::width) {
+            vmax = Vec::max(vmax, Vec::load(in + i));
+        }
+        max = Vec::reduce_max(vmax);
+    }
+    for (; i < n; i++) max = in[i] > max ? in[i] : max;
+
+    V vmax = Vec::set1(max);
+    V vsum = Vec::zero();
+    for (i = 0; i + Vec::width <= n; i += Vec::width) {
+        V e = vec_exp<Vec>(Vec::sub(Vec::load(in + i), vmax));
+        Vec::store(out + i, e);
+        vsum = Vec::add(vsum, e);
+    }
+    float sum = Vec::reduce_add(vsum);
+    if (i < n) {
+        alignas(64) float tail[Vec::width];
+        for (u32 j = 0; j < Vec::width; j++) tail[j] = i + j < n ? in[i + j] - max : -1000.0f;
+        Vec::store(tail, vec_exp<Vec>(Vec::load(tail)));
+        for (u64 j = i; j < n; j++) {
+            out[j] = tail[j - i];
+            sum += tail[j - i];
+        }
+    }
+
+    V scale = Vec::set1(1.0f/sum);
+    vec_map<Vec>(out, out, n, [scale](V x) { return Vec::mul(x, scale); });
+}
+
+
+/**
+ * Optimizer updates read and write every buffer exactly once.
+ */
+template <typename Vec>
+void vec_sgd(float* weights, const float* grad, float* velocity, u64 n,
+             float learning_rate, float momentum) {
+    typedef typename Vec::V V;
+    V vlr = Vec::set1(-learning_rate);
+    V vmomentum = Vec::set1(momentum);
+    u64 i = 0;
+    for (; i + Vec::width <= n; i += Vec::width) {
+        V v = Vec::fmadd(vmomentum, Vec::load(velocity + i), Vec::load(grad + i));
+        Vec::store(velocity + i, v);
+        Vec::store(weights + i, Vec::fmadd(vlr, v, Vec::load(weights + i)));
+    }
+    for (; i < n; i++) {
+        velocity[i] = momentum*velocity[i] + grad[i];
+        weights[i] -= learning_rate*velocity[i];
+    }
+}
+
+
+template <typename Vec>
+void vec_adam(float* weights, const float* grad, float* m, float* v, u64 n,
+              float learning_rate, float beta1, float beta2, float epsilon) {
+    typedef typename Vec::V V;
+    V vlr = Vec::set1(-learning_rate);
+    V vbeta1 = Vec::set1(beta1), vbeta1c = Vec::set1(1.0f - beta1);
+    V vbeta2 = Vec::set1(beta2), vbeta2c = Vec::set1(1.0f - beta2);
+    V veps = Vec::set1(epsilon);
+    u64 i = 0;
+    for (; i + Vec::width <= n; i += Vec::width) {
+        V g = Vec::load(grad + i);
+        V mi = Vec::fmadd(vbeta1, Vec::load(m + i), Vec::mul(vbeta1c, g));
+        V vi = Vec::fmadd(vbeta2, Vec::load(v + i), Vec::mul(vbeta2c, Vec::mul(g, g)));
+        Vec::store(m + i, mi);
+        Vec::store(v + i, vi);
+        V step = Vec::div(mi, Vec::add(Vec::sqrt(vi), veps));
+        Vec::store(weights + i, Vec::fmadd(vlr, step, Vec::load(weights + i)));
+    }
+    for (; i < n; i++) {
+        m[i] = beta1*m[i] + (1.0f - beta1)*grad[i];
+        v[i] = beta2*v[i] + (1.0f - beta2)*grad[i]*grad[i];
+        weights[i] -= learning_rate*m[i]/(sqrtf(v[i]) + epsilon);
+    }
+}
+
+
+}
@@ -0,0 +1,27 @@
+// NOTE: this file is compiled with SSE4.1 enabled (see premake5.lua).
+#include "kernels_impl.h"
+
+
+#if defined(__SSE4_1__) || (defined(_MSC_VER) && defined(_M_X64))
+
+const Elementwise_Kernels kernels_sse = {
+    "sse",
+    vec_add<Vec_SSE>,
+    vec_mul<Vec_SSE>,
+    vec_fma<Vec_SSE>,
+    vec_relu<Vec_SSE>,
+    vec_exp_kernel<Vec_SSE>,
+    vec_sigmoid_kernel<Vec_SSE>,
+    vec_tanh_kernel<Vec_SSE>,
+    vec_softmax<Vec_SSE>,
+    vec_relu_grad<Vec_SSE>,
+    vec_sgd<Vec_SSE>,
+    vec_adam<Vec_SSE>,
+};
+
+#else
+
+// Never selected since the CPU check fails, but the table has to exist.
+const Elementwise_Kernels kernels_sse = kernels_scalar;
+
+#endif
@@ -1,5 +1,6 @@
 #include "tensor.h"
 #include "network.h"
+#include "plan.h"
 #include <iostream>
 
 
@@ -14,6 +15,9 @@ int main(int argc, char** argv) {
         dense_layer(3, 2, init_incr, tensor_init_zeros),
         relu(),
     });
+
+    // Runs every dense layer and its activation as a single kernel.
+    network_fuse_layers(model);
         
 
     Tensor input = tensor_create_2d(1, 3);
@@ -27,5 +31,21 @@ int main(int argc, char** argv) {
     std::cout << "Input:\n" << input << std::endl;
     std::cout << "Output:\n" << output << std::endl;
 
+    // Multiple samples can be forwarded at once by storing them as columns.
+    Tensor batch = tensor_create_2d(4, 3);
+    tensor_init_random(batch);
+
+    Tensor batch_output = model.forward_batch(&batch);
+    std::cout << "Batch input:\n" << batch << std::endl;
+    std::cout << "Batch output:\n" << batch_output << std::endl;
+
+    // Compiling the network plans the memory of every intermediate up front.
+    Execution_Plan* plan = plan_compile(&model, batch.shape, batch.ndim);
+    std::cout << *plan << std::endl;
+
+    Tensor planned_output = plan_forward(plan, &batch);
+    std::cout << "Planned output:\n" << planned_output << std::endl;
+    plan_destroy(plan);
+
     return 0;
 }
@@ -0,0 +1,154 @@
+#include "memory.h"
+#include <atomic>
+#include <cstdlib>
+
+
+static std::atomic<u64> memory_heap_allocations{0};
+static std::atomic<u64> memory_heap_frees{0};
+static std::atomic<u64> memory_heap_bytes{0};
+static std::atomic<u64> memory_arena_allocations{0};
+
+static thread_local Memory_Arena* memory_arena = nullptr;
+
+
+void* memory_alloc(size_t size, size_t alignment) {
+    size = (size + alignment - 1) & ~(alignment - 1);
+    if (size == 0) size = alignment;
+#ifdef _MSC_VER
+    void* ptr = _aligned_malloc(size, alignment);
+#else
+    void* ptr = aligned_alloc(alignment, size);
+#endif
+    memory_heap_allocations.fetch_add(1, std::memory_order_relaxed);
+    memory_heap_bytes.fetch_add(size, std::memory_order_relaxed);
+    return ptr;
+}
+
+
+void memory_free(void* ptr) {
+    if (!ptr) return;
+    memory_heap_frees.fetch_add(1, std::memory_order_relaxed);
+#ifdef _MSC_VER
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+
+Memory_Stats memory_stats() {
+    Memory_Stats stats;
+    stats.heap_allocations = memory_heap_allocations.load(std::memory_order_relaxed);
+    stats.heap_frees = memory_heap_frees.load(std::memory_order_relaxed);
+    stats.heap_bytes_allocated = memory_heap_bytes.load(std::memory_order_relaxed);
+    stats.arena_allocations = memory_arena_allocations.load(std::memory_order_relaxed);
+    return stats;
+}
+
+
+/**
+ * Size of the block header rounded up so the data stays aligned.
+ */
+const size_t MEMORY_BLOCK_HEADER = (sizeof(Memory_Block) + MEMORY_ALIGNMENT - 1) & ~(MEMORY_ALIGNMENT - 1);
+
+/**
+ * Smallest block allocated by an arena.
+ */
+const size_t MEMORY_MIN_BLOCK_SIZE = 64*1024;
+
+
+static u8* arena_block_data(Memory_Block* block) {
+    return (u8*) block + MEMORY_BLOCK_HEADER;
+}
+
+
+static Memory_Block* arena_push_block(Memory_Arena* arena, size_t size) {
+    Memory_Block* block = (Memory_Block*) memory_alloc(MEMORY_BLOCK_HEADER + size);
+    block->next = arena->blocks;
+    block->size = size;
+    block->used = 0;
+    arena->blocks = block;
+    return block;
+}
+
+
+void* arena_alloc(Memory_Arena* arena, size_t size, size_t alignment) {
+    Memory_Block* block = arena->blocks;
+    size_t offset = 0;
+    if (block) {
+        offset = (block->used + alignment - 1) & ~(alignment - 1);
+    }
+
+    if (!block || offset + size > block->size) {
+        size_t block_size = block ? block->size*2 : MEMORY_MIN_BLOCK_SIZE;
+        if (block_size < size + alignment) block_size = size + alignment;
+        block = arena_push_block(arena, block_size);
+        offset = 0;
+    }
+
+    arena->used += offset - block->used + size;
+    if (arena->used > arena->peak) arena->peak = arena->used;
+    block->used = offset + size;
+    memory_arena_allocations.fetch_add(1, std::memory_order_relaxed);
+    return arena_block_data(block) + offset;
+}
+
+
+void arena_reset(Memory_Arena* arena) {
+    Memory_Block* block = arena->blocks;
+    if (block && block->next) {
+        // Coalesce the chain into one block that fits the peak usage.
+        size_t total = 0;
+        while (block) {
+            Memory_Block* next = block->next;
+            total += block->size;
+            memory_free(block);
+            block = next;
+        }
+        arena->blocks = nullptr;
+        arena_push_block(arena, total);
+    } else if (block) {
+        block->used = 0;
+    }
+    arena->used = 0;
+}
+
+
+void arena_destroy(Memory_Arena* arena) {
+    Memory_Block* block = arena->blocks;
+    while (block) {
+        Memory_Block* next = block->next;
+        memory_free(block);
+        block = next;
+    }
+    arena->blocks = nullptr;
+    arena->used = 0;
+    arena->peak = 0;
+}
+
+
+bool arena_contains(Memory_Arena* arena, const void* ptr) {
+    for (Memory_Block* block = arena->blocks; block; block = block->next) {
+        u8* data = arena_block_data(block);
+        if ((const u8*) ptr >= data && (const u8*) ptr < data + block->size) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+Memory_Arena* memory_current_arena() {
+    return memory_arena;
+}
+
+
+Arena_Scope::Arena_Scope(Memory_Arena* arena) {
+    previous = memory_arena;
+    memory_arena = arena;
+}
+
+
+Arena_Scope::~Arena_Scope() {
+    memory_arena = previous;
+}
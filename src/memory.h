@@ -0,0 +1,117 @@
+#pragma once
+
+
+#include "util.h"
+#include <cstddef>
+
+
+/***************************************************************************
+ * Memory
+ *
+ * Tensor storage is either allocated on the heap (weights and other long
+ * lived tensors) or in an arena (intermediates of a forward pass).
+ * Every heap allocation made through here is counted, so it is possible
+ * to verify that the steady state forward pass doesn't allocate.
+ ***************************************************************************/
+
+
+/**
+ * Alignment of all tensor data, one cache line which
+ * is also enough for aligned AVX-512 loads and stores.
+ */
+const size_t MEMORY_ALIGNMENT = 64;
+
+
+/**
+ * Allocates aligned memory from the heap, use `memory_free` to release it.
+ */
+void* memory_alloc(size_t size, size_t alignment = MEMORY_ALIGNMENT);
+
+
+/**
+ * Frees memory allocated by `memory_alloc`.
+ */
+void memory_free(void* ptr);
+
+
+/**
+ * Counters of the heap allocations made through `memory_alloc`.
+ */
+struct Memory_Stats {
+    u64 heap_allocations;
+    u64 heap_frees;
+    u64 heap_bytes_allocated;
+    u64 arena_allocations;
+};
+
+
+/**
+ * Returns a snapshot of the allocation counters.
+ */
+Memory_Stats memory_stats();
+
+
+/**
+ * Arena block header, the data starts at the next aligned address.
+ */
+struct Memory_Block {
+    Memory_Block* next;
+    size_t size;
+    size_t used;
+};
+
+
+/**
+ * Bump allocator for memory that is freed all at once by `arena_reset`.
+ * The arena starts out empty and grows by chaining new blocks, on reset
+ * the chain is replaced by a single block large enough to hold everything,
+ * so once warm an arena never touches the heap again.
+ */
+struct Memory_Arena {
+    Memory_Block* blocks = nullptr;
+    size_t used = 0;
+    size_t peak = 0;
+};
+
+
+/**
+ * Allocates aligned memory from the arena.
+ */
+void* arena_alloc(Memory_Arena* arena, size_t size, size_t alignment = MEMORY_ALIGNMENT);
+
+
+/**
+ * Releases everything allocated from the arena, the memory is kept for reuse.
+ */
+void arena_reset(Memory_Arena* arena);
+
+
+/**
+ * Returns all the memory of the arena back to the heap.
+ */
+void arena_destroy(Memory_Arena* arena);
+
+
+/**
+ * Checks if the pointer was allocated by the arena.
+ */
+bool arena_contains(Memory_Arena* arena, const void* ptr);
+
+
+/**
+ * Returns the arena that tensors on this thread are currently allocated from,
+ * or nullptr if tensors are allocated from the heap.
+ */
+Memory_Arena* memory_current_arena();
+
+
+/**
+ * Makes tensors created on this thread allocate from the given arena
+ * for the lifetime of the scope.
+ */
+struct Arena_Scope {
+    Memory_Arena* previous;
+
+    Arena_Scope(Memory_Arena* arena);
+    ~Arena_Scope();
+};
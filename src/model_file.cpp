@@ -0,0 +1,356 @@
+#include "model_file.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+static u64 model_file_align(u64 offset) {
+    return (offset + MODEL_FILE_ALIGNMENT - 1)/MODEL_FILE_ALIGNMENT*MODEL_FILE_ALIGNMENT;
+}
+
+
+/**
+ * Collects the layer records and the tensors to write, fused dense
+ * layers are stored with their activation and the dense weights.
+ */
+static bool model_file_describe(Network& network, std::vector<Model_File_Layer>& layers,
+                                std::vector<Tensor*>& tensors) {
+    for (Layer* layer : network.layers) {
+        Model_File_Layer record = {};
+        record.type = layer->type();
+        record.first_tensor = (u32) tensors.size();
+
+        switch (layer->type()) {
+            case Layer_Type_Dense: {
+                Dense_Layer* dense = (Dense_Layer*) layer;
+                tensors.push_back(&dense->weights);
+                tensors.push_back(&dense->bias);
+                break;
+            }
+
+            case Layer_Type_Fused_Dense: {
+                Fused_Dense_Layer* fused = (Fused_Dense_Layer*) layer;
+                record.activation = fused->activation;
+                tensors.push_back(&fused->dense->weights);
+                tensors.push_back(&fused->dense->bias);
+                break;
+            }
+
+            case Layer_Type_ReLU: record.inplace = ((ReLU_Layer*) layer)->inplace; break;
+            case Layer_Type_Sigmoid: record.inplace = ((Sigmoid_Layer*) layer)->inplace; break;
+            case Layer_Type_Tanh: record.inplace = ((Tanh_Layer*) layer)->inplace; break;
+            case Layer_Type_Softmax: record.inplace = ((Softmax_Layer*) layer)->inplace; break;
+
+            default: {
+                std::cerr << "error: cannot save " << layer_type_name(layer->type())
+                          << " layers to a model file" << std::endl;
+                return false;
+            }
+        }
+
+        record.num_tensors = (u32) tensors.size() - record.first_tensor;
+        layers.push_back(record);
+    }
+    return true;
+}
+
+
+bool model_save(Network& network, const char* path) {
+    std::vector<Model_File_Layer> layers;
+    std::vector<Tensor*> tensors;
+    if (!model_file_describe(network, layers, tensors)) {
+        return false;
+    }
+
+    Model_File_Header header = {};
+    memcpy(header.magic, MODEL_FILE_MAGIC, sizeof(header.magic));
+    header.version = MODEL_FILE_VERSION;
+    header.num_layers = (u32) layers.size();
+    header.num_tensors = (u32) tensors.size();
+    header.layers_offset = sizeof(Model_File_Header);
+    header.tensors_offset = model_file_align(header.layers_offset + sizeof(Model_File_Layer)*layers.size());
+    header.data_offset = model_file_align(header.tensors_offset + sizeof(Model_File_Tensor)*tensors.size());
+
+    std::vector<Model_File_Tensor> records(tensors.size());
+    u64 offset = header.data_offset;
+    for (u32 i = 0; i < tensors.size(); i++) {
+        Model_File_Tensor& record = records[i];
+        record.ndim = tensors[i]->ndim;
+        for (u8 d = 0; d < tensors[i]->ndim; d++) record.shape[d] = tensors[i]->shape[d];
+        record.dtype = tensors[i]->dtype;
+        record.offset = offset;
+        record.length = tensors[i]->length;
+        offset = model_file_align(offset + (u64) dtype_size(tensors[i]->dtype)*record.length);
+    }
+    header.file_size = offset;
+
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        std::cerr << "error: cannot open `" << path << "` for writing" << std::endl;
+        return false;
+    }
+
+    // Sections are written in order, the gaps between them are zero padding.
+    static const u8 zeros[MODEL_FILE_ALIGNMENT] = {};
+    u64 written = 0;
+    auto write = [&](const void* data, u64 size, u64 at) {
+        if (at > written) fwrite(zeros, 1, at - written, file);
+        written = at + (size > 0 ? fwrite(data, 1, size, file) : 0);
+    };
+    write(&header, sizeof(header), 0);
+    write(layers.data(), sizeof(Model_File_Layer)*layers.size(), header.layers_offset);
+    write(records.data(), sizeof(Model_File_Tensor)*records.size(), header.tensors_offset);
+    for (u32 i = 0; i < tensors.size(); i++) {
+        Tensor data = tensor_contiguous(*tensors[i]);
+        write(data.data, tensor_bytes(data), records[i].offset);
+        tensor_free(data);
+    }
+    write(nullptr, 0, header.file_size);
+
+    bool ok = written == header.file_size && fclose(file) == 0;
+    if (!ok) {
+        std::cerr << "error: failed to write `" << path << "`" << std::endl;
+    }
+    return ok;
+}
+
+
+/**
+ * Maps the whole file copy-on-write, so the weights can be modified
+ * in memory without changing the file or the other processes' view of it.
+ */
+static bool model_file_map(Model_File* model, const char* path) {
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        CloseHandle(file);
+        return false;
+    }
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+    void* base = mapping ? MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0) : nullptr;
+    if (!base) {
+        if (mapping) CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+    model->file = file;
+    model->mapping = mapping;
+    model->base = (u8*) base;
+    model->size = (u64) size.QuadPart;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    void* base = mmap(nullptr, (size_t) info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return false;
+    model->base = (u8*) base;
+    model->size = (u64) info.st_size;
+#endif
+    return true;
+}
+
+
+static void model_file_unmap(Model_File* model) {
+#ifdef _WIN32
+    UnmapViewOfFile(model->base);
+    CloseHandle(model->mapping);
+    CloseHandle(model->file);
+#else
+    munmap(model->base, model->size);
+#endif
+}
+
+
+/**
+ * Validates the header and tables, every offset and size is checked
+ * against the size of the file before anything points into it.
+ */
+static const char* model_file_validate(Model_File* model) {
+    if (model->size < sizeof(Model_File_Header)) return "file is too small";
+    Model_File_Header* header = (Model_File_Header*) model->base;
+    if (memcmp(header->magic, MODEL_FILE_MAGIC, sizeof(header->magic)) != 0) return "not a model file";
+    if (header->version != MODEL_FILE_VERSION) return "unsupported model file version";
+    if (header->file_size != model->size) return "file size does not match the header";
+
+    // Offsets and counts are compared without adding them up, so large values can't wrap around.
+    if (header->layers_offset > model->size ||
+        header->num_layers > (model->size - header->layers_offset)/sizeof(Model_File_Layer) ||
+        header->tensors_offset > model->size ||
+        header->num_tensors > (model->size - header->tensors_offset)/sizeof(Model_File_Tensor) ||
+        header->layers_offset % alignof(Model_File_Layer) != 0 ||
+        header->tensors_offset % alignof(Model_File_Tensor) != 0) {
+        return "layer or tensor table out of bounds";
+    }
+
+    Model_File_Tensor* tensors = (Model_File_Tensor*) (model->base + header->tensors_offset);
+    for (u32 i = 0; i < header->num_tensors; i++) {
+        Model_File_Tensor& tensor = tensors[i];
+        if (tensor.ndim > TENSOR_MAX_DIMS) return "tensor has too many dimensions";
+        // Lengths of tensors are 32 bits, checking after every dimension keeps the product from overflowing.
+        u64 length = 1;
+        for (u32 d = 0; d < tensor.ndim; d++) {
+            length *= tensor.shape[d];
+            if (length > UINT32_MAX) return "tensor is too large";
+        }
+        if (length != tensor.length) return "tensor shape does not match its length";
+        if (tensor.offset % MODEL_FILE_ALIGNMENT != 0) return "tensor data is not aligned";
+        if (tensor.dtype > Dtype_BF16) return "unknown tensor type";
+        u32 size = dtype_size((Dtype) tensor.dtype);
+        if (tensor.offset > model->size || tensor.length > (model->size - tensor.offset)/size) {
+            return "tensor data out of bounds";
+        }
+    }
+
+    // Features flowing between the layers, known from the first dense layer on.
+    bool chained = false;
+    u32 features = 0;
+    Model_File_Layer* layers = (Model_File_Layer*) (model->base + header->layers_offset);
+    for (u32 i = 0; i < header->num_layers; i++) {
+        Model_File_Layer& layer = layers[i];
+        if ((u64) layer.first_tensor + layer.num_tensors > header->num_tensors) {
+            return "layer tensors out of bounds";
+        }
+        bool dense = layer.type == Layer_Type_Dense || layer.type == Layer_Type_Fused_Dense;
+        if (dense && (layer.num_tensors != 2 || tensors[layer.first_tensor].ndim != 2 ||
+                      tensors[layer.first_tensor + 1].length != tensors[layer.first_tensor].shape[1] ||
+                      tensors[layer.first_tensor + 1].dtype != Dtype_F32)) {
+            return "dense layer has invalid weights";
+        }
+        if (dense) {
+            // The gemm trusts the shapes, every dense layer has to take the outputs of the previous one.
+            Model_File_Tensor& weights = tensors[layer.first_tensor];
+            if (chained && weights.shape[0] != features) return "dense layer inputs do not match the previous layer";
+            chained = true;
+            features = weights.shape[1];
+        }
+        if (layer.type == Layer_Type_Fused_Dense && layer.activation > Gemm_Activation_Tanh) {
+            return "unknown activation";
+        }
+    }
+    return nullptr;
+}
+
+
+static Tensor model_file_tensor(Model_File* model, u32 index) {
+    Model_File_Header* header = (Model_File_Header*) model->base;
+    Model_File_Tensor& record = ((Model_File_Tensor*) (model->base + header->tensors_offset))[index];
+    Tensor tensor = tensor_wrap((float*) (model->base + record.offset), record.shape, (u8) record.ndim);
+    tensor.dtype = (Dtype) record.dtype;
+    return tensor;
+}
+
+
+static Dense_Layer* model_file_dense_layer(Model_File* model, Model_File_Layer& record) {
+    Dense_Layer* dense = new Dense_Layer;
+    dense->weights = model_file_tensor(model, record.first_tensor);
+    dense->bias = model_file_tensor(model, record.first_tensor + 1);
+    return dense;
+}
+
+
+/**
+ * Recreates the activation layer that was fused into a dense layer.
+ */
+static Layer* model_file_activation_layer(Gemm_Activation activation) {
+    switch (activation) {
+        case Gemm_Activation_None: return nullptr;
+        case Gemm_Activation_ReLU: return relu();
+        case Gemm_Activation_Sigmoid: return sigmoid();
+        case Gemm_Activation_Tanh: return tanh_layer();
+    }
+    return nullptr;
+}
+
+
+static Layer* model_file_activation_layer(Layer_Type type, bool inplace) {
+    switch (type) {
+        case Layer_Type_ReLU: return relu(inplace);
+        case Layer_Type_Sigmoid: return sigmoid(inplace);
+        case Layer_Type_Tanh: return tanh_layer(inplace);
+        case Layer_Type_Softmax: return softmax(inplace);
+        default: return nullptr;
+    }
+}
+
+
+Model_File* model_load(const char* path, Network* network) {
+    Model_File* model = new Model_File;
+    if (!model_file_map(model, path)) {
+        std::cerr << "error: cannot map `" << path << "`" << std::endl;
+        delete model;
+        return nullptr;
+    }
+
+    const char* error = model_file_validate(model);
+    if (error) {
+        std::cerr << "error: `" << path << "`: " << error << std::endl;
+        model_close(model);
+        return nullptr;
+    }
+
+    Model_File_Header* header = (Model_File_Header*) model->base;
+    Model_File_Layer* records = (Model_File_Layer*) (model->base + header->layers_offset);
+    std::vector<Layer*> layers;
+    for (u32 i = 0; i < header->num_layers; i++) {
+        Model_File_Layer& record = records[i];
+        Layer* layer = nullptr;
+        switch (record.type) {
+            case Layer_Type_Dense: {
+                layer = model_file_dense_layer(model, record);
+                break;
+            }
+
+            case Layer_Type_Fused_Dense: {
+                Fused_Dense_Layer* fused = new Fused_Dense_Layer;
+                fused->dense = model_file_dense_layer(model, record);
+                fused->activation = (Gemm_Activation) record.activation;
+                fused->activation_layer = model_file_activation_layer(fused->activation);
+                layer = fused;
+                break;
+            }
+
+            default: {
+                layer = model_file_activation_layer((Layer_Type) record.type, record.inplace != 0);
+                break;
+            }
+        }
+
+        if (!layer) {
+            std::cerr << "error: `" << path << "`: unknown layer type " << record.type << std::endl;
+            for (Layer* loaded : layers) delete loaded;
+            model_close(model);
+            return nullptr;
+        }
+        layers.push_back(layer);
+    }
+
+    network->layers.insert(network->layers.end(), layers.begin(), layers.end());
+    return model;
+}
+
+
+void model_close(Model_File* model) {
+    model_file_unmap(model);
+    delete model;
+}
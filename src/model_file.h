@@ -0,0 +1,123 @@
+#pragma once
+
+
+#include "network.h"
+
+
+/***************************************************************************
+ * Model files
+ *
+ * Binary file holding the layers of a network together with their weights.
+ * Loading maps the file into memory and the weight tensors point straight
+ * into the mapping, nothing is copied or parsed, so loading a model costs
+ * the same regardless of its size and pages are only read from disk when
+ * they are first touched. The mapping is copy-on-write, processes loading
+ * the same file share the physical pages until they modify the weights.
+ *
+ * Layout (all little endian):
+ *
+ *   Model_File_Header       at offset 0
+ *   Model_File_Layer[]      at header.layers_offset
+ *   Model_File_Tensor[]     at header.tensors_offset
+ *   tensor data             every tensor at a MODEL_FILE_ALIGNMENT offset
+ *
+ * Layers refer to a consecutive range of tensors, a dense layer has two
+ * (weights and bias, the bias is always fp32), activations have none.
+ * The Layer_Type, Dtype and Gemm_Activation values are stored as is, so
+ * new ones must be added at the end of the enums. Weights converted to
+ * 16 bits are stored and mapped as such, so they also take half the
+ * space in the file.
+ ***************************************************************************/
+
+
+const char MODEL_FILE_MAGIC[8] = { 'A', 'I', 'P', 'G', 'M', 'O', 'D', 'L' };
+
+
+/**
+ * Bumped whenever the layout changes, files of other versions are rejected.
+ */
+const u32 MODEL_FILE_VERSION = 1;
+
+
+/**
+ * Alignment of the tensor data in the file, mapped files start at a page
+ * boundary so the data ends up aligned to MEMORY_ALIGNMENT in memory.
+ */
+const u64 MODEL_FILE_ALIGNMENT = 64;
+
+
+struct Model_File_Header {
+    char magic[8];
+    u32 version;
+    u32 num_layers;
+    u32 num_tensors;
+    u32 reserved;
+    u64 layers_offset;
+    u64 tensors_offset;
+    u64 data_offset;
+    u64 file_size;
+    u8 padding[8];
+};
+
+
+struct Model_File_Layer {
+    // Layer_Type of the layer.
+    u32 type;
+    // Gemm_Activation of fused layers.
+    u32 activation;
+    u32 inplace;
+    u32 first_tensor;
+    u32 num_tensors;
+    u32 reserved[3];
+};
+
+
+struct Model_File_Tensor {
+    u32 ndim;
+    u32 shape[TENSOR_MAX_DIMS];
+    // Dtype of the elements, this used to be reserved and always zero (fp32).
+    u32 dtype;
+    // Offset of the data from the start of the file and number of elements.
+    u64 offset;
+    u64 length;
+};
+
+
+static_assert(sizeof(Model_File_Header) == 64, "unexpected model file header size");
+static_assert(sizeof(Model_File_Layer) == 32, "unexpected model file layer size");
+static_assert(sizeof(Model_File_Tensor) == 40, "unexpected model file tensor size");
+
+
+/**
+ * Memory mapping of a loaded model file, the layers
+ * of the network refer to it so it must outlive them.
+ */
+struct Model_File {
+    u8* base;
+    u64 size;
+#ifdef _WIN32
+    void* file;
+    void* mapping;
+#endif
+};
+
+
+/**
+ * Writes the layers and weights of the network to a model file.
+ * Returns false (and prints why) if the network can't be saved.
+ */
+bool model_save(Network& network, const char* path);
+
+
+/**
+ * Maps a model file and appends its layers to the network, the weights
+ * point into the mapping. Returns nullptr (and prints why) if the file
+ * can't be opened or is not a valid model file of this version.
+ */
+Model_File* model_load(const char* path, Network* network);
+
+
+/**
+ * Unmaps the model file, the layers loaded from it must no longer be used.
+ */
+void model_close(Model_File* model);
@@ -1,17 +1,287 @@
 #include "network.h"
+#include "conv.h"
+#include "quantize.h"
+#include "sparse.h"
 #include "tensor.h"
 
 
-Dense_Layer dense_layer(
+Dense_Layer* dense_layer(
     int num_inputs, 
     int num_outputs, 
     void init_weights(Tensor&) = tensor_init_random,
     void init_biases(Tensor&) = tensor_init_random
 ) {
-    Dense_Layer layer;
-    layer.weights = tensor_create_2d(num_inputs, num_outputs);
-    layer.bias = tensor_create_1d(num_outputs);
-    init_weights(layer.weights);
-    init_biases(layer.bias);
+    Dense_Layer* layer = new Dense_Layer;
+    layer->weights = tensor_create_2d(num_inputs, num_outputs);
+    layer->bias = tensor_create_1d(num_outputs);
+    init_weights(layer->weights);
+    init_biases(layer->bias);
     return layer;
 }
+
+
+Tensor Layer::backward(Tensor* grad_output, bool input_grad) {
+    std::cerr << "error: " << layer_type_name(type()) << " layers have no backward pass" << std::endl;
+    assert(false);
+    return {};
+}
+
+
+Tensor Dense_Layer::backward(Tensor* grad_output, bool input_grad) {
+    // Layers that are not trained skip the weight gradients entirely,
+    // only the gradient of the input is propagated further back.
+    if (require_grad) {
+        if (!grad_weights.data) {
+            std::vector<Layer_Parameter> unused;
+            parameters(unused);
+        }
+        tensor_dense_backward_weights(grad_weights, grad_bias, *grad_output, saved_input);
+    }
+
+    if (!input_grad) return {};
+    return tensor_dense_backward_input(weights, *grad_output);
+}
+
+
+void Dense_Layer::parameters(std::vector<Layer_Parameter>& parameters) {
+    if (!require_grad) return;
+    assert(weights.dtype == Dtype_F32);
+    if (!grad_weights.data) {
+        Arena_Scope heap(nullptr);
+        grad_weights = tensor_create(weights.shape, weights.ndim);
+        grad_bias = tensor_create(bias.shape, bias.ndim);
+        tensor_init_zeros(grad_weights);
+        tensor_init_zeros(grad_bias);
+    }
+    parameters.push_back({ &weights, &grad_weights });
+    parameters.push_back({ &bias, &grad_bias });
+}
+
+
+const char* layer_type_name(Layer_Type type) {
+    switch (type) {
+        case Layer_Type_Dense: return "dense";
+        case Layer_Type_ReLU: return "relu";
+        case Layer_Type_Sigmoid: return "sigmoid";
+        case Layer_Type_Tanh: return "tanh";
+        case Layer_Type_Softmax: return "softmax";
+        case Layer_Type_Fused_Dense: return "fused_dense";
+        case Layer_Type_Quantized_Dense: return "quantized_dense";
+        case Layer_Type_Conv2D: return "conv2d";
+        case Layer_Type_Max_Pool: return "max_pool";
+        case Layer_Type_Avg_Pool: return "avg_pool";
+        case Layer_Type_Flatten: return "flatten";
+        case Layer_Type_Sparse_Dense: return "sparse_dense";
+    }
+    return "unknown";
+}
+
+
+bool layer_gemm_activation(Layer* layer, Gemm_Activation* activation) {
+    switch (layer->type()) {
+        case Layer_Type_ReLU: {
+            *activation = Gemm_Activation_ReLU;
+            return true;
+        }
+
+        case Layer_Type_Sigmoid: {
+            *activation = Gemm_Activation_Sigmoid;
+            return true;
+        }
+
+        case Layer_Type_Tanh: {
+            *activation = Gemm_Activation_Tanh;
+            return true;
+        }
+
+        default: {
+            return false;
+        }
+    }
+}
+
+
+void network_fuse_layers(Network& network) {
+    std::vector<Layer*> fused;
+    fused.reserve(network.layers.size());
+
+    for (u32 i = 0; i < network.layers.size(); i++) {
+        Layer* layer = network.layers[i];
+        Gemm_Activation activation;
+        if (layer->type() == Layer_Type_Dense && i + 1 < network.layers.size() &&
+            layer_gemm_activation(network.layers[i + 1], &activation)) {
+            Fused_Dense_Layer* fused_layer = new Fused_Dense_Layer;
+            fused_layer->dense = (Dense_Layer*) layer;
+            fused_layer->activation_layer = network.layers[i + 1];
+            fused_layer->activation = activation;
+            fused_layer->require_grad = layer->require_grad;
+            fused.push_back(fused_layer);
+            i++;
+        } else {
+            fused.push_back(layer);
+        }
+    }
+
+    network.layers = fused;
+}
+
+
+void dense_layer_convert(Dense_Layer* layer, Dtype dtype) {
+    Arena_Scope heap(nullptr);
+    Tensor converted = tensor_convert(layer->weights, dtype);
+    tensor_free(layer->weights);
+    layer->weights = converted;
+    if (dtype != Dtype_F32) layer->require_grad = false;
+}
+
+
+i64 network_convert_weights(Network& network, Dtype dtype) {
+    i64 saved = 0;
+    for (Layer* layer : network.layers) {
+        Dense_Layer* dense = nullptr;
+        if (layer->type() == Layer_Type_Dense) dense = (Dense_Layer*) layer;
+        if (layer->type() == Layer_Type_Fused_Dense) dense = ((Fused_Dense_Layer*) layer)->dense;
+        if (!dense || dense->weights.dtype == dtype) continue;
+
+        saved += (i64) tensor_bytes(dense->weights);
+        dense_layer_convert(dense, dtype);
+        saved -= (i64) tensor_bytes(dense->weights);
+        if (dtype != Dtype_F32) layer->require_grad = false;
+    }
+    return saved;
+}
+
+
+/**
+ * Copies a layer for inference, the tensors are copied as views without
+ * a reference, i.e. they share the data of the original.
+ */
+template <typename Layer_Kind>
+static Layer_Kind* network_copy_layer(Layer* layer) {
+    Layer_Kind* copy = new Layer_Kind(*(Layer_Kind*) layer);
+    copy->require_grad = false;
+    return copy;
+}
+
+
+static Dense_Layer* network_copy_dense(Dense_Layer* dense) {
+    Dense_Layer* copy = network_copy_layer<Dense_Layer>(dense);
+    copy->grad_weights = {};
+    copy->grad_bias = {};
+    copy->saved_input = {};
+    return copy;
+}
+
+
+Network network_share_weights(Network& network) {
+    Network copy;
+    copy.layers.reserve(network.layers.size());
+    for (Layer* layer : network.layers) {
+        Layer* shared = nullptr;
+        switch (layer->type()) {
+            case Layer_Type_Dense: {
+                shared = network_copy_dense((Dense_Layer*) layer);
+                break;
+            }
+
+            case Layer_Type_Fused_Dense: {
+                Fused_Dense_Layer* fused = network_copy_layer<Fused_Dense_Layer>(layer);
+                fused->dense = network_copy_dense(fused->dense);
+                // The activation runs in the epilogue, the replaced layer stays with the original.
+                fused->activation_layer = nullptr;
+                shared = fused;
+                break;
+            }
+
+            case Layer_Type_ReLU: {
+                shared = network_copy_layer<ReLU_Layer>(layer);
+                ((ReLU_Layer*) shared)->saved_output = {};
+                break;
+            }
+
+            case Layer_Type_Sigmoid: shared = network_copy_layer<Sigmoid_Layer>(layer); break;
+            case Layer_Type_Tanh: shared = network_copy_layer<Tanh_Layer>(layer); break;
+            case Layer_Type_Softmax: shared = network_copy_layer<Softmax_Layer>(layer); break;
+            case Layer_Type_Quantized_Dense: shared = network_copy_layer<Quantized_Dense_Layer>(layer); break;
+
+            case Layer_Type_Conv2D: {
+                // The tuned algorithm and the winograd weights are shared if the original
+                // already computed them, otherwise each copy tunes itself on first use.
+                Conv2D_Layer* conv = network_copy_layer<Conv2D_Layer>(layer);
+                if (conv->winograd_weights.data) conv->winograd_weights = tensor_view(conv->winograd_weights);
+                shared = conv;
+                break;
+            }
+
+            case Layer_Type_Max_Pool:
+            case Layer_Type_Avg_Pool: shared = network_copy_layer<Pool_Layer>(layer); break;
+            case Layer_Type_Flatten: shared = network_copy_layer<Flatten_Layer>(layer); break;
+            case Layer_Type_Sparse_Dense: shared = network_copy_layer<Sparse_Dense_Layer>(layer); break;
+        }
+        assert(shared);
+        copy.layers.push_back(shared);
+    }
+    return copy;
+}
+
+
+void network_release_shared(Network& network) {
+    for (Layer* layer : network.layers) {
+        // Either a reference to the original's winograd weights or the copy's own.
+        if (layer->type() == Layer_Type_Conv2D) tensor_free(((Conv2D_Layer*) layer)->winograd_weights);
+        if (layer->type() == Layer_Type_Quantized_Dense) {
+            // The weights belong to the original layer.
+            Quantized_Dense_Layer* quantized = (Quantized_Dense_Layer*) layer;
+            quantized->weights = nullptr;
+            quantized->weight_scale = nullptr;
+            quantized->row_sum = nullptr;
+            quantized->bias = {};
+        }
+        if (layer->type() == Layer_Type_Sparse_Dense) {
+            Sparse_Dense_Layer* sparse = (Sparse_Dense_Layer*) layer;
+            sparse->weights = {};
+            sparse->bias = {};
+        }
+        delete layer;
+    }
+    network.layers.clear();
+    arena_destroy(&network.arena);
+}
+
+
+/**
+ * Frees the weights and gradients of a dense layer, not the layer itself.
+ */
+static void network_free_dense(Dense_Layer* dense) {
+    tensor_free(dense->weights);
+    tensor_free(dense->bias);
+    tensor_free(dense->grad_weights);
+    tensor_free(dense->grad_bias);
+}
+
+
+void layer_destroy(Layer* layer) {
+    switch (layer->type()) {
+        case Layer_Type_Dense: network_free_dense((Dense_Layer*) layer); break;
+        case Layer_Type_Fused_Dense: network_free_dense(((Fused_Dense_Layer*) layer)->dense); break;
+
+        case Layer_Type_Conv2D: {
+            Conv2D_Layer* conv = (Conv2D_Layer*) layer;
+            conv_reset(conv);
+            tensor_free(conv->weights);
+            tensor_free(conv->bias);
+            break;
+        }
+
+        // The other layers either have no weights or own them.
+        default: break;
+    }
+    delete layer;
+}
+
+
+void network_destroy(Network& network) {
+    for (Layer* layer : network.layers) layer_destroy(layer);
+    network.layers.clear();
+    arena_destroy(&network.arena);
+}
@@ -3,6 +3,7 @@
 
 #include "tensor.h"
 #include "functional.h"
+#include "profiler.h"
 #include <initializer_list>
 #include <vector>
 
@@ -12,6 +13,41 @@ struct Network;
 struct Layer;
 struct Dense_Layer;
 struct ReLU_Layer;
+struct Sigmoid_Layer;
+struct Tanh_Layer;
+struct Softmax_Layer;
+struct Fused_Dense_Layer;
+
+
+enum Layer_Type {
+    Layer_Type_Dense,
+    Layer_Type_ReLU,
+    Layer_Type_Sigmoid,
+    Layer_Type_Tanh,
+    Layer_Type_Softmax,
+    Layer_Type_Fused_Dense,
+    Layer_Type_Quantized_Dense,
+    Layer_Type_Conv2D,
+    Layer_Type_Max_Pool,
+    Layer_Type_Avg_Pool,
+    Layer_Type_Flatten,
+    Layer_Type_Sparse_Dense,
+};
+
+
+/**
+ * Returns the name of the layer type, e.g. for printing.
+ */
+const char* layer_type_name(Layer_Type type);
+
+
+/**
+ * Trainable parameter of a layer together with its gradient.
+ */
+struct Layer_Parameter {
+    Tensor* value;
+    Tensor* grad;
+};
 
 
 /**
@@ -23,7 +59,59 @@ struct Layer {
     /// Requires the gradient to be calculated in backwards step.
     bool require_grad = true;
 
-    virtual Tensor forward(Tensor* input) = 0;
+    virtual ~Layer() = default;
+
+    virtual Layer_Type type() const = 0;
+
+    /**
+     * Infers the shape of the output for an input of the given shape and
+     * returns its number of dimensions, by default the shape is unchanged.
+     */
+    virtual u8 output_shape(const u32* input_shape, u8 ndim, u32* shape) const {
+        for (u8 d = 0; d < ndim; d++) shape[d] = input_shape[d];
+        return ndim;
+    }
+
+    /**
+     * Can the output be written over the input, this is true when every
+     * output element only depends on input elements that are not yet
+     * overwritten, e.g. for element-wise activations.
+     */
+    virtual bool supports_inplace() const {
+        return false;
+    }
+
+    /**
+     * Computes the layer into a preallocated output of the inferred shape,
+     * the output is the input itself if the layer runs in place.
+     */
+    virtual void forward_into(Tensor* input, Tensor* output) = 0;
+
+    /**
+     * Computes the layer into a newly allocated output tensor.
+     */
+    virtual Tensor forward(Tensor* input) {
+        u32 shape[TENSOR_MAX_DIMS];
+        u8 ndim = output_shape(input->shape, input->ndim, shape);
+        Tensor output = tensor_create(shape, ndim);
+        forward_into(input, &output);
+        return output;
+    }
+
+    /**
+     * Propagates the gradient w.r.t. the output of the last forward pass back
+     * to the input, reusing the activations saved by the forward pass, so it
+     * must be called before the next one. The gradients of the parameters are
+     * accumulated unless `require_grad` is false. The gradient of the input is
+     * only computed if `input_grad` is set, otherwise an empty tensor is returned.
+     */
+    virtual Tensor backward(Tensor* grad_output, bool input_grad);
+
+    /**
+     * Appends the trainable parameters of the layer, the gradient
+     * buffers are allocated on the heap the first time.
+     */
+    virtual void parameters(std::vector<Layer_Parameter>& parameters) {}
 };
 
 
@@ -36,11 +124,35 @@ struct Dense_Layer : Layer {
     Tensor weights;
     Tensor bias;
 
-    virtual Tensor forward(Tensor* input) override {
-        Tensor output = tensor_matmul(weights, *input);
-        tensor_add(output, bias);
-        return output;
+    // Gradients, allocated once and accumulated into by backward.
+    Tensor grad_weights = {};
+    Tensor grad_bias = {};
+    // Input of the last forward pass, needed for the gradient of the weights.
+    Tensor saved_input = {};
+
+    /**
+     * The input is either a single sample of shape (1, inputs) or a batch
+     * of N samples stored as columns of shape (N, inputs), the whole batch
+     * goes through one matrix multiplication and the bias is broadcast.
+     */
+    virtual Layer_Type type() const override {
+        return Layer_Type_Dense;
+    }
+
+    virtual u8 output_shape(const u32* input_shape, u8, u32* shape) const override {
+        shape[0] = input_shape[0];
+        shape[1] = weights.shape[1];
+        return 2;
     }
+
+    virtual void forward_into(Tensor* input, Tensor* output) override {
+        saved_input = *input;
+        tensor_dense_into(*output, weights, *input, bias);
+    }
+
+    virtual Tensor backward(Tensor* grad_output, bool input_grad) override;
+
+    virtual void parameters(std::vector<Layer_Parameter>& parameters) override;
 };
 
 
@@ -50,16 +162,151 @@ struct Dense_Layer : Layer {
  */
 struct ReLU_Layer : Layer {
     bool inplace = false;
+    // Output of the last forward pass, its sign is the gradient mask.
+    Tensor saved_output = {};
+
+    virtual Layer_Type type() const override {
+        return Layer_Type_ReLU;
+    }
     
+    virtual bool supports_inplace() const override {
+        return true;
+    }
+
+    virtual void forward_into(Tensor* input, Tensor* output) override {
+        tensor_copy_into(*output, *input);
+        f_relu(*output);
+        saved_output = *output;
+    }
+
     virtual Tensor forward(Tensor* input) override {
-        Tensor t;
-        if (inplace) {
-            t = *input;
-        } else {
-            t = tensor_copy(*input);
-        }
-        f_relu(t);
-        return t;
+        if (!inplace) return Layer::forward(input);
+        f_relu(*input);
+        saved_output = *input;
+        return *input;
+    }
+
+    /**
+     * The gradient is masked in place, since nothing else reads it.
+     */
+    virtual Tensor backward(Tensor* grad_output, bool input_grad) override {
+        if (!input_grad) return {};
+        tensor_apply(*grad_output, saved_output, kernels().relu_grad);
+        return *grad_output;
+    }
+};
+
+
+/**
+ * Sigmoid activation defined as `1 / (1 + exp(-x))`
+ * for each element `x` in the input tensor.
+ */
+struct Sigmoid_Layer : Layer {
+    bool inplace = false;
+
+    virtual Layer_Type type() const override {
+        return Layer_Type_Sigmoid;
+    }
+
+    virtual bool supports_inplace() const override {
+        return true;
+    }
+
+    virtual void forward_into(Tensor* input, Tensor* output) override {
+        tensor_copy_into(*output, *input);
+        f_sigmoid(*output);
+    }
+
+    virtual Tensor forward(Tensor* input) override {
+        if (!inplace) return Layer::forward(input);
+        f_sigmoid(*input);
+        return *input;
+    }
+};
+
+
+/**
+ * Hyperbolic tangent activation applied to each element in the input tensor.
+ */
+struct Tanh_Layer : Layer {
+    bool inplace = false;
+
+    virtual Layer_Type type() const override {
+        return Layer_Type_Tanh;
+    }
+
+    virtual bool supports_inplace() const override {
+        return true;
+    }
+
+    virtual void forward_into(Tensor* input, Tensor* output) override {
+        tensor_copy_into(*output, *input);
+        f_tanh(*output);
+    }
+
+    virtual Tensor forward(Tensor* input) override {
+        if (!inplace) return Layer::forward(input);
+        f_tanh(*input);
+        return *input;
+    }
+};
+
+
+/**
+ * Softmax turns the outputs of each sample into a probability distribution,
+ * unlike the other activations this is not element-wise.
+ */
+struct Softmax_Layer : Layer {
+    bool inplace = false;
+
+    virtual Layer_Type type() const override {
+        return Layer_Type_Softmax;
+    }
+
+    virtual bool supports_inplace() const override {
+        return true;
+    }
+
+    virtual void forward_into(Tensor* input, Tensor* output) override {
+        tensor_copy_into(*output, *input);
+        f_softmax(*output);
+    }
+
+    virtual Tensor forward(Tensor* input) override {
+        if (!inplace) return Layer::forward(input);
+        f_softmax(*input);
+        return *input;
+    }
+};
+
+
+/**
+ * Dense layer followed by an element-wise activation executed as a single
+ * kernel, the bias and activation are applied in the matmul epilogue while
+ * the output tile is still in registers. Created by `network_fuse_layers`,
+ * it owns the dense layer and the activation layer it replaces.
+ */
+struct Fused_Dense_Layer : Layer {
+    Dense_Layer* dense = nullptr;
+    // The activation replaced by the epilogue, kept so it is deleted with the layer.
+    Layer* activation_layer = nullptr;
+    Gemm_Activation activation;
+
+    ~Fused_Dense_Layer() {
+        delete dense;
+        delete activation_layer;
+    }
+
+    virtual Layer_Type type() const override {
+        return Layer_Type_Fused_Dense;
+    }
+
+    virtual u8 output_shape(const u32* input_shape, u8 ndim, u32* shape) const override {
+        return dense->output_shape(input_shape, ndim, shape);
+    }
+
+    virtual void forward_into(Tensor* input, Tensor* output) override {
+        tensor_dense_into(*output, dense->weights, *input, dense->bias, activation);
     }
 };
 
@@ -68,27 +315,85 @@ struct ReLU_Layer : Layer {
  * Neural network defiend by an array of layers.
  */
 struct Network {
-    std::vector<Layer> layers;
+    std::vector<Layer*> layers;
+
+    /// Intermediate tensors of the last forward pass are allocated here.
+    Memory_Arena arena;
 
 
     /**
      * Forwards the input through the list of layers and
-     * returns the resulting tensor.
+     * returns the resulting tensor. All the intermediate tensors
+     * are allocated from the given arena which is reset first,
+     * so the output is only valid until the arena is reset again.
      */
-    Tensor forward(Tensor* input) {
+    Tensor forward(Tensor* input, Memory_Arena* arena) {
+        PROFILE_SCOPE("forward", PROFILE_PASS, 0, 0);
+        arena_reset(arena);
+        Arena_Scope scope(arena);
+
         Tensor output = *input;
         for (int i = 0; i < layers.size(); i++) {
-            output = layers[i].forward(&output);
+            PROFILE_SCOPE(layers[i], i, &output);
+            output = layers[i]->forward(&output);
         }
         return output;
     }
+
+
+    /**
+     * Forwards the input through the list of layers using the network's
+     * own arena, the output is valid until the next call to forward.
+     */
+    Tensor forward(Tensor* input) {
+        return forward(input, &arena);
+    }
+
+
+    /**
+     * Forwards a batch of N samples stored as the columns of a tensor
+     * of shape (N, inputs), the output has the shape (N, outputs).
+     * Each dense layer runs as a single matrix multiplication over the batch.
+     */
+    Tensor forward_batch(Tensor* batch, Memory_Arena* arena) {
+        assert(batch->ndim == 2);
+        return forward(batch, arena);
+    }
+
+
+    Tensor forward_batch(Tensor* batch) {
+        return forward_batch(batch, &arena);
+    }
+
+
+    /**
+     * Backpropagates the gradient of the loss w.r.t. the output of the last
+     * forward pass through all the layers, accumulating the gradients of the
+     * parameters. The intermediate gradients are allocated from the same arena
+     * as the forward pass, which still holds the saved activations.
+     */
+    void backward(Tensor* grad_output, Memory_Arena* arena) {
+        PROFILE_SCOPE("backward", PROFILE_PASS, 0, 0);
+        Arena_Scope scope(arena);
+        Tensor grad = *grad_output;
+        for (size_t i = layers.size(); i > 0; i--) {
+            // The shapes of the forward pass are gone, so only the time is recorded.
+            PROFILE_SCOPE(layer_type_name(layers[i - 1]->type()), PROFILE_BACKWARD, 0, 0, (i32) i - 1);
+            grad = layers[i - 1]->backward(&grad, i > 1);
+        }
+    }
+
+
+    void backward(Tensor* grad_output) {
+        backward(grad_output, &arena);
+    }
 };
 
 
 /**
  * Creates a neural network with layers in sequence.
  */
-inline Network sequential(std::initializer_list<Layer> layers) {
+inline Network sequential(std::initializer_list<Layer*> layers) {
     Network network;
     network.layers = layers;
     return network;
@@ -100,7 +405,7 @@ inline Network sequential(std::initializer_list<Layer> layers) {
  * Create a new dense layer which connects every neuron
  * to each neuron in the next layer.
  */
-Dense_Layer dense_layer(
+Dense_Layer* dense_layer(
     int num_inputs, 
     int num_outputs, 
     void init_weights(Tensor&),
@@ -108,9 +413,90 @@ Dense_Layer dense_layer(
 );
 
 
-inline ReLU_Layer relu(bool inplace = false) {
-    ReLU_Layer layer;
-    layer.inplace = inplace;
+inline ReLU_Layer* relu(bool inplace = false) {
+    ReLU_Layer* layer = new ReLU_Layer;
+    layer->inplace = inplace;
     return layer;
 }
-    
+
+
+inline Sigmoid_Layer* sigmoid(bool inplace = false) {
+    Sigmoid_Layer* layer = new Sigmoid_Layer;
+    layer->inplace = inplace;
+    return layer;
+}
+
+
+inline Tanh_Layer* tanh_layer(bool inplace = false) {
+    Tanh_Layer* layer = new Tanh_Layer;
+    layer->inplace = inplace;
+    return layer;
+}
+
+
+inline Softmax_Layer* softmax(bool inplace = false) {
+    Softmax_Layer* layer = new Softmax_Layer;
+    layer->inplace = inplace;
+    return layer;
+}
+
+
+/**
+ * Returns the epilogue activation equivalent to the layer,
+ * or false if the layer is not an element-wise activation.
+ */
+bool layer_gemm_activation(Layer* layer, Gemm_Activation* activation);
+
+
+/**
+ * Fusion pass over the layers of the network, every dense layer followed
+ * by an element-wise activation is replaced by a single fused layer.
+ */
+void network_fuse_layers(Network& network);
+
+
+/**
+ * Converts the weights of a dense layer to another type, e.g. fp16 or bf16
+ * to halve their memory, the bias stays fp32. The forward pass converts the
+ * weights back to fp32 as they are read, but layers with 16-bit weights
+ * can't be trained so the layer no longer requires gradients.
+ */
+void dense_layer_convert(Dense_Layer* layer, Dtype dtype);
+
+
+/**
+ * Converts the weights of every dense and fused dense layer, returns the
+ * number of bytes of weights saved (negative when converting back to fp32).
+ */
+i64 network_convert_weights(Network& network, Dtype dtype);
+
+
+/**
+ * Creates a copy of the network for inference on another thread. Every
+ * layer is a new object, so the state a forward pass writes to (saved
+ * activations) is separate, but the weights are not copied and point to
+ * the same memory as the layers of `network`, which must outlive the copy.
+ * The weights must not change while the copies are in use.
+ */
+Network network_share_weights(Network& network);
+
+
+/**
+ * Deletes the layers created by `network_share_weights`, the shared weights are left alone.
+ */
+void network_release_shared(Network& network);
+
+
+/**
+ * Deletes a layer together with the weights it holds, for layers owned by
+ * their network (not copies made by `network_share_weights`).
+ */
+void layer_destroy(Layer* layer);
+
+
+/**
+ * Deletes the layers of a network that owns them together with their
+ * weights, and frees its arena. Weights mapped from a model file have
+ * no storage of their own and are left to `model_close`.
+ */
+void network_destroy(Network& network);
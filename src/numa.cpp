@@ -0,0 +1,335 @@
+#include "numa.h"
+#include "quantize.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+
+#ifdef OS_LINUX
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+
+// Memory policies of the mbind and set_mempolicy system calls (linux/mempolicy.h).
+const int NUMA_MPOL_PREFERRED = 1;
+const int NUMA_MPOL_INTERLEAVE = 3;
+const unsigned NUMA_MPOL_MF_MOVE = 1 << 1;
+const int NUMA_MPOL_F_NODE = 1 << 0;
+const int NUMA_MPOL_F_ADDR = 1 << 1;
+
+/**
+ * Largest node number the node masks passed to the kernel can hold.
+ */
+const u32 NUMA_MAX_NODES = 1024;
+
+
+static thread_local i32 numa_thread_node = -1;
+
+
+const char* numa_policy_name(Numa_Policy policy) {
+    switch (policy) {
+        case Numa_Policy_None: return "none";
+        case Numa_Policy_Replicate: return "replicate";
+        case Numa_Policy_Interleave: return "interleave";
+    }
+    return "unknown";
+}
+
+
+/**
+ * Parses a list in the format of /sys, e.g. `0-3,8,10-11`.
+ */
+static void numa_parse_list(const std::string& text, std::vector<u32>& values) {
+    size_t i = 0;
+    while (i < text.size()) {
+        u32 first = 0, last = 0;
+        int used = 0;
+        if (sscanf(text.c_str() + i, "%u-%u%n", &first, &last, &used) == 2) {
+        } else if (sscanf(text.c_str() + i, "%u%n", &first, &used) == 1) {
+            last = first;
+        } else {
+            break;
+        }
+        for (u32 value = first; value <= last; value++) values.push_back(value);
+        i += (size_t) used;
+        if (i < text.size() && text[i] == ',') i++;
+        else break;
+    }
+}
+
+
+static bool numa_read_line(const std::string& path, std::string& line) {
+    std::ifstream file(path);
+    return file && std::getline(file, line);
+}
+
+
+/**
+ * Fills in the node of every CPU from the CPUs of every node.
+ */
+static void numa_map_cpus(Numa_Topology& topology) {
+    u32 num_cpus = std::max(std::thread::hardware_concurrency(), 1u);
+    for (const std::vector<u32>& cpus : topology.cpus) {
+        for (u32 cpu : cpus) num_cpus = std::max(num_cpus, cpu + 1);
+    }
+    topology.cpu_node.assign(num_cpus, 0);
+    for (u32 node = 0; node < topology.num_nodes; node++) {
+        for (u32 cpu : topology.cpus[node]) topology.cpu_node[cpu] = node;
+    }
+}
+
+
+Numa_Topology numa_topology() {
+    Numa_Topology topology = {};
+    std::vector<u32> nodes;
+#ifdef OS_LINUX
+    std::string online;
+    if (numa_read_line("/sys/devices/system/node/online", online)) {
+        numa_parse_list(online, nodes);
+    }
+#endif
+
+    // Nodes without CPUs (memory only) can't run threads, so they are left out.
+    for (u32 id : nodes) {
+        std::string list;
+        std::vector<u32> cpus;
+        if (numa_read_line("/sys/devices/system/node/node" + std::to_string(id) + "/cpulist", list)) {
+            numa_parse_list(list, cpus);
+        }
+        if (cpus.empty()) continue;
+        topology.ids.push_back(id);
+        topology.cpus.push_back(cpus);
+    }
+
+    if (topology.cpus.empty()) {
+        std::vector<u32> cpus;
+        for (u32 cpu = 0; cpu < std::max(std::thread::hardware_concurrency(), 1u); cpu++) cpus.push_back(cpu);
+        topology.ids.assign(1, 0);
+        topology.cpus.assign(1, cpus);
+    }
+    topology.num_nodes = (u32) topology.cpus.size();
+    topology.simulated = false;
+    numa_map_cpus(topology);
+    return topology;
+}
+
+
+Numa_Topology numa_topology_simulated(u32 num_nodes) {
+    assert(num_nodes > 0);
+    Numa_Topology topology = {};
+    u32 num_cpus = std::max(std::thread::hardware_concurrency(), 1u);
+    topology.num_nodes = num_nodes;
+    topology.cpus.resize(num_nodes);
+    for (u32 node = 0; node < num_nodes; node++) {
+        for (u32 cpu = node*num_cpus/num_nodes; cpu < (node + 1)*num_cpus/num_nodes; cpu++) {
+            topology.cpus[node].push_back(cpu);
+        }
+        if (topology.cpus[node].empty()) topology.cpus[node].push_back(node % num_cpus);
+        topology.ids.push_back(node);
+    }
+    topology.simulated = true;
+    numa_map_cpus(topology);
+    return topology;
+}
+
+
+#ifdef OS_LINUX
+
+static u64 numa_page_size() {
+    long size = sysconf(_SC_PAGESIZE);
+    return size > 0 ? (u64) size : 4096;
+}
+
+
+/**
+ * Node mask for the system calls with the given nodes (all of them if node is -1).
+ */
+static void numa_node_mask(const Numa_Topology& topology, i32 node, unsigned long* mask) {
+    const u32 bits = 8*sizeof(unsigned long);
+    for (u32 i = 0; i < NUMA_MAX_NODES/bits; i++) mask[i] = 0;
+    for (u32 n = 0; n < topology.num_nodes; n++) {
+        u32 id = topology.ids[n];
+        if ((node < 0 || (u32) node == n) && id < NUMA_MAX_NODES) mask[id/bits] |= 1ul << (id % bits);
+    }
+}
+
+
+/**
+ * Sets the policy of the whole pages inside the range and moves the ones
+ * already faulted in, pages shared with neighbouring allocations are left alone.
+ */
+static bool numa_mbind(void* ptr, u64 bytes, const Numa_Topology& topology, i32 node) {
+    u64 page = numa_page_size();
+    u64 begin = ((u64) ptr + page - 1)/page*page;
+    u64 end = ((u64) ptr + bytes)/page*page;
+    if (end <= begin) return true;
+    unsigned long mask[NUMA_MAX_NODES/(8*sizeof(unsigned long))];
+    numa_node_mask(topology, node, mask);
+    int mode = node < 0 ? NUMA_MPOL_INTERLEAVE : NUMA_MPOL_PREFERRED;
+    return syscall(SYS_mbind, begin, end - begin, mode, mask, NUMA_MAX_NODES + 1, NUMA_MPOL_MF_MOVE) == 0;
+}
+
+#endif
+
+
+bool numa_bind_thread(const Numa_Topology& topology, u32 node) {
+    assert(node < topology.num_nodes);
+    numa_thread_node = (i32) node;
+#ifdef OS_LINUX
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (u32 cpu : topology.cpus[node]) CPU_SET(cpu, &set);
+    bool bound = pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+    if (!topology.simulated) {
+        unsigned long mask[NUMA_MAX_NODES/(8*sizeof(unsigned long))];
+        numa_node_mask(topology, (i32) node, mask);
+        syscall(SYS_set_mempolicy, NUMA_MPOL_PREFERRED, mask, NUMA_MAX_NODES + 1);
+    }
+    return bound;
+#else
+    return false;
+#endif
+}
+
+
+u32 numa_current_node(const Numa_Topology& topology) {
+    if (numa_thread_node >= 0 && (u32) numa_thread_node < topology.num_nodes) return (u32) numa_thread_node;
+#ifdef OS_LINUX
+    int cpu = sched_getcpu();
+    if (cpu >= 0 && (u32) cpu < topology.cpu_node.size()) return topology.cpu_node[cpu];
+#endif
+    return 0;
+}
+
+
+i32 numa_node_of(const void* ptr) {
+#ifdef OS_LINUX
+    int node = -1;
+    if (syscall(SYS_get_mempolicy, &node, nullptr, 0, ptr, NUMA_MPOL_F_NODE | NUMA_MPOL_F_ADDR) == 0) return node;
+#endif
+    return -1;
+}
+
+
+/**
+ * Copies `bytes` from `src` into the fresh memory at `dst` so that its pages
+ * end up on `node`, or on all nodes round robin if node is -1. Every page is
+ * written first by a thread bound to its node, on the real topology the
+ * pages are also bound with mbind in case the memory was touched before.
+ */
+static void numa_place(void* dst, const void* src, u64 bytes, const Numa_Topology& topology, i32 node) {
+    if (bytes == 0) return;
+#ifdef OS_LINUX
+    if (!topology.simulated) numa_mbind(dst, bytes, topology, node);
+    u64 page = numa_page_size();
+#else
+    u64 page = 4096;
+#endif
+
+    u32 writers = node < 0 ? topology.num_nodes : 1;
+    std::vector<std::thread> threads;
+    for (u32 w = 0; w < writers; w++) {
+        threads.emplace_back([=, &topology]() {
+            numa_bind_thread(topology, node < 0 ? w : (u32) node);
+            u64 begin = (u64) dst;
+            u64 end = begin + bytes;
+            for (u64 p = begin/page + w; p*page < end; p += writers) {
+                u64 first = std::max(p*page, begin);
+                u64 last = std::min((p + 1)*page, end);
+                memcpy((u8*) first, (const u8*) src + (first - begin), last - first);
+            }
+        });
+    }
+    for (std::thread& thread : threads) thread.join();
+}
+
+
+static Tensor numa_place_tensor(Numa_Network* numa, Tensor& tensor, i32 node) {
+    if (!tensor.data) return tensor;
+    assert(tensor_is_contiguous(tensor));
+    Tensor placed;
+    {
+        Arena_Scope heap(nullptr);
+        placed = tensor_create(tensor.shape, tensor.ndim, tensor.dtype);
+    }
+    numa_place(placed.data, tensor.data, tensor_bytes(tensor), numa->topology, node);
+    numa->tensors.push_back(placed);
+    numa->bytes += tensor_bytes(tensor);
+    return placed;
+}
+
+
+template <typename T>
+static T* numa_place_buffer(Numa_Network* numa, T* data, u64 count, i32 node) {
+    T* placed = (T*) memory_alloc(sizeof(T)*count);
+    numa_place(placed, data, sizeof(T)*count, numa->topology, node);
+    numa->buffers.push_back(placed);
+    numa->bytes += sizeof(T)*count;
+    return placed;
+}
+
+
+/**
+ * Points the layers of a copy made by `network_share_weights` at placed copies of their weights.
+ */
+static void numa_place_layers(Numa_Network* numa, Network& network, i32 node) {
+    for (Layer* layer : network.layers) {
+        Dense_Layer* dense = nullptr;
+        if (layer->type() == Layer_Type_Dense) dense = (Dense_Layer*) layer;
+        if (layer->type() == Layer_Type_Fused_Dense) dense = ((Fused_Dense_Layer*) layer)->dense;
+        if (dense) {
+            dense->weights = numa_place_tensor(numa, dense->weights, node);
+            dense->bias = numa_place_tensor(numa, dense->bias, node);
+        }
+
+        if (layer->type() == Layer_Type_Quantized_Dense) {
+            Quantized_Dense_Layer* quantized = (Quantized_Dense_Layer*) layer;
+            quantized->weights = numa_place_buffer(numa, quantized->weights, (u64) quantized->num_outputs*quantized->stride, node);
+            quantized->weight_scale = numa_place_buffer(numa, quantized->weight_scale, quantized->num_outputs, node);
+            quantized->row_sum = numa_place_buffer(numa, quantized->row_sum, quantized->num_outputs, node);
+            quantized->bias = numa_place_tensor(numa, quantized->bias, node);
+        }
+    }
+}
+
+
+Numa_Network* numa_network_create(Network* network, const Numa_Topology& topology, Numa_Policy policy) {
+    Numa_Network* numa = new Numa_Network;
+    numa->network = network;
+    numa->topology = topology;
+    numa->policy = policy;
+    numa->bytes = 0;
+
+    // Only replication has a network per node, the others share one.
+    u32 num_replicas = policy == Numa_Policy_Replicate ? topology.num_nodes : 1;
+    for (u32 node = 0; node < num_replicas; node++) {
+        numa->replicas.push_back(network_share_weights(*network));
+        if (policy == Numa_Policy_Replicate) numa_place_layers(numa, numa->replicas.back(), (i32) node);
+        if (policy == Numa_Policy_Interleave) numa_place_layers(numa, numa->replicas.back(), -1);
+    }
+    return numa;
+}
+
+
+void numa_network_destroy(Numa_Network* numa) {
+    for (Network& replica : numa->replicas) network_release_shared(replica);
+    for (Tensor& tensor : numa->tensors) tensor_free(tensor);
+    for (void* buffer : numa->buffers) memory_free(buffer);
+    delete numa;
+}
+
+
+Network* numa_network_replica(Numa_Network* numa, u32 node) {
+    assert(node < numa->topology.num_nodes);
+    return &numa->replicas[numa->policy == Numa_Policy_Replicate ? node : 0];
+}
+
+
+Network numa_network_share_local(Numa_Network* numa) {
+    return network_share_weights(*numa_network_replica(numa, numa_current_node(numa->topology)));
+}
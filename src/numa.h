@@ -0,0 +1,146 @@
+#pragma once
+
+
+#include "network.h"
+#include <vector>
+
+
+/***************************************************************************
+ * NUMA placement
+ *
+ * On machines with several memory nodes (sockets) a page lives on the node
+ * of the thread that first touched it, so weights created or loaded by one
+ * thread are read across the interconnect by every thread on the other
+ * nodes. The topology is read from /sys/devices/system/node without any
+ * extra library, the weights of a network can then be
+ *
+ *   replicated   one copy per node, every thread reads the copy of its node
+ *   interleaved  a single copy with its pages spread over all the nodes
+ *                round robin, so every thread has the same mix of local
+ *                and remote reads and the bandwidth of all nodes is used
+ *
+ * Threads are bound to the CPUs of a node with `numa_bind_thread`, and
+ * `numa_network_share_local` gives a thread its own copy of the layers
+ * pointing at the replica of its node, so its forward passes only read
+ * local weights. A thread doing so should also run its kernels inline
+ * (`thread_pool_set_inline`), the thread pool isn't node aware.
+ *
+ * Pages are placed with the mbind system call on the real topology, and
+ * by having a thread bound to the node write them first on either kind.
+ * A simulated topology splits the CPUs of a single node machine into
+ * several nodes, memory can't be bound to those so they only exercise
+ * the thread binding and routing, e.g. for testing and benchmarks.
+ *
+ * Replicated are the weights and biases of dense, fused dense and int8
+ * quantized dense layers, other layers share the weights of the original.
+ ***************************************************************************/
+
+
+struct Numa_Topology {
+    u32 num_nodes;
+    /// Number of every node in the operating system, there may be gaps.
+    std::vector<u32> ids;
+    /// Logical CPUs of every node.
+    std::vector<std::vector<u32>> cpus;
+    /// Node of every logical CPU.
+    std::vector<u32> cpu_node;
+    /// Made up by `numa_topology_simulated`, memory can't be bound to the nodes.
+    bool simulated;
+};
+
+
+enum Numa_Policy {
+    /// Weights stay where they are, every node reads the original.
+    Numa_Policy_None,
+    Numa_Policy_Replicate,
+    Numa_Policy_Interleave,
+};
+
+
+/**
+ * Returns the name of the policy, e.g. for printing.
+ */
+const char* numa_policy_name(Numa_Policy policy);
+
+
+/**
+ * Reads the nodes and their CPUs from /sys, machines (or platforms)
+ * without that information are a single node with all the CPUs.
+ */
+Numa_Topology numa_topology();
+
+
+/**
+ * Splits the CPUs of the machine into `num_nodes` nodes of consecutive
+ * CPUs, nodes share CPUs when there are more nodes than CPUs.
+ */
+Numa_Topology numa_topology_simulated(u32 num_nodes);
+
+
+/**
+ * Binds the calling thread to the CPUs of a node and, on the real
+ * topology, makes it allocate memory from that node. Returns false if
+ * binding isn't supported on this platform or failed. The node is
+ * remembered for `numa_current_node` either way.
+ */
+bool numa_bind_thread(const Numa_Topology& topology, u32 node);
+
+
+/**
+ * Returns the node the calling thread was bound to, or the node of
+ * the CPU it is running on if it wasn't bound.
+ */
+u32 numa_current_node(const Numa_Topology& topology);
+
+
+/**
+ * Returns the node holding the page of the address, or -1 if it
+ * is unknown (not faulted in yet or not supported).
+ */
+i32 numa_node_of(const void* ptr);
+
+
+/**
+ * Network with its weights placed according to a policy, one network per
+ * node whose layers point at the weights local to (or interleaved for)
+ * that node. The replicas are for making per thread copies, they must not
+ * be run directly by several threads at a time.
+ */
+struct Numa_Network {
+    Network* network;
+    Numa_Topology topology;
+    Numa_Policy policy;
+    std::vector<Network> replicas;
+    /// Memory allocated for the placed weights over all replicas.
+    u64 bytes;
+    // Placed copies owned by the replicas, freed with them.
+    std::vector<Tensor> tensors;
+    std::vector<void*> buffers;
+};
+
+
+/**
+ * Places the weights of the network, which must outlive the result and
+ * must not change while it is in use.
+ */
+Numa_Network* numa_network_create(Network* network, const Numa_Topology& topology, Numa_Policy policy);
+
+
+/**
+ * Frees the replicas and their weights, the copies made from them must
+ * have been released first.
+ */
+void numa_network_destroy(Numa_Network* numa);
+
+
+/**
+ * Returns the replica of a node.
+ */
+Network* numa_network_replica(Numa_Network* numa, u32 node);
+
+
+/**
+ * Makes a copy of the layers for the calling thread (see `network_share_weights`)
+ * from the replica of its node, release it with `network_release_shared`.
+ */
+Network numa_network_share_local(Numa_Network* numa);
@@ -0,0 +1,327 @@
+#include "pipeline.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+
+
+static u64 pipeline_now_ns() {
+    using namespace std::chrono;
+    return (u64) duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+
+/**
+ * Times every layer on its own, the best of a few runs on an input of the
+ * compiled shape (random values, the cost of the layers doesn't depend on them).
+ * Element-wise layers are timed out of place so they don't run on their own output.
+ */
+static void pipeline_measure_layers(Pipeline* pipeline, const u32* input_shape, u8 ndim) {
+    Memory_Arena arena;
+    {
+        Arena_Scope scope(&arena);
+        Tensor input = tensor_create(input_shape, ndim);
+        tensor_init_random(input);
+        for (Layer* layer : pipeline->network->layers) {
+            u32 shape[TENSOR_MAX_DIMS];
+            u8 output_ndim = layer->output_shape(input.shape, input.ndim, shape);
+            Tensor output = tensor_create(shape, output_ndim);
+            u64 best = ~0ull;
+            for (u32 r = 0; r < std::max(pipeline->config.calibration_runs, 1u); r++) {
+                u64 start = pipeline_now_ns();
+                layer->forward_into(&input, &output);
+                best = std::min(best, pipeline_now_ns() - start);
+            }
+            pipeline->layer_costs.push_back(best*1e-9);
+            input = output;
+        }
+    }
+    arena_destroy(&arena);
+}
+
+
+/**
+ * Splits the layers into `num_stages` contiguous ranges minimizing the
+ * cost of the most expensive one, which limits the throughput. Dynamic
+ * programming over (stages, layers), `ends[s]` is the end of stage `s`.
+ */
+static void pipeline_partition(const std::vector<f64>& costs, u32 num_stages, std::vector<u32>& ends) {
+    u32 n = (u32) costs.size();
+    std::vector<f64> prefix(n + 1, 0.0);
+    for (u32 i = 0; i < n; i++) prefix[i + 1] = prefix[i] + costs[i];
+
+    // best[s*(n + 1) + i] is the lowest max cost of the first i layers
+    // in s + 1 stages, split[] the start of the last of those stages.
+    std::vector<f64> best(num_stages*(n + 1), 1e30);
+    std::vector<u32> split(num_stages*(n + 1), 0);
+    for (u32 i = 1; i <= n; i++) best[i] = prefix[i];
+    for (u32 s = 1; s < num_stages; s++) {
+        for (u32 i = s + 1; i <= n; i++) {
+            for (u32 j = s; j < i; j++) {
+                f64 cost = std::max(best[(s - 1)*(n + 1) + j], prefix[i] - prefix[j]);
+                if (cost < best[s*(n + 1) + i]) {
+                    best[s*(n + 1) + i] = cost;
+                    split[s*(n + 1) + i] = j;
+                }
+            }
+        }
+    }
+
+    ends.assign(num_stages, n);
+    for (u32 s = num_stages - 1; s > 0; s--) {
+        ends[s - 1] = split[s*(n + 1) + ends[s]];
+    }
+}
+
+
+static Pipeline_Ring* pipeline_ring_create(u32 capacity, const u32* shape, u8 ndim) {
+    Pipeline_Ring* ring = new Pipeline_Ring;
+    ring->head.store(0, std::memory_order_relaxed);
+    ring->tail.store(0, std::memory_order_relaxed);
+    ring->cached_head = 0;
+    ring->cached_tail = 0;
+    ring->capacity = capacity;
+    ring->slots = new Tensor[capacity];
+    for (u32 i = 0; i < capacity; i++) {
+        ring->slots[i] = tensor_create(shape, ndim);
+    }
+    return ring;
+}
+
+
+static void pipeline_ring_destroy(Pipeline_Ring* ring) {
+    for (u32 i = 0; i < ring->capacity; i++) {
+        tensor_free(ring->slots[i]);
+    }
+    delete[] ring->slots;
+    delete ring;
+}
+
+
+/**
+ * Waits for a free slot to write into, returns nullptr on shutdown.
+ * Only called by the producer of the ring.
+ */
+static Tensor* pipeline_ring_reserve(Pipeline_Ring* ring, const std::atomic<bool>& shutdown) {
+    u64 head = ring->head.load(std::memory_order_relaxed);
+    while (head - ring->cached_tail >= ring->capacity) {
+        ring->cached_tail = ring->tail.load(std::memory_order_acquire);
+        if (head - ring->cached_tail < ring->capacity) break;
+        if (shutdown.load(std::memory_order_relaxed)) return nullptr;
+        std::this_thread::yield();
+    }
+    return &ring->slots[head % ring->capacity];
+}
+
+
+static void pipeline_ring_publish(Pipeline_Ring* ring) {
+    ring->head.store(ring->head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+
+/**
+ * Waits for the oldest published slot, returns nullptr on shutdown.
+ * Only called by the consumer of the ring.
+ */
+static Tensor* pipeline_ring_peek(Pipeline_Ring* ring, const std::atomic<bool>& shutdown) {
+    u64 tail = ring->tail.load(std::memory_order_relaxed);
+    while (tail == ring->cached_head) {
+        ring->cached_head = ring->head.load(std::memory_order_acquire);
+        if (tail != ring->cached_head) break;
+        if (shutdown.load(std::memory_order_relaxed)) return nullptr;
+        std::this_thread::yield();
+    }
+    return &ring->slots[tail % ring->capacity];
+}
+
+
+static void pipeline_ring_release(Pipeline_Ring* ring) {
+    ring->tail.store(ring->tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+
+/**
+ * Copies a tensor into a ring slot, the slot takes its shape (contiguous).
+ */
+static void pipeline_copy_to_slot(Tensor& slot, Tensor& tensor) {
+    slot.ndim = tensor.ndim;
+    for (u8 d = 0; d < tensor.ndim; d++) slot.shape[d] = tensor.shape[d];
+    tensor_set_contiguous(slot);
+    tensor_copy_into(slot, tensor);
+}
+
+
+static void pipeline_stage_main(Pipeline* pipeline, u32 index) {
+    Pipeline_Stage* stage = pipeline->stages[index];
+    if (pipeline->config.pin_threads) thread_pin_to_cpu(stage->cpu);
+    thread_pool_set_inline(true);
+
+    Pipeline_Ring* input_ring = pipeline->rings[index];
+    Pipeline_Ring* output_ring = pipeline->rings[index + 1];
+    while (true) {
+        u64 wait_start = pipeline_now_ns();
+        Tensor* input = pipeline_ring_peek(input_ring, pipeline->shutdown);
+        if (!input) break;
+        u64 compute_start = pipeline_now_ns();
+        Tensor output = plan_forward(stage->plan, input);
+        u64 compute_end = pipeline_now_ns();
+
+        // The output is still in the plan's workspace, so the input slot can
+        // go back to the previous stage before waiting on the next one.
+        pipeline_ring_release(input_ring);
+        Tensor* slot = pipeline_ring_reserve(output_ring, pipeline->shutdown);
+        if (!slot) break;
+        u64 copy_start = pipeline_now_ns();
+        pipeline_copy_to_slot(*slot, output);
+        pipeline_ring_publish(output_ring);
+        u64 copy_end = pipeline_now_ns();
+
+        stage->items.fetch_add(1, std::memory_order_relaxed);
+        stage->starved_ns.fetch_add(compute_start - wait_start, std::memory_order_relaxed);
+        stage->busy_ns.fetch_add(compute_end - compute_start + copy_end - copy_start, std::memory_order_relaxed);
+        stage->blocked_ns.fetch_add(copy_start - compute_end, std::memory_order_relaxed);
+    }
+}
+
+
+Pipeline* pipeline_create(Network* network, const u32* input_shape, u8 ndim, Pipeline_Config config) {
+    assert(!network->layers.empty());
+    assert(config.ring_capacity > 0);
+    Pipeline* pipeline = new Pipeline;
+    pipeline->network = network;
+    pipeline->config = config;
+    pipeline->shutdown.store(false);
+    pipeline_measure_layers(pipeline, input_shape, ndim);
+
+    u32 num_layers = (u32) network->layers.size();
+    u32 num_stages = config.num_stages;
+    if (num_stages == 0) num_stages = std::max(std::thread::hardware_concurrency(), 1u);
+    num_stages = std::min(num_stages, num_layers);
+    std::vector<u32> ends;
+    pipeline_partition(pipeline->layer_costs, num_stages, ends);
+
+    // Every stage gets a plan for its input shape and a ring for its input,
+    // the input shape of a stage is the output shape of the previous one.
+    u32 shape[TENSOR_MAX_DIMS];
+    for (u8 d = 0; d < ndim; d++) shape[d] = input_shape[d];
+    u32 first = 0;
+    for (u32 s = 0; s < num_stages; s++) {
+        Pipeline_Stage* stage = new Pipeline_Stage;
+        stage->first_layer = first;
+        stage->end_layer = ends[s];
+        stage->cpu = (config.first_cpu + s) % std::max(std::thread::hardware_concurrency(), 1u);
+        stage->cost = 0.0;
+        stage->network.layers.assign(network->layers.begin() + first, network->layers.begin() + ends[s]);
+        stage->plan = plan_compile(&stage->network, shape, ndim);
+        stage->items.store(0);
+        stage->busy_ns.store(0);
+        stage->starved_ns.store(0);
+        stage->blocked_ns.store(0);
+        pipeline->rings.push_back(pipeline_ring_create(config.ring_capacity, shape, ndim));
+
+        for (u32 i = first; i < ends[s]; i++) stage->cost += pipeline->layer_costs[i];
+        const Plan_Step& last = stage->plan->steps.back();
+        ndim = last.ndim;
+        for (u8 d = 0; d < ndim; d++) shape[d] = last.shape[d];
+        pipeline->stages.push_back(stage);
+        first = ends[s];
+    }
+    pipeline->rings.push_back(pipeline_ring_create(config.ring_capacity, shape, ndim));
+
+    pipeline->start_time = pipeline_now_ns()*1e-9;
+    for (u32 s = 0; s < num_stages; s++) {
+        pipeline->stages[s]->thread = std::thread(pipeline_stage_main, pipeline, s);
+    }
+    return pipeline;
+}
+
+
+void pipeline_destroy(Pipeline* pipeline) {
+    pipeline->shutdown.store(true);
+    for (Pipeline_Stage* stage : pipeline->stages) {
+        stage->thread.join();
+        plan_destroy(stage->plan);
+        arena_destroy(&stage->network.arena);
+        delete stage;
+    }
+    for (Pipeline_Ring* ring : pipeline->rings) {
+        pipeline_ring_destroy(ring);
+    }
+    delete pipeline;
+}
+
+
+void pipeline_submit(Pipeline* pipeline, Tensor* input) {
+    Pipeline_Ring* ring = pipeline->rings.front();
+#ifdef DEBUG
+    const Execution_Plan* plan = pipeline->stages[0]->plan;
+    if (input->ndim != plan->input_ndim || input->shape[0] > plan->input_shape[0]) {
+        std::cerr << "error: input shape does not match the pipeline" << std::endl;
+        assert(false);
+    }
+#endif
+    Tensor* slot = pipeline_ring_reserve(ring, pipeline->shutdown);
+    assert(slot);
+    pipeline_copy_to_slot(*slot, *input);
+    pipeline_ring_publish(ring);
+}
+
+
+void pipeline_receive(Pipeline* pipeline, Tensor* output) {
+    Pipeline_Ring* ring = pipeline->rings.back();
+    Tensor* slot = pipeline_ring_peek(ring, pipeline->shutdown);
+    assert(slot);
+    assert(output->length == slot->length);
+    tensor_copy_into(*output, *slot);
+    pipeline_ring_release(ring);
+}
+
+
+Pipeline_Stats pipeline_stats(Pipeline* pipeline) {
+    Pipeline_Stats stats = {};
+    f64 elapsed = pipeline_now_ns()*1e-9 - pipeline->start_time;
+    f64 highest = -1.0;
+    for (u32 s = 0; s < pipeline->stages.size(); s++) {
+        Pipeline_Stage* stage = pipeline->stages[s];
+        Pipeline_Stage_Stats stage_stats = {};
+        stage_stats.first_layer = stage->first_layer;
+        stage_stats.end_layer = stage->end_layer;
+        stage_stats.cpu = stage->cpu;
+        stage_stats.cost_ms = stage->cost*1e3;
+        stage_stats.items = stage->items.load(std::memory_order_relaxed);
+        if (elapsed > 0.0) {
+            stage_stats.utilization = stage->busy_ns.load(std::memory_order_relaxed)*1e-9/elapsed;
+            stage_stats.starved = stage->starved_ns.load(std::memory_order_relaxed)*1e-9/elapsed;
+            stage_stats.blocked = stage->blocked_ns.load(std::memory_order_relaxed)*1e-9/elapsed;
+        }
+        if (stage_stats.utilization > highest) {
+            highest = stage_stats.utilization;
+            stats.bottleneck = s;
+        }
+        stats.stages.push_back(stage_stats);
+    }
+    if (elapsed > 0.0) {
+        stats.items_per_second = stats.stages.back().items/elapsed;
+    }
+    return stats;
+}
+
+
+std::ostream& operator<<(std::ostream& stream, const Pipeline_Stats& stats) {
+    stream << "pipeline with " << stats.stages.size() << " stages, "
+           << std::fixed << std::setprecision(1) << stats.items_per_second << " items/s" << std::endl;
+    stream << "  stage  layers     cpu   cost ms   items   busy %  starved %  blocked %" << std::endl;
+    for (u32 s = 0; s < stats.stages.size(); s++) {
+        const Pipeline_Stage_Stats& stage = stats.stages[s];
+        stream << "  " << std::setw(5) << s << "  " << std::setw(3) << stage.first_layer << "-"
+               << std::left << std::setw(6) << stage.end_layer - 1 << std::right
+               << std::setw(4) << stage.cpu
+               << std::setw(10) << std::setprecision(3) << stage.cost_ms
+               << std::setw(8) << stage.items
+               << std::setw(9) << std::setprecision(1) << stage.utilization*100.0
+               << std::setw(11) << stage.starved*100.0
+               << std::setw(11) << stage.blocked*100.0
+               << (s == stats.bottleneck ? "  <- bottleneck" : "") << std::endl;
+    }
+    return stream;
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+
+#include "network.h"
+#include "plan.h"
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+
+/***************************************************************************
+ * Pipelined execution
+ *
+ * Streams a sequence of inputs through a sequential network with the
+ * layers split into contiguous stages, each stage runs on its own thread
+ * pinned to its own core. While stage 2 computes input 1, stage 1 already
+ * computes input 2, so every core is busy and each core only ever touches
+ * the weights of its own layers, which stay in its caches.
+ *
+ * The stages are balanced by the measured time of every layer for the
+ * compiled input shape, and pass their outputs on through single producer
+ * single consumer rings of preallocated tensors, so the steady state
+ * neither locks nor allocates. A stage runs its layers through its own
+ * execution plan and its kernels run single threaded on its core.
+ *
+ * Inputs are submitted by one thread and the outputs are received in the
+ * same order by one thread (possibly the same one, as long as it doesn't
+ * submit more than the pipeline can hold before receiving).
+ ***************************************************************************/
+
+
+struct Pipeline_Config {
+    /// Number of stages, zero means one per hardware thread. Never more
+    /// than the number of layers.
+    u32 num_stages = 0;
+    /// Number of tensors in each ring between two stages.
+    u32 ring_capacity = 4;
+    /// Stage `s` is pinned to logical CPU `first_cpu + s` (modulo the number of CPUs).
+    u32 first_cpu = 0;
+    bool pin_threads = true;
+    /// Number of timed forward passes per layer used to balance the stages.
+    u32 calibration_runs = 5;
+};
+
+
+/**
+ * Bounded single producer single consumer queue of tensors. The slots are
+ * allocated for the largest shape once, the producer writes into the slot
+ * at `head` and publishes it, the consumer reads the slot at `tail` and
+ * hands it back. The counters live on their own cache lines, and each side
+ * keeps a cached copy of the other side's counter so it only touches the
+ * shared line when the ring looks full or empty.
+ */
+struct Pipeline_Ring {
+    alignas(64) std::atomic<u64> head;
+    u64 cached_tail;
+    alignas(64) std::atomic<u64> tail;
+    u64 cached_head;
+    alignas(64) u32 capacity;
+    Tensor* slots;
+};
+
+
+struct Pipeline_Stage {
+    /// Layers [first_layer, end_layer) of the network.
+    u32 first_layer;
+    u32 end_layer;
+    u32 cpu;
+    /// Measured time of the stage's layers in seconds.
+    f64 cost;
+
+    // The stage's layers (not owned) and their plan for the stage's input shape.
+    Network network;
+    Execution_Plan* plan;
+    std::thread thread;
+
+    // Statistics in nanoseconds, written by the stage and read by anyone.
+    std::atomic<u64> items;
+    std::atomic<u64> busy_ns;
+    std::atomic<u64> starved_ns;
+    std::atomic<u64> blocked_ns;
+};
+
+
+struct Pipeline {
+    Network* network;
+    Pipeline_Config config;
+    /// Measured time of every layer in seconds.
+    std::vector<f64> layer_costs;
+    std::vector<Pipeline_Stage*> stages;
+    /// Ring `s` is the input of stage `s`, the last ring holds the outputs.
+    std::vector<Pipeline_Ring*> rings;
+    std::atomic<bool> shutdown;
+    f64 start_time;
+};
+
+
+struct Pipeline_Stage_Stats {
+    u32 first_layer;
+    u32 end_layer;
+    u32 cpu;
+    f64 cost_ms;
+    u64 items;
+    /// Fractions of the time since the pipeline started the stage was
+    /// computing, waiting for an input and waiting for space for its output.
+    f64 utilization;
+    f64 starved;
+    f64 blocked;
+};
+
+
+struct Pipeline_Stats {
+    std::vector<Pipeline_Stage_Stats> stages;
+    /// Items that left the last stage per second.
+    f64 items_per_second;
+    /// Stage with the highest utilization, i.e. the one limiting the throughput.
+    u32 bottleneck;
+};
+
+
+/**
+ * Measures the layers on inputs of the given shape, splits them into
+ * balanced stages and starts a pinned thread per stage. The network must
+ * not be used by anyone else while the pipeline is running.
+ */
+Pipeline* pipeline_create(Network* network, const u32* input_shape, u8 ndim, Pipeline_Config config = {});
+
+
+/**
+ * Stops the stages and frees the rings, items still in flight are dropped.
+ */
+void pipeline_destroy(Pipeline* pipeline);
+
+
+/**
+ * Copies the input into the pipeline, waiting while the first ring is full.
+ * The input must have the compiled shape or fewer samples in the batch.
+ */
+void pipeline_submit(Pipeline* pipeline, Tensor* input);
+
+
+/**
+ * Waits for the output of the oldest submitted input and copies it into
+ * `output`, which must have the matching shape.
+ */
+void pipeline_receive(Pipeline* pipeline, Tensor* output);
+
+
+/**
+ * Returns the per-stage utilization and the throughput so far.
+ */
+Pipeline_Stats pipeline_stats(Pipeline* pipeline);
+
+
+/**
+ * Render the stages with their layers, cost and utilization.
+ */
+std::ostream& operator<<(std::ostream& stream, const Pipeline_Stats& stats);
@@ -0,0 +1,159 @@
+#include "plan.h"
+#include <algorithm>
+#include <iomanip>
+
+
+/**
+ * Finds a buffer that is free before `step`, preferring the smallest one
+ * that can hold `length` floats and otherwise the largest one which is
+ * then grown. Returns PLAN_INPUT_BUFFER if every buffer is in use.
+ */
+static u32 plan_find_free_buffer(Execution_Plan* plan, u32 step, u32 length) {
+    u32 best = PLAN_INPUT_BUFFER;
+    for (u32 b = 0; b < plan->buffers.size(); b++) {
+        Plan_Buffer& buffer = plan->buffers[b];
+        if (buffer.last_step >= step) continue;
+        if (best == PLAN_INPUT_BUFFER) {
+            best = b;
+            continue;
+        }
+
+        u32 best_capacity = plan->buffers[best].capacity;
+        bool fits = buffer.capacity >= length;
+        bool best_fits = best_capacity >= length;
+        if ((fits && (!best_fits || buffer.capacity < best_capacity)) ||
+            (!fits && !best_fits && buffer.capacity > best_capacity)) {
+            best = b;
+        }
+    }
+    return best;
+}
+
+
+Execution_Plan* plan_compile(Network* network, const u32* input_shape, u8 ndim) {
+    assert(ndim <= TENSOR_MAX_DIMS);
+    Execution_Plan* plan = new Execution_Plan;
+    plan->network = network;
+    plan->input_ndim = ndim;
+    for (u8 d = 0; d < ndim; d++) plan->input_shape[d] = input_shape[d];
+    plan->unplanned_bytes = 0;
+
+    // Infer the shapes of all the intermediates.
+    u32 num_steps = (u32) network->layers.size();
+    const u32* shape = input_shape;
+    for (u32 i = 0; i < num_steps; i++) {
+        Plan_Step step = {};
+        step.layer = network->layers[i];
+        step.ndim = step.layer->output_shape(shape, ndim, step.shape);
+        step.length = 1;
+        for (u8 d = 0; d < step.ndim; d++) step.length *= step.shape[d];
+        plan->steps.push_back(step);
+        plan->unplanned_bytes += sizeof(float)*step.length;
+        shape = plan->steps.back().shape;
+        ndim = step.ndim;
+    }
+
+    // The output of step i is read by step i + 1, except for the output
+    // of the network which has to survive until the end of the pass.
+    // An in place step extends the lifetime of its input buffer instead
+    // of taking a new one, the input of the network is never written to.
+    for (u32 i = 0; i < num_steps; i++) {
+        Plan_Step& step = plan->steps[i];
+        u32 last_use = i + 1;
+        u32 input_buffer = i == 0 ? PLAN_INPUT_BUFFER : plan->steps[i - 1].buffer;
+        if (step.layer->supports_inplace() && input_buffer != PLAN_INPUT_BUFFER &&
+            plan->buffers[input_buffer].capacity >= step.length) {
+            step.buffer = input_buffer;
+            step.inplace = true;
+            plan->buffers[input_buffer].last_step = last_use;
+            continue;
+        }
+
+        step.buffer = plan_find_free_buffer(plan, i, step.length);
+        if (step.buffer == PLAN_INPUT_BUFFER) {
+            step.buffer = (u32) plan->buffers.size();
+            Plan_Buffer buffer = {};
+            buffer.first_step = i;
+            plan->buffers.push_back(buffer);
+        }
+        Plan_Buffer& buffer = plan->buffers[step.buffer];
+        buffer.capacity = std::max(buffer.capacity, step.length);
+        buffer.last_step = last_use;
+    }
+
+    // Carve the buffers out of a single workspace, each one cache line aligned.
+    u64 floats_per_line = MEMORY_ALIGNMENT/sizeof(float);
+    u64 offset = 0;
+    for (Plan_Buffer& buffer : plan->buffers) {
+        buffer.offset = offset;
+        offset += (buffer.capacity + floats_per_line - 1)/floats_per_line*floats_per_line;
+    }
+    plan->workspace_bytes = sizeof(float)*offset;
+    plan->workspace = (float*) memory_alloc(plan->workspace_bytes);
+    return plan;
+}
+
+
+void plan_destroy(Execution_Plan* plan) {
+    memory_free(plan->workspace);
+    delete plan;
+}
+
+
+Tensor plan_forward(Execution_Plan* plan, Tensor* input) {
+#ifdef DEBUG
+    if (input->ndim != plan->input_ndim || input->shape[0] > plan->input_shape[0]) {
+        std::cerr << "error: input shape does not match the compiled plan" << std::endl;
+        assert(false);
+    }
+    for (u8 d = 1; d < input->ndim; d++) {
+        assert(input->shape[d] == plan->input_shape[d]);
+    }
+#endif
+
+    // Shapes are inferred again since the batch may be smaller than
+    // the compiled one, the buffers are large enough either way.
+    PROFILE_SCOPE("plan_forward", PROFILE_PASS, 0, 0);
+    Tensor output = *input;
+    u32 shape[TENSOR_MAX_DIMS];
+    for (u32 i = 0; i < plan->steps.size(); i++) {
+        Plan_Step& step = plan->steps[i];
+        PROFILE_SCOPE(step.layer, (i32) i, &output);
+        u8 ndim = step.layer->output_shape(output.shape, output.ndim, shape);
+        float* data = plan->workspace + plan->buffers[step.buffer].offset;
+        Tensor next = tensor_wrap(data, shape, ndim);
+        assert(next.length <= plan->buffers[step.buffer].capacity);
+        if (step.inplace && next.ndim == output.ndim) {
+            // Writing over the input keeps its layout, e.g. permuted image strides.
+            for (u8 d = 0; d < ndim; d++) next.stride[d] = output.stride[d];
+        }
+        step.layer->forward_into(&output, &next);
+        output = next;
+    }
+    return output;
+}
+
+
+std::ostream& operator<<(std::ostream& stream, Execution_Plan& plan) {
+    stream << "plan for input (";
+    for (u8 d = 0; d < plan.input_ndim; d++) {
+        stream << (d > 0 ? ", " : "") << plan.input_shape[d];
+    }
+    stream << ")" << std::endl;
+
+    for (u32 i = 0; i < plan.steps.size(); i++) {
+        Plan_Step& step = plan.steps[i];
+        stream << "  " << std::setw(3) << i << "  " << std::left << std::setw(12)
+               << layer_type_name(step.layer->type()) << std::right << " -> (";
+        for (u8 d = 0; d < step.ndim; d++) {
+            stream << (d > 0 ? ", " : "") << step.shape[d];
+        }
+        stream << ") buffer " << step.buffer << (step.inplace ? " (in place)" : "") << std::endl;
+    }
+
+    stream << std::fixed << std::setprecision(2);
+    stream << "  workspace: " << plan.workspace_bytes/1024.0 << " KiB in "
+           << plan.buffers.size() << " buffers, "
+           << plan.unplanned_bytes/1024.0 << " KiB without reuse" << std::endl;
+    return stream;
+}
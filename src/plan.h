@@ -0,0 +1,98 @@
+#pragma once
+
+
+#include "network.h"
+#include <iostream>
+#include <vector>
+
+
+/***************************************************************************
+ * Execution plans
+ *
+ * Compiling a network for a given input shape infers the shape of every
+ * intermediate tensor up front and assigns each of them to a buffer in a
+ * single preallocated workspace. Buffers are reused as soon as the tensor
+ * in them is no longer needed, so a sequential network ping-pongs between
+ * two buffers, and element-wise layers write over their input. A forward
+ * pass through the plan touches the same small set of memory every time
+ * and never allocates.
+ ***************************************************************************/
+
+
+/**
+ * Buffer index used for the input of the network, which is not owned by the plan.
+ */
+const u32 PLAN_INPUT_BUFFER = ~0u;
+
+
+/**
+ * Single layer of the plan with the shape of its output
+ * (for the input shape the plan was compiled for).
+ */
+struct Plan_Step {
+    Layer* layer;
+    u8 ndim;
+    u32 shape[TENSOR_MAX_DIMS];
+    u32 length;
+    // Buffer the output is written to.
+    u32 buffer;
+    // Is the output written over the input.
+    bool inplace;
+};
+
+
+/**
+ * Region of the workspace holding one intermediate tensor at a time.
+ * The lifetime is the range of steps using the buffer, from the step
+ * producing the first tensor to the last step reading from it.
+ */
+struct Plan_Buffer {
+    u64 offset;
+    u32 capacity;
+    u32 first_step;
+    u32 last_step;
+};
+
+
+struct Execution_Plan {
+    Network* network;
+    u8 input_ndim;
+    u32 input_shape[TENSOR_MAX_DIMS];
+    std::vector<Plan_Step> steps;
+    std::vector<Plan_Buffer> buffers;
+
+    float* workspace;
+    // Size of the workspace, i.e. the peak memory of the intermediates.
+    u64 workspace_bytes;
+    // Memory the intermediates would need without reusing buffers.
+    u64 unplanned_bytes;
+};
+
+
+/**
+ * Compiles the network into a plan for inputs of the given shape, the
+ * workspace is allocated right away so the peak memory is known before
+ * the first forward pass. The plan refers to the layers of the network,
+ * which must stay alive and unchanged for as long as the plan is used.
+ */
+Execution_Plan* plan_compile(Network* network, const u32* input_shape, u8 ndim);
+
+
+/**
+ * Frees the workspace and the plan.
+ */
+void plan_destroy(Execution_Plan* plan);
+
+
+/**
+ * Forwards the input through the plan, the input must have the compiled
+ * shape or a smaller first dimension (i.e. fewer samples in the batch).
+ * The output lives in the workspace and is valid until the next call.
+ */
+Tensor plan_forward(Execution_Plan* plan, Tensor* input);
+
+
+/**
+ * Render the steps, buffer assignment and peak memory of the plan.
+ */
+std::ostream& operator<<(std::ostream& stream, Execution_Plan& plan);
@@ -0,0 +1,327 @@
+#include "profiler.h"
+#include "conv.h"
+#include "memory.h"
+#include "network.h"
+#include "quantize.h"
+#include "sparse.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <mutex>
+#include <vector>
+
+
+std::atomic<bool> profiler_active{false};
+
+
+/**
+ * Events recorded by one thread, the buffers are never freed
+ * so the events of threads that have exited can still be exported.
+ */
+struct Profiler_Thread {
+    u32 id;
+    std::vector<Profile_Event> events;
+    u64 dropped;
+};
+
+
+static std::mutex profiler_mutex;
+static std::vector<Profiler_Thread*> profiler_threads;
+static thread_local Profiler_Thread* profiler_thread = nullptr;
+static f64 profiler_epoch = 0.0;
+
+
+static f64 profiler_now() {
+    using namespace std::chrono;
+    return duration<f64>(steady_clock::now().time_since_epoch()).count() - profiler_epoch;
+}
+
+
+static u64 profiler_allocations() {
+    Memory_Stats stats = memory_stats();
+    return stats.heap_allocations + stats.arena_allocations;
+}
+
+
+static Profiler_Thread* profiler_current_thread() {
+    if (!profiler_thread) {
+        std::lock_guard<std::mutex> lock(profiler_mutex);
+        profiler_thread = new Profiler_Thread;
+        profiler_thread->id = (u32) profiler_threads.size();
+        profiler_thread->events.reserve(4096);
+        profiler_thread->dropped = 0;
+        profiler_threads.push_back(profiler_thread);
+    }
+    return profiler_thread;
+}
+
+
+bool profiler_set_enabled(bool enabled) {
+#ifdef PROFILE
+    if (enabled && profiler_epoch == 0.0) profiler_reset();
+    profiler_active.store(enabled, std::memory_order_relaxed);
+    return true;
+#else
+    (void) enabled;
+    return false;
+#endif
+}
+
+
+void profiler_reset() {
+    std::lock_guard<std::mutex> lock(profiler_mutex);
+    for (Profiler_Thread* thread : profiler_threads) {
+        thread->events.clear();
+        thread->dropped = 0;
+    }
+    profiler_epoch = 0.0;
+    profiler_epoch = profiler_now();
+}
+
+
+void Profile_Scope::begin(const char* name, const char* category, i32 index, u64 flops, u64 bytes) {
+    event.name = name;
+    event.category = category;
+    event.index = index;
+    event.flops = flops;
+    event.bytes = bytes;
+    allocations = profiler_allocations();
+    event.start = profiler_now();
+}
+
+
+void Profile_Scope::begin_layer(const Layer* layer, i32 index, const Tensor* input) {
+    u64 flops, bytes;
+    profile_layer_cost(layer, input->shape, input->ndim, &flops, &bytes);
+    begin(layer_type_name(layer->type()), PROFILE_LAYER, index, flops, bytes);
+}
+
+
+void Profile_Scope::end() {
+    event.duration = profiler_now() - event.start;
+    event.allocations = profiler_allocations() - allocations;
+
+    Profiler_Thread* thread = profiler_current_thread();
+    event.thread = thread->id;
+    if (thread->events.size() >= PROFILER_MAX_EVENTS) {
+        thread->dropped++;
+        return;
+    }
+    thread->events.push_back(event);
+}
+
+
+void profile_layer_cost(const Layer* layer, const u32* input_shape, u8 ndim, u64* flops, u64* bytes) {
+    u32 output_shape[TENSOR_MAX_DIMS];
+    u8 output_ndim = layer->output_shape(input_shape, ndim, output_shape);
+    u64 inputs = 1, outputs = 1;
+    for (u8 d = 0; d < ndim; d++) inputs *= input_shape[d];
+    for (u8 d = 0; d < output_ndim; d++) outputs *= output_shape[d];
+    u64 batch = input_shape[0];
+
+    // Element-wise by default, reading the input and writing the output once.
+    *flops = outputs;
+    *bytes = sizeof(float)*(inputs + outputs);
+
+    switch (layer->type()) {
+        case Layer_Type_Dense: {
+            const Tensor& weights = ((const Dense_Layer*) layer)->weights;
+            *flops = 2*batch*weights.shape[0]*weights.shape[1];
+            *bytes += tensor_bytes(weights) + sizeof(float)*weights.shape[1];
+            break;
+        }
+
+        case Layer_Type_Fused_Dense: {
+            const Tensor& weights = ((const Fused_Dense_Layer*) layer)->dense->weights;
+            *flops = 2*batch*weights.shape[0]*weights.shape[1];
+            *bytes += tensor_bytes(weights) + sizeof(float)*weights.shape[1];
+            break;
+        }
+
+        case Layer_Type_Quantized_Dense: {
+            const Quantized_Dense_Layer* dense = (const Quantized_Dense_Layer*) layer;
+            *flops = 2*batch*dense->num_inputs*dense->num_outputs;
+            *bytes += (u64) dense->stride*dense->num_outputs + sizeof(float)*dense->num_outputs;
+            break;
+        }
+
+        case Layer_Type_Sparse_Dense: {
+            const Sparse_Matrix& weights = ((const Sparse_Dense_Layer*) layer)->weights;
+            *flops = 2*batch*sparse_stored_values(weights);
+            *bytes += sparse_bytes(weights) + sizeof(float)*weights.rows;
+            break;
+        }
+
+        case Layer_Type_Conv2D: {
+            const Conv2D_Layer* conv = (const Conv2D_Layer*) layer;
+            *flops = 2*outputs*conv->weights.shape[0];
+            *bytes += sizeof(float)*(conv->weights.length + conv->out_channels);
+            break;
+        }
+
+        case Layer_Type_Max_Pool:
+        case Layer_Type_Avg_Pool: {
+            u32 kernel_size = ((const Pool_Layer*) layer)->kernel_size;
+            *flops = outputs*kernel_size*kernel_size;
+            break;
+        }
+
+        case Layer_Type_Softmax: {
+            // Max, exponent, sum and division.
+            *flops = 4*outputs;
+            break;
+        }
+
+        case Layer_Type_Flatten: {
+            // Usually a view of the input, copies show up as kernels.
+            *flops = 0;
+            *bytes = 0;
+            break;
+        }
+
+        default: {
+            break;
+        }
+    }
+}
+
+
+/**
+ * Collects the events of all threads ordered by start time.
+ */
+static std::vector<Profile_Event> profiler_events(u64* dropped) {
+    std::lock_guard<std::mutex> lock(profiler_mutex);
+    std::vector<Profile_Event> events;
+    *dropped = 0;
+    for (Profiler_Thread* thread : profiler_threads) {
+        events.insert(events.end(), thread->events.begin(), thread->events.end());
+        *dropped += thread->dropped;
+    }
+    std::sort(events.begin(), events.end(), [](const Profile_Event& a, const Profile_Event& b) {
+        return a.start < b.start;
+    });
+    return events;
+}
+
+
+bool profiler_write_trace(const char* path) {
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        std::cerr << "error: failed to open `" << path << "` for writing" << std::endl;
+        return false;
+    }
+
+    u64 dropped;
+    std::vector<Profile_Event> events = profiler_events(&dropped);
+    fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    for (u64 i = 0; i < events.size(); i++) {
+        Profile_Event& event = events[i];
+        // Times are in microseconds, complete events ("X") have a start and a duration.
+        fprintf(file, "{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": 0, \"tid\": %u, "
+                      "\"ts\": %.3f, \"dur\": %.3f, \"args\": {\"layer\": %d, \"flops\": %llu, "
+                      "\"bytes\": %llu, \"allocations\": %llu}}%s\n",
+                event.name, event.category, event.thread, event.start*1e6, event.duration*1e6,
+                event.index, (unsigned long long) event.flops, (unsigned long long) event.bytes,
+                (unsigned long long) event.allocations, i + 1 < events.size() ? "," : "");
+    }
+    fprintf(file, "], \"otherData\": {\"dropped_events\": %llu}}\n", (unsigned long long) dropped);
+
+    bool ok = !ferror(file);
+    if (fclose(file) != 0 || !ok) {
+        std::cerr << "error: failed to write `" << path << "`" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+
+/**
+ * Events of the same category, name and layer index added up.
+ */
+struct Profile_Summary_Row {
+    const char* name;
+    const char* category;
+    i32 index;
+    u64 calls;
+    f64 time;
+    u64 flops;
+    u64 bytes;
+    u64 allocations;
+};
+
+
+static void profiler_print_rows(std::ostream& stream, const char* title, std::vector<Profile_Summary_Row>& rows) {
+    if (rows.empty()) return;
+    f64 total = 0.0;
+    for (Profile_Summary_Row& row : rows) total += row.time;
+
+    stream << title << std::endl;
+    stream << "  " << std::left << std::setw(22) << "name" << std::right << std::setw(8) << "calls"
+           << std::setw(11) << "total ms" << std::setw(7) << "%" << std::setw(11) << "avg us"
+           << std::setw(10) << "GFLOP/s" << std::setw(9) << "GB/s" << std::setw(8) << "allocs" << std::endl;
+    for (Profile_Summary_Row& row : rows) {
+        std::string name = row.index >= 0 ? std::to_string(row.index) + " " + row.name : row.name;
+        f64 gflops = row.time > 0.0 ? row.flops/row.time*1e-9 : 0.0;
+        f64 bandwidth = row.time > 0.0 ? row.bytes/row.time*1e-9 : 0.0;
+        stream << "  " << std::left << std::setw(22) << name << std::right << std::setw(8) << row.calls
+               << std::setprecision(3) << std::setw(11) << row.time*1e3
+               << std::setprecision(1) << std::setw(7) << 100.0*row.time/total
+               << std::setprecision(2) << std::setw(11) << row.time/row.calls*1e6
+               << std::setprecision(1) << std::setw(10) << gflops << std::setw(9) << bandwidth
+               << std::setw(8) << row.allocations << std::endl;
+    }
+}
+
+
+void profiler_print_summary(std::ostream& stream) {
+    u64 dropped;
+    std::vector<Profile_Event> events = profiler_events(&dropped);
+
+    std::vector<Profile_Summary_Row> rows;
+    for (Profile_Event& event : events) {
+        Profile_Summary_Row* row = nullptr;
+        for (Profile_Summary_Row& candidate : rows) {
+            if (candidate.index == event.index && strcmp(candidate.name, event.name) == 0 &&
+                strcmp(candidate.category, event.category) == 0) {
+                row = &candidate;
+                break;
+            }
+        }
+        if (!row) {
+            rows.push_back({ event.name, event.category, event.index, 0, 0.0, 0, 0, 0 });
+            row = &rows.back();
+        }
+        row->calls++;
+        row->time += event.duration;
+        row->flops += event.flops;
+        row->bytes += event.bytes;
+        row->allocations += event.allocations;
+    }
+
+    // Layers and passes in network order, kernels from the most expensive.
+    std::vector<Profile_Summary_Row> passes, layers, backward, kernels;
+    for (Profile_Summary_Row& row : rows) {
+        if (strcmp(row.category, PROFILE_PASS) == 0) passes.push_back(row);
+        else if (strcmp(row.category, PROFILE_LAYER) == 0) layers.push_back(row);
+        else if (strcmp(row.category, PROFILE_BACKWARD) == 0) backward.push_back(row);
+        else kernels.push_back(row);
+    }
+    auto by_index = [](const Profile_Summary_Row& a, const Profile_Summary_Row& b) { return a.index < b.index; };
+    std::stable_sort(layers.begin(), layers.end(), by_index);
+    std::stable_sort(backward.begin(), backward.end(), by_index);
+    std::sort(kernels.begin(), kernels.end(), [](const Profile_Summary_Row& a, const Profile_Summary_Row& b) {
+        return a.time > b.time;
+    });
+
+    stream << std::fixed;
+    profiler_print_rows(stream, "passes", passes);
+    profiler_print_rows(stream, "layers", layers);
+    profiler_print_rows(stream, "backward", backward);
+    profiler_print_rows(stream, "kernels (summed over threads, nested kernels count in both)", kernels);
+    if (dropped > 0) {
+        stream << "  " << dropped << " events dropped, at most " << PROFILER_MAX_EVENTS
+               << " are recorded per thread" << std::endl;
+    }
+}
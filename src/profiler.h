@@ -0,0 +1,150 @@
+#pragma once
+
+
+#include "util.h"
+#include <atomic>
+#include <iostream>
+
+
+/***************************************************************************
+ * Profiler
+ *
+ * Records a timed event for every layer of a forward or backward pass and
+ * for the kernels inside them (GEMMs, element-wise ops, copies), together
+ * with the work done: floating point operations, bytes read and written
+ * and heap or arena allocations. The events can be exported in the Chrome
+ * trace event format (chrome://tracing, Perfetto) or aggregated into a
+ * summary table with the achieved GFLOP/s and GB/s of each entry.
+ *
+ * The instrumentation is compiled in when PROFILE is defined (the debug
+ * and profile configurations) and is switched on at runtime with
+ * `profiler_set_enabled`. While switched off each scope costs a single
+ * load and branch, in release builds the scopes expand to nothing.
+ *
+ * Each thread records into its own buffer without locking, so the events
+ * must only be exported or reset while no profiled work is running.
+ * The allocations of a scope are the difference of the global counters,
+ * which includes allocations of other threads running at the same time.
+ ***************************************************************************/
+
+
+// Forward declare types.
+struct Layer;
+struct Tensor;
+
+
+/**
+ * Events recorded per thread, further events are dropped and counted.
+ */
+const u64 PROFILER_MAX_EVENTS = 1 << 20;
+
+
+// Categories of the events, whole passes through a network, the layers
+// in a forward or backward pass and the kernels called by the layers.
+const char* const PROFILE_PASS = "pass";
+const char* const PROFILE_LAYER = "layer";
+const char* const PROFILE_BACKWARD = "backward";
+const char* const PROFILE_KERNEL = "kernel";
+
+
+struct Profile_Event {
+    const char* name;
+    const char* category;
+    /// Position of the layer in the network, -1 for other events.
+    i32 index;
+    u32 thread;
+    /// Start in seconds since the profiler was reset and duration in seconds.
+    f64 start;
+    f64 duration;
+    u64 flops;
+    u64 bytes;
+    u64 allocations;
+};
+
+
+extern std::atomic<bool> profiler_active;
+
+
+inline bool profiler_enabled() {
+    return profiler_active.load(std::memory_order_relaxed);
+}
+
+
+/**
+ * Switches recording on or off, returns false if the
+ * instrumentation isn't compiled into this build.
+ */
+bool profiler_set_enabled(bool enabled);
+
+
+/**
+ * Drops the recorded events of all threads and restarts the clock.
+ */
+void profiler_reset();
+
+
+/**
+ * Writes the recorded events as Chrome trace event JSON,
+ * returns false if the file can't be written.
+ */
+bool profiler_write_trace(const char* path);
+
+
+/**
+ * Prints the events aggregated by name, the layers in network
+ * order followed by the kernels sorted by their total time.
+ */
+void profiler_print_summary(std::ostream& stream);
+
+
+/**
+ * Estimated floating point operations and bytes moved of a layer for
+ * an input of the given shape, based on the layer type and shapes.
+ */
+void profile_layer_cost(const Layer* layer, const u32* input_shape, u8 ndim, u64* flops, u64* bytes);
+
+
+/**
+ * Records an event for its lifetime if the profiler is enabled.
+ */
+struct Profile_Scope {
+    Profile_Event event;
+    u64 allocations;
+    bool active;
+
+    Profile_Scope(const char* name, const char* category, u64 flops, u64 bytes, i32 index = -1) {
+        active = profiler_enabled();
+        if (active) begin(name, category, index, flops, bytes);
+    }
+
+    /**
+     * Scope of a layer at `index` in the network, the costs
+     * are only estimated when the profiler is enabled.
+     */
+    Profile_Scope(const Layer* layer, i32 index, const Tensor* input) {
+        active = profiler_enabled();
+        if (active) begin_layer(layer, index, input);
+    }
+
+    ~Profile_Scope() {
+        if (active) end();
+    }
+
+    void begin(const char* name, const char* category, i32 index, u64 flops, u64 bytes);
+    void begin_layer(const Layer* layer, i32 index, const Tensor* input);
+    void end();
+};
+
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+
+#ifdef PROFILE
+/**
+ * Profiles the rest of the enclosing block, takes the arguments of a
+ * Profile_Scope constructor which are not evaluated in release builds.
+ */
+#define PROFILE_SCOPE(...) Profile_Scope PROFILE_CONCAT(profile_scope_, __LINE__)(__VA_ARGS__)
+#else
+#define PROFILE_SCOPE(...)
+#endif
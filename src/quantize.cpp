@@ -0,0 +1,167 @@
+#include "quantize.h"
+#include "memory.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+
+/**
+ * Scratch buffers for the quantized input and the 32-bit accumulators,
+ * one set per thread that only ever grows.
+ */
+struct Quantize_Workspace {
+    u8* input = nullptr;
+    u64 input_size = 0;
+    i32* accumulators = nullptr;
+    u64 accumulators_size = 0;
+
+    ~Quantize_Workspace() {
+        memory_free(input);
+        memory_free(accumulators);
+    }
+};
+
+
+static Quantize_Workspace& quantize_workspace() {
+    static thread_local Quantize_Workspace workspace;
+    return workspace;
+}
+
+
+template <typename T>
+static T* quantize_reserve(T*& buffer, u64& size, u64 count) {
+    if (size < count) {
+        memory_free(buffer);
+        buffer = (T*) memory_alloc(sizeof(T)*count);
+        size = count;
+    }
+    return buffer;
+}
+
+
+void Quantized_Dense_Layer::forward_into(Tensor* input, Tensor* output) {
+    assert(input->ndim == 2 && input->shape[1] == num_inputs);
+    u32 batch = input->shape[0];
+    assert(output->length == batch*num_outputs && tensor_is_contiguous(*output));
+
+    // Quantize the input, transposing the samples into contiguous rows.
+    Quantize_Workspace& workspace = quantize_workspace();
+    u8* q = quantize_reserve(workspace.input, workspace.input_size, (u64) batch*stride);
+    i32* acc = quantize_reserve(workspace.accumulators, workspace.accumulators_size, (u64) batch*num_outputs);
+    f32 inv_scale = 1.0f/input_scale;
+    for (u32 s = 0; s < batch; s++) {
+        const float* x = input->data + (u64) s*input->stride[0];
+        u8* q_row = q + (u64) s*stride;
+        for (u32 f = 0; f < num_inputs; f++) {
+            i32 value = (i32) nearbyintf(x[(u64) f*input->stride[1]]*inv_scale) + input_zero_point;
+            q_row[f] = (u8) std::min(std::max(value, 0), QUANTIZE_INPUT_MAX);
+        }
+        memset(q_row + num_inputs, 0, stride - num_inputs);
+    }
+
+    gemm_s8(num_outputs, batch, stride, weights, stride, q, stride, acc, batch);
+
+    // Dequantize, then add the bias and apply the activation.
+    Tensor bias_data = tensor_contiguous(bias);
+    for (u32 o = 0; o < num_outputs; o++) {
+        const i32* acc_row = acc + (u64) o*batch;
+        float* out_row = output->data + (u64) o*batch;
+        f32 scale = input_scale*weight_scale[o];
+        i32 offset = input_zero_point*row_sum[o];
+        f32 b = bias_data.data[o];
+        for (u32 s = 0; s < batch; s++) {
+            out_row[s] = (f32) (acc_row[s] - offset)*scale + b;
+        }
+    }
+    tensor_free(bias_data);
+
+    switch (activation) {
+        case Gemm_Activation_None: break;
+        case Gemm_Activation_ReLU: f_relu(*output); break;
+        case Gemm_Activation_Sigmoid: f_sigmoid(*output); break;
+        case Gemm_Activation_Tanh: f_tanh(*output); break;
+    }
+}
+
+
+Quantized_Dense_Layer* quantize_dense_layer(Dense_Layer* dense, f32 input_min, f32 input_max,
+                                            Gemm_Activation activation) {
+    Tensor& w = dense->weights;
+    Quantized_Dense_Layer* layer = new Quantized_Dense_Layer;
+    layer->require_grad = false;
+    layer->num_inputs = w.shape[0];
+    layer->num_outputs = w.shape[1];
+    layer->stride = (layer->num_inputs + QUANTIZE_K_ALIGNMENT - 1)/QUANTIZE_K_ALIGNMENT*QUANTIZE_K_ALIGNMENT;
+    layer->weights = (i8*) memory_alloc((u64) layer->num_outputs*layer->stride);
+    layer->weight_scale = (f32*) memory_alloc(sizeof(f32)*layer->num_outputs);
+    layer->row_sum = (i32*) memory_alloc(sizeof(i32)*layer->num_outputs);
+    layer->bias = tensor_view(dense->bias);
+    layer->activation = activation;
+
+    // The input range always contains zero so that zero (e.g. padding
+    // or the output of a ReLU) is represented exactly.
+    input_min = std::min(input_min, 0.0f);
+    input_max = std::max(input_max, 0.0f);
+    f32 range = input_max - input_min;
+    layer->input_scale = range > 0.0f ? range/QUANTIZE_INPUT_MAX : 1.0f;
+    layer->input_zero_point = (i32) nearbyintf(-input_min/layer->input_scale);
+
+    // Symmetric per-channel weight scales.
+    for (u32 o = 0; o < layer->num_outputs; o++) {
+        f32 max_abs = 0.0f;
+        for (u32 k = 0; k < layer->num_inputs; k++) {
+            max_abs = std::max(max_abs, fabsf(dtype_load(w.dtype, w.data, (u64) o*w.stride[1] + (u64) k*w.stride[0])));
+        }
+        f32 scale = max_abs > 0.0f ? max_abs/QUANTIZE_WEIGHT_MAX : 1.0f;
+
+        i8* row = layer->weights + (u64) o*layer->stride;
+        i32 sum = 0;
+        for (u32 k = 0; k < layer->num_inputs; k++) {
+            f32 value = dtype_load(w.dtype, w.data, (u64) o*w.stride[1] + (u64) k*w.stride[0])/scale;
+            i32 q = std::min(std::max((i32) nearbyintf(value), -QUANTIZE_WEIGHT_MAX), QUANTIZE_WEIGHT_MAX);
+            row[k] = (i8) q;
+            sum += q;
+        }
+        memset(row + layer->num_inputs, 0, layer->stride - layer->num_inputs);
+        layer->weight_scale[o] = scale;
+        layer->row_sum[o] = sum;
+    }
+    return layer;
+}
+
+
+void network_quantize(Network& network, Tensor& calibration) {
+    std::vector<f32> input_min(network.layers.size(), 0.0f);
+    std::vector<f32> input_max(network.layers.size(), 0.0f);
+
+    Memory_Arena arena;
+    {
+        Arena_Scope scope(&arena);
+        Tensor x = calibration;
+        for (u32 i = 0; i < network.layers.size(); i++) {
+            Tensor values = tensor_contiguous(x);
+            for (u32 j = 0; j < values.length; j++) {
+                input_min[i] = std::min(input_min[i], values.data[j]);
+                input_max[i] = std::max(input_max[i], values.data[j]);
+            }
+            tensor_free(values);
+            x = network.layers[i]->forward(&x);
+        }
+    }
+    arena_destroy(&arena);
+
+    for (u32 i = 0; i < network.layers.size(); i++) {
+        Layer* layer = network.layers[i];
+        if (layer->type() == Layer_Type_Dense) {
+            network.layers[i] = quantize_dense_layer((Dense_Layer*) layer, input_min[i], input_max[i]);
+        } else if (layer->type() == Layer_Type_Fused_Dense) {
+            Fused_Dense_Layer* fused = (Fused_Dense_Layer*) layer;
+            network.layers[i] = quantize_dense_layer(fused->dense, input_min[i], input_max[i],
+                                                     fused->activation);
+        } else {
+            continue;
+        }
+        // The quantized layer holds its own reference to the bias.
+        layer_destroy(layer);
+    }
+}
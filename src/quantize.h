@@ -0,0 +1,99 @@
+#pragma once
+
+
+#include "gemm_s8.h"
+#include "network.h"
+
+
+/***************************************************************************
+ * Int8 quantization
+ *
+ * Post-training quantization of dense layers. Weights are stored as signed
+ * 8-bit integers with one scale per output channel (row), and the inputs
+ * are quantized on the fly to unsigned 7-bit integers with a scale and zero
+ * point per layer that come from a calibration pass over sample inputs.
+ * The products are accumulated in 32-bit integers and then dequantized,
+ * the bias and activation are applied in floating point.
+ * ***************************************************************************/
+
+
+/**
+ * Rows of the quantized weights are padded with zeros to this many elements.
+ */
+const u32 QUANTIZE_K_ALIGNMENT = GEMM_S8_K_ALIGNMENT;
+
+
+/**
+ * Largest quantized input value, see GEMM_S8_B_MAX.
+ */
+const i32 QUANTIZE_INPUT_MAX = GEMM_S8_B_MAX;
+
+
+/**
+ * Largest magnitude of a quantized weight, the range is symmetric.
+ */
+const i32 QUANTIZE_WEIGHT_MAX = 127;
+
+
+/**
+ * Dense layer with int8 weights, replaces a (fused) dense layer after
+ * calibration. The input is quantized as `q = round(x/input_scale) + zero_point`
+ * and weight `w[o][k]` as `round(w/weight_scale[o])`, so that
+ * `sum(w*x) = input_scale*weight_scale[o]*(sum(qw*qx) - zero_point*row_sum[o])`.
+ * Unlike the fp32 layers it owns its weights, they are freed with the layer
+ * (copies made by `network_share_weights` don't own them).
+ */
+struct Quantized_Dense_Layer : Layer {
+    u32 num_inputs;
+    u32 num_outputs;
+    // Row length of the quantized weights, padded to QUANTIZE_K_ALIGNMENT.
+    u32 stride;
+    // Quantized weights, num_outputs rows of `stride` elements.
+    i8* weights = nullptr;
+    // Scale and sum of the quantized weights of each output channel.
+    f32* weight_scale = nullptr;
+    i32* row_sum = nullptr;
+    Tensor bias = {};
+    f32 input_scale;
+    i32 input_zero_point;
+    Gemm_Activation activation;
+
+    ~Quantized_Dense_Layer() {
+        memory_free(weights);
+        memory_free(weight_scale);
+        memory_free(row_sum);
+        tensor_free(bias);
+    }
+
+    virtual Layer_Type type() const override {
+        return Layer_Type_Quantized_Dense;
+    }
+
+    virtual u8 output_shape(const u32* input_shape, u8, u32* shape) const override {
+        shape[0] = input_shape[0];
+        shape[1] = num_outputs;
+        return 2;
+    }
+
+    virtual void forward_into(Tensor* input, Tensor* output) override;
+};
+
+
+/**
+ * Quantizes the weights of a dense layer, where [input_min, input_max]
+ * is the range of the inputs seen during calibration. The fp32 layer
+ * is left untouched and the bias is shared with it.
+ */
+Quantized_Dense_Layer* quantize_dense_layer(Dense_Layer* dense, f32 input_min, f32 input_max,
+                                            Gemm_Activation activation = Gemm_Activation_None);
+
+
+/**
+ * Calibrates and quantizes every dense and fused dense layer of the network.
+ * The calibration batch (N, inputs) is forwarded in fp32 to find the range
+ * of the inputs of each layer, then the layers are replaced by quantized ones.
+ * Fuse the network first so the activations end up in the quantized layers.
+ * The replaced layers are deleted and their fp32 weights freed, copies made
+ * by `network_share_weights` must be released before.
+ */
+void network_quantize(Network& network, Tensor& calibration);
@@ -0,0 +1,817 @@
+#include "server.h"
+#include "quantize.h"
+#include "sparse.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+#ifdef OS_LINUX
+#include <cerrno>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+
+/**
+ * Number of recent request latencies kept per model for the percentiles.
+ */
+const u32 SERVER_LATENCY_WINDOW = 4096;
+
+
+/**
+ * Epoll tags of the listening socket and the wake up event, connections use their id.
+ */
+const u64 SERVER_LISTEN_TAG = 0;
+const u64 SERVER_WAKE_TAG = 1;
+
+
+static f64 server_now() {
+    using namespace std::chrono;
+    return duration<f64>(steady_clock::now().time_since_epoch()).count();
+}
+
+
+/**
+ * Returns the number of features the first layer takes, or zero
+ * if the network doesn't start with a dense layer.
+ */
+static u32 server_network_inputs(Network* network) {
+    if (network->layers.empty()) return 0;
+    Layer* first = network->layers[0];
+    switch (first->type()) {
+        case Layer_Type_Dense: return ((Dense_Layer*) first)->weights.shape[0];
+        case Layer_Type_Fused_Dense: return ((Fused_Dense_Layer*) first)->dense->weights.shape[0];
+        case Layer_Type_Quantized_Dense: return ((Quantized_Dense_Layer*) first)->num_inputs;
+        case Layer_Type_Sparse_Dense: return ((Sparse_Dense_Layer*) first)->weights.cols;
+        default: return 0;
+    }
+}
+
+
+Server* server_create(Server_Config config) {
+    assert(config.max_batch_samples > 0 && config.max_pending > 0);
+    Server* server = new Server;
+    server->config = config;
+    if (server->config.num_workers == 0) {
+        server->config.num_workers = std::max(1u, std::thread::hardware_concurrency());
+    }
+    server->listen_fd = -1;
+    server->epoll_fd = -1;
+    server->wake_fd = -1;
+    server->stopping = false;
+    server->start_time = server_now();
+    // Ids 0 and 1 are the epoll tags of the listening socket and the wake up event.
+    server->next_connection = 2;
+    server->shutdown = false;
+    return server;
+}
+
+
+i32 server_add_model(Server* server, const char* name, Network* network) {
+    if (strlen(name) == 0 || strlen(name) >= SERVER_MODEL_NAME) {
+        std::cerr << "error: model name `" << name << "` must have 1 to "
+                  << SERVER_MODEL_NAME - 1 << " characters" << std::endl;
+        return -1;
+    }
+    for (Server_Model* model : server->models) {
+        if (model->name == name) {
+            std::cerr << "error: there already is a model called `" << name << "`" << std::endl;
+            return -1;
+        }
+    }
+
+    u32 num_inputs = server_network_inputs(network);
+    u32 shape[TENSOR_MAX_DIMS] = { 1, num_inputs };
+    u8 ndim = 2;
+    for (Layer* layer : network->layers) ndim = layer->output_shape(shape, ndim, shape);
+    if (num_inputs == 0 || ndim != 2) {
+        std::cerr << "error: model `" << name << "` does not take a batch of shape (N, features)" << std::endl;
+        return -1;
+    }
+
+    Server_Model* model = new Server_Model;
+    model->name = name;
+    model->network = network;
+    model->file = nullptr;
+    model->numa = nullptr;
+    model->num_inputs = num_inputs;
+    model->num_outputs = shape[1];
+    model->pending = 0;
+    model->num_requests = 0;
+    model->num_samples = 0;
+    model->num_rejected = 0;
+    model->num_batches = 0;
+    model->latencies.assign(SERVER_LATENCY_WINDOW, 0.0f);
+    model->latency_cursor = 0;
+    server->models.push_back(model);
+    return (i32) server->models.size() - 1;
+}
+
+
+i32 server_load_model(Server* server, const char* name, const char* path) {
+    Network* network = new Network;
+    Model_File* file = model_load(path, network);
+    if (!file) {
+        delete network;
+        return -1;
+    }
+    i32 index = server_add_model(server, name, network);
+    if (index < 0) {
+        model_close(file);
+        delete network;
+        return -1;
+    }
+    server->models[index]->file = file;
+    return index;
+}
+
+
+/**
+ * Frees a model, networks loaded from a file are owned by the server.
+ */
+static void server_free_model(Server_Model* model) {
+    if (model->file) {
+        network_destroy(*model->network);
+        model_close(model->file);
+        delete model->network;
+    }
+    delete model;
+}
+
+
+Server_Model_Stats server_stats(Server* server, u32 index) {
+    assert(index < server->models.size());
+    Server_Model* model = server->models[index];
+    std::lock_guard<std::mutex> lock(model->stats_mutex);
+    Server_Model_Stats stats = {};
+    stats.requests = model->num_requests;
+    stats.samples = model->num_samples;
+    stats.rejected = model->num_rejected;
+    stats.batches = model->num_batches;
+    stats.throughput = model->num_requests/std::max(server_now() - server->start_time, 1e-9);
+    if (stats.batches > 0) {
+        stats.mean_batch_samples = (f64) stats.samples/stats.batches;
+    }
+
+    u32 count = std::min(model->latency_cursor, SERVER_LATENCY_WINDOW);
+    if (count > 0) {
+        std::vector<f32> sorted(model->latencies.begin(), model->latencies.begin() + count);
+        std::sort(sorted.begin(), sorted.end());
+        stats.p50_latency_ms = sorted[(count - 1)*50/100];
+        stats.p99_latency_ms = sorted[(count - 1)*99/100];
+    }
+    return stats;
+}
+
+
+/**
+ * Fills in the header of a response, the payload follows it in the same buffer.
+ */
+static void server_write_response(std::vector<u8>& buffer, const Server_Request& request, Server_Status status,
+                                  u32 num_samples, u32 num_features, u32 payload_bytes) {
+    buffer.resize(sizeof(Server_Response) + payload_bytes);
+    Server_Response* response = (Server_Response*) buffer.data();
+    *response = {};
+    response->magic = SERVER_PROTOCOL_MAGIC;
+    response->status = status;
+    response->id = request.id;
+    response->model = request.model;
+    response->num_samples = num_samples;
+    response->num_features = num_features;
+    response->payload_bytes = payload_bytes;
+}
+
+
+/**
+ * Runs the jobs (all of the same model) as a single batch. The samples are
+ * the columns of the batch, the responses hold one sample after the other.
+ */
+static void server_run_jobs(Server* server, Server_Worker* worker, u32 index, Server_Job** jobs, u32 count) {
+    Server_Model* model = server->models[index];
+    u32 total = 0;
+    for (u32 j = 0; j < count; j++) total += jobs[j]->request.num_samples;
+
+    Tensor& batch = worker->batches[index];
+    batch.shape[0] = total;
+    batch.shape[1] = model->num_inputs;
+    tensor_set_contiguous(batch);
+    u32 column = 0;
+    for (u32 j = 0; j < count; j++) {
+        const f32* input = jobs[j]->input.data();
+        for (u32 s = 0; s < jobs[j]->request.num_samples; s++, column++) {
+            for (u32 f = 0; f < model->num_inputs; f++) {
+                batch.data[f*total + column] = input[s*model->num_inputs + f];
+            }
+        }
+    }
+
+    Tensor output = plan_forward(worker->plans[index], &batch);
+    assert(output.length == total*model->num_outputs);
+
+    column = 0;
+    for (u32 j = 0; j < count; j++) {
+        Server_Job* job = jobs[j];
+        u32 num_samples = job->request.num_samples;
+        server_write_response(job->response, job->request, Server_Status_Ok, num_samples, model->num_outputs,
+                              num_samples*model->num_outputs*sizeof(f32));
+        f32* result = (f32*) (job->response.data() + sizeof(Server_Response));
+        for (u32 s = 0; s < num_samples; s++, column++) {
+            for (u32 o = 0; o < model->num_outputs; o++) {
+                result[s*model->num_outputs + o] = output.data[o*total + column];
+            }
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(model->stats_mutex);
+    model->num_batches++;
+}
+
+
+static void server_worker_main(Server* server, Server_Worker* worker) {
+    // The copies of the networks are made on the worker's own thread, the
+    // plans refer to them so the vector must not reallocate afterwards.
+    u32 num_models = (u32) server->models.size();
+    if (server->config.numa_policy != Numa_Policy_None) {
+        numa_bind_thread(server->topology, worker->node);
+        thread_pool_set_inline(true);
+    }
+    worker->networks.reserve(num_models);
+    for (Server_Model* model : server->models) {
+        if (model->numa) worker->networks.push_back(numa_network_share_local(model->numa));
+        else worker->networks.push_back(network_share_weights(*model->network));
+        worker->batches.push_back(tensor_create_2d(server->config.max_batch_samples, model->num_inputs));
+        worker->plans.push_back(plan_compile(&worker->networks.back(), worker->batches.back().shape, 2));
+    }
+    worker->jobs.reserve(server->config.max_batch_samples);
+
+#ifdef OS_LINUX
+    u64 one = 1;
+    std::unique_lock<std::mutex> lock(server->queue_mutex);
+    while (true) {
+        server->queue_ready.wait(lock, [&] { return server->shutdown || !server->queue.empty(); });
+        if (server->queue.empty()) break;
+
+        // Take the oldest request and every other queued request of the same model that fits.
+        Server_Job* first = server->queue.front();
+        server->queue.pop_front();
+        u32 index = first->request.model;
+        u32 samples = first->request.num_samples;
+        worker->jobs.assign(1, first);
+        for (auto it = server->queue.begin(); it != server->queue.end() && samples < server->config.max_batch_samples;) {
+            Server_Job* job = *it;
+            if (job->request.model == index && samples + job->request.num_samples <= server->config.max_batch_samples) {
+                samples += job->request.num_samples;
+                worker->jobs.push_back(job);
+                it = server->queue.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
+        lock.unlock();
+        server_run_jobs(server, worker, index, worker->jobs.data(), (u32) worker->jobs.size());
+        {
+            std::lock_guard<std::mutex> done_lock(server->done_mutex);
+            server->done.insert(server->done.end(), worker->jobs.begin(), worker->jobs.end());
+        }
+        if (write(server->wake_fd, &one, sizeof(one)) < 0) {
+            // The counter can't overflow in practice, the event loop drains it all the time.
+        }
+        lock.lock();
+    }
+#endif
+
+    for (u32 i = 0; i < num_models; i++) {
+        plan_destroy(worker->plans[i]);
+        tensor_free(worker->batches[i]);
+        network_release_shared(worker->networks[i]);
+    }
+}
+
+
+#ifdef OS_LINUX
+
+
+static void server_close_connection(Server* server, Server_Connection* connection) {
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, connection->fd, nullptr);
+    close(connection->fd);
+    server->connections.erase(connection->id);
+    delete connection;
+}
+
+
+/**
+ * Polls the socket for writing while output is pending, and for reading
+ * unless the client fell too far behind reading its responses.
+ */
+static void server_update_events(Server* server, Server_Connection* connection) {
+    size_t pending = connection->output.size() - connection->output_sent;
+    bool writing = pending > 0;
+    bool reading = pending <= server->config.max_output_bytes;
+    if (writing == connection->writing && reading == connection->reading) return;
+
+    epoll_event event = {};
+    event.events = (reading ? (u32) EPOLLIN : 0u) | (writing ? (u32) EPOLLOUT : 0u);
+    event.data.u64 = connection->id;
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, connection->fd, &event);
+    connection->writing = writing;
+    connection->reading = reading;
+}
+
+
+/**
+ * Writes as much of the pending output as the socket takes, and waits for
+ * the socket to become writable again if some is left. Returns false if
+ * the connection was closed.
+ */
+static bool server_flush(Server* server, Server_Connection* connection) {
+    while (connection->output_sent < connection->output.size()) {
+        ssize_t sent = send(connection->fd, connection->output.data() + connection->output_sent,
+                            connection->output.size() - connection->output_sent, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (sent <= 0) {
+            server_close_connection(server, connection);
+            return false;
+        }
+        connection->output_sent += (size_t) sent;
+    }
+
+    if (connection->output_sent == connection->output.size()) {
+        connection->output.clear();
+        connection->output_sent = 0;
+    }
+    server_update_events(server, connection);
+    return true;
+}
+
+
+static void server_send_response(Server* server, Server_Connection* connection, const std::vector<u8>& response) {
+    connection->output.insert(connection->output.end(), response.begin(), response.end());
+    if (!connection->writing) server_flush(server, connection);
+    else server_update_events(server, connection);
+}
+
+
+static void server_reject(Server* server, Server_Connection* connection, const Server_Request& request,
+                          Server_Status status) {
+    std::vector<u8> response;
+    server_write_response(response, request, status, 0, 0, 0);
+    server_send_response(server, connection, response);
+}
+
+
+/**
+ * Answers the requests the event loop handles itself and queues forward
+ * requests that pass admission control for the workers.
+ */
+static void server_handle_request(Server* server, Server_Connection* connection,
+                                  const Server_Request& request, const u8* payload) {
+    u32 num_models = (u32) server->models.size();
+    switch (request.op) {
+        case Server_Op_Models: {
+            std::vector<u8> response;
+            server_write_response(response, request, Server_Status_Ok, num_models, 0,
+                                  num_models*sizeof(Server_Model_Info));
+            Server_Model_Info* infos = (Server_Model_Info*) (response.data() + sizeof(Server_Response));
+            for (u32 i = 0; i < num_models; i++) {
+                infos[i] = {};
+                strncpy(infos[i].name, server->models[i]->name.c_str(), SERVER_MODEL_NAME - 1);
+                infos[i].num_inputs = server->models[i]->num_inputs;
+                infos[i].num_outputs = server->models[i]->num_outputs;
+            }
+            server_send_response(server, connection, response);
+            return;
+        }
+
+        case Server_Op_Stats: {
+            std::vector<u8> response;
+            server_write_response(response, request, Server_Status_Ok, num_models, 0,
+                                  num_models*sizeof(Server_Model_Stats));
+            Server_Model_Stats* stats = (Server_Model_Stats*) (response.data() + sizeof(Server_Response));
+            for (u32 i = 0; i < num_models; i++) stats[i] = server_stats(server, i);
+            server_send_response(server, connection, response);
+            return;
+        }
+
+        case Server_Op_Forward: {
+            break;
+        }
+
+        default: {
+            server_reject(server, connection, request, Server_Status_Bad_Request);
+            return;
+        }
+    }
+
+    if (request.model >= num_models) {
+        server_reject(server, connection, request, Server_Status_Unknown_Model);
+        return;
+    }
+    Server_Model* model = server->models[request.model];
+    if (request.num_samples == 0 || request.num_features != model->num_inputs) {
+        server_reject(server, connection, request, Server_Status_Bad_Request);
+        return;
+    }
+    if (request.num_samples > server->config.max_batch_samples) {
+        server_reject(server, connection, request, Server_Status_Too_Large);
+        return;
+    }
+    if (model->pending >= server->config.max_pending) {
+        {
+            std::lock_guard<std::mutex> lock(model->stats_mutex);
+            model->num_rejected++;
+        }
+        server_reject(server, connection, request, Server_Status_Overloaded);
+        return;
+    }
+
+    model->pending++;
+    u32 length = request.num_samples*request.num_features;
+    std::lock_guard<std::mutex> lock(server->queue_mutex);
+    Server_Job* job;
+    if (server->free_jobs.empty()) {
+        job = new Server_Job;
+    } else {
+        job = server->free_jobs.back();
+        server->free_jobs.pop_back();
+    }
+    job->connection = connection->id;
+    job->request = request;
+    job->receive_time = server_now();
+    job->input.assign((const f32*) payload, (const f32*) payload + length);
+    server->queue.push_back(job);
+    server->queue_ready.notify_one();
+}
+
+
+/**
+ * Reads everything available on the connection and handles the complete
+ * requests, a partial request stays in the buffer until the rest arrives.
+ */
+static void server_read(Server* server, Server_Connection* connection) {
+    const size_t read_size = 64 << 10;
+    while (true) {
+        if (connection->input.size() < connection->input_used + read_size) {
+            connection->input.resize(connection->input_used + read_size);
+        }
+        ssize_t received = recv(connection->fd, connection->input.data() + connection->input_used, read_size, 0);
+        if (received < 0 && errno == EINTR) continue;
+        if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (received <= 0) {
+            server_close_connection(server, connection);
+            return;
+        }
+        connection->input_used += (size_t) received;
+        if ((size_t) received < read_size) break;
+    }
+
+    u64 id = connection->id;
+    size_t offset = 0;
+    while (connection->input_used - offset >= sizeof(Server_Request)) {
+        // The rest waits in the buffer until the client reads its responses.
+        if (!connection->reading) break;
+        Server_Request request;
+        memcpy(&request, connection->input.data() + offset, sizeof(request));
+        u64 payload_bytes = (u64) request.num_samples*request.num_features*sizeof(f32);
+        if (request.op != Server_Op_Forward) payload_bytes = 0;
+        if (request.magic != SERVER_PROTOCOL_MAGIC || payload_bytes > SERVER_MAX_PAYLOAD) {
+            // The stream can't be resynchronized after a broken header.
+            server_close_connection(server, connection);
+            return;
+        }
+        if (connection->input_used - offset < sizeof(Server_Request) + payload_bytes) break;
+
+        server_handle_request(server, connection, request, connection->input.data() + offset + sizeof(Server_Request));
+        // Sending a response may have found the connection closed.
+        if (!server->connections.count(id)) return;
+        offset += sizeof(Server_Request) + payload_bytes;
+    }
+
+    memmove(connection->input.data(), connection->input.data() + offset, connection->input_used - offset);
+    connection->input_used -= offset;
+}
+
+
+static void server_accept(Server* server) {
+    while (true) {
+        int fd = accept4(server->listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        if (server->connections.size() >= server->config.max_connections) {
+            close(fd);
+            continue;
+        }
+
+        Server_Connection* connection = new Server_Connection;
+        connection->fd = fd;
+        connection->id = server->next_connection++;
+        connection->input_used = 0;
+        connection->output_sent = 0;
+        connection->writing = false;
+        connection->reading = true;
+        server->connections[connection->id] = connection;
+
+        epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.u64 = connection->id;
+        epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &event);
+    }
+}
+
+
+/**
+ * Sends the responses of the jobs the workers finished and recycles the jobs.
+ */
+static void server_complete_jobs(Server* server, std::vector<Server_Job*>& completed) {
+    completed.clear();
+    {
+        std::lock_guard<std::mutex> lock(server->done_mutex);
+        completed.swap(server->done);
+    }
+
+    f64 now = server_now();
+    for (Server_Job* job : completed) {
+        Server_Model* model = server->models[job->request.model];
+        model->pending--;
+        {
+            std::lock_guard<std::mutex> lock(model->stats_mutex);
+            model->num_requests++;
+            model->num_samples += job->request.num_samples;
+            model->latencies[model->latency_cursor % SERVER_LATENCY_WINDOW] = (f32) ((now - job->receive_time)*1e3);
+            model->latency_cursor++;
+        }
+
+        // The client may have disconnected in the meantime.
+        auto it = server->connections.find(job->connection);
+        if (it != server->connections.end()) server_send_response(server, it->second, job->response);
+    }
+
+    std::lock_guard<std::mutex> lock(server->queue_mutex);
+    server->free_jobs.insert(server->free_jobs.end(), completed.begin(), completed.end());
+}
+
+
+static bool server_listen(Server* server) {
+    const char* path = server->config.socket_path;
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        std::cerr << "error: socket path `" << path << "` is too long" << std::endl;
+        return false;
+    }
+    strcpy(address.sun_path, path);
+
+    // A socket file left behind by a previous run would make bind fail.
+    unlink(path);
+    server->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (server->listen_fd < 0 || bind(server->listen_fd, (sockaddr*) &address, sizeof(address)) != 0 ||
+        listen(server->listen_fd, SOMAXCONN) != 0) {
+        std::cerr << "error: cannot listen on `" << path << "`: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    server->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    server->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (server->epoll_fd < 0 || server->wake_fd < 0) {
+        std::cerr << "error: cannot create the event loop: " << strerror(errno) << std::endl;
+        return false;
+    }
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.u64 = SERVER_LISTEN_TAG;
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->listen_fd, &event);
+    event.data.u64 = SERVER_WAKE_TAG;
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->wake_fd, &event);
+    return true;
+}
+
+
+bool server_run(Server* server) {
+    if (server->models.empty()) {
+        std::cerr << "error: the server has no models" << std::endl;
+        return false;
+    }
+    if (!server_listen(server)) return false;
+
+    if (server->config.numa_policy != Numa_Policy_None) {
+        server->topology = numa_topology();
+        for (Server_Model* model : server->models) {
+            model->numa = numa_network_create(model->network, server->topology, server->config.numa_policy);
+        }
+    }
+
+    server->start_time = server_now();
+    for (u32 i = 0; i < server->config.num_workers; i++) {
+        Server_Worker* worker = new Server_Worker;
+        worker->node = server->config.numa_policy != Numa_Policy_None ? i % server->topology.num_nodes : 0;
+        worker->thread = std::thread(server_worker_main, server, worker);
+        server->workers.push_back(worker);
+    }
+
+    const int max_events = 64;
+    epoll_event events[max_events];
+    std::vector<Server_Job*> completed;
+    while (!server->stopping.load(std::memory_order_acquire)) {
+        int count = epoll_wait(server->epoll_fd, events, max_events, -1);
+        if (count < 0 && errno == EINTR) continue;
+        if (count < 0) {
+            std::cerr << "error: epoll_wait failed: " << strerror(errno) << std::endl;
+            break;
+        }
+
+        for (int i = 0; i < count; i++) {
+            u64 tag = events[i].data.u64;
+            if (tag == SERVER_LISTEN_TAG) {
+                server_accept(server);
+            } else if (tag == SERVER_WAKE_TAG) {
+                u64 value;
+                while (read(server->wake_fd, &value, sizeof(value)) > 0) {}
+                server_complete_jobs(server, completed);
+            } else {
+                // Earlier events of this round may have closed the connection.
+                auto it = server->connections.find(tag);
+                if (it == server->connections.end()) continue;
+                Server_Connection* connection = it->second;
+                if (events[i].events & EPOLLOUT) {
+                    bool paused = !connection->reading;
+                    if (!server_flush(server, connection)) continue;
+                    // Requests buffered while reading was paused are handled now.
+                    if (paused && connection->reading) {
+                        server_read(server, connection);
+                        continue;
+                    }
+                }
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) server_read(server, connection);
+            }
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(server->queue_mutex);
+        server->shutdown = true;
+    }
+    server->queue_ready.notify_all();
+    for (Server_Worker* worker : server->workers) {
+        worker->thread.join();
+        delete worker;
+    }
+    server->workers.clear();
+    server_complete_jobs(server, completed);
+    for (Server_Model* model : server->models) {
+        if (model->numa) numa_network_destroy(model->numa);
+        model->numa = nullptr;
+    }
+
+    while (!server->connections.empty()) server_close_connection(server, server->connections.begin()->second);
+    close(server->listen_fd);
+    close(server->epoll_fd);
+    unlink(server->config.socket_path);
+    server->listen_fd = -1;
+    server->epoll_fd = -1;
+    return true;
+}
+
+
+void server_stop(Server* server) {
+    server->stopping.store(true, std::memory_order_release);
+    u64 one = 1;
+    if (server->wake_fd >= 0 && write(server->wake_fd, &one, sizeof(one)) < 0) {
+        // Nothing to do in a signal handler, the loop is awake already if the counter is full.
+    }
+}
+
+
+void server_destroy(Server* server) {
+    assert(server->workers.empty());
+    for (Server_Model* model : server->models) server_free_model(model);
+    for (Server_Job* job : server->free_jobs) delete job;
+    if (server->wake_fd >= 0) close(server->wake_fd);
+    delete server;
+}
+
+
+/**
+ * Reads or writes exactly `size` bytes on a blocking socket.
+ */
+static bool server_transfer(int fd, u8* data, size_t size, bool write) {
+    while (size > 0) {
+        ssize_t done = write ? send(fd, data, size, MSG_NOSIGNAL) : recv(fd, data, size, 0);
+        if (done < 0 && errno == EINTR) continue;
+        if (done <= 0) return false;
+        data += done;
+        size -= (size_t) done;
+    }
+    return true;
+}
+
+
+int server_connect(const char* socket_path) {
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socket_path, sizeof(address.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (sockaddr*) &address, sizeof(address)) != 0) {
+        std::cerr << "error: cannot connect to `" << socket_path << "`: " << strerror(errno) << std::endl;
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+
+bool server_send(int fd, const Server_Request& request, const f32* payload) {
+    // Header and payload go out in one message, so small requests are a single packet.
+    iovec parts[2] = {
+        { (void*) &request, sizeof(request) },
+        { (void*) payload, (size_t) request.num_samples*request.num_features*sizeof(f32) },
+    };
+    msghdr message = {};
+    message.msg_iov = parts;
+    message.msg_iovlen = payload ? 2 : 1;
+    ssize_t sent = sendmsg(fd, &message, MSG_NOSIGNAL);
+    if (sent < 0) return false;
+
+    size_t total = parts[0].iov_len + (payload ? parts[1].iov_len : 0);
+    if ((size_t) sent == total) return true;
+    // Rest of a message larger than the socket buffer.
+    if ((size_t) sent < sizeof(request)) {
+        if (!server_transfer(fd, (u8*) &request + sent, sizeof(request) - sent, true)) return false;
+        sent = sizeof(request);
+    }
+    size_t payload_sent = (size_t) sent - sizeof(request);
+    return server_transfer(fd, (u8*) payload + payload_sent, parts[1].iov_len - payload_sent, true);
+}
+
+
+bool server_receive(int fd, Server_Response* response, std::vector<u8>& payload) {
+    if (!server_transfer(fd, (u8*) response, sizeof(*response), false)) return false;
+    if (response->magic != SERVER_PROTOCOL_MAGIC || response->payload_bytes > SERVER_MAX_PAYLOAD) return false;
+    payload.resize(response->payload_bytes);
+    return server_transfer(fd, payload.data(), response->payload_bytes, false);
+}
+
+
+bool server_list_models(int fd, std::vector<Server_Model_Info>& models) {
+    Server_Request request = {};
+    request.magic = SERVER_PROTOCOL_MAGIC;
+    request.op = Server_Op_Models;
+    Server_Response response;
+    std::vector<u8> payload;
+    if (!server_send(fd, request, nullptr) || !server_receive(fd, &response, payload)) return false;
+    if (response.status != Server_Status_Ok) return false;
+    models.resize(response.num_samples);
+    memcpy(models.data(), payload.data(), models.size()*sizeof(Server_Model_Info));
+    return true;
+}
+
+
+#else
+
+
+bool server_run(Server* server) {
+    std::cerr << "error: the server needs Linux" << std::endl;
+    return false;
+}
+
+
+void server_stop(Server* server) {
+    server->stopping = true;
+}
+
+
+void server_destroy(Server* server) {
+    for (Server_Model* model : server->models) server_free_model(model);
+    delete server;
+}
+
+
+int server_connect(const char* socket_path) {
+    std::cerr << "error: the server needs Linux" << std::endl;
+    return -1;
+}
+
+
+bool server_send(int fd, const Server_Request& request, const f32* payload) {
+    return false;
+}
+
+
+bool server_receive(int fd, Server_Response* response, std::vector<u8>& payload) {
+    return false;
+}
+
+
+bool server_list_models(int fd, std::vector<Server_Model_Info>& models) {
+    return false;
+}
+
+
+#endif
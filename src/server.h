@@ -0,0 +1,315 @@
+#pragma once
+
+
+#include "model_file.h"
+#include "numa.h"
+#include "plan.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+
+/***************************************************************************
+ * Inference server
+ *
+ * Serves forward requests for several models over a Unix domain socket.
+ * A single event loop thread accepts connections and parses requests with
+ * epoll, the forward passes run on a fixed set of worker threads. Every
+ * worker has its own copy of each network made by `network_share_weights`,
+ * so the weights exist once while the saved activations, the execution
+ * plan and the batch buffers are per thread and nothing is locked during
+ * a forward pass. A worker picking up a request also takes the other
+ * queued requests of the same model, up to `max_batch_samples` samples,
+ * and runs them as one batch.
+ *
+ * Admission control keeps the latency bounded under overload: a request
+ * arriving while its model already has `max_pending` requests queued or
+ * running is answered right away with Server_Status_Overloaded instead
+ * of being queued.
+ *
+ * Protocol (little endian, every message is a header and a payload):
+ *
+ *   Server_Request     op, client chosen id, model index, samples, features
+ *                      payload: samples*features floats, one sample after the other
+ *   Server_Response    status, the id and model of the request, samples, features
+ *                      payload: `payload_bytes` bytes depending on the op
+ *
+ *   Server_Op_Models   payload of the response: Server_Model_Info[samples]
+ *   Server_Op_Forward  payload of the response: samples*outputs floats
+ *   Server_Op_Stats    payload of the response: Server_Model_Stats[samples]
+ *
+ * Responses on a connection may come back in a different order than the
+ * requests were sent, clients match them by id. Only models taking a batch
+ * of shape (N, features) are supported. The server needs Linux.
+ ***************************************************************************/
+
+
+const u32 SERVER_PROTOCOL_MAGIC = 0x31565253;
+
+
+/**
+ * Requests with a larger payload are a protocol error and close the connection.
+ */
+const u32 SERVER_MAX_PAYLOAD = 64 << 20;
+
+
+/**
+ * Length of the model names, including the terminating zero.
+ */
+const u32 SERVER_MODEL_NAME = 32;
+
+
+enum Server_Op : u32 {
+    Server_Op_Models = 1,
+    Server_Op_Forward = 2,
+    Server_Op_Stats = 3,
+};
+
+
+enum Server_Status : u32 {
+    Server_Status_Ok = 0,
+    Server_Status_Bad_Request = 1,
+    Server_Status_Unknown_Model = 2,
+    /// The model has too many requests pending, try again later.
+    Server_Status_Overloaded = 3,
+    /// More samples than `max_batch_samples`, split the request.
+    Server_Status_Too_Large = 4,
+};
+
+
+struct Server_Request {
+    u32 magic;
+    u32 op;
+    u32 id;
+    u32 model;
+    u32 num_samples;
+    u32 num_features;
+    u32 reserved[2];
+};
+
+
+struct Server_Response {
+    u32 magic;
+    u32 status;
+    u32 id;
+    u32 model;
+    u32 num_samples;
+    u32 num_features;
+    u32 payload_bytes;
+    u32 reserved;
+};
+
+
+struct Server_Model_Info {
+    char name[SERVER_MODEL_NAME];
+    u32 num_inputs;
+    u32 num_outputs;
+    u32 reserved[2];
+};
+
+
+struct Server_Model_Stats {
+    u64 requests;
+    u64 samples;
+    u64 rejected;
+    u64 batches;
+    /// Completed requests per second since the server started.
+    f64 throughput;
+    /// Latency from receiving a request to sending the response in milliseconds,
+    /// over the recent requests.
+    f64 p50_latency_ms;
+    f64 p99_latency_ms;
+    f64 mean_batch_samples;
+};
+
+
+static_assert(sizeof(Server_Request) == 32, "unexpected request header size");
+static_assert(sizeof(Server_Response) == 32, "unexpected response header size");
+static_assert(sizeof(Server_Model_Info) == 48, "unexpected model info size");
+static_assert(sizeof(Server_Model_Stats) == 64, "unexpected model stats size");
+
+
+struct Server_Config {
+    const char* socket_path = "/tmp/playground.sock";
+    /// Number of worker threads, zero means one per hardware thread.
+    u32 num_workers = 0;
+    /// Largest batch a worker runs, requests with more samples are rejected.
+    u32 max_batch_samples = 64;
+    /// Requests per model queued or running before new ones are rejected.
+    u32 max_pending = 256;
+    u32 max_connections = 1024;
+    /// Responses waiting to be sent on a connection, while a client sends
+    /// requests but doesn't read them no more of its requests are read.
+    u32 max_output_bytes = 4 << 20;
+    /// Placement of the weights on machines with several NUMA nodes. With a
+    /// policy the workers are bound to the nodes round robin, run their kernels
+    /// inline and every one of them reads the weights placed for its node.
+    Numa_Policy numa_policy = Numa_Policy_None;
+};
+
+
+/**
+ * Forward request on its way from the event loop to a worker and back,
+ * the buffers are recycled so a warm server doesn't allocate per request.
+ */
+struct Server_Job {
+    u64 connection;
+    Server_Request request;
+    f64 receive_time;
+    std::vector<f32> input;
+    // Header and payload of the response, filled in by the worker.
+    std::vector<u8> response;
+};
+
+
+struct Server_Model {
+    std::string name;
+    // Network owning the weights, the workers run copies of it.
+    Network* network;
+    Model_File* file;
+    u32 num_inputs;
+    u32 num_outputs;
+    // Weights placed per node while the server runs with a NUMA policy.
+    Numa_Network* numa;
+
+    // Owned by the event loop.
+    u32 pending;
+
+    // Statistics, latencies are kept in a ring of the most recent requests.
+    std::mutex stats_mutex;
+    u64 num_requests;
+    u64 num_samples;
+    u64 num_rejected;
+    u64 num_batches;
+    std::vector<f32> latencies;
+    u32 latency_cursor;
+};
+
+
+/**
+ * Scratch of a worker, one network copy, plan and batch buffer per model.
+ */
+struct Server_Worker {
+    std::thread thread;
+    u32 node;
+    std::vector<Network> networks;
+    std::vector<Execution_Plan*> plans;
+    std::vector<Tensor> batches;
+    std::vector<Server_Job*> jobs;
+};
+
+
+struct Server_Connection {
+    int fd;
+    u64 id;
+    std::vector<u8> input;
+    size_t input_used;
+    std::vector<u8> output;
+    size_t output_sent;
+    // Events polled for, writing while output is pending, reading
+    // unless too much output is pending.
+    bool writing;
+    bool reading;
+};
+
+
+struct Server {
+    Server_Config config;
+    std::vector<Server_Model*> models;
+    std::vector<Server_Worker*> workers;
+
+    int listen_fd;
+    int epoll_fd;
+    // Signaled when jobs are completed or the server is stopped.
+    int wake_fd;
+    std::atomic<bool> stopping;
+    f64 start_time;
+    Numa_Topology topology;
+
+    std::unordered_map<u64, Server_Connection*> connections;
+    u64 next_connection;
+
+    // Jobs waiting for a worker, and a free list of job buffers.
+    std::mutex queue_mutex;
+    std::condition_variable queue_ready;
+    std::deque<Server_Job*> queue;
+    std::vector<Server_Job*> free_jobs;
+    bool shutdown;
+
+    // Jobs finished by the workers, waiting to be sent by the event loop.
+    std::mutex done_mutex;
+    std::vector<Server_Job*> done;
+};
+
+
+/**
+ * Creates a server, models have to be added before it runs.
+ */
+Server* server_create(Server_Config config);
+
+
+/**
+ * Adds a model served under `name` (at most SERVER_MODEL_NAME - 1 characters),
+ * the network must take inputs of shape (N, features) and stay alive while the
+ * server runs. Returns the index of the model, or -1 (and prints why) if the
+ * network is not supported.
+ */
+i32 server_add_model(Server* server, const char* name, Network* network);
+
+
+/**
+ * Loads a model file and adds it, the file is closed by `server_destroy`.
+ */
+i32 server_load_model(Server* server, const char* name, const char* path);
+
+
+/**
+ * Binds the socket, starts the workers and runs the event loop on the calling
+ * thread until `server_stop`. Returns false (and prints why) if the socket
+ * can't be set up.
+ */
+bool server_run(Server* server);
+
+
+/**
+ * Makes `server_run` return, safe to call from any thread and from signal handlers.
+ */
+void server_stop(Server* server);
+
+
+/**
+ * Returns the statistics of a model, safe to call while the server runs.
+ */
+Server_Model_Stats server_stats(Server* server, u32 model);
+
+
+void server_destroy(Server* server);
+
+
+/**
+ * Connects to a server, returns the socket or -1 (and prints why).
+ */
+int server_connect(const char* socket_path);
+
+
+/**
+ * Sends a request with a payload of `num_samples*num_features` floats, blocking.
+ */
+bool server_send(int fd, const Server_Request& request, const f32* payload);
+
+
+/**
+ * Receives the next response and its payload, blocking.
+ */
+bool server_receive(int fd, Server_Response* response, std::vector<u8>& payload);
+
+
+/**
+ * Asks the server for its models, returns false if it can't be reached.
+ */
+bool server_list_models(int fd, std::vector<Server_Model_Info>& models);
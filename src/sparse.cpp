@@ -0,0 +1,238 @@
+#include "sparse.h"
+#include "memory.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+
+/**
+ * Below this many operations the product runs on the calling thread.
+ */
+const u64 SPARSE_PARALLEL_MIN_OPS = 1 << 20;
+
+
+/**
+ * Minimum number of block rows per task when split over the thread pool.
+ */
+const u32 SPARSE_ROWS_PER_TASK = 8;
+
+
+/**
+ * Element (input, output) of dense weights of shape (in, out).
+ */
+static inline f32 sparse_weight(const Tensor& weights, u32 output, u32 input) {
+    return dtype_load(weights.dtype, weights.data, (u64) output*weights.stride[1] + (u64) input*weights.stride[0]);
+}
+
+
+f32 sparse_density(const Tensor& weights) {
+    assert(weights.ndim == 2);
+    u64 nonzero = 0;
+    for (u32 o = 0; o < weights.shape[1]; o++) {
+        for (u32 i = 0; i < weights.shape[0]; i++) nonzero += sparse_weight(weights, o, i) != 0.0f;
+    }
+    return weights.length ? (f32) nonzero/weights.length : 0.0f;
+}
+
+
+void sparse_prune(Tensor& weights, f32 sparsity, u32 block_rows, u32 block_cols) {
+    assert(weights.ndim == 2 && block_rows > 0 && block_cols > 0 && weights.dtype == Dtype_F32);
+    u32 inputs = weights.shape[0];
+    u32 outputs = weights.shape[1];
+    u32 grid_rows = (outputs + block_rows - 1)/block_rows;
+    u32 grid_cols = (inputs + block_cols - 1)/block_cols;
+
+    // Magnitude of every block, element-wise pruning uses 1 x 1 blocks.
+    std::vector<f32> magnitudes((u64) grid_rows*grid_cols, 0.0f);
+    for (u32 o = 0; o < outputs; o++) {
+        for (u32 i = 0; i < inputs; i++) {
+            magnitudes[(u64) (o/block_rows)*grid_cols + i/block_cols] += fabsf(sparse_weight(weights, o, i));
+        }
+    }
+
+    u64 count = (u64) (std::min(std::max(sparsity, 0.0f), 1.0f)*magnitudes.size());
+    if (count == 0) return;
+    std::vector<u32> order(magnitudes.size());
+    for (u32 b = 0; b < order.size(); b++) order[b] = b;
+    std::nth_element(order.begin(), order.begin() + (count - 1), order.end(), [&](u32 a, u32 b) {
+        return magnitudes[a] < magnitudes[b];
+    });
+
+    std::vector<bool> pruned(magnitudes.size(), false);
+    for (u64 b = 0; b < count; b++) pruned[order[b]] = true;
+    for (u32 o = 0; o < outputs; o++) {
+        for (u32 i = 0; i < inputs; i++) {
+            if (pruned[(u64) (o/block_rows)*grid_cols + i/block_cols]) {
+                weights.data[(u64) o*weights.stride[1] + (u64) i*weights.stride[0]] = 0.0f;
+            }
+        }
+    }
+}
+
+
+Sparse_Matrix sparse_from_dense(const Tensor& weights, Sparse_Format format) {
+    assert(weights.ndim == 2);
+    Sparse_Matrix matrix = {};
+    matrix.format = format;
+    matrix.rows = weights.shape[1];
+    matrix.cols = weights.shape[0];
+    matrix.block_rows = format == Sparse_Format_Block ? SPARSE_BLOCK_ROWS : 1;
+    matrix.block_cols = format == Sparse_Format_Block ? SPARSE_BLOCK_COLS : 1;
+    u32 grid_rows = (matrix.rows + matrix.block_rows - 1)/matrix.block_rows;
+    u32 grid_cols = (matrix.cols + matrix.block_cols - 1)/matrix.block_cols;
+    u32 block_size = matrix.block_rows*matrix.block_cols;
+
+    // Find the blocks with a nonzero weight, then copy them out.
+    std::vector<u32> blocks;
+    std::vector<u32> row_offsets(grid_rows + 1, 0);
+    for (u32 r = 0; r < grid_rows; r++) {
+        for (u32 c = 0; c < grid_cols; c++) {
+            bool nonzero = false;
+            for (u32 o = r*matrix.block_rows; o < std::min((r + 1)*matrix.block_rows, matrix.rows) && !nonzero; o++) {
+                for (u32 i = c*matrix.block_cols; i < std::min((c + 1)*matrix.block_cols, matrix.cols); i++) {
+                    if (sparse_weight(weights, o, i) != 0.0f) {
+                        nonzero = true;
+                        break;
+                    }
+                }
+            }
+            if (nonzero) blocks.push_back(c*matrix.block_cols);
+        }
+        row_offsets[r + 1] = (u32) blocks.size();
+    }
+
+    matrix.num_blocks = (u32) blocks.size();
+    matrix.row_offsets = (u32*) memory_alloc(sizeof(u32)*(grid_rows + 1));
+    matrix.columns = (u32*) memory_alloc(sizeof(u32)*std::max(matrix.num_blocks, 1u));
+    matrix.values = (f32*) memory_alloc(sizeof(f32)*std::max(sparse_stored_values(matrix), (u64) 1));
+    memcpy(matrix.row_offsets, row_offsets.data(), sizeof(u32)*(grid_rows + 1));
+    memcpy(matrix.columns, blocks.data(), sizeof(u32)*matrix.num_blocks);
+
+    for (u32 r = 0; r < grid_rows; r++) {
+        for (u32 b = row_offsets[r]; b < row_offsets[r + 1]; b++) {
+            f32* values = matrix.values + (u64) b*block_size;
+            for (u32 y = 0; y < matrix.block_rows; y++) {
+                for (u32 x = 0; x < matrix.block_cols; x++) {
+                    u32 o = r*matrix.block_rows + y;
+                    u32 i = matrix.columns[b] + x;
+                    values[y*matrix.block_cols + x] = o < matrix.rows && i < matrix.cols ? sparse_weight(weights, o, i) : 0.0f;
+                }
+            }
+        }
+    }
+    return matrix;
+}
+
+
+void sparse_free(Sparse_Matrix& matrix) {
+    memory_free(matrix.row_offsets);
+    memory_free(matrix.columns);
+    memory_free(matrix.values);
+    matrix = {};
+}
+
+
+u64 sparse_bytes(const Sparse_Matrix& matrix) {
+    u32 grid_rows = (matrix.rows + matrix.block_rows - 1)/matrix.block_rows;
+    return sizeof(f32)*sparse_stored_values(matrix) + sizeof(u32)*((u64) matrix.num_blocks + grid_rows + 1);
+}
+
+
+void sparse_dense_into(Tensor& output, const Sparse_Matrix& weights, Tensor& input, Tensor& bias,
+                       Gemm_Activation activation) {
+    assert(input.ndim == 2 && input.shape[1] == weights.cols);
+    u32 n = input.shape[0];
+    assert(output.length == n*weights.rows && tensor_is_contiguous(output));
+    assert(bias.length == 0 || (bias.length == weights.rows && tensor_is_contiguous(bias)));
+
+    u64 stored = sparse_stored_values(weights);
+    PROFILE_SCOPE(weights.format == Sparse_Format_CSR ? "spmm_csr" : "spmm_block", PROFILE_KERNEL,
+                  2*stored*n, sparse_bytes(weights) + sizeof(float)*((u64) n*(weights.cols + weights.rows)));
+    Tensor x = tensor_contiguous(input);
+    const float* b = bias.length ? bias.data : nullptr;
+    u32 grid_rows = (weights.rows + weights.block_rows - 1)/weights.block_rows;
+    if (2*stored*n < SPARSE_PARALLEL_MIN_OPS) {
+        spmm(weights, 0, grid_rows, n, x.data, output.data, b, activation);
+    } else {
+        parallel_for(0, grid_rows, SPARSE_ROWS_PER_TASK, [&](u64 begin, u64 end) {
+            spmm(weights, (u32) begin, (u32) end, n, x.data, output.data, b, activation);
+        });
+    }
+    tensor_free(x);
+}
+
+
+Sparse_Dense_Layer* sparse_dense_layer(Dense_Layer* dense, Sparse_Format format, Gemm_Activation activation) {
+    Sparse_Dense_Layer* layer = new Sparse_Dense_Layer;
+    layer->require_grad = false;
+    layer->weights = sparse_from_dense(dense->weights, format);
+    layer->bias = tensor_view(dense->bias);
+    layer->activation = activation;
+    return layer;
+}
+
+
+/**
+ * Best time of a few calls in seconds.
+ */
+template <typename Function>
+static f64 sparse_measure(Function&& function) {
+    using namespace std::chrono;
+    function();
+    f64 best = 1e30;
+    for (int i = 0; i < 5; i++) {
+        auto start = steady_clock::now();
+        function();
+        best = std::min(best, duration<f64>(steady_clock::now() - start).count());
+    }
+    return best;
+}
+
+
+u32 network_sparsify(Network& network, u32 batch_size, f32 max_density) {
+    Arena_Scope heap(nullptr);
+    u32 replaced = 0;
+    for (u32 i = 0; i < network.layers.size(); i++) {
+        Layer* layer = network.layers[i];
+        Dense_Layer* dense = nullptr;
+        Gemm_Activation activation = Gemm_Activation_None;
+        if (layer->type() == Layer_Type_Dense) {
+            dense = (Dense_Layer*) layer;
+        } else if (layer->type() == Layer_Type_Fused_Dense) {
+            dense = ((Fused_Dense_Layer*) layer)->dense;
+            activation = ((Fused_Dense_Layer*) layer)->activation;
+        }
+        if (!dense || sparse_density(dense->weights) > max_density) continue;
+
+        // Measure the dense layer against both formats on random inputs of the batch size.
+        Tensor input = tensor_create_2d(batch_size, dense->weights.shape[0]);
+        Tensor output = tensor_create_2d(batch_size, dense->weights.shape[1]);
+        tensor_init_random(input);
+        f64 best = sparse_measure([&]() {
+            tensor_dense_into(output, dense->weights, input, dense->bias, activation);
+        });
+
+        Sparse_Dense_Layer* fastest = nullptr;
+        for (Sparse_Format format : { Sparse_Format_CSR, Sparse_Format_Block }) {
+            Sparse_Dense_Layer* sparse = sparse_dense_layer(dense, format, activation);
+            f64 time = sparse_measure([&]() { sparse->forward_into(&input, &output); });
+            if (time < best) {
+                best = time;
+                std::swap(fastest, sparse);
+            }
+            delete sparse;
+        }
+        tensor_free(input);
+        tensor_free(output);
+
+        if (fastest) {
+            // The sparse layer holds its own reference to the bias.
+            network.layers[i] = fastest;
+            layer_destroy(layer);
+            replaced++;
+        }
+    }
+    return replaced;
+}
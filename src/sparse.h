@@ -0,0 +1,124 @@
+#pragma once
+
+
+#include "network.h"
+#include "spmm.h"
+
+
+/***************************************************************************
+ * Sparse weights
+ *
+ * Pruned dense layers stored without their zeros. The weights of a dense
+ * layer are viewed as a matrix with one row per output and one column per
+ * input (row `o` holds the weights of output `o`), and only the blocks of
+ * that matrix with a nonzero weight are kept:
+ *
+ *   CSR      1 x 1 blocks, i.e. every nonzero weight with its column index
+ *   Block    SPARSE_BLOCK_ROWS x SPARSE_BLOCK_COLS blocks, zeros inside a
+ *            kept block are stored, but a whole block shares one column
+ *            index and its weights are loaded as vectors
+ *
+ * The layer computes `Y = W*X` for a batch X of shape (N, inputs), whose
+ * samples are contiguous along each input row, so every stored weight is
+ * multiplied with a contiguous row of N samples (SpMM). A single sample
+ * (SpMV) instead gathers the inputs of the weights. Both the work and the
+ * bytes of weights read shrink with the density, CSR pays an index per
+ * weight so it only reads less than the dense weights below 50% density.
+ *
+ * Magnitude pruning zeroes the weights (or blocks) with the smallest
+ * absolute values, `network_sparsify` then measures every dense layer and
+ * replaces it if one of the sparse formats is faster.
+ ***************************************************************************/
+
+
+/**
+ * Layers with more nonzero weights than this are left dense without measuring.
+ */
+const f32 SPARSE_MAX_DENSITY = 0.5f;
+
+
+/**
+ * Fraction of the weights (in, out) that are nonzero.
+ */
+f32 sparse_density(const Tensor& weights);
+
+
+/**
+ * Zeroes the `sparsity` fraction of the weights (in, out) with the smallest
+ * magnitudes. With blocks larger than 1 x 1 whole blocks of `block_rows`
+ * outputs by `block_cols` inputs are zeroed by the sum of their magnitudes,
+ * so the block format can skip them.
+ */
+void sparse_prune(Tensor& weights, f32 sparsity, u32 block_rows = 1, u32 block_cols = 1);
+
+
+/**
+ * Converts dense weights (in, out) to a sparse matrix, free it with `sparse_free`.
+ */
+Sparse_Matrix sparse_from_dense(const Tensor& weights, Sparse_Format format);
+
+
+void sparse_free(Sparse_Matrix& matrix);
+
+
+/**
+ * Bytes of the values and indices of the matrix.
+ */
+u64 sparse_bytes(const Sparse_Matrix& matrix);
+
+
+/**
+ * Computes output = activation(W*input + bias) for an input of shape (N, cols)
+ * into a contiguous output of shape (N, rows), i.e. the forward pass of a dense
+ * layer with sparse weights. Split over the thread pool when large enough.
+ */
+void sparse_dense_into(Tensor& output, const Sparse_Matrix& weights, Tensor& input, Tensor& bias,
+                       Gemm_Activation activation = Gemm_Activation_None);
+
+
+/**
+ * Dense layer with sparse weights, replaces a (fused) dense layer. It owns
+ * its weights and a reference to the bias, both released with the layer
+ * (copies made by `network_share_weights` don't own them).
+ */
+struct Sparse_Dense_Layer : Layer {
+    Sparse_Matrix weights = {};
+    Tensor bias = {};
+    Gemm_Activation activation;
+
+    ~Sparse_Dense_Layer() {
+        sparse_free(weights);
+        tensor_free(bias);
+    }
+
+    virtual Layer_Type type() const override {
+        return Layer_Type_Sparse_Dense;
+    }
+
+    virtual u8 output_shape(const u32* input_shape, u8, u32* shape) const override {
+        shape[0] = input_shape[0];
+        shape[1] = weights.rows;
+        return 2;
+    }
+
+    virtual void forward_into(Tensor* input, Tensor* output) override {
+        sparse_dense_into(*output, weights, *input, bias, activation);
+    }
+};
+
+
+/**
+ * Converts the weights of a dense layer, the bias is shared with it.
+ */
+Sparse_Dense_Layer* sparse_dense_layer(Dense_Layer* dense, Sparse_Format format,
+                                       Gemm_Activation activation = Gemm_Activation_None);
+
+
+/**
+ * Replaces every dense and fused dense layer with at most `max_density` nonzero
+ * weights by a sparse layer, if one of the sparse formats measures faster than
+ * the dense layer for batches of `batch_size` samples. Returns the number of
+ * layers replaced, fuse the network first so the activations are kept.
+ */
+u32 network_sparsify(Network& network, u32 batch_size, f32 max_density = SPARSE_MAX_DENSITY);
+
@@ -0,0 +1,97 @@
+#include "spmm.h"
+#include "cpu.h"
+#include <algorithm>
+#include <cstring>
+
+
+static Sparse_Kernel* sparse_csr_kernel = nullptr;
+static Sparse_Kernel* sparse_block_kernel = nullptr;
+static const char* sparse_kernel_label = "none";
+
+
+bool sparse_set_kernel(Sparse_Kernel_Type type) {
+    const Cpu_Features& cpu = cpu_features();
+    switch (type) {
+        case Sparse_Kernel_Auto: {
+            if (cpu.avx2 && cpu.fma) {
+                return sparse_set_kernel(Sparse_Kernel_AVX2);
+            }
+            return sparse_set_kernel(Sparse_Kernel_Scalar);
+        }
+
+        case Sparse_Kernel_Scalar: {
+            sparse_csr_kernel = sparse_kernel_csr_scalar;
+            sparse_block_kernel = sparse_kernel_block_scalar;
+            sparse_kernel_label = "scalar";
+            return true;
+        }
+
+        case Sparse_Kernel_AVX2: {
+            if (!(cpu.avx2 && cpu.fma)) return false;
+            sparse_csr_kernel = sparse_kernel_csr_avx2;
+            sparse_block_kernel = sparse_kernel_block_avx2;
+            sparse_kernel_label = "avx2";
+            return true;
+        }
+    }
+    return false;
+}
+
+
+const char* sparse_kernel_name() {
+    if (!sparse_csr_kernel) sparse_set_kernel(Sparse_Kernel_Auto);
+    return sparse_kernel_label;
+}
+
+
+void spmm(const Sparse_Matrix& w, u32 row_begin, u32 row_end, u32 n,
+          const float* x, float* y, const float* bias, Gemm_Activation activation) {
+    if (!sparse_csr_kernel) sparse_set_kernel(Sparse_Kernel_Auto);
+    Sparse_Kernel* kernel = w.format == Sparse_Format_CSR ? sparse_csr_kernel : sparse_block_kernel;
+    kernel(w, row_begin, row_end, n, x, y, bias, activation);
+}
+
+
+void sparse_kernel_csr_scalar(const Sparse_Matrix& w, u32 row_begin, u32 row_end, u32 n,
+                              const float* x, float* y, const float* bias, Gemm_Activation activation) {
+    for (u32 o = row_begin; o < row_end; o++) {
+        float* y_row = y + (u64) o*n;
+        for (u32 s = 0; s < n; s++) y_row[s] = 0.0f;
+        for (u32 b = w.row_offsets[o]; b < w.row_offsets[o + 1]; b++) {
+            f32 value = w.values[b];
+            const float* x_row = x + (u64) w.columns[b]*n;
+            for (u32 s = 0; s < n; s++) y_row[s] += value*x_row[s];
+        }
+        for (u32 s = 0; s < n; s++) y_row[s] = gemm_apply_epilogue(y_row[s], bias, o, activation);
+    }
+}
+
+
+void sparse_kernel_block_scalar(const Sparse_Matrix& w, u32 row_begin, u32 row_end, u32 n,
+                                const float* x, float* y, const float* bias, Gemm_Activation activation) {
+    const u32 block_size = SPARSE_BLOCK_ROWS*SPARSE_BLOCK_COLS;
+    for (u32 block_row = row_begin; block_row < row_end; block_row++) {
+        u32 first = block_row*SPARSE_BLOCK_ROWS;
+        u32 rows = std::min(SPARSE_BLOCK_ROWS, w.rows - first);
+        for (u32 r = 0; r < rows; r++) memset(y + (u64) (first + r)*n, 0, sizeof(float)*n);
+
+        for (u32 b = w.row_offsets[block_row]; b < w.row_offsets[block_row + 1]; b++) {
+            u32 column = w.columns[b];
+            u32 cols = std::min(SPARSE_BLOCK_COLS, w.cols - column);
+            const f32* values = w.values + (u64) b*block_size;
+            for (u32 r = 0; r < rows; r++) {
+                float* y_row = y + (u64) (first + r)*n;
+                for (u32 c = 0; c < cols; c++) {
+                    f32 value = values[r*SPARSE_BLOCK_COLS + c];
+                    const float* x_row = x + (u64) (column + c)*n;
+                    for (u32 s = 0; s < n; s++) y_row[s] += value*x_row[s];
+                }
+            }
+        }
+
+        for (u32 r = 0; r < rows; r++) {
+            float* y_row = y + (u64) (first + r)*n;
+            for (u32 s = 0; s < n; s++) y_row[s] = gemm_apply_epilogue(y_row[s], bias, first + r, activation);
+        }
+    }
+}
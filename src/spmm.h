@@ -0,0 +1,98 @@
+#pragma once
+
+
+#include "gemm.h"
+
+
+/***************************************************************************
+ * Sparse matrix multiplication
+ *
+ * Kernels multiplying a sparse matrix with a dense batch of samples, used
+ * by the sparse dense layers (see sparse.h). The sparse matrix is stored
+ * in block compressed sparse row format, CSR is the special case of 1 x 1
+ * blocks. The dense matrices are row major with the samples contiguous.
+ ***************************************************************************/
+
+
+/**
+ * Size of the blocks of the block-sparse format, 4 outputs by 8 inputs
+ * (one AVX2 register of inputs for each output).
+ */
+const u32 SPARSE_BLOCK_ROWS = 4;
+const u32 SPARSE_BLOCK_COLS = 8;
+
+
+enum Sparse_Format {
+    Sparse_Format_CSR,
+    Sparse_Format_Block,
+};
+
+
+/**
+ * Matrix of `rows` x `cols` in block compressed sparse row format. The
+ * blocks of block row `r` are `row_offsets[r]` .. `row_offsets[r + 1]`,
+ * block `b` starts at column `columns[b]` (a multiple of block_cols) and
+ * its values are stored row by row at `values + b*block_rows*block_cols`.
+ * Blocks at the right and bottom edges are padded with zeros.
+ */
+struct Sparse_Matrix {
+    Sparse_Format format;
+    u32 rows;
+    u32 cols;
+    u32 block_rows;
+    u32 block_cols;
+    u32 num_blocks;
+    u32* row_offsets;
+    u32* columns;
+    f32* values;
+};
+
+
+/**
+ * Kernel computes block rows [row_begin, row_end) of Y = activation(W*X + bias)
+ * for a batch of `n` samples, X is (cols x n) and Y is (rows x n) row major.
+ */
+typedef void Sparse_Kernel(const Sparse_Matrix& w, u32 row_begin, u32 row_end, u32 n,
+                           const float* x, float* y, const float* bias, Gemm_Activation activation);
+
+
+enum Sparse_Kernel_Type {
+    Sparse_Kernel_Auto,
+    Sparse_Kernel_Scalar,
+    Sparse_Kernel_AVX2,
+};
+
+
+/**
+ * Forces specific kernels, mostly useful for benchmarking.
+ * Returns false if the requested kernels are not supported.
+ */
+bool sparse_set_kernel(Sparse_Kernel_Type type);
+
+
+/**
+ * Returns the name of the kernels that are currently in use.
+ */
+const char* sparse_kernel_name();
+
+
+/**
+ * Number of multiply-adds per sample, including the zeros stored in blocks.
+ */
+static inline u64 sparse_stored_values(const Sparse_Matrix& matrix) {
+    return (u64) matrix.num_blocks*matrix.block_rows*matrix.block_cols;
+}
+
+
+/**
+ * Computes block rows [row_begin, row_end) of the product using the current kernels.
+ */
+void spmm(const Sparse_Matrix& w, u32 row_begin, u32 row_end, u32 n,
+          const float* x, float* y, const float* bias, Gemm_Activation activation);
+
+
+// The AVX2 kernels live in their own translation unit compiled with AVX2 and FMA.
+Sparse_Kernel sparse_kernel_csr_scalar;
+Sparse_Kernel sparse_kernel_block_scalar;
+Sparse_Kernel sparse_kernel_csr_avx2;
+Sparse_Kernel sparse_kernel_block_avx2;
@@ -0,0 +1,189 @@
+// NOTE: this file is compiled with AVX2 and FMA enabled (see premake5.lua),
+// so only include headers without inline functions to avoid the compiler
+// emitting AVX2 instructions into code shared with the other translation units.
+#include "spmm.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+
+
+namespace {
+
+/**
+ * Mask of the first `count` (at most 8) lanes.
+ */
+inline __m256i lane_mask(u32 count) {
+    return _mm256_cmpgt_epi32(_mm256_set1_epi32((i32) count), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+}
+
+
+template <bool Masked>
+inline __m256 load(const float* p, __m256i mask) {
+    return Masked ? _mm256_maskload_ps(p, mask) : _mm256_loadu_ps(p);
+}
+
+
+/**
+ * Adds the bias and applies the activation to V vectors of samples of one
+ * output and stores them, sigmoid and tanh are applied to the stored values.
+ */
+template <u32 V, bool Masked>
+inline void store_row(float* y, __m256* acc, float bias, Gemm_Activation activation, __m256i mask, u32 count) {
+    __m256 b = _mm256_set1_ps(bias);
+    for (u32 v = 0; v < V; v++) {
+        __m256 value = _mm256_add_ps(acc[v], b);
+        if (activation == Gemm_Activation_ReLU) value = _mm256_max_ps(value, _mm256_setzero_ps());
+        if (Masked) _mm256_maskstore_ps(y + 8*v, mask, value);
+        else _mm256_storeu_ps(y + 8*v, value);
+    }
+    if (activation == Gemm_Activation_Sigmoid || activation == Gemm_Activation_Tanh) {
+        for (u32 s = 0; s < count; s++) y[s] = gemm_apply_epilogue(y[s], nullptr, 0, activation);
+    }
+}
+
+
+inline float reduce_add(__m256 v) {
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+    return _mm_cvtss_f32(sum);
+}
+
+
+/**
+ * Samples [s, s + 8*V) of one output row of a CSR matrix, every weight is
+ * broadcast against V vectors of the samples of its input.
+ */
+template <u32 V, bool Masked>
+inline void csr_row(const Sparse_Matrix& w, u32 o, u32 n, u32 s, const float* x, float* y,
+                    const float* bias, Gemm_Activation activation, __m256i mask, u32 count) {
+    __m256 acc[V];
+    for (u32 v = 0; v < V; v++) acc[v] = _mm256_setzero_ps();
+    for (u32 b = w.row_offsets[o]; b < w.row_offsets[o + 1]; b++) {
+        __m256 value = _mm256_set1_ps(w.values[b]);
+        const float* x_row = x + (u64) w.columns[b]*n + s;
+        for (u32 v = 0; v < V; v++) acc[v] = _mm256_fmadd_ps(value, load<Masked>(x_row + 8*v, mask), acc[v]);
+    }
+    store_row<V, Masked>(y + (u64) o*n + s, acc, bias ? bias[o] : 0.0f, activation, mask, count);
+}
+
+
+/**
+ * Samples [s, s + 8*V) of one block row, the 4 x 8 weights of a block are
+ * broadcast one input at a time against V vectors of its samples.
+ */
+template <u32 V, bool Masked>
+inline void block_row(const Sparse_Matrix& w, u32 block_row, u32 n, u32 s, const float* x, float* y,
+                      const float* bias, Gemm_Activation activation, __m256i mask, u32 count) {
+    const u32 block_size = SPARSE_BLOCK_ROWS*SPARSE_BLOCK_COLS;
+    __m256 acc[SPARSE_BLOCK_ROWS][V];
+    for (u32 r = 0; r < SPARSE_BLOCK_ROWS; r++) {
+        for (u32 v = 0; v < V; v++) acc[r][v] = _mm256_setzero_ps();
+    }
+
+    for (u32 b = w.row_offsets[block_row]; b < w.row_offsets[block_row + 1]; b++) {
+        u32 column = w.columns[b];
+        u32 cols = w.cols - column < SPARSE_BLOCK_COLS ? w.cols - column : SPARSE_BLOCK_COLS;
+        const f32* values = w.values + (u64) b*block_size;
+        for (u32 c = 0; c < cols; c++) {
+            const float* x_row = x + (u64) (column + c)*n + s;
+            __m256 samples[V];
+            for (u32 v = 0; v < V; v++) samples[v] = load<Masked>(x_row + 8*v, mask);
+            for (u32 r = 0; r < SPARSE_BLOCK_ROWS; r++) {
+                __m256 value = _mm256_set1_ps(values[r*SPARSE_BLOCK_COLS + c]);
+                for (u32 v = 0; v < V; v++) acc[r][v] = _mm256_fmadd_ps(value, samples[v], acc[r][v]);
+            }
+        }
+    }
+
+    // Rows past the bottom edge only have padding.
+    u32 first = block_row*SPARSE_BLOCK_ROWS;
+    for (u32 r = 0; r < SPARSE_BLOCK_ROWS && first + r < w.rows; r++) {
+        store_row<V, Masked>(y + (u64) (first + r)*n + s, acc[r], bias ? bias[first + r] : 0.0f, activation, mask, count);
+    }
+}
+
+}
+
+
+void sparse_kernel_csr_avx2(const Sparse_Matrix& w, u32 row_begin, u32 row_end, u32 n,
+                            const float* x, float* y, const float* bias, Gemm_Activation activation) {
+    if (n == 1) {
+        // Single sample, the inputs of 8 weights at a time are gathered.
+        for (u32 o = row_begin; o < row_end; o++) {
+            u32 b = w.row_offsets[o];
+            u32 end = w.row_offsets[o + 1];
+            __m256 acc = _mm256_setzero_ps();
+            for (; b + 8 <= end; b += 8) {
+                __m256i columns = _mm256_loadu_si256((const __m256i*) (w.columns + b));
+                acc = _mm256_fmadd_ps(_mm256_loadu_ps(w.values + b), _mm256_i32gather_ps(x, columns, 4), acc);
+            }
+            float sum = reduce_add(acc);
+            for (; b < end; b++) sum += w.values[b]*x[w.columns[b]];
+            y[o] = gemm_apply_epilogue(sum, bias, o, activation);
+        }
+        return;
+    }
+
+    // 32 samples at a time, then 8, then the rest masked.
+    __m256i all = _mm256_set1_epi32(-1);
+    for (u32 o = row_begin; o < row_end; o++) {
+        u32 s = 0;
+        for (; s + 32 <= n; s += 32) csr_row<4, false>(w, o, n, s, x, y, bias, activation, all, 32);
+        for (; s + 8 <= n; s += 8) csr_row<1, false>(w, o, n, s, x, y, bias, activation, all, 8);
+        if (s < n) csr_row<1, true>(w, o, n, s, x, y, bias, activation, lane_mask(n - s), n - s);
+    }
+}
+
+
+void sparse_kernel_block_avx2(const Sparse_Matrix& w, u32 row_begin, u32 row_end, u32 n,
+                              const float* x, float* y, const float* bias, Gemm_Activation activation) {
+    const u32 block_size = SPARSE_BLOCK_ROWS*SPARSE_BLOCK_COLS;
+    if (n == 1) {
+        // Single sample, a block is 4 rows of 8 weights against one vector of inputs.
+        for (u32 block_row = row_begin; block_row < row_end; block_row++) {
+            __m256 acc[SPARSE_BLOCK_ROWS];
+            for (u32 r = 0; r < SPARSE_BLOCK_ROWS; r++) acc[r] = _mm256_setzero_ps();
+            for (u32 b = w.row_offsets[block_row]; b < w.row_offsets[block_row + 1]; b++) {
+                u32 column = w.columns[b];
+                __m256 inputs = column + SPARSE_BLOCK_COLS <= w.cols
+                    ? _mm256_loadu_ps(x + column) : _mm256_maskload_ps(x + column, lane_mask(w.cols - column));
+                const f32* values = w.values + (u64) b*block_size;
+                for (u32 r = 0; r < SPARSE_BLOCK_ROWS; r++) {
+                    acc[r] = _mm256_fmadd_ps(_mm256_loadu_ps(values + r*SPARSE_BLOCK_COLS), inputs, acc[r]);
+                }
+            }
+            u32 first = block_row*SPARSE_BLOCK_ROWS;
+            for (u32 r = 0; r < SPARSE_BLOCK_ROWS && first + r < w.rows; r++) {
+                y[first + r] = gemm_apply_epilogue(reduce_add(acc[r]), bias, first + r, activation);
+            }
+        }
+        return;
+    }
+
+    // 16 samples at a time (8 accumulators), then 8, then the rest masked.
+    __m256i all = _mm256_set1_epi32(-1);
+    for (u32 r = row_begin; r < row_end; r++) {
+        u32 s = 0;
+        for (; s + 16 <= n; s += 16) block_row<2, false>(w, r, n, s, x, y, bias, activation, all, 16);
+        for (; s + 8 <= n; s += 8) block_row<1, false>(w, r, n, s, x, y, bias, activation, all, 8);
+        if (s < n) block_row<1, true>(w, r, n, s, x, y, bias, activation, lane_mask(n - s), n - s);
+    }
+}
+
+
+#else
+
+// Never selected since the CPU check fails, but the kernels have to exist.
+void sparse_kernel_csr_avx2(const Sparse_Matrix& w, u32 row_begin, u32 row_end, u32 n,
+                            const float* x, float* y, const float* bias, Gemm_Activation activation) {
+    sparse_kernel_csr_scalar(w, row_begin, row_end, n, x, y, bias, activation);
+}
+
+
+void sparse_kernel_block_avx2(const Sparse_Matrix& w, u32 row_begin, u32 row_end, u32 n,
+                              const float* x, float* y, const float* bias, Gemm_Activation activation) {
+    sparse_kernel_block_scalar(w, row_begin, row_end, n, x, y, bias, activation);
+}
+
+#endif
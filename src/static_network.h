@@ -0,0 +1,234 @@
+#pragma once
+
+
+#include "static_tensor.h"
+#include <tuple>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <xmmintrin.h>
+#endif
+
+
+/***************************************************************************
+ * Static networks
+ *
+ * Layers with their sizes as template parameters and their parameters
+ * stored inline, chained by `Static_Sequential` which checks at compile
+ * time that the outputs of each layer match the inputs of the next one.
+ * A forward pass keeps every intermediate on the stack, so it never
+ * allocates and does no shape bookkeeping at runtime. The weights can be
+ * loaded from the equivalent dynamic layers and give the same results as
+ * the fused dense layers up to the order of the additions.
+ *
+ *     Static_Sequential<Static_Dense<3, 2>, Static_ReLU<2>> model;
+ *     static_dense_load(std::get<0>(model.layers), weights, bias);
+ *     model.forward(input, output);  // Static_Tensor<N, 3> -> Static_Tensor<N, 2>
+ ***************************************************************************/
+
+
+/**
+ * Dot product of two vectors of `Length` floats with four independent
+ * vector sums, the tail is added up in scalar code. Targets without SSE
+ * keep the same sums in arrays, so the additions happen in the same order.
+ */
+template <u32 Length>
+inline float static_dot(const float* a, const float* b) {
+    constexpr u32 body = Length/16*16;
+    float total = 0.0f;
+    if constexpr (body > 0) {
+#if defined(__x86_64__) || defined(_M_X64)
+        __m128 sum[4] = { _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps() };
+        static_loop<body/16>([&](u32 i) {
+            static_unroll<4>([&](u32 v) {
+                u32 offset = i*16 + v*4;
+                sum[v] = _mm_add_ps(sum[v], _mm_mul_ps(_mm_loadu_ps(a + offset), _mm_loadu_ps(b + offset)));
+            });
+        });
+        __m128 all = _mm_add_ps(_mm_add_ps(sum[0], sum[1]), _mm_add_ps(sum[2], sum[3]));
+        alignas(16) float lanes[4];
+        _mm_store_ps(lanes, all);
+#else
+        float sum[4][4] = {};
+        static_loop<body/16>([&](u32 i) {
+            static_unroll<16>([&](u32 j) { sum[j/4][j%4] += a[i*16 + j]*b[i*16 + j]; });
+        });
+        float lanes[4];
+        static_unroll<4>([&](u32 l) { lanes[l] = (sum[0][l] + sum[1][l]) + (sum[2][l] + sum[3][l]); });
+#endif
+        total = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    }
+    static_unroll<Length - body>([&](u32 i) { total += a[body + i]*b[body + i]; });
+    return total;
+}
+
+
+/**
+ * Dense layer from `In` to `Out` features with a fused activation. The
+ * weights have the layout of a contiguous (In, Out) tensor like those of
+ * Dense_Layer, i.e. the `In` weights of each output are contiguous.
+ *
+ * Written with SSE, the baseline of x64, since the static kernels are
+ * compiled into the callers without runtime dispatch, other targets run the
+ * same loops in scalar code. Wide layers and large batches run faster on
+ * the dispatched AVX2 kernels of Dense_Layer.
+ */
+template <u32 In, u32 Out, Gemm_Activation Activation = Gemm_Activation_None>
+struct Static_Dense {
+    static constexpr u32 inputs = In;
+    static constexpr u32 outputs = Out;
+
+    Static_Tensor<In, Out> weights;
+    Static_Tensor<Out> bias;
+
+    template <u32 N>
+    void forward(const Static_Tensor<N, In>& input, Static_Tensor<N, Out>& output) const {
+        if constexpr (N % 4 == 0) {
+            // The samples of a feature are contiguous, so every weight is broadcast over
+            // vectors of 4 samples, for a block of outputs to reuse the loaded inputs.
+            constexpr u32 vectors = N/4;
+            constexpr u32 widest = vectors <= 2 ? 4 : vectors <= 4 ? 2 : 1;
+            constexpr u32 block = widest < Out ? widest : Out;
+            u32 o = 0;
+            for (; o + block <= Out; o += block) forward_block<N, block>(input, output, o);
+            for (; o < Out; o++) forward_block<N, 1>(input, output, o);
+        } else if constexpr (N == 1) {
+            for (u32 o = 0; o < Out; o++) {
+                f32 sum = static_dot<In>(weights.data + o*In, input.data);
+                output.data[o] = gemm_apply_epilogue(sum, bias.data, o, Activation);
+            }
+        } else {
+            for (u32 o = 0; o < Out; o++) {
+                const float* w = weights.data + o*In;
+                float sum[N] = {};
+                static_loop<In>([&](u32 i) {
+                    static_unroll<N>([&](u32 n) { sum[n] += w[i]*input.data[i*N + n]; });
+                });
+                static_unroll<N>([&](u32 n) {
+                    output.data[o*N + n] = gemm_apply_epilogue(sum[n], bias.data, o, Activation);
+                });
+            }
+        }
+    }
+
+private:
+    template <u32 N, u32 Block>
+    void forward_block(const Static_Tensor<N, In>& input, Static_Tensor<N, Out>& output, u32 first) const {
+#if defined(__x86_64__) || defined(_M_X64)
+        constexpr u32 vectors = N/4;
+        __m128 sum[Block][vectors];
+        static_unroll<Block>([&](u32 b) {
+            static_unroll<vectors>([&](u32 v) { sum[b][v] = _mm_set1_ps(bias.data[first + b]); });
+        });
+        const float* w = weights.data + first*In;
+        const float* x = input.data;
+        for (u32 i = 0; i < In; i++, x += N) {
+            static_unroll<Block>([&](u32 b) {
+                __m128 weight = _mm_set1_ps(w[b*In + i]);
+                static_unroll<vectors>([&](u32 v) {
+                    sum[b][v] = _mm_add_ps(sum[b][v], _mm_mul_ps(weight, _mm_loadu_ps(x + v*4)));
+                });
+            });
+        }
+        static_unroll<Block>([&](u32 b) {
+            float* y = output.data + (first + b)*N;
+            static_unroll<vectors>([&](u32 v) {
+                if constexpr (Activation == Gemm_Activation_ReLU) sum[b][v] = _mm_max_ps(sum[b][v], _mm_setzero_ps());
+                _mm_storeu_ps(y + v*4, sum[b][v]);
+            });
+            if constexpr (Activation != Gemm_Activation_None && Activation != Gemm_Activation_ReLU) {
+                static_unroll<N>([&](u32 n) { y[n] = gemm_apply_epilogue(y[n], nullptr, 0, Activation); });
+            }
+        });
+#else
+        float sum[Block][N];
+        static_unroll<Block>([&](u32 b) {
+            static_loop<N>([&](u32 n) { sum[b][n] = bias.data[first + b]; });
+        });
+        const float* w = weights.data + first*In;
+        const float* x = input.data;
+        for (u32 i = 0; i < In; i++, x += N) {
+            static_unroll<Block>([&](u32 b) {
+                float weight = w[b*In + i];
+                static_loop<N>([&](u32 n) { sum[b][n] += weight*x[n]; });
+            });
+        }
+        static_unroll<Block>([&](u32 b) {
+            float* y = output.data + (first + b)*N;
+            static_loop<N>([&](u32 n) { y[n] = gemm_apply_epilogue(sum[b][n], nullptr, 0, Activation); });
+        });
+#endif
+    }
+};
+
+
+/**
+ * Element-wise activation of `Size` features.
+ */
+template <u32 Size, Gemm_Activation Activation>
+struct Static_Activation {
+    static constexpr u32 inputs = Size;
+    static constexpr u32 outputs = Size;
+
+    template <u32 N>
+    void forward(const Static_Tensor<N, Size>& input, Static_Tensor<N, Size>& output) const {
+        static_loop<N*Size>([&](u32 i) {
+            output.data[i] = gemm_apply_epilogue(input.data[i], nullptr, 0, Activation);
+        });
+    }
+};
+
+
+template <u32 Size>
+using Static_ReLU = Static_Activation<Size, Gemm_Activation_ReLU>;
+
+template <u32 Size>
+using Static_Sigmoid = Static_Activation<Size, Gemm_Activation_Sigmoid>;
+
+template <u32 Size>
+using Static_Tanh = Static_Activation<Size, Gemm_Activation_Tanh>;
+
+
+/**
+ * Layers in sequence, the network is a single object holding all the parameters.
+ */
+template <typename... Layers>
+struct Static_Sequential {
+    static_assert(sizeof...(Layers) > 0, "a network needs at least one layer");
+
+    typedef std::tuple<Layers...> Layer_Tuple;
+    static constexpr u32 inputs = std::tuple_element_t<0, Layer_Tuple>::inputs;
+    static constexpr u32 outputs = std::tuple_element_t<sizeof...(Layers) - 1, Layer_Tuple>::outputs;
+
+    Layer_Tuple layers;
+
+    template <u32 N>
+    void forward(const Static_Tensor<N, inputs>& input, Static_Tensor<N, outputs>& output) const {
+        forward_from<0>(input, output);
+    }
+
+private:
+    template <size_t Index, u32 N, u32 Features>
+    void forward_from(const Static_Tensor<N, Features>& input, Static_Tensor<N, outputs>& output) const {
+        typedef std::tuple_element_t<Index, Layer_Tuple> Current;
+        static_assert(Current::inputs == Features, "the layer does not take the outputs of the previous one");
+
+        if constexpr (Index + 1 == sizeof...(Layers)) {
+            std::get<Index>(layers).forward(input, output);
+        } else {
+            Static_Tensor<N, Current::outputs> next;
+            std::get<Index>(layers).forward(input, next);
+            forward_from<Index + 1>(next, output);
+        }
+    }
+};
+
+
+/**
+ * Copies the parameters of a dynamic dense layer, which must have
+ * weights of shape (In, Out) and a bias of length Out.
+ */
+template <u32 In, u32 Out, Gemm_Activation Activation>
+inline void static_dense_load(Static_Dense<In, Out, Activation>& layer, Tensor& weights, Tensor& bias) {
+    static_copy_from(layer.weights, weights);
+    static_copy_from(layer.bias, bias);
+}
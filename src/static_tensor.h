@@ -0,0 +1,145 @@
+#pragma once
+
+
+#include "tensor.h"
+#include <type_traits>
+#include <utility>
+
+
+/***************************************************************************
+ * Static tensors
+ *
+ * Tensors whose shape is part of the type, for fixed architectures where
+ * every shape is known when the program is built. The elements are stored
+ * inline (on the stack or inside the owning object) in the same layout as
+ * a contiguous Tensor, dimension 0 is the fastest changing one, so a batch
+ * of N samples with F features is a `Static_Tensor<N, F>` and the samples
+ * are its columns. There is no shape, stride or length stored at runtime,
+ * and operations on tensors of different shapes don't compile.
+ *
+ * The loops run over compile-time trip counts, short ones are unrolled
+ * completely with `static_unroll` so small models compile to straight-line
+ * code. Meant for small tensors, large ones belong on the heap.
+ ***************************************************************************/
+
+
+/**
+ * Loops with at most this many iterations are unrolled completely.
+ */
+const u32 STATIC_UNROLL_MAX = 64;
+
+
+template <typename Function, u32... I>
+inline void static_unroll_impl(Function&& function, std::integer_sequence<u32, I...>) {
+    (function(std::integral_constant<u32, I>{}), ...);
+}
+
+
+/**
+ * Calls `function(i)` for i = 0 .. Count - 1 with each call written out,
+ * the index is a std::integral_constant so it can also be used as a
+ * template argument.
+ */
+template <u32 Count, typename Function>
+inline void static_unroll(Function&& function) {
+    static_unroll_impl(function, std::make_integer_sequence<u32, Count>{});
+}
+
+
+/**
+ * Calls `function(i)` for i = 0 .. Count - 1, unrolled if the loop is short.
+ */
+template <u32 Count, typename Function>
+inline void static_loop(Function&& function) {
+    if constexpr (Count <= STATIC_UNROLL_MAX) {
+        static_unroll<Count>([&](u32 i) { function(i); });
+    } else {
+        for (u32 i = 0; i < Count; i++) function(i);
+    }
+}
+
+
+template <u32... Shape>
+struct Static_Tensor {
+    static_assert(sizeof...(Shape) >= 1 && sizeof...(Shape) <= TENSOR_MAX_DIMS, "unsupported number of dimensions");
+    static_assert(((Shape > 0) && ...), "dimensions must not be empty");
+
+    static constexpr u8 ndim = sizeof...(Shape);
+    static constexpr u32 length = (Shape * ...);
+    static constexpr u32 shape[ndim] = { Shape... };
+
+    alignas(MEMORY_ALIGNMENT) float data[length];
+
+    float& operator[](u32 index) {
+        return data[index];
+    }
+
+    const float& operator[](u32 index) const {
+        return data[index];
+    }
+
+    /**
+     * Dynamic tensor viewing the same elements, e.g. for printing
+     * or for passing them to the regular kernels.
+     */
+    Tensor tensor() {
+        return tensor_wrap(data, shape, ndim);
+    }
+};
+
+
+/**
+ * Element (sample, feature) of a batch.
+ */
+template <u32 N, u32 F>
+inline float& static_at(Static_Tensor<N, F>& tensor, u32 sample, u32 feature) {
+    return tensor.data[feature*N + sample];
+}
+
+
+/**
+ * Copies a dynamic tensor of the same shape (any strides) into a static tensor.
+ */
+template <u32... Shape>
+inline void static_copy_from(Static_Tensor<Shape...>& out, Tensor& tensor) {
+#ifdef DEBUG
+    if (tensor.ndim != out.ndim || tensor.length != out.length) {
+        std::cerr << "error: tensor shape does not match the static tensor" << std::endl;
+        assert(false);
+    }
+    for (u8 d = 0; d < out.ndim; d++) assert(tensor.shape[d] == out.shape[d]);
+#endif
+    Tensor view = out.tensor();
+    tensor_copy_into(view, tensor);
+}
+
+
+template <u32... Shape>
+inline void static_fill(Static_Tensor<Shape...>& tensor, float value) {
+    static_loop<Static_Tensor<Shape...>::length>([&](u32 i) { tensor.data[i] = value; });
+}
+
+
+template <u32... Shape>
+inline void static_add(Static_Tensor<Shape...>& lhs, const Static_Tensor<Shape...>& rhs) {
+    static_loop<Static_Tensor<Shape...>::length>([&](u32 i) { lhs.data[i] += rhs.data[i]; });
+}
+
+
+template <u32... Shape>
+inline void static_mul(Static_Tensor<Shape...>& lhs, const Static_Tensor<Shape...>& rhs) {
+    static_loop<Static_Tensor<Shape...>::length>([&](u32 i) { lhs.data[i] *= rhs.data[i]; });
+}
+
+
+/**
+ * Applies an activation to every element, exactly like the GEMM epilogue.
+ */
+template <Gemm_Activation Activation, u32... Shape>
+inline void static_activate(Static_Tensor<Shape...>& tensor) {
+    if constexpr (Activation != Gemm_Activation_None) {
+        static_loop<Static_Tensor<Shape...>::length>([&](u32 i) {
+            tensor.data[i] = gemm_apply_epilogue(tensor.data[i], nullptr, 0, Activation);
+        });
+    }
+}
@@ -1,63 +1,503 @@
 #include "util.h"
 #include "tensor.h"
+#include "profiler.h"
+#include <algorithm>
 #include <cmath>
+#include <cstring>
 #include <iomanip>
 #include <iostream>
+#include <new>
 
 
-Tensor tensor_create_1d(u32 len) {
-    Tensor tensor;
-    tensor.ndim = 1;
-    tensor.length = len;
-    tensor.shape = (u32*) malloc(sizeof(u32)*tensor.ndim);
-    tensor.shape[0] = len;
-    tensor.data = (float*) malloc(sizeof(float)*tensor.length);
+Tensor_Storage* tensor_storage_alloc(u32 count) {
+    size_t size = TENSOR_STORAGE_HEADER + sizeof(float)*count;
+    Memory_Arena* arena = memory_current_arena();
+    void* memory = arena ? arena_alloc(arena, size) : memory_alloc(size);
+    Tensor_Storage* storage = new (memory) Tensor_Storage;
+    storage->refs.store(1, std::memory_order_relaxed);
+    storage->capacity = count;
+    storage->heap = arena == nullptr;
+    return storage;
+}
+
+
+void tensor_free(Tensor& tensor) {
+    Tensor_Storage* storage = tensor.storage;
+    if (storage && storage->refs.fetch_sub(1, std::memory_order_acq_rel) == 1 && storage->heap) {
+        storage->~Tensor_Storage();
+        memory_free(storage);
+    }
+    tensor.storage = nullptr;
+    tensor.data = nullptr;
+    tensor.length = 0;
+}
+
+
+void tensor_set_contiguous(Tensor& tensor) {
+    u32 length = 1;
+    for (u8 d = 0; d < tensor.ndim; d++) {
+        tensor.stride[d] = length;
+        length *= tensor.shape[d];
+    }
+    for (u8 d = tensor.ndim; d < TENSOR_MAX_DIMS; d++) {
+        tensor.shape[d] = 0;
+        tensor.stride[d] = 0;
+    }
+    tensor.length = length;
+}
+
+
+bool tensor_is_contiguous(const Tensor& tensor) {
+    u32 expected = 1;
+    for (u8 d = 0; d < tensor.ndim; d++) {
+        if (tensor.shape[d] != 1 && tensor.stride[d] != expected) {
+            return false;
+        }
+        expected *= tensor.shape[d];
+    }
+    return true;
+}
+
+
+bool tensor_is_dense(const Tensor& tensor) {
+    // Every stride has to be the product of the sizes of the dimensions
+    // with smaller strides, so pick the dimensions in order of stride.
+    bool used[TENSOR_MAX_DIMS] = {};
+    u32 expected = 1;
+    for (u8 i = 0; i < tensor.ndim; i++) {
+        u8 next = TENSOR_MAX_DIMS;
+        for (u8 d = 0; d < tensor.ndim; d++) {
+            if (used[d] || tensor.shape[d] == 1) continue;
+            if (next == TENSOR_MAX_DIMS || tensor.stride[d] < tensor.stride[next]) next = d;
+        }
+        if (next == TENSOR_MAX_DIMS) break;
+        if (tensor.stride[next] != expected) return false;
+        used[next] = true;
+        expected *= tensor.shape[next];
+    }
+    return true;
+}
+
+
+bool tensor_same_layout(const Tensor& a, const Tensor& b) {
+    if (a.ndim != b.ndim) return false;
+    for (u8 d = 0; d < a.ndim; d++) {
+        if (a.shape[d] != b.shape[d]) return false;
+        if (a.shape[d] != 1 && a.stride[d] != b.stride[d]) return false;
+    }
+    return true;
+}
+
+
+Tensor tensor_create(const u32* shape, u8 ndim, Dtype dtype) {
+    assert(ndim <= TENSOR_MAX_DIMS);
+    Tensor tensor = {};
+    tensor.ndim = ndim;
+    tensor.dtype = dtype;
+    for (u8 d = 0; d < ndim; d++) tensor.shape[d] = shape[d];
+    tensor_set_contiguous(tensor);
+    // The storage counts floats, 16-bit elements take half of one each.
+    tensor.storage = tensor_storage_alloc((u32) ((tensor_bytes(tensor) + sizeof(float) - 1)/sizeof(float)));
+    tensor.data = tensor_storage_data(tensor.storage);
     return tensor;
 }
 
 
-Tensor tensor_create_2d(u32 xlen, u32 ylen) {
-    Tensor tensor;
-    tensor.ndim = 2;
-    tensor.length = xlen*ylen;
-    tensor.shape = (u32*) malloc(sizeof(u32)*tensor.ndim);
-    tensor.shape[0] = xlen;
-    tensor.shape[1] = ylen;
-    tensor.data = (float*) malloc(sizeof(float)*tensor.length);
+Tensor tensor_wrap(float* data, const u32* shape, u8 ndim) {
+    assert(ndim <= TENSOR_MAX_DIMS);
+    Tensor tensor = {};
+    tensor.ndim = ndim;
+    for (u8 d = 0; d < ndim; d++) tensor.shape[d] = shape[d];
+    tensor_set_contiguous(tensor);
+    tensor.data = data;
     return tensor;
 }
 
 
+Tensor tensor_create_scalar(float value) {
+    Tensor tensor = tensor_create_1d(1);
+    tensor.data[0] = value;
+    return tensor;
+}
+
+
+Tensor tensor_create_1d(u32 len) {
+    u32 shape[1] = { len };
+    return tensor_create(shape, 1);
+}
+
+
+Tensor tensor_create_2d(u32 xlen, u32 ylen) {
+    u32 shape[2] = { xlen, ylen };
+    return tensor_create(shape, 2);
+}
+
+
+static void tensor_copy_kernel(float* out, const float*, const float* b, u64 n) {
+    memcpy(out, b, sizeof(float)*n);
+}
+
+
+/**
+ * Number of elements gathered at a time when a row is not contiguous
+ * (or converted from 16-bit elements).
+ */
+const u32 TENSOR_GATHER_SIZE = 256;
+
+
+/**
+ * Copies between tensors where at least one of them has 16-bit elements,
+ * contiguous ones are converted in chunks by the vectorized kernels.
+ */
+static void tensor_convert_into(Tensor& out, Tensor& tensor, bool contiguous) {
+    Dtype from = tensor.dtype;
+    Dtype to = out.dtype;
+    if (!contiguous) {
+        u32 rows = tensor_num_rows(out);
+        Tensor in = tensor;
+        for (u32 row = 0; row < rows; row++) {
+            u64 out_offset = tensor_row_offset(out, row);
+            u64 in_offset = tensor_row_offset(in, row);
+            for (u32 i = 0; i < out.shape[0]; i++) {
+                f32 value = dtype_load(from, in.data, in_offset + (u64) i*in.stride[0]);
+                dtype_store(to, out.data, out_offset + (u64) i*out.stride[0], value);
+            }
+        }
+        return;
+    }
+
+    if (from == to) {
+        memcpy(out.data, tensor.data, tensor_bytes(out));
+        return;
+    }
+    void* destination = out.data;
+    const void* source = tensor.data;
+    tensor_parallel_for(out.length, [destination, source, from, to](u64 begin, u64 end) {
+        if (from == Dtype_F32) {
+            half_from_f32(to, (u16*) destination + begin, (const float*) source + begin, end - begin);
+        } else if (to == Dtype_F32) {
+            half_to_f32(from, (float*) destination + begin, (const u16*) source + begin, end - begin);
+        } else {
+            // Between the 16-bit types through fp32.
+            float buffer[TENSOR_GATHER_SIZE];
+            for (u64 i = begin; i < end; i += TENSOR_GATHER_SIZE) {
+                u64 count = std::min<u64>(end - i, TENSOR_GATHER_SIZE);
+                half_to_f32(from, buffer, (const u16*) source + i, count);
+                half_from_f32(to, (u16*) destination + i, buffer, count);
+            }
+        }
+    });
+}
+
+
+void tensor_copy_into(Tensor& out, Tensor& tensor) {
+    bool contiguous = tensor_is_contiguous(out) && tensor_is_contiguous(tensor);
+    if (out.data == tensor.data && out.dtype == tensor.dtype && (contiguous || tensor_same_layout(out, tensor))) {
+        return;
+    }
+    PROFILE_SCOPE("copy", PROFILE_KERNEL, 0, (u64) (dtype_size(out.dtype) + dtype_size(tensor.dtype))*out.length);
+    if (out.dtype != Dtype_F32 || tensor.dtype != Dtype_F32) {
+        tensor_convert_into(out, tensor, contiguous);
+    } else if (contiguous) {
+        memcpy(out.data, tensor.data, sizeof(float)*out.length);
+    } else {
+        tensor_apply(out, tensor, tensor_copy_kernel);
+    }
+}
+
+
 Tensor tensor_copy(Tensor& tensor) {
-    Tensor copy;
-    copy.ndim = tensor.ndim;
-    copy.length = tensor.length;
-    copy.shape = (u32*) malloc(sizeof(u32)*copy.ndim);
-    copy.data = (float*) malloc(sizeof(float)*copy.length);
-    memcpy(copy.shape, tensor.shape, sizeof(u32)*copy.ndim);
-    memcpy(copy.data, tensor.data, sizeof(float)*copy.length);
+    Tensor copy = tensor_create(tensor.shape, tensor.ndim, tensor.dtype);
+    tensor_copy_into(copy, tensor);
     return copy;
 }
 
 
-void tensor_init_zeros(Tensor& tensor) {
-    for (int i = 0; i < tensor.length; i++) {
-        tensor.data[i] = 0;
+Tensor tensor_convert(Tensor& tensor, Dtype dtype) {
+    if (tensor.dtype == dtype && tensor_is_contiguous(tensor)) {
+        return tensor_view(tensor);
     }
+    Tensor copy = tensor_create(tensor.shape, tensor.ndim, dtype);
+    tensor_copy_into(copy, tensor);
+    return copy;
 }
 
 
+/**
+ * Adds a reference to the storage of the tensor and returns the same view.
+ */
+static Tensor tensor_retain(Tensor& tensor) {
+    if (tensor.storage) {
+        tensor.storage->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+    return tensor;
+}
 
-void tensor_init_ones(Tensor& tensor) {
-    for (int i = 0; i < tensor.length; i++) {
-        tensor.data[i] = 1;
+
+static u32 tensor_shape_length(const u32* shape, u8 ndim) {
+    u32 length = 1;
+    for (u8 d = 0; d < ndim; d++) length *= shape[d];
+    return length;
+}
+
+
+Tensor tensor_view(Tensor& tensor) {
+    return tensor_retain(tensor);
+}
+
+
+Tensor tensor_reshape(Tensor& tensor, const u32* shape, u8 ndim) {
+    assert(ndim <= TENSOR_MAX_DIMS);
+#ifdef DEBUG
+    if (tensor_shape_length(shape, ndim) != tensor.length) {
+        std::cerr << "error: cannot reshape tensor of " << tensor.length << " elements into ";
+        std::cerr << tensor_shape_length(shape, ndim) << " elements" << std::endl;
+        assert(false);
+    }
+#endif
+    Tensor view = tensor_is_contiguous(tensor) ? tensor_retain(tensor) : tensor_copy(tensor);
+    view.ndim = ndim;
+    for (u8 d = 0; d < ndim; d++) view.shape[d] = shape[d];
+    tensor_set_contiguous(view);
+    return view;
+}
+
+
+Tensor tensor_transpose(Tensor& tensor, u8 dim0, u8 dim1) {
+    assert(dim0 < tensor.ndim && dim1 < tensor.ndim);
+    Tensor view = tensor_retain(tensor);
+    std::swap(view.shape[dim0], view.shape[dim1]);
+    std::swap(view.stride[dim0], view.stride[dim1]);
+    return view;
+}
+
+
+Tensor tensor_slice(Tensor& tensor, u8 dim, u32 begin, u32 end) {
+    assert(dim < tensor.ndim);
+    assert(begin <= end && end <= tensor.shape[dim]);
+    Tensor view = tensor_retain(tensor);
+    view.offset += begin*view.stride[dim];
+    view.data = (float*) ((u8*) view.data + (u64) begin*view.stride[dim]*dtype_size(view.dtype));
+    view.shape[dim] = end - begin;
+    view.length = tensor_shape_length(view.shape, view.ndim);
+    return view;
+}
+
+
+Tensor tensor_broadcast(Tensor& tensor, const u32* shape, u8 ndim) {
+    assert(tensor.ndim <= ndim && ndim <= TENSOR_MAX_DIMS);
+    Tensor view = tensor_retain(tensor);
+    for (u8 d = 0; d < ndim; d++) {
+        if (d >= tensor.ndim || tensor.shape[d] != shape[d]) {
+#ifdef DEBUG
+            if (d < tensor.ndim && tensor.shape[d] != 1) {
+                std::cerr << "error: cannot broadcast dimension " << (int) d << " of size ";
+                std::cerr << tensor.shape[d] << " to size " << shape[d] << std::endl;
+                assert(false);
+            }
+#endif
+            view.stride[d] = 0;
+        }
+        view.shape[d] = shape[d];
+    }
+    view.ndim = ndim;
+    view.length = tensor_shape_length(shape, ndim);
+    return view;
+}
+
+
+Tensor tensor_contiguous(Tensor& tensor) {
+    return tensor_is_contiguous(tensor) ? tensor_retain(tensor) : tensor_copy(tensor);
+}
+
+
+/**
+ * Calls `function(begin, end)` over the rows of the tensor,
+ * split over the thread pool if the tensor is large enough.
+ */
+template <typename Function>
+static void tensor_parallel_rows(const Tensor& tensor, Function&& function) {
+    u32 rows = tensor_num_rows(tensor);
+    if (tensor.length < TENSOR_PARALLEL_THRESHOLD) {
+        function(0, rows);
+    } else {
+        u32 grain = TENSOR_PARALLEL_GRAIN/std::max<u32>(tensor.shape[0], 1);
+        parallel_for(0, rows, std::max<u32>(grain, 1), function);
+    }
+}
+
+
+void tensor_apply(Tensor& tensor, Tensor_Unary_Kernel kernel) {
+    assert(tensor.dtype == Dtype_F32);
+    PROFILE_SCOPE("elementwise", PROFILE_KERNEL, tensor.length, 2*sizeof(float)*tensor.length);
+    float* data = tensor.data;
+    if (tensor_is_dense(tensor)) {
+        tensor_parallel_for(tensor.length, [data, kernel](u64 begin, u64 end) {
+            kernel(data + begin, data + begin, end - begin);
+        });
+        return;
+    }
+
+    Tensor view = tensor;
+    tensor_parallel_rows(view, [&view, data, kernel](u64 begin, u64 end) {
+        u32 length = view.shape[0];
+        u32 stride = view.stride[0];
+        float buffer[TENSOR_GATHER_SIZE];
+        for (u64 row = begin; row < end; row++) {
+            float* x = data + tensor_row_offset(view, row);
+            if (stride == 1) {
+                kernel(x, x, length);
+                continue;
+            }
+            for (u32 i0 = 0; i0 < length; i0 += TENSOR_GATHER_SIZE) {
+                u32 count = std::min(length - i0, TENSOR_GATHER_SIZE);
+                for (u32 i = 0; i < count; i++) buffer[i] = x[(u64) (i0 + i)*stride];
+                kernel(buffer, buffer, count);
+                for (u32 i = 0; i < count; i++) x[(u64) (i0 + i)*stride] = buffer[i];
+            }
+        }
+    });
+}
+
+
+/**
+ * Returns a view of `tensor` with the shape of `target`, where the
+ * dimensions with more than one element are matched up in order.
+ */
+static Tensor tensor_match_shape(const Tensor& tensor, const Tensor& target) {
+    Tensor view = tensor;
+    view.ndim = target.ndim;
+    u8 source = 0;
+    for (u8 d = 0; d < target.ndim; d++) {
+        view.shape[d] = target.shape[d];
+        view.stride[d] = 0;
+        if (target.shape[d] == 1) continue;
+        while (source < tensor.ndim && tensor.shape[source] == 1) source++;
+        assert(source < tensor.ndim && tensor.shape[source] == target.shape[d]);
+        view.stride[d] = tensor.stride[source++];
+    }
+    return view;
+}
+
+
+void tensor_apply(Tensor& lhs, Tensor& rhs, Tensor_Binary_Kernel kernel) {
+    assert(lhs.length == rhs.length && lhs.dtype == Dtype_F32);
+    PROFILE_SCOPE("elementwise", PROFILE_KERNEL, lhs.length, (2*sizeof(float) + dtype_size(rhs.dtype))*lhs.length);
+    float* a = lhs.data;
+    float* b = rhs.data;
+    Dtype dtype = rhs.dtype;
+    bool flat = tensor_is_contiguous(lhs) && tensor_is_contiguous(rhs);
+    flat = flat || (tensor_is_dense(lhs) && tensor_same_layout(lhs, rhs));
+    if (flat && dtype == Dtype_F32) {
+        tensor_parallel_for(lhs.length, [a, b, kernel](u64 begin, u64 end) {
+            kernel(a + begin, a + begin, b + begin, end - begin);
+        });
+        return;
+    }
+    if (flat) {
+        // The 16-bit right hand side is converted a chunk at a time.
+        const u16* h = (const u16*) b;
+        tensor_parallel_for(lhs.length, [a, h, dtype, kernel](u64 begin, u64 end) {
+            float buffer[TENSOR_GATHER_SIZE];
+            for (u64 i = begin; i < end; i += TENSOR_GATHER_SIZE) {
+                u64 count = std::min<u64>(end - i, TENSOR_GATHER_SIZE);
+                half_to_f32(dtype, buffer, h + i, count);
+                kernel(a + i, a + i, buffer, count);
+            }
+        });
+        return;
     }
+
+    Tensor out = lhs;
+    Tensor in = tensor_match_shape(rhs, lhs);
+    tensor_parallel_rows(out, [&out, &in, a, b, dtype, kernel](u64 begin, u64 end) {
+        u32 length = out.shape[0];
+        u32 stride_a = out.ndim > 0 ? out.stride[0] : 1;
+        u32 stride_b = in.ndim > 0 ? in.stride[0] : 1;
+        float buffer_a[TENSOR_GATHER_SIZE];
+        float buffer_b[TENSOR_GATHER_SIZE];
+        for (u64 row = begin; row < end; row++) {
+            float* x = a + tensor_row_offset(out, row);
+            u64 offset_b = tensor_row_offset(in, row);
+            const float* y = dtype == Dtype_F32 ? b + offset_b : nullptr;
+            if (stride_a == 1 && stride_b == 1 && dtype == Dtype_F32) {
+                kernel(x, x, y, length);
+                continue;
+            }
+            for (u32 i0 = 0; i0 < length; i0 += TENSOR_GATHER_SIZE) {
+                u32 count = std::min(length - i0, TENSOR_GATHER_SIZE);
+                for (u32 i = 0; i < count; i++) buffer_a[i] = x[(u64) (i0 + i)*stride_a];
+                if (dtype == Dtype_F32) {
+                    for (u32 i = 0; i < count; i++) buffer_b[i] = y[(u64) (i0 + i)*stride_b];
+                } else if (stride_b == 1) {
+                    half_to_f32(dtype, buffer_b, (const u16*) b + offset_b + i0, count);
+                } else {
+                    for (u32 i = 0; i < count; i++) buffer_b[i] = dtype_load(dtype, b, offset_b + (u64) (i0 + i)*stride_b);
+                }
+                kernel(buffer_a, buffer_a, buffer_b, count);
+                for (u32 i = 0; i < count; i++) x[(u64) (i0 + i)*stride_a] = buffer_a[i];
+            }
+        }
+    });
+}
+
+
+static void tensor_zeros_kernel(float* out, const float*, u64 n) {
+    memset(out, 0, sizeof(float)*n);
 }
 
+
+static void tensor_ones_kernel(float* out, const float*, u64 n) {
+    for (u64 i = 0; i < n; i++) out[i] = 1;
+}
+
+
+void tensor_init_zeros(Tensor& tensor) {
+    tensor_apply(tensor, tensor_zeros_kernel);
+}
+
+
+void tensor_init_ones(Tensor& tensor) {
+    tensor_apply(tensor, tensor_ones_kernel);
+}
+
+
 void tensor_init_random(Tensor& tensor) {
-    for (int i = 0; i < tensor.length; i++) {
-        tensor.data[i] = (float) rand() / RAND_MAX;
+    assert(tensor.dtype == Dtype_F32);
+    if (!tensor_is_contiguous(tensor)) {
+        u32 rows = tensor_num_rows(tensor);
+        for (u32 row = 0; row < rows; row++) {
+            float* x = tensor.data + tensor_row_offset(tensor, row);
+            for (u32 i = 0; i < tensor.shape[0]; i++) {
+                x[(u64) i*tensor.stride[0]] = (float) rand() / RAND_MAX;
+            }
+        }
+        return;
+    }
+
+    if (tensor.length < TENSOR_PARALLEL_THRESHOLD) {
+        for (u32 i = 0; i < tensor.length; i++) {
+            tensor.data[i] = (float) rand() / RAND_MAX;
+        }
+        return;
     }
+
+    // rand() is not thread safe, so large tensors use a splitmix64 generator
+    // seeded per chunk from rand(), this way the result doesn't depend on
+    // how the chunks are scheduled.
+    float* data = tensor.data;
+    u64 seed = ((u64) rand() << 32) ^ (u64) rand();
+    tensor_parallel_for(tensor.length, [data, seed](u64 begin, u64 end) {
+        u64 state = seed ^ (begin*0x9E3779B97F4A7C15ull);
+        for (u64 i = begin; i < end; i++) {
+            state += 0x9E3779B97F4A7C15ull;
+            u64 z = state;
+            z = (z ^ (z >> 30))*0xBF58476D1CE4E5B9ull;
+            z = (z ^ (z >> 27))*0x94D049BB133111EBull;
+            z = z ^ (z >> 31);
+            data[i] = (float) (z >> 40)/(float) (1 << 24);
+        }
+    });
 }
 
 
@@ -67,8 +507,9 @@ void tensor_init_identity(Tensor& tensor) {
 
     u32 xlen = tensor.shape[0];
     u32 ylen = tensor.shape[1];
-    for (int i = 0; i < fmin(xlen, ylen); i++) {
-        tensor.data[i*xlen + i] = 1;
+    u32 diagonal = tensor.stride[0] + tensor.stride[1];
+    for (u32 i = 0; i < std::min(xlen, ylen); i++) {
+        tensor.data[(u64) i*diagonal] = 1;
     }
 }
 
@@ -78,42 +519,88 @@ Tensor tensor_matmul(Tensor& lhs, Tensor& rhs) {
     u32 xlen_lhs = lhs.shape[0];
     u32 ylen_lhs = lhs.shape[1];
     u32 xlen_rhs = rhs.shape[0];
+    assert(rhs.dtype == Dtype_F32);
     Tensor out = tensor_create_2d(xlen_rhs, ylen_lhs);
-    tensor_init_zeros(out);
-    for (int j = 0; j < ylen_lhs; j++) {
-        for (int i = 0; i < xlen_rhs; i++) {
-            for (int k = 0; k < xlen_lhs; k++) {
-                out.data[i + j*xlen_rhs] += lhs.data[k + j*xlen_lhs]*rhs.data[i + k*xlen_rhs];
-            }
-        }
-    }
+
+    // Rows are dimension 1 and columns dimension 0, so transposed
+    // views are multiplied directly without materializing them.
+    Gemm_Epilogue epilogue;
+    gemm_mixed_fused(lhs.dtype, ylen_lhs, xlen_rhs, xlen_lhs,
+                     lhs.data, lhs.stride[1], lhs.stride[0],
+                     rhs.data, rhs.stride[1], rhs.stride[0],
+                     0.0f, out.data, xlen_rhs, epilogue);
+    return out;
+}
+
+
+Tensor tensor_dense(Tensor& weights, Tensor& input, Tensor& bias, Gemm_Activation activation) {
+    Tensor out = tensor_create_2d(input.shape[0], weights.shape[1]);
+    tensor_dense_into(out, weights, input, bias, activation);
     return out;
 }
 
 
-void tensor_reshape(Tensor& tensor, u32 shape[], u8 ndim) {
-    u32 newLength = 1;
+void tensor_dense_into(Tensor& output, Tensor& weights, Tensor& input, Tensor& bias,
+                       Gemm_Activation activation) {
+    tensor_check_matmul_shape(weights, input);
+    u32 num_inputs = weights.shape[0];
+    u32 num_outputs = weights.shape[1];
+    u32 batch = input.shape[0];
+    assert(bias.length == num_outputs);
+    assert(output.length == batch*num_outputs && tensor_is_contiguous(output));
 
-    free(tensor.shape);
-    tensor.shape = (u32*) malloc(sizeof(u32)*ndim);
-    for (u8 i = 0; i < ndim; i++) {
-        newLength *= shape[i];
-        tensor.shape[i] = shape[i];
-    }
+    assert(input.dtype == Dtype_F32);
+    // Only the weights may be 16 bits (converted by the gemm as they are
+    // packed), the bias is read directly without taking a reference.
+    assert(bias.dtype == Dtype_F32 && tensor_is_contiguous(bias));
 
-    if (newLength != tensor.length) {
-        float* newData = (float*) realloc((void*) tensor.data, sizeof(float)*newLength);
-        if (!newData) {
-            free(tensor.data);
-            tensor.data = (float*) malloc(sizeof(float)*newLength);
-            memcpy(newData, tensor.data, sizeof(float)*newLength);
-        }
-        tensor.data = newData;
+    Gemm_Epilogue epilogue;
+    epilogue.bias = bias.data;
+    epilogue.activation = activation;
+    gemm_mixed_fused(weights.dtype, num_outputs, batch, num_inputs,
+                     weights.data, weights.stride[1], weights.stride[0],
+                     input.data, input.stride[1], input.stride[0],
+                     0.0f, output.data, batch, epilogue);
+}
+
+
+void tensor_dense_backward_weights(Tensor& grad_weights, Tensor& grad_bias,
+                                   Tensor& grad_output, Tensor& input) {
+    u32 num_inputs = grad_weights.shape[0];
+    u32 num_outputs = grad_weights.shape[1];
+    u32 batch = input.shape[0];
+    assert(input.shape[1] == num_inputs && grad_output.shape[1] == num_outputs);
+    assert(grad_output.shape[0] == batch && tensor_is_contiguous(grad_weights));
+
+    // grad_weights += grad_output*input^T, where row o of grad_output holds
+    // the gradient of output o for every sample and so does row f of input.
+    gemm_f32(num_outputs, num_inputs, batch,
+             grad_output.data, grad_output.stride[1], grad_output.stride[0],
+             input.data, input.stride[0], input.stride[1],
+             1.0f, grad_weights.data, num_inputs);
+
+    for (u32 o = 0; o < num_outputs; o++) {
+        const float* row = grad_output.data + (u64) o*grad_output.stride[1];
+        float sum = 0.0f;
+        for (u32 n = 0; n < batch; n++) sum += row[(u64) n*grad_output.stride[0]];
+        grad_bias.data[(u64) o*grad_bias.stride[0]] += sum;
     }
-    std::cout << newLength << std::endl;
+}
 
-    tensor.ndim = ndim;
-    tensor.length = newLength;
+
+Tensor tensor_dense_backward_input(Tensor& weights, Tensor& grad_output) {
+    u32 num_inputs = weights.shape[0];
+    u32 num_outputs = weights.shape[1];
+    u32 batch = grad_output.shape[0];
+    assert(grad_output.shape[1] == num_outputs);
+
+    Tensor grad_input = tensor_create_2d(batch, num_inputs);
+    Gemm_Epilogue epilogue;
+    gemm_mixed_fused(weights.dtype, num_inputs, batch, num_outputs,
+                     weights.data, weights.stride[0], weights.stride[1],
+                     grad_output.data, grad_output.stride[1], grad_output.stride[0],
+                     0.0f, grad_input.data, batch, epilogue);
+    return grad_input;
 }
 
 
@@ -123,16 +610,15 @@ std::ostream& operator<<(std::ostream& stream, Tensor& tensor) {
     for (int i = 0; i < tensor.shape[0]; i++) stream << "      ";
     stream << "┐" << std::endl;
 
-    for (int i = 0; i < tensor.length; i++) {
-        if (i % tensor.shape[0] == 0) {
-            stream << "| ";
-        }
-        stream << tensor.data[i] << " ";
-        if ((i % tensor.shape[0]) == (tensor.shape[0] - 1)) {
-            stream << "|" << std::endl;
-        } else {
-            stream << " ";
+    u32 rows = tensor_num_rows(tensor);
+    for (u32 row = 0; row < rows; row++) {
+        u64 offset = tensor_row_offset(tensor, row);
+        stream << "| ";
+        for (u32 i = 0; i < tensor.shape[0]; i++) {
+            stream << dtype_load(tensor.dtype, tensor.data, offset + (u64) i*tensor.stride[0]) << " ";
+            stream << (i == tensor.shape[0] - 1 ? "|" : " ");
         }
+        stream << std::endl;
     }
 
     stream << "└";
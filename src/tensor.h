@@ -2,6 +2,12 @@
 
 
 #include "util.h"
+#include "gemm.h"
+#include "half.h"
+#include "kernels.h"
+#include "memory.h"
+#include "thread_pool.h"
+#include <atomic>
 #include <iostream>
 #include <string>
 #include <cassert>
@@ -11,24 +17,112 @@
 struct Tensor;
 
 
+/**
+ * Maximum number of dimensions of a tensor, the shape is stored inline.
+ */
+const u8 TENSOR_MAX_DIMS = 4;
+
+
+/**
+ * Reference counted storage shared by a tensor and all the views of it.
+ * The header is placed right before the data in the same allocation,
+ * heap storage is freed once the last tensor referring to it is freed
+ * while arena storage is owned by the arena and only counts references.
+ */
+struct Tensor_Storage {
+    std::atomic<u32> refs;
+    // Number of floats that fit in the storage.
+    u32 capacity;
+    // Was the storage allocated from the heap (otherwise from an arena).
+    bool heap;
+};
+
+
+/**
+ * Size of the storage header, the data after it stays aligned to MEMORY_ALIGNMENT.
+ */
+const u32 TENSOR_STORAGE_HEADER = MEMORY_ALIGNMENT;
+static_assert(sizeof(Tensor_Storage) <= TENSOR_STORAGE_HEADER, "storage header too large");
+
+
 /**
  * Abstract tensor provides an interface to operate on tensors that
  * could possibly be stored on the CPU or on another device.
  * Using to(device), cpu(), or cuda() function will transfer the data from
  * one device to another.
+ *
+ * A tensor is a strided view into its storage, element (i0, i1, ...) is
+ * located at `data[i0*stride[0] + i1*stride[1] + ...]`. Tensors created by
+ * the tensor_create_* functions are contiguous, i.e. dimension 0 is the
+ * fastest changing one, views may have arbitrary strides including 0 for
+ * broadcast dimensions. Copying the struct does not add a reference, use
+ * the view functions (tensor_view, tensor_transpose, ...) for that.
+ *
+ * Elements are fp32 unless the dtype says otherwise, tensors of 16-bit
+ * elements (see half.h) hold weights for inference, they can be read by
+ * the dense and element-wise operations and converted with tensor_convert,
+ * but the results of operations are always fp32.
  */
 struct Tensor {
     // Number of dimensions.
     u8 ndim;
+    // Type of the elements, offsets and strides are in elements of this type.
+    Dtype dtype;
     // Number of elements in tensor.
     u32 length;
     // Number of elements per dimension.
-    u32* shape;
-    // Pointer to the actual storage.
+    u32 shape[TENSOR_MAX_DIMS];
+    // Distance in elements between consecutive indices of each dimension.
+    u32 stride[TENSOR_MAX_DIMS];
+    // Offset in elements of the first element in the storage.
+    u32 offset;
+    // Shared storage, nullptr if the data is owned by someone else.
+    Tensor_Storage* storage;
+    // Pointer to the first element, i.e. the storage data plus the offset,
+    // it points at u16 elements for 16-bit types (see tensor_data_half).
     float* data;
 };
 
 
+/**
+ * Returns the first element of a tensor with 16-bit elements.
+ */
+inline u16* tensor_data_half(const Tensor& tensor) {
+    assert(tensor.dtype != Dtype_F32);
+    return (u16*) tensor.data;
+}
+
+
+/**
+ * Returns the number of bytes of the elements of a contiguous tensor.
+ */
+inline u64 tensor_bytes(const Tensor& tensor) {
+    return (u64) dtype_size(tensor.dtype)*tensor.length;
+}
+
+
+/**
+ * Element-wise kernels are split over the thread pool once a tensor has
+ * at least this many elements, smaller tensors run on the calling thread.
+ */
+const u32 TENSOR_PARALLEL_THRESHOLD = 1 << 16;
+const u32 TENSOR_PARALLEL_GRAIN = 1 << 14;
+
+
+/**
+ * Calls `function(begin, end)` over the element range [0, length),
+ * split over the thread pool if the range is large enough.
+ */
+template <typename Function>
+inline void tensor_parallel_for(u32 length, Function&& function) {
+    if (length < TENSOR_PARALLEL_THRESHOLD) {
+        function(0, length);
+    } else {
+        parallel_for(0, length, TENSOR_PARALLEL_GRAIN, function);
+    }
+}
+
+
 /**
  * Create a tensor scalar value.
  */
@@ -48,11 +142,181 @@ Tensor tensor_create_2d(u32 xlen, u32 ylen);
 
 
 /**
- * Makes a copy of the provided tensor pointer.
+ * Makes a contiguous copy of the provided tensor.
  */
 Tensor tensor_copy(Tensor& tensor);
 
 
+/**
+ * Copies the elements of a tensor into another one of the same length,
+ * converting them if the types differ.
+ */
+void tensor_copy_into(Tensor& out, Tensor& tensor);
+
+
+/**
+ * Creates a tensor with the given shape from the current arena or the heap.
+ */
+Tensor tensor_create(const u32* shape, u8 ndim, Dtype dtype = Dtype_F32);
+
+
+/**
+ * Returns the elements of the tensor as another type, rounding to nearest
+ * even when converting to 16 bits. This is a new contiguous tensor unless
+ * the tensor is already contiguous and of that type (then a new view).
+ */
+Tensor tensor_convert(Tensor& tensor, Dtype dtype);
+
+
+/**
+ * Wraps memory owned by someone else as a contiguous tensor, the
+ * tensor has no storage so freeing it doesn't release the data.
+ */
+Tensor tensor_wrap(float* data, const u32* shape, u8 ndim);
+
+
+/**
+ * Allocates storage for `count` floats, from the current arena if there
+ * is one on this thread (see Arena_Scope), otherwise from the heap.
+ */
+Tensor_Storage* tensor_storage_alloc(u32 count);
+
+
+/**
+ * Returns the first element of the storage.
+ */
+inline float* tensor_storage_data(Tensor_Storage* storage) {
+    return (float*) ((u8*) storage + TENSOR_STORAGE_HEADER);
+}
+
+
+/**
+ * Releases the reference of the tensor to its storage, the storage is
+ * freed when this was the last reference to heap storage. Arena storage
+ * is owned by the arena and is not released.
+ */
+void tensor_free(Tensor& tensor);
+
+
+/**
+ * Sets the strides of the tensor so that it is contiguous
+ * with its current shape, and updates the length to match.
+ */
+void tensor_set_contiguous(Tensor& tensor);
+
+
+/**
+ * Checks if the elements of the tensor are packed in order without gaps,
+ * dimensions with a single element are ignored.
+ */
+bool tensor_is_contiguous(const Tensor& tensor);
+
+
+/**
+ * Checks if the elements of the tensor are packed without gaps in any order,
+ * i.e. the strides are a permutation of contiguous ones. Element-wise
+ * operations can treat such tensors as flat arrays.
+ */
+bool tensor_is_dense(const Tensor& tensor);
+
+
+/**
+ * Checks if two tensors have the same shape and the same strides.
+ */
+bool tensor_same_layout(const Tensor& a, const Tensor& b);
+
+
+/**
+ * Returns a new reference to the same elements as the tensor.
+ */
+Tensor tensor_view(Tensor& tensor);
+
+
+/**
+ * Returns the tensor with another shape of the same length. This is
+ * a view if the tensor is contiguous, otherwise a contiguous copy.
+ */
+Tensor tensor_reshape(Tensor& tensor, const u32* shape, u8 ndim);
+
+
+/**
+ * Returns a view with the two dimensions swapped.
+ */
+Tensor tensor_transpose(Tensor& tensor, u8 dim0 = 0, u8 dim1 = 1);
+
+
+/**
+ * Returns a view of the elements [begin, end) along one dimension.
+ */
+Tensor tensor_slice(Tensor& tensor, u8 dim, u32 begin, u32 end);
+
+
+/**
+ * Returns a view with the given shape where dimensions of size 1 (and
+ * the dimensions missing after the last one) are repeated with stride 0.
+ * The view can be read from but writing to it aliases elements.
+ */
+Tensor tensor_broadcast(Tensor& tensor, const u32* shape, u8 ndim);
+
+
+/**
+ * Returns the tensor if it is already contiguous (as a new view),
+ * otherwise materializes its elements into a new contiguous tensor.
+ */
+Tensor tensor_contiguous(Tensor& tensor);
+
+
+/**
+ * Number of rows of a tensor, i.e. runs of elements along dimension 0.
+ */
+inline u32 tensor_num_rows(const Tensor& tensor) {
+    return tensor.ndim == 0 || tensor.shape[0] == 0 ? 1 : tensor.length / tensor.shape[0];
+}
+
+
+/**
+ * Offset in elements of the first element of a row, rows are numbered
+ * in order of the dimensions after the first one.
+ */
+inline u64 tensor_row_offset(const Tensor& tensor, u64 row) {
+    u64 offset = 0;
+    for (u8 d = 1; d < tensor.ndim; d++) {
+        offset += (row % tensor.shape[d])*tensor.stride[d];
+        row /= tensor.shape[d];
+    }
+    return offset;
+}
+
+
+/**
+ * Element-wise unary kernel `out = f(in)` over contiguous arrays.
+ */
+typedef void (*Tensor_Unary_Kernel)(float* out, const float* in, u64 n);
+
+
+/**
+ * Element-wise binary kernel `out = f(a, b)` over contiguous arrays.
+ */
+typedef void (*Tensor_Binary_Kernel)(float* out, const float* a, const float* b, u64 n);
+
+
+/**
+ * Applies the kernel to every element of the tensor in place. Contiguous
+ * tensors run the kernel over the whole range, strided tensors one row
+ * at a time, gathering the row first if it is not contiguous itself.
+ */
+void tensor_apply(Tensor& tensor, Tensor_Unary_Kernel kernel);
+
+
+/**
+ * Applies the kernel to every pair of elements storing the result in
+ * the left hand side tensor, which may not have broadcast dimensions.
+ * The right hand side can be any view with the same shape (e.g. from
+ * tensor_broadcast) or a contiguous tensor with the same length.
+ */
+void tensor_apply(Tensor& lhs, Tensor& rhs, Tensor_Binary_Kernel kernel);
+
+
 /**
  * Initialize tensor with zeros.
  */
@@ -85,9 +349,37 @@ Tensor tensor_matmul(Tensor& lhs, Tensor& rhs);
 
 
 /**
- * Reshape the tensor from one shape to another.
+ * Fully connected layer computing `activation(weights*input + bias)` where
+ * the bias is broadcast over the columns (samples) of the input. The bias
+ * and activation are applied in the matmul epilogue so the output is
+ * written exactly once.
+ */
+Tensor tensor_dense(Tensor& weights, Tensor& input, Tensor& bias,
+                    Gemm_Activation activation = Gemm_Activation_None);
+
+
+/**
+ * Same as `tensor_dense` but writes into an existing contiguous output
+ * of shape (batch, outputs), which must not overlap the input.
+ */
+void tensor_dense_into(Tensor& output, Tensor& weights, Tensor& input, Tensor& bias,
+                       Gemm_Activation activation = Gemm_Activation_None);
+
+
+/**
+ * Gradients of the parameters of a dense layer given the gradient of its
+ * output and the input of the forward pass, both of shape (batch, ...).
+ * The gradients are accumulated, i.e. added to the existing values.
+ */
+void tensor_dense_backward_weights(Tensor& grad_weights, Tensor& grad_bias,
+                                   Tensor& grad_output, Tensor& input);
+
+
+/**
+ * Gradient of the input of a dense layer given the gradient of its output,
+ * i.e. `weights^T*grad_output`, of shape (batch, inputs).
  */
-void tensor_reshape(Tensor& tensor, u32 shape[], u8 ndim);
+Tensor tensor_dense_backward_input(Tensor& weights, Tensor& grad_output);
 
 
 /**
@@ -127,7 +419,7 @@ inline void tensor_check_same_shape(Tensor& lhs, Tensor& rhs) {
     // match and ignore whenever there is fewer than 2 elements in a dimension.
     int i = 0;
     int j = 0;
-    while (i <= lhs.ndim && j <= rhs.ndim) {
+    while (i < lhs.ndim && j < rhs.ndim) {
         if (lhs.shape[i] < 2) {
             i++;
             continue;
@@ -167,8 +459,52 @@ inline void tensor_check_matmul_shape(Tensor& lhs, Tensor& rhs) {
  */
 inline void tensor_add(Tensor& lhs, Tensor& rhs) {
     tensor_check_same_shape(lhs, rhs);
-    for (int i = 0; i < lhs.length; i++) {
-        lhs.data[i] += rhs.data[i];
+    tensor_apply(lhs, rhs, kernels().add);
+}
+
+
+/**
+ * Adds a 1-dimensional bias to every column of a 2-dimensional tensor,
+ * i.e. `bias[j]` is added to every element in row `j` of the output.
+ * Used to broadcast the bias of a layer over a batch of samples.
+ */
+inline void tensor_add_bias(Tensor& output, Tensor& bias) {
+#ifdef DEBUG
+    assert(output.length % bias.length == 0);
+    assert(output.length / bias.length == output.shape[0]);
+#endif
+    u32 batch = output.length / bias.length;
+    if (batch == 1) {
+        tensor_add(output, bias);
+        return;
+    }
+
+    if (!tensor_is_contiguous(output) || !tensor_is_contiguous(bias) || bias.dtype != Dtype_F32) {
+        u32 column_shape[2] = { 1, bias.length };
+        Tensor column = tensor_reshape(bias, column_shape, 2);
+        Tensor broadcast = tensor_broadcast(column, output.shape, output.ndim);
+        tensor_apply(output, broadcast, kernels().add);
+        tensor_free(broadcast);
+        tensor_free(column);
+        return;
+    }
+
+    float* out = output.data;
+    float* b = bias.data;
+    u64 grain = (TENSOR_PARALLEL_GRAIN + batch - 1) / batch;
+    auto kernel = [out, b, batch](u64 begin, u64 end) {
+        for (u64 j = begin; j < end; j++) {
+            float* row = out + j*batch;
+            float value = b[j];
+            for (u32 i = 0; i < batch; i++) {
+                row[i] += value;
+            }
+        }
+    };
+    if (output.length < TENSOR_PARALLEL_THRESHOLD) {
+        kernel(0, bias.length);
+    } else {
+        parallel_for(0, bias.length, grain, kernel);
     }
 }
 
@@ -190,9 +526,7 @@ inline Tensor tensor_copy_add(Tensor& lhs, Tensor& rhs) {
  */
 inline void tensor_mul(Tensor& lhs, Tensor& rhs) {
     tensor_check_same_shape(lhs, rhs);
-    for (int i = 0; i < lhs.length; i++) {
-        lhs.data[i] *= rhs.data[i];
-    }
+    tensor_apply(lhs, rhs, kernels().mul);
 }
 
 
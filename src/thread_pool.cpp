@@ -0,0 +1,245 @@
+#include "thread_pool.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef OS_LINUX
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+
+/**
+ * Queue of chunk indices [lo, hi) owned by one thread, the owner pops
+ * from the front and thieves steal from the back.
+ */
+struct alignas(64) Work_Queue {
+    std::mutex mutex;
+    u64 lo = 0;
+    u64 hi = 0;
+};
+
+
+struct Parallel_Job {
+    Parallel_Range_Function* function;
+    void* context;
+    u64 begin;
+    u64 end;
+    u64 chunk_size;
+};
+
+
+struct Thread_Pool {
+    std::vector<std::thread> workers;
+    Work_Queue* queues = nullptr;
+    u32 num_threads = 0;
+    bool pin_threads = false;
+
+    Parallel_Job job;
+    std::atomic<u64> remaining_chunks{0};
+
+    // Workers sleep until the generation changes, i.e. a new job is posted.
+    std::mutex wake_mutex;
+    std::condition_variable wake;
+    u64 generation = 0;
+    bool shutdown = false;
+
+    // Only one job runs at a time, other callers run their work inline.
+    std::mutex dispatch_mutex;
+};
+
+
+static Thread_Pool thread_pool;
+static std::mutex thread_pool_init_mutex;
+static thread_local bool thread_pool_is_worker = false;
+
+
+static bool thread_pool_pop(u32 index, u64* chunk) {
+    Work_Queue& queue = thread_pool.queues[index];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.lo >= queue.hi) return false;
+    *chunk = queue.lo++;
+    return true;
+}
+
+
+static bool thread_pool_steal(u32 thief, u64* chunk) {
+    u32 n = thread_pool.num_threads;
+    for (u32 i = 1; i < n; i++) {
+        Work_Queue& queue = thread_pool.queues[(thief + i) % n];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.lo < queue.hi) {
+            *chunk = --queue.hi;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/**
+ * Runs chunks of the current job until there are none left to pop or steal.
+ */
+static void thread_pool_work(u32 index) {
+    u64 chunk;
+    while (thread_pool_pop(index, &chunk) || thread_pool_steal(index, &chunk)) {
+        const Parallel_Job& job = thread_pool.job;
+        u64 b = job.begin + chunk*job.chunk_size;
+        u64 e = b + job.chunk_size < job.end ? b + job.chunk_size : job.end;
+        job.function(job.context, b, e);
+        thread_pool.remaining_chunks.fetch_sub(1, std::memory_order_release);
+    }
+}
+
+
+static void thread_pool_worker_main(u32 index) {
+    thread_pool_is_worker = true;
+    if (thread_pool.pin_threads) thread_pin_to_cpu(index);
+    u64 seen_generation = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(thread_pool.wake_mutex);
+            thread_pool.wake.wait(lock, [&] {
+                return thread_pool.shutdown || thread_pool.generation != seen_generation;
+            });
+            if (thread_pool.shutdown) return;
+            seen_generation = thread_pool.generation;
+        }
+        thread_pool_work(index);
+    }
+}
+
+
+static void thread_pool_stop() {
+    {
+        std::lock_guard<std::mutex> lock(thread_pool.wake_mutex);
+        thread_pool.shutdown = true;
+    }
+    thread_pool.wake.notify_all();
+    for (std::thread& worker : thread_pool.workers) {
+        worker.join();
+    }
+    thread_pool.workers.clear();
+    delete[] thread_pool.queues;
+    thread_pool.queues = nullptr;
+    thread_pool.num_threads = 0;
+    thread_pool.shutdown = false;
+}
+
+
+static void thread_pool_start(u32 num_threads) {
+    if (num_threads == 0) {
+        num_threads = std::thread::hardware_concurrency();
+        if (num_threads == 0) num_threads = 1;
+    }
+
+    // Index 0 is reserved for the thread that posts the job.
+    thread_pool.num_threads = num_threads;
+    thread_pool.queues = new Work_Queue[num_threads];
+    for (u32 i = 1; i < num_threads; i++) {
+        thread_pool.workers.emplace_back(thread_pool_worker_main, i);
+    }
+}
+
+
+struct Thread_Pool_Shutdown {
+    ~Thread_Pool_Shutdown() {
+        if (thread_pool.num_threads > 0) thread_pool_stop();
+    }
+};
+static Thread_Pool_Shutdown thread_pool_shutdown;
+
+
+static void thread_pool_ensure_started() {
+    if (thread_pool.num_threads > 0) return;
+    std::lock_guard<std::mutex> lock(thread_pool_init_mutex);
+    if (thread_pool.num_threads == 0) thread_pool_start(0);
+}
+
+
+void thread_pool_set_num_threads(u32 num_threads, bool pin_threads) {
+    std::lock_guard<std::mutex> init_lock(thread_pool_init_mutex);
+    std::lock_guard<std::mutex> dispatch_lock(thread_pool.dispatch_mutex);
+    if (thread_pool.num_threads > 0) thread_pool_stop();
+    thread_pool.pin_threads = pin_threads;
+    if (pin_threads) thread_pin_to_cpu(0);
+    thread_pool_start(num_threads);
+}
+
+
+bool thread_pin_to_cpu(u32 cpu) {
+#ifdef OS_LINUX
+    u32 num_cpus = std::thread::hardware_concurrency();
+    if (num_cpus == 0) return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu % num_cpus, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void) cpu;
+    return false;
+#endif
+}
+
+
+void thread_pool_set_inline(bool run_inline) {
+    thread_pool_is_worker = run_inline;
+}
+
+
+u32 thread_pool_num_threads() {
+    thread_pool_ensure_started();
+    return thread_pool.num_threads;
+}
+
+
+void parallel_for_range(u64 begin, u64 end, u64 grain,
+                        Parallel_Range_Function* function, void* context) {
+    if (begin >= end) return;
+    if (grain == 0) grain = 1;
+    thread_pool_ensure_started();
+
+    u64 count = end - begin;
+    u32 n = thread_pool.num_threads;
+    if (n <= 1 || count <= grain || thread_pool_is_worker) {
+        function(context, begin, end);
+        return;
+    }
+
+    std::unique_lock<std::mutex> dispatch(thread_pool.dispatch_mutex, std::try_to_lock);
+    if (!dispatch.owns_lock()) {
+        function(context, begin, end);
+        return;
+    }
+
+    // Aim for a few chunks per thread so there is something left to steal
+    // when the threads are unevenly loaded, but never go below the grain size.
+    u64 chunk_size = (count + 4*n - 1)/(4*n);
+    if (chunk_size < grain) chunk_size = grain;
+    u64 num_chunks = (count + chunk_size - 1)/chunk_size;
+
+    thread_pool.job = { function, context, begin, end, chunk_size };
+    thread_pool.remaining_chunks.store(num_chunks, std::memory_order_relaxed);
+    for (u32 i = 0; i < n; i++) {
+        Work_Queue& queue = thread_pool.queues[i];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.lo = num_chunks*i/n;
+        queue.hi = num_chunks*(i + 1)/n;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(thread_pool.wake_mutex);
+        thread_pool.generation++;
+    }
+    thread_pool.wake.notify_all();
+
+    // The calling thread works as thread 0 and then waits for the stragglers.
+    thread_pool_is_worker = true;
+    thread_pool_work(0);
+    thread_pool_is_worker = false;
+    while (thread_pool.remaining_chunks.load(std::memory_order_acquire) > 0) {
+        std::this_thread::yield();
+    }
+}
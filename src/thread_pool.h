@@ -0,0 +1,75 @@
+#pragma once
+
+
+#include "util.h"
+#include <type_traits>
+
+
+/***************************************************************************
+ * Thread pool
+ *
+ * A single process-wide pool of persistent worker threads, created on first
+ * use and reused by every parallel kernel. Work is handed out as ranges of
+ * chunks, each worker owns a queue of chunks and once it runs out of work
+ * it steals chunks from the back of the other queues.
+ ***************************************************************************/
+
+
+/**
+ * Type erased range function, called with a half-open range [begin, end).
+ */
+typedef void Parallel_Range_Function(void* context, u64 begin, u64 end);
+
+
+/**
+ * Sets the number of threads used by the pool (including the calling thread),
+ * zero means one per hardware thread. The pool is resized immediately.
+ * With `pin_threads` the calling thread is pinned to logical CPU 0 and
+ * worker `i` to CPU `i`, so the threads don't migrate during measurements.
+ */
+void thread_pool_set_num_threads(u32 num_threads, bool pin_threads = false);
+
+
+/**
+ * Returns the number of threads used by the pool (including the calling thread).
+ */
+u32 thread_pool_num_threads();
+
+
+/**
+ * Pins the calling thread to a logical CPU (modulo the number of CPUs),
+ * returns false if pinning is not supported on this platform or failed.
+ */
+bool thread_pin_to_cpu(u32 cpu);
+
+
+/**
+ * With `run_inline` every parallel range started from the calling thread
+ * runs on that thread alone, for threads that own their core (e.g. the
+ * stages of a pipeline) and shouldn't hand work to cores owned by others.
+ */
+void thread_pool_set_inline(bool run_inline);
+
+
+/**
+ * Splits [begin, end) into chunks of at least `grain` elements and runs
+ * them on the thread pool, the calling thread also takes part in the work.
+ * Returns once every chunk has finished. If the pool is already busy
+ * (e.g. when called from within a parallel task) then the range is
+ * simply run on the calling thread.
+ */
+void parallel_for_range(u64 begin, u64 end, u64 grain,
+                        Parallel_Range_Function* function, void* context);
+
+
+/**
+ * Convenience wrapper taking any callable `function(u64 begin, u64 end)`,
+ * the callable is never copied so this does not allocate.
+ */
+template <typename Function>
+inline void parallel_for(u64 begin, u64 end, u64 grain, Function&& function) {
+    typedef typename std::remove_reference<Function>::type Function_Type;
+    parallel_for_range(begin, end, grain, [](void* context, u64 b, u64 e) {
+        (*(Function_Type*) context)(b, e);
+    }, (void*) &function);
+}
@@ -0,0 +1,149 @@
+#include "train.h"
+#include "kernels.h"
+#include "thread_pool.h"
+#include <cmath>
+
+
+/**
+ * Number of parameters updated per parallel task, large enough to
+ * amortize the scheduling and small enough to stay in the L2 cache.
+ */
+const u32 OPTIMIZER_GRAIN = 16*1024;
+
+
+f32 loss_mse(Tensor& output, Tensor& target, Tensor& grad) {
+    assert(tensor_is_contiguous(output) && tensor_is_contiguous(target));
+    assert(output.length == target.length && grad.length == output.length);
+    u32 batch = output.ndim == 2 ? output.shape[0] : 1;
+
+    // loss = sum((y - t)^2)/batch, so the gradient is 2*(y - t)/batch.
+    f32 scale = 2.0f/batch;
+    f64 loss = 0.0;
+    for (u32 i = 0; i < output.length; i++) {
+        f32 difference = output.data[i] - target.data[i];
+        loss += difference*difference;
+        grad.data[i] = scale*difference;
+    }
+    return (f32) (loss/batch);
+}
+
+
+f32 loss_cross_entropy(Tensor& output, Tensor& target, Tensor& grad) {
+    assert(tensor_is_contiguous(output) && tensor_is_contiguous(target));
+    assert(output.length == target.length && grad.length == output.length);
+    u32 batch = output.ndim == 2 ? output.shape[0] : 1;
+
+    // The gradient of softmax followed by cross entropy is simply (p - t)/batch.
+    tensor_copy_into(grad, output);
+    f_softmax(grad);
+
+    f32 scale = 1.0f/batch;
+    f64 loss = 0.0;
+    for (u32 i = 0; i < output.length; i++) {
+        f32 p = grad.data[i];
+        if (target.data[i] != 0.0f) loss -= target.data[i]*logf(fmaxf(p, 1e-30f));
+        grad.data[i] = scale*(p - target.data[i]);
+    }
+    return (f32) (loss/batch);
+}
+
+
+Optimizer* optimizer_create(Network& network, Optimizer_Config config) {
+    std::vector<Layer_Parameter> parameters;
+    for (Layer* layer : network.layers) layer->parameters(parameters);
+
+    Optimizer* optimizer = new Optimizer();
+    optimizer->config = config;
+    optimizer->step = 0;
+
+    Arena_Scope heap(nullptr);
+    for (Layer_Parameter& parameter : parameters) {
+        assert(tensor_is_contiguous(*parameter.value) && tensor_is_contiguous(*parameter.grad));
+        Optimizer_State state = {};
+        state.value = parameter.value;
+        state.grad = parameter.grad;
+        state.m = tensor_create(parameter.value->shape, parameter.value->ndim);
+        tensor_init_zeros(state.m);
+        if (config.type == Optimizer_Adam) {
+            state.v = tensor_create(parameter.value->shape, parameter.value->ndim);
+            tensor_init_zeros(state.v);
+        }
+        optimizer->states.push_back(state);
+    }
+    return optimizer;
+}
+
+
+void optimizer_destroy(Optimizer* optimizer) {
+    for (Optimizer_State& state : optimizer->states) {
+        tensor_free(state.m);
+        if (state.v.data) tensor_free(state.v);
+    }
+    delete optimizer;
+}
+
+
+void optimizer_step(Optimizer* optimizer) {
+    const Optimizer_Config& config = optimizer->config;
+    optimizer->step++;
+
+    // Adam's bias correction is the same for every parameter, so it is folded
+    // into the learning rate and epsilon: lr*m/(1 - b1^t)/(sqrt(v/(1 - b2^t)) + eps)
+    // equals lr_t*m/(sqrt(v) + eps_t) with the definitions below.
+    f32 learning_rate = config.learning_rate;
+    f32 epsilon = config.epsilon;
+    if (config.type == Optimizer_Adam) {
+        f64 correction1 = 1.0 - pow(config.beta1, (f64) optimizer->step);
+        f64 correction2 = sqrt(1.0 - pow(config.beta2, (f64) optimizer->step));
+        learning_rate = (f32) (config.learning_rate*correction2/correction1);
+        epsilon = (f32) (config.epsilon*correction2);
+    }
+
+    const Elementwise_Kernels& k = kernels();
+    for (Optimizer_State& state : optimizer->states) {
+        float* weights = state.value->data;
+        const float* grad = state.grad->data;
+        float* m = state.m.data;
+        float* v = state.v.data;
+        parallel_for(0, state.value->length, OPTIMIZER_GRAIN, [&](u64 begin, u64 end) {
+            if (config.type == Optimizer_Adam) {
+                k.adam(weights + begin, grad + begin, m + begin, v + begin, end - begin,
+                       learning_rate, config.beta1, config.beta2, epsilon);
+            } else {
+                k.sgd(weights + begin, grad + begin, m + begin, end - begin,
+                      learning_rate, config.momentum);
+            }
+        });
+    }
+}
+
+
+void network_zero_grad(Network& network) {
+    std::vector<Layer_Parameter> parameters;
+    for (Layer* layer : network.layers) layer->parameters(parameters);
+    for (Layer_Parameter& parameter : parameters) tensor_init_zeros(*parameter.grad);
+}
+
+
+f32 network_train_step(Network& network, Optimizer* optimizer,
+                       Tensor& input, Tensor& target, Loss_Type loss) {
+    for (Optimizer_State& state : optimizer->states) tensor_init_zeros(*state.grad);
+
+    Tensor output = network.forward(&input);
+
+    Tensor grad;
+    {
+        Arena_Scope scope(&network.arena);
+        grad = tensor_create(output.shape, output.ndim);
+    }
+
+    f32 value = 0.0f;
+    switch (loss) {
+        case Loss_MSE: value = loss_mse(output, target, grad); break;
+        case Loss_Cross_Entropy: value = loss_cross_entropy(output, target, grad); break;
+    }
+
+    network.backward(&grad);
+    optimizer_step(optimizer);
+    return value;
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+
+#include "network.h"
+
+
+/***************************************************************************
+ * Training
+ *
+ * Minibatch gradient descent on a network of dense and activation layers.
+ * A training step forwards the batch through the network's arena, computes
+ * the loss and its gradient, backpropagates it (the activations saved by the
+ * forward pass are still in the arena) and then updates the parameters with
+ * a fused vectorized kernel. The gradients and the optimizer state are
+ * allocated once, so a warm training step does not touch the heap.
+ *
+ * Fused dense layers have no backward pass, so train before calling
+ * `network_fuse_layers`. Layers with `require_grad` set to false are frozen,
+ * they still propagate the gradient but skip the gradient of their weights.
+ ***************************************************************************/
+
+
+enum Loss_Type {
+    /// Mean squared error, averaged over the batch.
+    Loss_MSE,
+    /// Softmax followed by cross entropy against target probabilities,
+    /// the network should output the logits (no softmax layer).
+    Loss_Cross_Entropy,
+};
+
+
+/**
+ * Computes the loss of the output w.r.t. the target, both of shape (batch, outputs),
+ * and writes the gradient of the loss w.r.t. the output into `grad` (same shape).
+ */
+f32 loss_mse(Tensor& output, Tensor& target, Tensor& grad);
+f32 loss_cross_entropy(Tensor& output, Tensor& target, Tensor& grad);
+
+
+enum Optimizer_Type {
+    Optimizer_SGD,
+    Optimizer_Adam,
+};
+
+
+struct Optimizer_Config {
+    Optimizer_Type type = Optimizer_SGD;
+    f32 learning_rate = 0.01f;
+    /// SGD only, zero disables momentum.
+    f32 momentum = 0.9f;
+    /// Adam only.
+    f32 beta1 = 0.9f;
+    f32 beta2 = 0.999f;
+    f32 epsilon = 1e-8f;
+};
+
+
+/**
+ * Parameter together with its optimizer state, SGD uses `m` as
+ * the velocity and Adam `m` and `v` as the moment estimates.
+ */
+struct Optimizer_State {
+    Tensor* value;
+    Tensor* grad;
+    Tensor m;
+    Tensor v;
+};
+
+
+struct Optimizer {
+    Optimizer_Config config;
+    u64 step;
+    std::vector<Optimizer_State> states;
+};
+
+
+/**
+ * Creates an optimizer for all trainable parameters of the network,
+ * this also allocates the gradient buffers of the layers.
+ */
+Optimizer* optimizer_create(Network& network, Optimizer_Config config);
+
+
+/**
+ * Frees the optimizer state, the gradients are owned by the layers.
+ */
+void optimizer_destroy(Optimizer* optimizer);
+
+
+/**
+ * Updates every parameter from its accumulated gradient.
+ */
+void optimizer_step(Optimizer* optimizer);
+
+
+/**
+ * Zeroes the gradients of all the parameters in place.
+ */
+void network_zero_grad(Network& network);
+
+
+/**
+ * Runs one training step on a batch of shape (batch, inputs) with
+ * the target of shape (batch, outputs) and returns the loss.
+ */
+f32 network_train_step(Network& network, Optimizer* optimizer,
+                       Tensor& input, Tensor& target, Loss_Type loss);